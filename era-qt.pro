@@ -220,6 +220,8 @@ HEADERS += src/qt/eragui.h \
     src/sync.h \
     src/util.h \
     src/hash.h \
+    src/crypto/common.h \
+    src/crypto/sha256.h \
     src/uint256.h \
     src/kernel.h \
     src/scrypt.h \
@@ -227,16 +229,20 @@ HEADERS += src/qt/eragui.h \
     src/serialize.h \
     src/core.h \
     src/main.h \
+    src/blockencodings.h \
     src/miner.h \
     src/net.h \
     src/key.h \
     src/db.h \
     src/txdb.h \
     src/txmempool.h \
+    src/txvalidation.h \
+    src/orphanpool.h \
     src/walletdb.h \
     src/script.h \
     src/init.h \
     src/mruset.h \
+    src/bloom.h \
     src/json/json_spirit_writer_template.h \
     src/json/json_spirit_writer.h \
     src/json/json_spirit_value.h \
@@ -322,13 +328,21 @@ SOURCES += src/qt/era.cpp src/qt/eragui.cpp \
     src/version.cpp \
     src/sync.cpp \
     src/txmempool.cpp \
+    src/txvalidation.cpp \
+    src/orphanpool.cpp \
     src/util.cpp \
     src/hash.cpp \
+    src/bloom.cpp \
+    src/crypto/sha256.cpp \
+    src/crypto/sha256_avx2.cpp \
+    src/crypto/sha256_shani.cpp \
+    src/crypto/sha256_sse41.cpp \
     src/netbase.cpp \
     src/key.cpp \
     src/script.cpp \
     src/core.cpp \
     src/main.cpp \
+    src/blockencodings.cpp \
     src/miner.cpp \
     src/init.cpp \
     src/net.cpp \
@@ -490,6 +504,8 @@ macx:QMAKE_INFO_PLIST = share/qt/Info.plist
 INCLUDEPATH += $$BOOST_INCLUDE_PATH $$BDB_INCLUDE_PATH $$OPENSSL_INCLUDE_PATH $$QRENCODE_INCLUDE_PATH
 LIBS += $$join(BOOST_LIB_PATH,,-L,) $$join(BDB_LIB_PATH,,-L,) $$join(OPENSSL_LIB_PATH,,-L,) $$join(QRENCODE_LIB_PATH,,-L,)
 LIBS += -lssl -lcrypto -ldb_cxx$$BDB_LIB_SUFFIX
+# zlib is used by the bundled LevelDB for optional block compression
+!windows:LIBS += -lz
 # -lgdi32 has to happen after -lcrypto (see  #681)
 windows:LIBS += -lws2_32 -lshlwapi -lmswsock -lole32 -loleaut32 -luuid -lgdi32
 windows:LIBS += libboost_system$$BOOST_LIB_SUFFIX libboost_filesystem$$BOOST_LIB_SUFFIX libboost_program_options$$BOOST_LIB_SUFFIX libboost_thread$$BOOST_THREAD_LIB_SUFFIX libboost_chrono$$BOOST_LIB_SUFFIX
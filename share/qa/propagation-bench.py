@@ -0,0 +1,241 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Era developers
+# Distributed under the MIT/X11 software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+'''
+Propagation benchmark on a private regtest network.
+
+Starts several erad instances on 127.0.0.1, connected in a line
+(node 0 - node 1 - ... - node N-1), and measures:
+
+    block    time for a block mined on node 0 to become every node's tip
+    stake    the same for a proof-of-stake block from generatestake
+    tx       time for a wallet transaction sent on node 0 to reach
+             every node's mempool
+    reorg    time for the whole network to switch to a longer fork that
+             was built on an isolated node
+
+Usage:
+
+    propagation-bench.py [--erad src/erad] [--nodes 4] [--rounds 10]
+
+Each run uses a fresh temporary data directory, removed afterwards unless
+--keep is given. Times are wall clock and include RPC polling overhead
+(about --poll seconds).
+'''
+import argparse
+import base64
+import json
+import os
+import shutil
+import subprocess
+import tempfile
+import time
+
+from urllib.request import Request, urlopen
+
+RPC_USER = 'bench'
+RPC_PASSWORD = 'bench'
+
+
+class RPCError(Exception):
+    pass
+
+
+class Node(object):
+    def __init__(self, args, index, datadir):
+        self.index = index
+        self.datadir = datadir
+        self.port = args.port + index
+        self.rpcport = args.rpcport + index
+        self.erad = args.erad
+        self.process = None
+
+    def start(self, extra_args):
+        cmd = [self.erad, '-regtest', '-datadir=' + self.datadir,
+               '-port=%d' % self.port, '-rpcport=%d' % self.rpcport,
+               '-rpcuser=' + RPC_USER, '-rpcpassword=' + RPC_PASSWORD,
+               '-bind=127.0.0.1', '-discover=0', '-staking=0'] + extra_args
+        self.process = subprocess.Popen(cmd, stdout=subprocess.DEVNULL,
+                                        stderr=subprocess.DEVNULL)
+        deadline = time.time() + 60
+        while True:
+            try:
+                self.call('getblockcount')
+                return
+            except Exception:
+                if self.process.poll() is not None:
+                    raise RuntimeError('node %d exited on startup' % self.index)
+                if time.time() > deadline:
+                    raise RuntimeError('node %d RPC did not come up' % self.index)
+                time.sleep(0.25)
+
+    def stop(self):
+        if self.process is None:
+            return
+        try:
+            self.call('stop')
+        except Exception:
+            pass
+        try:
+            self.process.wait(30)
+        except Exception:
+            self.process.kill()
+        self.process = None
+
+    def call(self, method, *params):
+        body = json.dumps({'version': '1.1', 'method': method,
+                           'params': list(params), 'id': 1}).encode()
+        request = Request('http://127.0.0.1:%d/' % self.rpcport, body)
+        auth = base64.b64encode(('%s:%s' % (RPC_USER, RPC_PASSWORD)).encode())
+        request.add_header('Authorization', 'Basic ' + auth.decode())
+        request.add_header('Content-Type', 'application/json')
+        try:
+            reply = json.loads(urlopen(request, timeout=60).read().decode())
+        except Exception as e:
+            # erad answers RPC errors with a non-200 status and a JSON body
+            if hasattr(e, 'read'):
+                reply = json.loads(e.read().decode())
+            else:
+                raise
+        if reply.get('error'):
+            raise RPCError('%s: %s' % (method, reply['error']))
+        return reply['result']
+
+
+def wait_for(nodes, predicate, timeout, poll):
+    '''Poll until predicate(node) holds on every node; returns per-node
+    seconds from the call, or None for nodes that timed out.'''
+    start = time.time()
+    arrived = [None] * len(nodes)
+    while time.time() - start < timeout:
+        for i, node in enumerate(nodes):
+            if arrived[i] is None and predicate(node):
+                arrived[i] = time.time() - start
+        if all(t is not None for t in arrived):
+            break
+        time.sleep(poll)
+    return arrived
+
+
+def set_time(nodes, timestamp):
+    for node in nodes:
+        node.call('setmocktime', timestamp)
+
+
+def next_stake_slot(node):
+    '''First 16 second stake timestamp after the best block'''
+    best = node.call('getblock', node.call('getbestblockhash'))
+    return (best['time'] // 16 + 1) * 16
+
+
+def summary(name, samples):
+    samples = [s for s in samples if s is not None]
+    if not samples:
+        print('%-8s no samples' % name)
+        return
+    samples.sort()
+    print('%-8s n=%-3d min=%7.1fms  median=%7.1fms  max=%7.1fms' % (
+        name, len(samples), samples[0] * 1000,
+        samples[len(samples) // 2] * 1000, samples[-1] * 1000))
+
+
+def report(name, rounds):
+    '''rounds: list of per-node arrival lists; prints the time to reach
+    all nodes and, per hop, the time to reach that node'''
+    summary(name, [max(r) if None not in r else None for r in rounds])
+    for hop in range(1, len(rounds[0]) if rounds else 0):
+        summary('  hop %d' % hop, [r[hop] for r in rounds])
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().split('\n')[0])
+    parser.add_argument('--erad', default=os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..', 'src', 'erad'))
+    parser.add_argument('--nodes', type=int, default=4)
+    parser.add_argument('--rounds', type=int, default=10)
+    parser.add_argument('--reorg-depth', type=int, default=3)
+    parser.add_argument('--port', type=int, default=34600)
+    parser.add_argument('--rpcport', type=int, default=34700)
+    parser.add_argument('--poll', type=float, default=0.005)
+    parser.add_argument('--timeout', type=float, default=60)
+    parser.add_argument('--keep', action='store_true', help='keep the data directories')
+    args = parser.parse_args()
+
+    if args.nodes < 2:
+        parser.error('--nodes must be at least 2')
+
+    root = tempfile.mkdtemp(prefix='era-bench-')
+    nodes = []
+    try:
+        for i in range(args.nodes):
+            datadir = os.path.join(root, 'node%d' % i)
+            os.makedirs(datadir)
+            nodes.append(Node(args, i, datadir))
+
+        def link_args(node):
+            extra = ['-listen=1']
+            if node.index > 0:
+                extra.append('-connect=127.0.0.1:%d' % nodes[node.index - 1].port)
+            else:
+                extra.append('-connect=0')
+            return extra
+
+        for node in nodes:
+            node.start(link_args(node))
+
+        now = int(time.time())
+        set_time(nodes, now)
+
+        # Mature coinbase outputs on node 0 so it can send and stake
+        nodes[0].call('generate', 60)
+        tip = nodes[0].call('getbestblockhash')
+        if None in wait_for(nodes, lambda n: n.call('getbestblockhash') == tip, args.timeout, 0.1):
+            raise RuntimeError('nodes did not sync the initial chain')
+        print('%d nodes in a line, %d rounds, data in %s' % (args.nodes, args.rounds, root))
+
+        blocks = []
+        for _ in range(args.rounds):
+            tip = nodes[0].call('generate', 1)[0]
+            blocks.append(wait_for(nodes, lambda n: n.call('getbestblockhash') == tip, args.timeout, args.poll))
+        report('block', blocks)
+
+        stakes = []
+        for _ in range(args.rounds):
+            set_time(nodes, next_stake_slot(nodes[0]))
+            tip = nodes[0].call('generatestake')
+            stakes.append(wait_for(nodes, lambda n: n.call('getbestblockhash') == tip, args.timeout, args.poll))
+        report('stake', stakes)
+
+        txs = []
+        address = nodes[-1].call('getnewaddress')
+        for _ in range(args.rounds):
+            txid = nodes[0].call('sendtoaddress', address, 1)
+            txs.append(wait_for(nodes, lambda n: txid in n.call('getrawmempool'), args.timeout, args.poll))
+        report('tx', txs)
+
+        # Restart the last node isolated, outgrow the others' chain on it,
+        # then let it connect back and time the switch everywhere else
+        isolated = nodes[-1]
+        isolated.stop()
+        isolated.start(['-listen=0', '-connect=0'])
+        set_time(nodes, next_stake_slot(nodes[0]))
+        nodes[0].call('generate', args.reorg_depth)
+        isolated.call('generate', args.reorg_depth + 1)
+        tip = isolated.call('getbestblockhash')
+        isolated.call('addnode', '127.0.0.1:%d' % nodes[-2].port, 'onetry')
+        arrived = wait_for(nodes[:-1], lambda n: n.call('getbestblockhash') == tip, args.timeout, args.poll)
+        if None in arrived:
+            print('reorg    not every node switched within %ds' % args.timeout)
+        else:
+            summary('reorg', [max(arrived)])
+    finally:
+        for node in nodes:
+            node.stop()
+        if args.keep:
+            print('kept %s' % root)
+        else:
+            shutil.rmtree(root, ignore_errors=True)
+
+
+if __name__ == '__main__':
+    main()
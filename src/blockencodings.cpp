@@ -0,0 +1,169 @@
+// Copyright (c) 2016-2018 The Era developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockencodings.h"
+
+#include "crypto/sha256.h"
+#include "util.h"
+
+#include <boost/unordered_map.hpp>
+
+/** No block can hold more transactions than this; bounds what a peer can make us allocate */
+static const unsigned int MAX_COMPACT_BLOCK_TXS = MAX_BLOCK_SIZE / 60;
+
+CBlockCompact::CBlockCompact()
+{
+    nVersion = 0;
+    hashPrevBlock = 0;
+    hashMerkleRoot = 0;
+    nTime = 0;
+    nBits = 0;
+    nNonce = 0;
+    nShortIdSalt = 0;
+}
+
+CBlockCompact::CBlockCompact(const CBlock& block)
+{
+    nVersion = block.nVersion;
+    hashPrevBlock = block.hashPrevBlock;
+    hashMerkleRoot = block.hashMerkleRoot;
+    nTime = block.nTime;
+    nBits = block.nBits;
+    nNonce = block.nNonce;
+    nShortIdSalt = GetRand(std::numeric_limits<uint64_t>::max());
+    vchBlockSig = block.vchBlockSig;
+
+    // Nobody else can have the coinbase or the coinstake in their mempool
+    unsigned int nPrefilled = block.IsProofOfStake() ? 2 : 1;
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        if (i < nPrefilled)
+            vPrefilledTx.push_back(CPrefilledTransaction(i, block.vtx[i]));
+        else
+            vShortTxIds.push_back(CShortTxId(GetShortTxId(block.vtx[i].GetHash())));
+    }
+}
+
+CBlock CBlockCompact::GetHeader() const
+{
+    CBlock block;
+    block.nVersion = nVersion;
+    block.hashPrevBlock = hashPrevBlock;
+    block.hashMerkleRoot = hashMerkleRoot;
+    block.nTime = nTime;
+    block.nBits = nBits;
+    block.nNonce = nNonce;
+    block.vchBlockSig = vchBlockSig;
+    return block;
+}
+
+uint256 CBlockCompact::GetShortIdKey() const
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << nVersion << hashPrevBlock << hashMerkleRoot << nTime << nBits << nNonce << nShortIdSalt;
+    return ss.GetHash();
+}
+
+uint64_t CBlockCompact::GetShortTxId(const uint256& hashTx) const
+{
+    // The key only depends on the header; callers hashing many transactions
+    // go through CPartialBlock, which reuses one midstate.
+    uint256 key = GetShortIdKey();
+    uint256 hash;
+    CSHA256().Write(key.begin(), 32).Write(hashTx.begin(), 32).Finalize(hash.begin());
+    return hash.GetLow64() & 0xffffffffffffULL;
+}
+
+CompactReadStatus CPartialBlock::InitData(const CBlockCompact& cmpctblock, const CTxMemPool& pool)
+{
+    unsigned int nTxCount = cmpctblock.GetTxCount();
+    if (nTxCount == 0 || nTxCount > MAX_COMPACT_BLOCK_TXS)
+        return READ_STATUS_INVALID;
+
+    header = cmpctblock.GetHeader();
+    vtx.assign(nTxCount, CTransaction());
+    vHave.assign(nTxCount, false);
+
+    BOOST_FOREACH (const CPrefilledTransaction& prefilled, cmpctblock.vPrefilledTx) {
+        if (prefilled.nIndex >= nTxCount || vHave[prefilled.nIndex])
+            return READ_STATUS_INVALID;
+        vtx[prefilled.nIndex] = prefilled.tx;
+        vHave[prefilled.nIndex] = true;
+    }
+
+    // Short ids fill the remaining positions in order
+    boost::unordered_map<uint64_t, unsigned int> mapShortIds;
+    mapShortIds.rehash(cmpctblock.vShortTxIds.size());
+    unsigned int nIndex = 0;
+    BOOST_FOREACH (const CShortTxId& shortid, cmpctblock.vShortTxIds) {
+        while (vHave[nIndex])
+            nIndex++;
+        // Two transactions in one block with the same short id: could be
+        // chance, could be an attack. Either way only the full block helps.
+        if (!mapShortIds.insert(std::make_pair(shortid.Get(), nIndex)).second)
+            return READ_STATUS_FAILED;
+        nIndex++;
+    }
+
+    uint256 key = cmpctblock.GetShortIdKey();
+    CSHA256 hasherKey;
+    hasherKey.Write(key.begin(), 32);
+
+    std::vector<bool> vCollided(nTxCount, false);
+    {
+        LOCK(pool.cs);
+        for (std::map<uint256, CTransaction>::const_iterator it = pool.mapTx.begin(); it != pool.mapTx.end(); ++it) {
+            uint256 hash;
+            CSHA256(hasherKey).Write(it->first.begin(), 32).Finalize(hash.begin());
+            boost::unordered_map<uint64_t, unsigned int>::const_iterator mi = mapShortIds.find(hash.GetLow64() & 0xffffffffffffULL);
+            if (mi == mapShortIds.end() || vCollided[mi->second])
+                continue;
+            if (vHave[mi->second]) {
+                // Two mempool transactions match; leave it to getblocktxn
+                vHave[mi->second] = false;
+                vtx[mi->second] = CTransaction();
+                vCollided[mi->second] = true;
+                continue;
+            }
+            vtx[mi->second] = it->second;
+            vHave[mi->second] = true;
+        }
+    }
+
+    return READ_STATUS_OK;
+}
+
+std::vector<unsigned int> CPartialBlock::GetMissing() const
+{
+    std::vector<unsigned int> vMissing;
+    for (unsigned int i = 0; i < vHave.size(); i++)
+        if (!vHave[i])
+            vMissing.push_back(i);
+    return vMissing;
+}
+
+CompactReadStatus CPartialBlock::FillBlock(CBlock& block, const std::vector<CTransaction>& vtxMissing) const
+{
+    block = header;
+    block.vtx = vtx;
+
+    unsigned int nMissing = 0;
+    for (unsigned int i = 0; i < vHave.size(); i++) {
+        if (vHave[i])
+            continue;
+        if (nMissing >= vtxMissing.size())
+            return READ_STATUS_INVALID;
+        block.vtx[i] = vtxMissing[nMissing++];
+    }
+    if (nMissing != vtxMissing.size())
+        return READ_STATUS_INVALID;
+
+    // A short id collision with a mempool transaction gives the wrong
+    // transaction here; the merkle root catches it.
+    if (block.BuildMerkleTree() != block.hashMerkleRoot) {
+        LogPrint("net", "compact block %s failed to reconstruct\n", block.GetHash().ToString());
+        return READ_STATUS_FAILED;
+    }
+
+    return READ_STATUS_OK;
+}
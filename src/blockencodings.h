@@ -0,0 +1,145 @@
+// Copyright (c) 2016-2018 The Era developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef ERA_BLOCKENCODINGS_H
+#define ERA_BLOCKENCODINGS_H
+
+#include "main.h"
+
+/** Transaction sent in full inside a compact block, with its position */
+class CPrefilledTransaction
+{
+public:
+    unsigned int nIndex;
+    CTransaction tx;
+
+    CPrefilledTransaction() : nIndex(0) {}
+    CPrefilledTransaction(unsigned int nIndexIn, const CTransaction& txIn) : nIndex(nIndexIn), tx(txIn) {}
+
+    IMPLEMENT_SERIALIZE(
+        READWRITE(VARINT(nIndex));
+        READWRITE(tx);)
+};
+
+/** Truncated, salted transaction hash identifying a transaction inside one compact block */
+class CShortTxId
+{
+public:
+    static const unsigned int SIZE = 6;
+    unsigned char data[SIZE];
+
+    CShortTxId() { memset(data, 0, sizeof(data)); }
+    explicit CShortTxId(uint64_t n)
+    {
+        for (unsigned int i = 0; i < SIZE; i++)
+            data[i] = (n >> (8 * i)) & 0xff;
+    }
+
+    uint64_t Get() const
+    {
+        uint64_t n = 0;
+        for (unsigned int i = 0; i < SIZE; i++)
+            n |= (uint64_t)data[i] << (8 * i);
+        return n;
+    }
+
+    IMPLEMENT_SERIALIZE(READWRITE(FLATDATA(data));)
+};
+
+/**
+ * Block announced as its header, block signature, the transactions the
+ * receiver cannot have (coinbase and coinstake), and a 6-byte short id for
+ * every other transaction. The receiver rebuilds the rest from its mempool
+ * and asks with "getblocktxn" for whatever it is missing.
+ */
+class CBlockCompact
+{
+public:
+    // header
+    int nVersion;
+    uint256 hashPrevBlock;
+    uint256 hashMerkleRoot;
+    unsigned int nTime;
+    unsigned int nBits;
+    unsigned int nNonce;
+
+    uint64_t nShortIdSalt;
+    std::vector<CShortTxId> vShortTxIds;
+    std::vector<CPrefilledTransaction> vPrefilledTx;
+    std::vector<unsigned char> vchBlockSig;
+
+    CBlockCompact();
+    explicit CBlockCompact(const CBlock& block);
+
+    IMPLEMENT_SERIALIZE(
+        READWRITE(this->nVersion);
+        nVersion = this->nVersion;
+        READWRITE(hashPrevBlock);
+        READWRITE(hashMerkleRoot);
+        READWRITE(nTime);
+        READWRITE(nBits);
+        READWRITE(nNonce);
+        READWRITE(nShortIdSalt);
+        READWRITE(vShortTxIds);
+        READWRITE(vPrefilledTx);
+        READWRITE(vchBlockSig);)
+
+    /** The block with its header and signature filled in, but no transactions */
+    CBlock GetHeader() const;
+    unsigned int GetTxCount() const { return vShortTxIds.size() + vPrefilledTx.size(); }
+    uint64_t GetShortTxId(const uint256& hashTx) const;
+    /** Key mixed into every short id so they can't be ground in advance */
+    uint256 GetShortIdKey() const;
+};
+
+/** "getblocktxn": the positions of the transactions a receiver could not rebuild */
+class CBlockTxRequest
+{
+public:
+    uint256 hashBlock;
+    std::vector<unsigned int> vIndexes;
+
+    IMPLEMENT_SERIALIZE(
+        READWRITE(hashBlock);
+        READWRITE(vIndexes);)
+};
+
+/** "blocktxn": the answer to a CBlockTxRequest, in the order asked for */
+class CBlockTxResponse
+{
+public:
+    uint256 hashBlock;
+    std::vector<CTransaction> vtx;
+
+    IMPLEMENT_SERIALIZE(
+        READWRITE(hashBlock);
+        READWRITE(vtx);)
+};
+
+enum CompactReadStatus {
+    READ_STATUS_OK,
+    READ_STATUS_INVALID, // the peer sent something malformed
+    READ_STATUS_FAILED,  // could not rebuild the block, fetch it in full
+};
+
+/** A compact block being filled in from the mempool and "blocktxn" */
+class CPartialBlock
+{
+public:
+    CBlock header;
+    NodeId nodeRequested; // the peer asked for the missing transactions
+    int64_t nTimeRequested;
+
+    CPartialBlock() : nodeRequested(-1), nTimeRequested(0) {}
+
+    CompactReadStatus InitData(const CBlockCompact& cmpctblock, const CTxMemPool& pool);
+    /** Positions still to be fetched, ascending */
+    std::vector<unsigned int> GetMissing() const;
+    CompactReadStatus FillBlock(CBlock& block, const std::vector<CTransaction>& vtxMissing) const;
+
+private:
+    std::vector<CTransaction> vtx;
+    std::vector<bool> vHave;
+};
+
+#endif // ERA_BLOCKENCODINGS_H
@@ -0,0 +1,125 @@
+// Copyright (c) 2012-2018 The Era developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bloom.h"
+
+#include "hash.h"
+#include "uint256.h"
+#include "util.h"
+
+#include <algorithm>
+#include <limits>
+#include <math.h>
+
+static const unsigned int MAX_HASH_FUNCS = 50;
+
+CRollingBloomFilter::CRollingBloomFilter(unsigned int nElements, double fpRate)
+{
+    double logFpRate = log(fpRate);
+    // The optimal number of hash functions is log(fpRate) / log(0.5), but
+    // restrict it to the range 1-50.
+    nHashFuncs = std::max(1, std::min((int)round(logFpRate / log(0.5)), (int)MAX_HASH_FUNCS));
+    // In this rolling bloom filter, we'll store between 2 and 3 generations of nElements / 2 entries.
+    nEntriesPerGeneration = (nElements + 1) / 2;
+    uint32_t nMaxElements = nEntriesPerGeneration * 3;
+    // The maximum fpRate = pow(1.0 - exp(-nHashFuncs * nMaxElements / nFilterBits), nHashFuncs)
+    // =>          pow(fpRate, 1.0 / nHashFuncs) = 1.0 - exp(-nHashFuncs * nMaxElements / nFilterBits)
+    // =>          1.0 - pow(fpRate, 1.0 / nHashFuncs) = exp(-nHashFuncs * nMaxElements / nFilterBits)
+    // =>          log(1.0 - pow(fpRate, 1.0 / nHashFuncs)) = -nHashFuncs * nMaxElements / nFilterBits
+    // =>          nFilterBits = -nHashFuncs * nMaxElements / log(1.0 - pow(fpRate, 1.0 / nHashFuncs))
+    // =>          nFilterBits = -nHashFuncs * nMaxElements / log(1.0 - exp(logFpRate / nHashFuncs))
+    uint32_t nFilterBits = (uint32_t)ceil(-1.0 * nHashFuncs * nMaxElements / log(1.0 - exp(logFpRate / nHashFuncs)));
+    data.clear();
+    // For each data element we need to store 2 bits. If both bits are 0, the
+    // bit is treated as unset. If the bits are (01), (10), or (11), the bit is
+    // treated as set in generation 1, 2, or 3 respectively.
+    // These bits are stored in separate integers: position P corresponds to bit
+    // (P & 63) of the integers data[(P >> 6) * 2] and data[(P >> 6) * 2 + 1].
+    data.resize(((nFilterBits + 63) / 64) << 1);
+    reset();
+}
+
+// Derive the nHashNum-th bit position hash for a key
+static inline uint32_t RollingBloomHash(unsigned int nHashNum, uint32_t nTweak, const unsigned char* pKey, size_t nLen)
+{
+    return MurmurHash3(nHashNum * 0xFBA4C795 + nTweak, pKey, nLen);
+}
+
+// Map a 32-bit hash onto [0, range) without a division
+static inline uint32_t FastMod(uint32_t x, size_t range)
+{
+    return ((uint64_t)x * (uint64_t)range) >> 32;
+}
+
+void CRollingBloomFilter::insert(const unsigned char* pKey, size_t nLen)
+{
+    if (nEntriesThisGeneration == nEntriesPerGeneration) {
+        nEntriesThisGeneration = 0;
+        nGeneration++;
+        if (nGeneration == 4)
+            nGeneration = 1;
+        uint64_t nGenerationMask1 = 0 - (uint64_t)(nGeneration & 1);
+        uint64_t nGenerationMask2 = 0 - (uint64_t)(nGeneration >> 1);
+        // Wipe old entries that used this generation number.
+        for (uint32_t p = 0; p < data.size(); p += 2) {
+            uint64_t p1 = data[p], p2 = data[p + 1];
+            uint64_t mask = (p1 ^ nGenerationMask1) | (p2 ^ nGenerationMask2);
+            data[p] = p1 & mask;
+            data[p + 1] = p2 & mask;
+        }
+    }
+    nEntriesThisGeneration++;
+
+    for (unsigned int n = 0; n < nHashFuncs; n++) {
+        uint32_t h = RollingBloomHash(n, nTweak, pKey, nLen);
+        int bit = h & 0x3F;
+        // FastMod works with the upper bits of h, so it is safe to ignore that the lower bits of h are already used for bit.
+        uint32_t pos = FastMod(h, data.size());
+        // The lowest bit of pos is ignored, and set to zero for the first bit, and to one for the second.
+        data[pos & ~1] = (data[pos & ~1] & ~(((uint64_t)1) << bit)) | ((uint64_t)(nGeneration & 1)) << bit;
+        data[pos | 1] = (data[pos | 1] & ~(((uint64_t)1) << bit)) | ((uint64_t)(nGeneration >> 1)) << bit;
+    }
+}
+
+void CRollingBloomFilter::insert(const std::vector<unsigned char>& vKey)
+{
+    insert(vKey.empty() ? NULL : &vKey[0], vKey.size());
+}
+
+void CRollingBloomFilter::insert(const uint256& hash)
+{
+    insert(hash.begin(), hash.size());
+}
+
+bool CRollingBloomFilter::contains(const unsigned char* pKey, size_t nLen) const
+{
+    for (unsigned int n = 0; n < nHashFuncs; n++) {
+        uint32_t h = RollingBloomHash(n, nTweak, pKey, nLen);
+        int bit = h & 0x3F;
+        uint32_t pos = FastMod(h, data.size());
+        // If the relevant bit is not set in either data[pos & ~1] or data[pos | 1], the filter does not contain vKey
+        if (!(((data[pos & ~1] | data[pos | 1]) >> bit) & 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CRollingBloomFilter::contains(const std::vector<unsigned char>& vKey) const
+{
+    return contains(vKey.empty() ? NULL : &vKey[0], vKey.size());
+}
+
+bool CRollingBloomFilter::contains(const uint256& hash) const
+{
+    return contains(hash.begin(), hash.size());
+}
+
+void CRollingBloomFilter::reset()
+{
+    nTweak = GetRand(std::numeric_limits<unsigned int>::max());
+    nEntriesThisGeneration = 0;
+    nGeneration = 1;
+    std::fill(data.begin(), data.end(), 0);
+}
@@ -0,0 +1,59 @@
+// Copyright (c) 2012-2018 The Era developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef ERA_BLOOM_H
+#define ERA_BLOOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+class uint256;
+
+/**
+ * RollingBloomFilter is a probabilistic "keep track of most recently inserted" set.
+ * Construct it with the number of items to keep track of, and a false-positive
+ * rate. Unlike an mruset its memory is allocated once up front and never grows,
+ * and insert() and contains() cost a fixed number of hash evaluations.
+ *
+ * Items are stored in three generations of nElements / 2 each. Once the
+ * current generation is full the oldest one is wiped, so everything from the
+ * last nElements insertions is always remembered and at most 1.5 * nElements
+ * items are held at once. The false-positive rate is at most fpRate
+ * relative to that maximum.
+ *
+ * The hash functions are salted with a random tweak chosen at construction
+ * (and again on every reset()), so a peer cannot craft items that collide
+ * in our filter.
+ */
+class CRollingBloomFilter
+{
+public:
+    CRollingBloomFilter(unsigned int nElements, double fpRate);
+
+    void insert(const std::vector<unsigned char>& vKey);
+    void insert(const uint256& hash);
+    bool contains(const std::vector<unsigned char>& vKey) const;
+    bool contains(const uint256& hash) const;
+
+    void reset();
+
+    /** Bytes of filter data, fixed for the lifetime of the object */
+    size_t GetMemoryUsage() const { return data.size() * sizeof(uint64_t); }
+
+private:
+    void insert(const unsigned char* pKey, size_t nLen);
+    bool contains(const unsigned char* pKey, size_t nLen) const;
+
+    int nEntriesPerGeneration;
+    int nEntriesThisGeneration;
+    int nGeneration;
+    /** Each bit position holds a 2-bit generation number (0 meaning empty),
+     * split across the two words of a pair: data[2k] has the low bits and
+     * data[2k+1] the high bits of 64 positions. */
+    std::vector<uint64_t> data;
+    unsigned int nTweak;
+    unsigned int nHashFuncs;
+};
+
+#endif // ERA_BLOOM_H
@@ -167,6 +167,38 @@ public:
 static CTestNetParams testNetParams;
 
 
+//
+// Regression test
+//
+
+class CRegTestParams : public CTestNetParams
+{
+public:
+    CRegTestParams()
+    {
+        pchMessageStart[0] = 0xfa;
+        pchMessageStart[1] = 0xbf;
+        pchMessageStart[2] = 0xb5;
+        pchMessageStart[3] = 0xda;
+        bnProofOfWorkLimit = CBigNum(~uint256(0) >> 1);
+        genesis.nBits = bnProofOfWorkLimit.GetCompact();
+        genesis.nNonce = 1;
+        hashGenesisBlock = genesis.GetHash();
+        nDefaultPort = 33546;
+        nRPCPort = 33547;
+        strDataDir = "regtest";
+        assert(hashGenesisBlock == uint256("0x6aa5422c324aacdf319099750f1ba5ecbed0b6659520bca8d6739e777491a946"));
+
+        vFixedSeeds.clear();
+        vSeeds.clear(); // Regtest mode doesn't have any DNS seeds.
+    }
+
+    virtual bool MineBlocksOnDemand() const { return true; }
+    virtual Network NetworkID() const { return CChainParams::REGTEST; }
+};
+static CRegTestParams regTestParams;
+
+
 static CChainParams* pCurrentParams = &mainParams;
 
 const CChainParams& Params()
@@ -183,6 +215,9 @@ void SelectParams(CChainParams::Network network)
     case CChainParams::TESTNET:
         pCurrentParams = &testNetParams;
         break;
+    case CChainParams::REGTEST:
+        pCurrentParams = &regTestParams;
+        break;
 
     default:
         assert(false && "Unimplemented network");
@@ -193,9 +228,15 @@ void SelectParams(CChainParams::Network network)
 bool SelectParamsFromCommandLine()
 {
     bool fTestNet = GetBoolArg("-testnet", false);
+    bool fRegTest = GetBoolArg("-regtest", false);
 
+    if (fTestNet && fRegTest) {
+        return false;
+    }
 
-    if (fTestNet) {
+    if (fRegTest) {
+        SelectParams(CChainParams::REGTEST);
+    } else if (fTestNet) {
         SelectParams(CChainParams::TESTNET);
     } else {
         SelectParams(CChainParams::MAIN);
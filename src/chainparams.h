@@ -38,6 +38,7 @@ public:
     enum Network {
         MAIN,
         TESTNET,
+        REGTEST,
 
         MAX_NETWORK_TYPES
     };
@@ -59,6 +60,8 @@ public:
     int SubsidyHalvingInterval() const { return nSubsidyHalvingInterval; }
     virtual const CBlock& GenesisBlock() const = 0;
     virtual bool RequireRPCPassword() const { return true; }
+    /* Blocks are minted on request (generate/generatestake) at a fixed minimal difficulty */
+    virtual bool MineBlocksOnDemand() const { return false; }
     const string& DataDir() const { return strDataDir; }
     virtual Network NetworkID() const = 0;
     const vector<CDNSSeedData>& DNSSeeds() const { return vSeeds; }
@@ -103,4 +106,9 @@ inline bool TestNet()
     return Params().NetworkID() == CChainParams::TESTNET;
 }
 
+inline bool RegTest()
+{
+    return Params().NetworkID() == CChainParams::REGTEST;
+}
+
 #endif
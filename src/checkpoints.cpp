@@ -27,12 +27,17 @@ typedef std::map<int, uint256> MapCheckpoints;
 static MapCheckpoints mapCheckpoints =
     boost::assign::map_list_of(0, uint256("0x0000aab7dff29b0749519a7886b8a8d3f2806eb5dd861f9a0dbb7441f9a97f6a"))(4, uint256("0x000059e51262fbdb6b5b636fb841a01f0f13fff549b801265fa751141b8a18ca"))(5, uint256("0x0000b023d186b6986b58373680cfc9e4dd13e70c51a2964688f3f1b4e58b8d8d"));
 
-// TestNet has no checkpoints
+// TestNet and RegTest have no checkpoints
 static MapCheckpoints mapCheckpointsTestnet;
 
+static MapCheckpoints& Checkpoints()
+{
+    return (Params().NetworkID() == CChainParams::MAIN ? mapCheckpoints : mapCheckpointsTestnet);
+}
+
 bool CheckHardened(int nHeight, const uint256& hash)
 {
-    MapCheckpoints& checkpoints = (TestNet() ? mapCheckpointsTestnet : mapCheckpoints);
+    MapCheckpoints& checkpoints = Checkpoints();
 
     MapCheckpoints::const_iterator i = checkpoints.find(nHeight);
     if (i == checkpoints.end()) return true;
@@ -41,7 +46,7 @@ bool CheckHardened(int nHeight, const uint256& hash)
 
 int GetTotalBlocksEstimate()
 {
-    MapCheckpoints& checkpoints = (TestNet() ? mapCheckpointsTestnet : mapCheckpoints);
+    MapCheckpoints& checkpoints = Checkpoints();
 
     if (checkpoints.empty())
         return 0;
@@ -50,7 +55,7 @@ int GetTotalBlocksEstimate()
 
 CBlockIndex* GetLastCheckpoint(const std::map<uint256, CBlockIndex*>& mapBlockIndex)
 {
-    MapCheckpoints& checkpoints = (TestNet() ? mapCheckpointsTestnet : mapCheckpoints);
+    MapCheckpoints& checkpoints = Checkpoints();
 
     BOOST_REVERSE_FOREACH(const MapCheckpoints::value_type& i, checkpoints)
     {
@@ -211,6 +211,27 @@ bool CCryptoKeyStore::AddKeyPubKey(const CKey& key, const CPubKey& pubkey)
 }
 
 
+bool CCryptoKeyStore::EncryptSecrets(const std::vector<CKey>& vKeys, const std::vector<CPubKey>& vPubKeys, std::vector<std::vector<unsigned char>>& vCryptedSecrets)
+{
+    LOCK(cs_KeyStore);
+    if (!IsCrypted() || IsLocked())
+        return false;
+
+    // Constructing a CCrypter locks and unlocks its key pages, so one is
+    // shared by the whole batch and only rekeyed with each key's IV
+    CCrypter cKeyCrypter;
+    std::vector<unsigned char> chIV(WALLET_CRYPTO_KEY_SIZE);
+    vCryptedSecrets.resize(vKeys.size());
+    for (unsigned int i = 0; i < vKeys.size(); i++) {
+        uint256 nIV = vPubKeys[i].GetHash();
+        memcpy(&chIV[0], &nIV, WALLET_CRYPTO_KEY_SIZE);
+        CKeyingMaterial vchSecret(vKeys[i].begin(), vKeys[i].end());
+        if (!cKeyCrypter.SetKey(vMasterKey, chIV) || !cKeyCrypter.Encrypt(vchSecret, vCryptedSecrets[i]))
+            return false;
+    }
+    return true;
+}
+
 bool CCryptoKeyStore::AddCryptedKey(const CPubKey& vchPubKey, const std::vector<unsigned char>& vchCryptedSecret)
 {
     {
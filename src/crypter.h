@@ -143,6 +143,9 @@ protected:
 
     bool Unlock(const CKeyingMaterial& vMasterKeyIn);
 
+    // Encrypts a batch of new keys with the master key, reusing one crypter
+    bool EncryptSecrets(const std::vector<CKey>& vKeys, const std::vector<CPubKey>& vPubKeys, std::vector<std::vector<unsigned char>>& vCryptedSecrets);
+
 public:
     CCryptoKeyStore() : fUseCrypto(false)
     {
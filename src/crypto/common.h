@@ -0,0 +1,30 @@
+// Copyright (c) 2014-2018 The Bitcoin Core developers
+// Copyright (c) 2009-2018 The Era developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef ERA_CRYPTO_COMMON_H
+#define ERA_CRYPTO_COMMON_H
+
+#include <stdint.h>
+
+static inline uint32_t ReadBE32(const unsigned char* ptr)
+{
+    return ((uint32_t)ptr[0] << 24) | ((uint32_t)ptr[1] << 16) | ((uint32_t)ptr[2] << 8) | (uint32_t)ptr[3];
+}
+
+static inline void WriteBE32(unsigned char* ptr, uint32_t x)
+{
+    ptr[0] = x >> 24;
+    ptr[1] = x >> 16;
+    ptr[2] = x >> 8;
+    ptr[3] = x;
+}
+
+static inline void WriteBE64(unsigned char* ptr, uint64_t x)
+{
+    WriteBE32(ptr, x >> 32);
+    WriteBE32(ptr + 4, (uint32_t)x);
+}
+
+#endif // ERA_CRYPTO_COMMON_H
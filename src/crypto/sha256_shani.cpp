@@ -0,0 +1,161 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Copyright (c) 2009-2018 The Era developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// SHA-256 transforms using the Intel SHA extensions. Based on the public
+// domain sample code by Intel (Sean Gulley). Compiled with target attributes
+// and only called after SHA256AutoDetect() has checked CPUID.
+
+#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
+
+#include <immintrin.h>
+#include <stddef.h>
+#include <stdint.h>
+
+extern const uint32_t SHA256_K[64];
+
+#define SHANI_ATTR __attribute__((target("sha,sse4.1")))
+
+namespace sha256_shani
+{
+namespace
+{
+/** Per 32-bit lane byte swap, used both for loading message words and for writing digests. */
+SHANI_ATTR inline __m128i ByteSwapMask()
+{
+    return _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+}
+
+/** Convert a DCBA/HGFE state into the ABEF/CDGH layout used by sha256rnds2. */
+SHANI_ATTR inline void Shuffle(__m128i& s0, __m128i& s1)
+{
+    const __m128i t1 = _mm_shuffle_epi32(s0, 0xB1); // CDAB
+    const __m128i t2 = _mm_shuffle_epi32(s1, 0x1B); // EFGH
+    s0 = _mm_alignr_epi8(t1, t2, 8);                // ABEF
+    s1 = _mm_blend_epi16(t2, t1, 0xF0);             // CDGH
+}
+
+/** Inverse of Shuffle(). */
+SHANI_ATTR inline void Unshuffle(__m128i& s0, __m128i& s1)
+{
+    const __m128i t1 = _mm_shuffle_epi32(s0, 0x1B); // FEBA
+    const __m128i t2 = _mm_shuffle_epi32(s1, 0xB1); // DCHG
+    s0 = _mm_blend_epi16(t1, t2, 0xF0);             // DCBA
+    s1 = _mm_alignr_epi8(t2, t1, 8);                // HGFE
+}
+
+/** Schedule the next four message words; msg[q & 3] holds words 4q-16..4q-13 on entry. */
+SHANI_ATTR inline __m128i Schedule(const __m128i* msg, int q)
+{
+    __m128i m = _mm_sha256msg1_epu32(msg[q & 3], msg[(q + 1) & 3]);
+    m = _mm_add_epi32(m, _mm_alignr_epi8(msg[(q + 3) & 3], msg[(q + 2) & 3], 4));
+    return _mm_sha256msg2_epu32(m, msg[(q + 3) & 3]);
+}
+
+/** Four rounds with message quad m and round constants 4q..4q+3. */
+SHANI_ATTR inline void QuadRound(__m128i& s0, __m128i& s1, __m128i m, int q)
+{
+    __m128i wk = _mm_add_epi32(m, _mm_loadu_si128((const __m128i*)&SHA256_K[4 * q]));
+    s1 = _mm_sha256rnds2_epu32(s1, s0, wk);
+    wk = _mm_shuffle_epi32(wk, 0x0E);
+    s0 = _mm_sha256rnds2_epu32(s0, s1, wk);
+}
+
+/** One compression of two independent lanes, interleaved to hide sha256rnds2 latency. */
+SHANI_ATTR inline void Compress2(__m128i& s0a, __m128i& s1a, __m128i* ma, __m128i& s0b, __m128i& s1b, __m128i* mb)
+{
+    const __m128i s0a_save = s0a, s1a_save = s1a, s0b_save = s0b, s1b_save = s1b;
+    for (int q = 0; q < 16; q++) {
+        if (q >= 4) {
+            ma[q & 3] = Schedule(ma, q);
+            mb[q & 3] = Schedule(mb, q);
+        }
+        QuadRound(s0a, s1a, ma[q & 3], q);
+        QuadRound(s0b, s1b, mb[q & 3], q);
+    }
+    s0a = _mm_add_epi32(s0a, s0a_save);
+    s1a = _mm_add_epi32(s1a, s1a_save);
+    s0b = _mm_add_epi32(s0b, s0b_save);
+    s1b = _mm_add_epi32(s1b, s1b_save);
+}
+
+SHANI_ATTR inline void InitState(__m128i& s0, __m128i& s1)
+{
+    s0 = _mm_set_epi32(0xa54ff53a, 0x3c6ef372, 0xbb67ae85, 0x6a09e667);
+    s1 = _mm_set_epi32(0x5be0cd19, 0x1f83d9ab, 0x9b05688c, 0x510e527f);
+    Shuffle(s0, s1);
+}
+} // namespace
+
+SHANI_ATTR void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks)
+{
+    const __m128i mask = ByteSwapMask();
+    __m128i s0 = _mm_loadu_si128((const __m128i*)&s[0]);
+    __m128i s1 = _mm_loadu_si128((const __m128i*)&s[4]);
+    __m128i msg[4];
+    Shuffle(s0, s1);
+
+    while (blocks--) {
+        const __m128i s0_save = s0, s1_save = s1;
+        for (int q = 0; q < 16; q++) {
+            if (q < 4)
+                msg[q] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(chunk + 16 * q)), mask);
+            else
+                msg[q & 3] = Schedule(msg, q);
+            QuadRound(s0, s1, msg[q & 3], q);
+        }
+        s0 = _mm_add_epi32(s0, s0_save);
+        s1 = _mm_add_epi32(s1, s1_save);
+        chunk += 64;
+    }
+
+    Unshuffle(s0, s1);
+    _mm_storeu_si128((__m128i*)&s[0], s0);
+    _mm_storeu_si128((__m128i*)&s[4], s1);
+}
+
+SHANI_ATTR void TransformD64_2way(unsigned char* out, const unsigned char* in)
+{
+    const __m128i mask = ByteSwapMask();
+    __m128i s0a, s1a, s0b, s1b;
+    __m128i ma[4], mb[4];
+
+    // First hash: the 64-byte messages...
+    InitState(s0a, s1a);
+    InitState(s0b, s1b);
+    for (int q = 0; q < 4; q++) {
+        ma[q] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + 16 * q)), mask);
+        mb[q] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + 64 + 16 * q)), mask);
+    }
+    Compress2(s0a, s1a, ma, s0b, s1b, mb);
+
+    // ...followed by their padding block (length 512 bits).
+    ma[0] = mb[0] = _mm_set_epi32(0, 0, 0, 0x80000000);
+    ma[1] = mb[1] = ma[2] = mb[2] = _mm_setzero_si128();
+    ma[3] = mb[3] = _mm_set_epi32(0x200, 0, 0, 0);
+    Compress2(s0a, s1a, ma, s0b, s1b, mb);
+
+    // Second hash: the 32-byte digests plus padding (length 256 bits).
+    Unshuffle(s0a, s1a);
+    Unshuffle(s0b, s1b);
+    ma[0] = s0a;
+    ma[1] = s1a;
+    mb[0] = s0b;
+    mb[1] = s1b;
+    ma[2] = mb[2] = _mm_set_epi32(0, 0, 0, 0x80000000);
+    ma[3] = mb[3] = _mm_set_epi32(0x100, 0, 0, 0);
+    InitState(s0a, s1a);
+    InitState(s0b, s1b);
+    Compress2(s0a, s1a, ma, s0b, s1b, mb);
+
+    Unshuffle(s0a, s1a);
+    Unshuffle(s0b, s1b);
+    _mm_storeu_si128((__m128i*)(out + 0), _mm_shuffle_epi8(s0a, mask));
+    _mm_storeu_si128((__m128i*)(out + 16), _mm_shuffle_epi8(s1a, mask));
+    _mm_storeu_si128((__m128i*)(out + 32), _mm_shuffle_epi8(s0b, mask));
+    _mm_storeu_si128((__m128i*)(out + 48), _mm_shuffle_epi8(s1b, mask));
+}
+} // namespace sha256_shani
+
+#endif
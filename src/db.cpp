@@ -15,6 +15,11 @@
 
 #include <boost/filesystem.hpp>
 #include <boost/version.hpp>
+#include <leveldb/db.h>
+#include <leveldb/env.h>
+#include <leveldb/filter_policy.h>
+#include <leveldb/write_batch.h>
+#include <memenv/memenv.h>
 #include <openssl/rand.h>
 
 using namespace std;
@@ -22,6 +27,7 @@ using namespace boost;
 
 
 unsigned int nWalletDBUpdated;
+WalletBackend nWalletBackend = WALLET_BACKEND_BDB;
 
 
 //
@@ -216,13 +222,145 @@ bool CDBEnv::Salvage(std::string strFile, bool fAggressive, std::vector<CDBEnv::
 void CDBEnv::CheckpointLSN(const std::string& strFile)
 {
     dbenv.txn_checkpoint(0, 0, 0);
-    if (fMockDb)
+    if (fMockDb || IsStore(strFile))
         return;
     dbenv.lsn_reset(strFile.c_str(), 0);
 }
 
 
-CDB::CDB(const std::string& strFilename, const char* pszMode) : pdb(NULL), activeTxn(NULL)
+//
+// LevelDB wallet stores
+//
+
+boost::filesystem::path GetWalletStorePath(const std::string& strFile)
+{
+    return GetDataDir() / "walletleveldb" / strFile;
+}
+
+static leveldb::Options GetStoreOptions(bool fMock, bool fCreate)
+{
+    static const leveldb::FilterPolicy* pfilter = leveldb::NewBloomFilterPolicy(10);
+    leveldb::Options options;
+    options.create_if_missing = fCreate;
+    options.paranoid_checks = true;
+    options.filter_policy = pfilter;
+    // Keys, hashes and encrypted secrets gain nothing from compression
+    options.compression = leveldb::kNoCompression;
+    if (fMock) {
+        static leveldb::Env* penvMock = leveldb::NewMemEnv(leveldb::Env::Default());
+        options.env = penvMock;
+    }
+    return options;
+}
+
+static std::string GetStoreName(bool fMock, const std::string& strFile)
+{
+    if (fMock)
+        return "walletleveldb/" + strFile;
+    return GetWalletStorePath(strFile).string();
+}
+
+namespace
+{
+/** Finds the last pending operation on one key in a transaction's write batch */
+class CStoreBatchScanner : public leveldb::WriteBatch::Handler
+{
+public:
+    leveldb::Slice slNeedle;
+    std::string* pstrValue;
+    bool fFound;
+    bool fDeleted;
+
+    CStoreBatchScanner(const leveldb::Slice& slNeedleIn, std::string* pstrValueIn) : slNeedle(slNeedleIn), pstrValue(pstrValueIn), fFound(false), fDeleted(false) {}
+
+    virtual void Put(const leveldb::Slice& key, const leveldb::Slice& value)
+    {
+        if (key == slNeedle) {
+            fFound = true;
+            fDeleted = false;
+            pstrValue->assign(value.data(), value.size());
+        }
+    }
+
+    virtual void Delete(const leveldb::Slice& key)
+    {
+        if (key == slNeedle) {
+            fFound = true;
+            fDeleted = true;
+        }
+    }
+};
+}
+
+bool CDBEnv::IsStore(const std::string& strFile)
+{
+    LOCK(cs_db);
+    return setStoreFiles.count(strFile) > 0;
+}
+
+leveldb::DB* CDBEnv::OpenStore(const std::string& strFile, bool fCreate)
+{
+    AssertLockHeld(cs_db);
+    map<string, leveldb::DB*>::iterator mi = mapStore.find(strFile);
+    if (mi != mapStore.end() && mi->second != NULL)
+        return mi->second;
+
+    if (!fMockDb && fCreate)
+        boost::filesystem::create_directories(GetWalletStorePath(strFile).parent_path());
+
+    leveldb::DB* pstore = NULL;
+    leveldb::Status status = leveldb::DB::Open(GetStoreOptions(fMockDb, fCreate), GetStoreName(fMockDb, strFile), &pstore);
+    if (!status.ok()) {
+        LogPrintf("CDBEnv::OpenStore() : error opening %s: %s\n", strFile, status.ToString());
+        return NULL;
+    }
+    mapStore[strFile] = pstore;
+    setStoreFiles.insert(strFile);
+    return pstore;
+}
+
+// Writes outside a transaction skip the fsync, like DB_TXN_WRITE_NOSYNC does
+// for Berkeley DB. An empty synced write makes everything before it durable,
+// so a burst of writes is committed to disk with one sync.
+void CDBEnv::SyncStore(const std::string& strFile)
+{
+    AssertLockHeld(cs_db);
+    map<string, leveldb::DB*>::iterator mi = mapStore.find(strFile);
+    if (mi == mapStore.end() || mi->second == NULL)
+        return;
+
+    leveldb::WriteOptions options;
+    options.sync = true;
+    leveldb::WriteBatch batch;
+    leveldb::Status status = mi->second->Write(options, &batch);
+    if (!status.ok())
+        LogPrintf("CDBEnv::SyncStore() : error syncing %s: %s\n", strFile, status.ToString());
+}
+
+bool CDBEnv::RepairStore(const std::string& strFile)
+{
+    LOCK(cs_db);
+    assert(mapFileUseCount.count(strFile) == 0);
+    CloseDb(strFile);
+
+    LogPrintf("Repairing wallet store %s...\n", strFile);
+    leveldb::Status status = leveldb::RepairDB(GetStoreName(fMockDb, strFile), GetStoreOptions(fMockDb, false));
+    if (!status.ok())
+        return error("CDBEnv::RepairStore() : %s", status.ToString());
+    return true;
+}
+
+
+void CDBCursor::close()
+{
+    if (pdbc)
+        pdbc->close();
+    delete piter;
+    delete this;
+}
+
+
+CDB::CDB(const std::string& strFilename, const char* pszMode, WalletBackend backend) : pdb(NULL), pstore(NULL), activeTxn(NULL), activeBatch(NULL)
 {
     int ret;
     fReadOnly = (!strchr(pszMode, '+') && !strchr(pszMode, 'w'));
@@ -230,6 +368,26 @@ CDB::CDB(const std::string& strFilename, const char* pszMode) : pdb(NULL), activ
         return;
 
     bool fCreate = strchr(pszMode, 'c');
+    if (backend == WALLET_BACKEND_AUTO)
+        backend = nWalletBackend;
+
+    if (backend == WALLET_BACKEND_LEVELDB) {
+        LOCK(bitdb.cs_db);
+        pstore = bitdb.OpenStore(strFilename, fCreate);
+        if (pstore == NULL)
+            throw runtime_error(strprintf("CDB : can't open wallet store %s", strFilename));
+        strFile = strFilename;
+        ++bitdb.mapFileUseCount[strFile];
+
+        if (fCreate && !Exists(string("version"))) {
+            bool fTmp = fReadOnly;
+            fReadOnly = false;
+            WriteVersion(CLIENT_VERSION);
+            fReadOnly = fTmp;
+        }
+        return;
+    }
+
     unsigned int nFlags = DB_THREAD;
     if (fCreate)
         nFlags |= DB_CREATE;
@@ -282,6 +440,16 @@ CDB::CDB(const std::string& strFilename, const char* pszMode) : pdb(NULL), activ
 
 void CDB::Close()
 {
+    if (pstore) {
+        // The store itself stays open; CDBEnv::CloseDb releases it
+        delete activeBatch;
+        activeBatch = NULL;
+        pstore = NULL;
+
+        LOCK(bitdb.cs_db);
+        --bitdb.mapFileUseCount[strFile];
+        return;
+    }
     if (!pdb)
         return;
     if (activeTxn)
@@ -313,6 +481,13 @@ void CDBEnv::CloseDb(const string& strFile)
             delete pdb;
             mapDb[strFile] = NULL;
         }
+
+        map<string, leveldb::DB*>::iterator mi = mapStore.find(strFile);
+        if (mi != mapStore.end() && mi->second != NULL) {
+            SyncStore(strFile);
+            delete mi->second;
+            mi->second = NULL;
+        }
     }
 }
 
@@ -331,6 +506,9 @@ bool CDB::Rewrite(const string& strFile, const char* pszSkip)
         {
             LOCK(bitdb.cs_db);
             if (!bitdb.mapFileUseCount.count(strFile) || bitdb.mapFileUseCount[strFile] == 0) {
+                if (bitdb.IsStore(strFile))
+                    return RewriteStore(strFile, pszSkip);
+
                 // Flush log data to the dat file
                 bitdb.CloseDb(strFile);
                 bitdb.CheckpointLSN(strFile);
@@ -354,7 +532,7 @@ bool CDB::Rewrite(const string& strFile, const char* pszSkip)
                         fSuccess = false;
                     }
 
-                    Dbc* pcursor = db.GetCursor();
+                    CDBCursor* pcursor = db.GetCursor();
                     if (pcursor)
                         while (fSuccess) {
                             CDataStream ssKey(SER_DISK, CLIENT_VERSION);
@@ -409,6 +587,332 @@ bool CDB::Rewrite(const string& strFile, const char* pszSkip)
 }
 
 
+// LevelDB never rewrites records in place, so instead of copying the file
+// the skipped records are deleted and a full compaction rewrites every table.
+bool CDB::RewriteStore(const string& strFile, const char* pszSkip)
+{
+    LogPrintf("Rewriting %s...\n", strFile);
+    CDB db(strFile, "r+", WALLET_BACKEND_LEVELDB);
+    CDBCursor* pcursor = db.GetCursor();
+    bool fSuccess = pcursor && db.TxnBegin();
+    while (fSuccess) {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        int ret = db.ReadAtCursor(pcursor, ssKey, ssValue, DB_NEXT);
+        if (ret == DB_NOTFOUND)
+            break;
+        else if (ret != 0)
+            fSuccess = false;
+        else if (pszSkip && strncmp(&ssKey[0], pszSkip, std::min(ssKey.size(), strlen(pszSkip))) == 0)
+            fSuccess = db.StoreErase(ssKey);
+    }
+    if (pcursor)
+        pcursor->close();
+    if (fSuccess)
+        fSuccess = db.WriteVersion(CLIENT_VERSION) && db.TxnCommit();
+    if (fSuccess)
+        db.pstore->CompactRange(NULL, NULL);
+    else
+        LogPrintf("Rewriting of %s FAILED!\n", strFile);
+    return fSuccess;
+}
+
+bool CDB::StoreRead(const CDataStream& ssKey, CDataStream& ssValue)
+{
+    leveldb::Slice slKey(&ssKey[0], ssKey.size());
+    string strValue;
+    bool fFound = false;
+
+    // A transaction sees its own uncommitted writes
+    if (activeBatch) {
+        CStoreBatchScanner scanner(slKey, &strValue);
+        activeBatch->Iterate(&scanner);
+        if (scanner.fDeleted)
+            return false;
+        fFound = scanner.fFound;
+    }
+    if (!fFound) {
+        leveldb::Status status = pstore->Get(leveldb::ReadOptions(), slKey, &strValue);
+        if (!status.ok()) {
+            if (!status.IsNotFound())
+                LogPrintf("CDB::StoreRead() : %s\n", status.ToString());
+            return false;
+        }
+    }
+
+    ssValue.SetType(SER_DISK);
+    ssValue.clear();
+    ssValue.write(strValue.data(), strValue.size());
+
+    // Clear memory in case it was a private key
+    if (!strValue.empty())
+        memset(&strValue[0], 0, strValue.size());
+    return true;
+}
+
+bool CDB::StoreWrite(const CDataStream& ssKey, const CDataStream& ssValue, bool fOverwrite)
+{
+    if (!fOverwrite) {
+        CDataStream ssExisting(SER_DISK, CLIENT_VERSION);
+        if (StoreRead(ssKey, ssExisting))
+            return false;
+    }
+
+    leveldb::Slice slKey(&ssKey[0], ssKey.size());
+    leveldb::Slice slValue(&ssValue[0], ssValue.size());
+    if (activeBatch) {
+        activeBatch->Put(slKey, slValue);
+        return true;
+    }
+
+    // Not synced; see CDBEnv::SyncStore
+    leveldb::Status status = pstore->Put(leveldb::WriteOptions(), slKey, slValue);
+    if (!status.ok())
+        return error("CDB::StoreWrite() : %s", status.ToString());
+    return true;
+}
+
+bool CDB::StoreErase(const CDataStream& ssKey)
+{
+    leveldb::Slice slKey(&ssKey[0], ssKey.size());
+    if (activeBatch) {
+        activeBatch->Delete(slKey);
+        return true;
+    }
+
+    leveldb::Status status = pstore->Delete(leveldb::WriteOptions(), slKey);
+    if (!status.ok())
+        return error("CDB::StoreErase() : %s", status.ToString());
+    return true;
+}
+
+bool CDB::WriteRaw(CDataStream& ssKey, CDataStream& ssValue)
+{
+    if (pstore)
+        return StoreWrite(ssKey, ssValue, true);
+    if (!pdb)
+        return false;
+
+    Dbt datKey(&ssKey[0], ssKey.size());
+    Dbt datValue(&ssValue[0], ssValue.size());
+    int ret = pdb->put(activeTxn, &datKey, &datValue, 0);
+    return (ret == 0);
+}
+
+CDBCursor* CDB::GetCursor()
+{
+    if (pstore) {
+        // Full scans (LoadWallet, Rewrite) should not push the
+        // recently used blocks out of the cache
+        leveldb::ReadOptions options;
+        options.fill_cache = false;
+        return new CDBCursor(pstore->NewIterator(options));
+    }
+    if (!pdb)
+        return NULL;
+    Dbc* pcursor = NULL;
+    int ret = pdb->cursor(NULL, &pcursor, 0);
+    if (ret != 0)
+        return NULL;
+    return new CDBCursor(pcursor);
+}
+
+int CDB::ReadAtCursor(CDBCursor* pcursor, CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags)
+{
+    if (pcursor->piter) {
+        leveldb::Iterator* piter = pcursor->piter;
+        if (fFlags == DB_SET_RANGE)
+            piter->Seek(leveldb::Slice(&ssKey[0], ssKey.size()));
+        else if (fFlags != DB_NEXT)
+            return 99999;
+        else if (pcursor->fStarted)
+            piter->Next();
+        else
+            piter->SeekToFirst();
+        pcursor->fStarted = true;
+
+        if (!piter->Valid())
+            return piter->status().ok() ? DB_NOTFOUND : 99999;
+
+        leveldb::Slice slKey = piter->key();
+        leveldb::Slice slValue = piter->value();
+        ssKey.SetType(SER_DISK);
+        ssKey.clear();
+        ssKey.write(slKey.data(), slKey.size());
+        ssValue.SetType(SER_DISK);
+        ssValue.clear();
+        ssValue.write(slValue.data(), slValue.size());
+        return 0;
+    }
+
+    // Read at cursor
+    Dbt datKey;
+    if (fFlags == DB_SET || fFlags == DB_SET_RANGE || fFlags == DB_GET_BOTH || fFlags == DB_GET_BOTH_RANGE) {
+        datKey.set_data(&ssKey[0]);
+        datKey.set_size(ssKey.size());
+    }
+    Dbt datValue;
+    if (fFlags == DB_GET_BOTH || fFlags == DB_GET_BOTH_RANGE) {
+        datValue.set_data(&ssValue[0]);
+        datValue.set_size(ssValue.size());
+    }
+    datKey.set_flags(DB_DBT_MALLOC);
+    datValue.set_flags(DB_DBT_MALLOC);
+    int ret = pcursor->pdbc->get(&datKey, &datValue, fFlags);
+    if (ret != 0)
+        return ret;
+    else if (datKey.get_data() == NULL || datValue.get_data() == NULL)
+        return 99999;
+
+    // Convert to streams
+    ssKey.SetType(SER_DISK);
+    ssKey.clear();
+    ssKey.write((char*)datKey.get_data(), datKey.get_size());
+    ssValue.SetType(SER_DISK);
+    ssValue.clear();
+    ssValue.write((char*)datValue.get_data(), datValue.get_size());
+
+    // Clear and free memory
+    memset(datKey.get_data(), 0, datKey.get_size());
+    memset(datValue.get_data(), 0, datValue.get_size());
+    free(datKey.get_data());
+    free(datValue.get_data());
+    return 0;
+}
+
+bool CDB::TxnBegin()
+{
+    if (pstore) {
+        if (activeBatch)
+            return false;
+        activeBatch = new leveldb::WriteBatch();
+        return true;
+    }
+    if (!pdb || activeTxn)
+        return false;
+    DbTxn* ptxn = bitdb.TxnBegin();
+    if (!ptxn)
+        return false;
+    activeTxn = ptxn;
+    return true;
+}
+
+bool CDB::TxnCommit()
+{
+    if (pstore) {
+        if (!activeBatch)
+            return false;
+        // Explicit transactions (encryption, moves) are rare; sync them
+        leveldb::WriteOptions options;
+        options.sync = true;
+        leveldb::Status status = pstore->Write(options, activeBatch);
+        delete activeBatch;
+        activeBatch = NULL;
+        if (!status.ok())
+            return error("CDB::TxnCommit() : %s", status.ToString());
+        return true;
+    }
+    if (!pdb || !activeTxn)
+        return false;
+    int ret = activeTxn->commit(0);
+    activeTxn = NULL;
+    return (ret == 0);
+}
+
+bool CDB::TxnAbort()
+{
+    if (pstore) {
+        if (!activeBatch)
+            return false;
+        delete activeBatch;
+        activeBatch = NULL;
+        return true;
+    }
+    if (!pdb || !activeTxn)
+        return false;
+    int ret = activeTxn->abort();
+    activeTxn = NULL;
+    return (ret == 0);
+}
+
+bool CDB::Migrate(const string& strFile, WalletBackend backendTo)
+{
+    bool fToStore = (backendTo == WALLET_BACKEND_LEVELDB);
+    WalletBackend backendFrom = fToStore ? WALLET_BACKEND_BDB : WALLET_BACKEND_LEVELDB;
+    LogPrintf("Migrating %s to %s...\n", strFile, fToStore ? "LevelDB" : "Berkeley DB");
+    int64_t nStart = GetTimeMillis();
+    unsigned int nRecords = 0;
+    bool fSuccess = true;
+
+    try {
+        CDB dbFrom(strFile, "r", backendFrom);
+        CDB dbTo(strFile, "cr+", backendTo);
+        CDBCursor* pcursor = dbFrom.GetCursor();
+        fSuccess = pcursor && dbTo.TxnBegin();
+        while (fSuccess) {
+            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+            int ret = dbFrom.ReadAtCursor(pcursor, ssKey, ssValue);
+            if (ret == DB_NOTFOUND)
+                break;
+            if (ret != 0 || !dbTo.WriteRaw(ssKey, ssValue)) {
+                fSuccess = false;
+                break;
+            }
+            // Commit in slices so a large wallet is not held in one transaction
+            if (++nRecords % 1000 == 0)
+                fSuccess = dbTo.TxnCommit() && dbTo.TxnBegin();
+        }
+        if (pcursor)
+            pcursor->close();
+        if (fSuccess)
+            fSuccess = dbTo.TxnCommit();
+        else
+            dbTo.TxnAbort();
+    } catch (std::exception& e) {
+        LogPrintf("CDB::Migrate() : %s\n", e.what());
+        fSuccess = false;
+    }
+
+    LOCK(bitdb.cs_db);
+    bitdb.CloseDb(strFile);
+    if (!fToStore)
+        bitdb.setStoreFiles.erase(strFile);
+    bitdb.CheckpointLSN(strFile);
+    bitdb.mapFileUseCount.erase(strFile);
+
+    if (!fSuccess) {
+        // Leave the source alone and drop the partial copy
+        LogPrintf("Migration of %s FAILED!\n", strFile);
+        if (fToStore) {
+            bitdb.setStoreFiles.erase(strFile);
+            leveldb::DestroyDB(GetStoreName(bitdb.IsMock(), strFile), GetStoreOptions(bitdb.IsMock(), false));
+        } else
+            bitdb.RemoveDb(strFile);
+        return false;
+    }
+
+    // Keep the source as a backup, out of the way of the next migration
+    if (!bitdb.IsMock()) {
+        string strSuffix = strprintf(".%d.bak", GetTime());
+        if (fToStore) {
+            int ret = bitdb.dbenv.dbrename(NULL, strFile.c_str(), NULL, (strFile + strSuffix).c_str(), DB_AUTO_COMMIT);
+            if (ret != 0)
+                LogPrintf("Failed to rename %s to %s%s\n", strFile, strFile, strSuffix);
+        } else {
+            try {
+                boost::filesystem::path pathStore = GetWalletStorePath(strFile);
+                boost::filesystem::rename(pathStore, pathStore.string() + strSuffix);
+            } catch (boost::filesystem::filesystem_error& e) {
+                LogPrintf("Failed to move wallet store %s aside: %s\n", strFile, e.what());
+            }
+        }
+    }
+    LogPrintf("Migrated %u records in %dms\n", nRecords, GetTimeMillis() - nStart);
+    return true;
+}
+
+
 void CDBEnv::Flush(bool fShutdown)
 {
     int64_t nStart = GetTimeMillis();
@@ -430,7 +934,7 @@ void CDBEnv::Flush(bool fShutdown)
                 LogPrint("db", "%s checkpoint\n", strFile);
                 dbenv.txn_checkpoint(0, 0, 0);
                 LogPrint("db", "%s detach\n", strFile);
-                if (!fMockDb)
+                if (!fMockDb && !IsStore(strFile))
                     dbenv.lsn_reset(strFile.c_str(), 0);
                 LogPrint("db", "%s closed\n", strFile);
                 mapFileUseCount.erase(mi++);
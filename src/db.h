@@ -11,6 +11,7 @@
 #include "version.h"
 
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -24,10 +25,28 @@ class CDiskTxPos;
 class COutPoint;
 class CTxIndex;
 
+namespace leveldb
+{
+class DB;
+class Iterator;
+class WriteBatch;
+}
+
+/** Storage engine behind a wallet file */
+enum WalletBackend {
+    WALLET_BACKEND_AUTO, // whatever -walletbackend selected
+    WALLET_BACKEND_BDB,
+    WALLET_BACKEND_LEVELDB
+};
+
 extern unsigned int nWalletDBUpdated;
+extern WalletBackend nWalletBackend;
 
 void ThreadFlushWalletDB(const std::string& strWalletFile);
 
+/** Directory holding the LevelDB store for wallet file strFile */
+boost::filesystem::path GetWalletStorePath(const std::string& strFile);
+
 
 class CDBEnv
 {
@@ -44,6 +63,8 @@ public:
     DbEnv dbenv;
     std::map<std::string, int> mapFileUseCount;
     std::map<std::string, Db*> mapDb;
+    std::map<std::string, leveldb::DB*> mapStore;
+    std::set<std::string> setStoreFiles; // files ever opened through LevelDB
 
     CDBEnv();
     ~CDBEnv();
@@ -78,6 +99,15 @@ public:
     void CloseDb(const std::string& strFile);
     bool RemoveDb(const std::string& strFile);
 
+    /*
+     * LevelDB wallet stores. A store stays open between CDB instances;
+     * OpenStore and SyncStore must be called with cs_db held.
+     */
+    bool IsStore(const std::string& strFile);
+    leveldb::DB* OpenStore(const std::string& strFile, bool fCreate);
+    void SyncStore(const std::string& strFile);
+    bool RepairStore(const std::string& strFile);
+
     DbTxn* TxnBegin(int flags = DB_TXN_WRITE_NOSYNC)
     {
         DbTxn* ptxn = NULL;
@@ -91,16 +121,34 @@ public:
 extern CDBEnv bitdb;
 
 
-/** RAII class that provides access to a Berkeley database */
+/** Cursor over a wallet database: a BDB cursor or a LevelDB iterator */
+class CDBCursor
+{
+public:
+    Dbc* pdbc;
+    leveldb::Iterator* piter;
+    bool fStarted;
+
+    explicit CDBCursor(Dbc* pdbcIn) : pdbc(pdbcIn), piter(NULL), fStarted(false) {}
+    explicit CDBCursor(leveldb::Iterator* piterIn) : pdbc(NULL), piter(piterIn), fStarted(false) {}
+
+    // Releases the underlying cursor and deletes this object
+    void close();
+};
+
+
+/** RAII class that provides access to a wallet database, kept in Berkeley DB or LevelDB */
 class CDB
 {
 protected:
     Db* pdb;
+    leveldb::DB* pstore;
     std::string strFile;
     DbTxn* activeTxn;
+    leveldb::WriteBatch* activeBatch;
     bool fReadOnly;
 
-    explicit CDB(const std::string& strFilename, const char* pszMode = "r+");
+    explicit CDB(const std::string& strFilename, const char* pszMode = "r+", WalletBackend backend = WALLET_BACKEND_AUTO);
     ~CDB() { Close(); }
 
 public:
@@ -110,17 +158,36 @@ private:
     CDB(const CDB&);
     void operator=(const CDB&);
 
+    // LevelDB side of the accessors below; keys and values arrive serialized
+    bool StoreRead(const CDataStream& ssKey, CDataStream& ssValue);
+    bool StoreWrite(const CDataStream& ssKey, const CDataStream& ssValue, bool fOverwrite);
+    bool StoreErase(const CDataStream& ssKey);
+    bool WriteRaw(CDataStream& ssKey, CDataStream& ssValue);
+    bool static RewriteStore(const std::string& strFile, const char* pszSkip);
+
 protected:
     template <typename K, typename T>
     bool Read(const K& key, T& value)
     {
-        if (!pdb)
+        if (!pdb && !pstore)
             return false;
 
         // Key
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+
+        if (pstore) {
+            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+            if (!StoreRead(ssKey, ssValue))
+                return false;
+            try {
+                ssValue >> value;
+            } catch (std::exception& e) {
+                return false;
+            }
+            return true;
+        }
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Read
@@ -148,7 +215,7 @@ protected:
     template <typename K, typename T>
     bool Write(const K& key, const T& value, bool fOverwrite = true)
     {
-        if (!pdb)
+        if (!pdb && !pstore)
             return false;
         if (fReadOnly)
             assert(!"Write called on database in read-only mode");
@@ -157,12 +224,15 @@ protected:
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
-        Dbt datKey(&ssKey[0], ssKey.size());
 
         // Value
         CDataStream ssValue(SER_DISK, CLIENT_VERSION);
         ssValue.reserve(10000);
         ssValue << value;
+
+        if (pstore)
+            return StoreWrite(ssKey, ssValue, fOverwrite);
+        Dbt datKey(&ssKey[0], ssKey.size());
         Dbt datValue(&ssValue[0], ssValue.size());
 
         // Write
@@ -177,7 +247,7 @@ protected:
     template <typename K>
     bool Erase(const K& key)
     {
-        if (!pdb)
+        if (!pdb && !pstore)
             return false;
         if (fReadOnly)
             assert(!"Erase called on database in read-only mode");
@@ -186,6 +256,9 @@ protected:
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+
+        if (pstore)
+            return StoreErase(ssKey);
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Erase
@@ -199,13 +272,18 @@ protected:
     template <typename K>
     bool Exists(const K& key)
     {
-        if (!pdb)
+        if (!pdb && !pstore)
             return false;
 
         // Key
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+
+        if (pstore) {
+            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+            return StoreRead(ssKey, ssValue);
+        }
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Exists
@@ -216,83 +294,16 @@ protected:
         return (ret == 0);
     }
 
-    Dbc* GetCursor()
-    {
-        if (!pdb)
-            return NULL;
-        Dbc* pcursor = NULL;
-        int ret = pdb->cursor(NULL, &pcursor, 0);
-        if (ret != 0)
-            return NULL;
-        return pcursor;
-    }
+    CDBCursor* GetCursor();
 
-    int ReadAtCursor(Dbc* pcursor, CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags = DB_NEXT)
-    {
-        // Read at cursor
-        Dbt datKey;
-        if (fFlags == DB_SET || fFlags == DB_SET_RANGE || fFlags == DB_GET_BOTH || fFlags == DB_GET_BOTH_RANGE) {
-            datKey.set_data(&ssKey[0]);
-            datKey.set_size(ssKey.size());
-        }
-        Dbt datValue;
-        if (fFlags == DB_GET_BOTH || fFlags == DB_GET_BOTH_RANGE) {
-            datValue.set_data(&ssValue[0]);
-            datValue.set_size(ssValue.size());
-        }
-        datKey.set_flags(DB_DBT_MALLOC);
-        datValue.set_flags(DB_DBT_MALLOC);
-        int ret = pcursor->get(&datKey, &datValue, fFlags);
-        if (ret != 0)
-            return ret;
-        else if (datKey.get_data() == NULL || datValue.get_data() == NULL)
-            return 99999;
-
-        // Convert to streams
-        ssKey.SetType(SER_DISK);
-        ssKey.clear();
-        ssKey.write((char*)datKey.get_data(), datKey.get_size());
-        ssValue.SetType(SER_DISK);
-        ssValue.clear();
-        ssValue.write((char*)datValue.get_data(), datValue.get_size());
-
-        // Clear and free memory
-        memset(datKey.get_data(), 0, datKey.get_size());
-        memset(datValue.get_data(), 0, datValue.get_size());
-        free(datKey.get_data());
-        free(datValue.get_data());
-        return 0;
-    }
+    // Supports DB_NEXT and DB_SET_RANGE on both backends; the other BDB
+    // positioning flags only on Berkeley DB.
+    int ReadAtCursor(CDBCursor* pcursor, CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags = DB_NEXT);
 
 public:
-    bool TxnBegin()
-    {
-        if (!pdb || activeTxn)
-            return false;
-        DbTxn* ptxn = bitdb.TxnBegin();
-        if (!ptxn)
-            return false;
-        activeTxn = ptxn;
-        return true;
-    }
-
-    bool TxnCommit()
-    {
-        if (!pdb || !activeTxn)
-            return false;
-        int ret = activeTxn->commit(0);
-        activeTxn = NULL;
-        return (ret == 0);
-    }
-
-    bool TxnAbort()
-    {
-        if (!pdb || !activeTxn)
-            return false;
-        int ret = activeTxn->abort();
-        activeTxn = NULL;
-        return (ret == 0);
-    }
+    bool TxnBegin();
+    bool TxnCommit();
+    bool TxnAbort();
 
     bool ReadVersion(int& nVersion)
     {
@@ -306,6 +317,12 @@ public:
     }
 
     bool static Rewrite(const std::string& strFile, const char* pszSkip = NULL);
+
+    /*
+     * Copy strFile into backendTo from the other backend, then move the
+     * source aside as a backup. Used when -walletbackend is switched.
+     */
+    bool static Migrate(const std::string& strFile, WalletBackend backendTo);
 };
 
 #endif // ERA_DB_H
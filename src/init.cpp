@@ -5,11 +5,14 @@
 
 #include "init.h"
 #include "chainparams.h"
+#include "crypto/sha256.h"
 #include "main.h"
 #include "net.h"
+#include "orphanpool.h"
 #include "rpcserver.h"
 #include "script.h"
 #include "txdb.h"
+#include "txvalidation.h"
 #include "ui_interface.h"
 #include "util.h"
 #ifdef ENABLE_WALLET
@@ -95,8 +98,10 @@ void Shutdown()
     StopRPCThreads();
 #ifdef ENABLE_WALLET
     ShutdownRPCMining();
-    if (pwalletMain)
+    if (pwalletMain) {
+        pwalletMain->StopKeyPoolRefill();
         bitdb.Flush(false);
+    }
 #endif
     StopNode();
     {
@@ -168,6 +173,12 @@ std::string HelpMessage()
     strUsage += "  -wallet=<dir>          " + _("Specify wallet file (within data directory)") + "\n";
     strUsage += "  -dbcache=<n>           " + _("Set database cache size in megabytes (default: 25)") + "\n";
     strUsage += "  -dblogsize=<n>         " + _("Set database disk log size in megabytes (default: 100)") + "\n";
+    strUsage += "  -dbcompression=<codec> " + _("Compress the block index database: none or zlib (default: none)") + "\n";
+    strUsage += "  -dbprofile=<profile>   " + _("Block index database tuning: initialsync, steady or auto to switch after the initial download (default: auto)") + "\n";
+    strUsage += "  -dbwritebuffer=<n>     " + _("Set database write buffer size in megabytes (default: 64 during initial sync, 8 after)") + "\n";
+    strUsage += "  -dbl0trigger=<n>       " + _("Start a database compaction at this many level-0 files (default: 8 during initial sync, 4 after)") + "\n";
+    strUsage += "  -dbblocksize=<n>       " + _("Set database block size in kilobytes (default: 4)") + "\n";
+    strUsage += "  -dbmaxopenfiles=<n>    " + _("Maximum number of database files kept open (default: 1000)") + "\n";
     strUsage += "  -timeout=<n>           " + _("Specify connection timeout in milliseconds (default: 5000)") + "\n";
     strUsage += "  -proxy=<ip:port>       " + _("Connect through SOCKS5 proxy") + "\n";
     strUsage += "  -tor=<ip:port>         " + _("Use proxy to reach tor hidden services (default: same as -proxy)") + "\n";
@@ -189,6 +200,11 @@ std::string HelpMessage()
     strUsage += "  -bantime=<n>           " + _("Number of seconds to keep misbehaving peers from reconnecting (default: 86400)") + "\n";
     strUsage += "  -maxreceivebuffer=<n>  " + _("Maximum per-connection receive buffer, <n>*1000 bytes (default: 5000)") + "\n";
     strUsage += "  -maxsendbuffer=<n>     " + _("Maximum per-connection send buffer, <n>*1000 bytes (default: 1000)") + "\n";
+    strUsage += "  -txvalidationthreads=<n> " + strprintf(_("Threads checking relayed transactions off the network thread, 0 = check inline (default: %d)"), DEFAULT_TX_VALIDATION_THREADS) + "\n";
+    strUsage += "  -msghandlerthreads=<n> " + strprintf(_("Threads processing peer messages, each serving its own share of peers (default: %d)"), DEFAULT_MSG_HANDLER_THREADS) + "\n";
+    strUsage += "  -compactblocks         " + _("Fetch new blocks from capable peers as compact blocks rebuilt from the mempool (default: 1)") + "\n";
+    strUsage += "  -statsfile=<file>      " + _("Periodically write per-command network statistics as JSON to <file>") + "\n";
+    strUsage += "  -statsinterval=<n>     " + _("Seconds between -statsfile writes (default: 60)") + "\n";
 #ifdef USE_UPNP
 #if USE_UPNP
     strUsage += "  -upnp                  " + _("Use UPnP to map the listening port (default: 1 when listening)") + "\n";
@@ -197,6 +213,9 @@ std::string HelpMessage()
 #endif
 #endif
     strUsage += "  -paytxfee=<amt>        " + _("Fee per KB to add to transactions you send") + "\n";
+    strUsage += "  -coinselection=<name>  " + _("Coin selection: bnb tries for an exact match without change first, knapsack only uses the randomized search (default: bnb)") + "\n";
+    strUsage += "  -stakeplanner=<n>      " + _("Every <n> minutes combine small staking outputs and split large ones toward -staketarget (default: 0, off)") + "\n";
+    strUsage += "  -staketarget=<amt>     " + _("Staking output size the planner aims for (default: 5000)") + "\n";
     strUsage += "  -mininput=<amt>        " + _("When creating transactions, ignore inputs with value less than this (default: 0.01)") + "\n";
     if (fHaveGUI)
         strUsage += "  -server                " + _("Accept command line and JSON-RPC commands") + "\n";
@@ -230,17 +249,23 @@ std::string HelpMessage()
         strUsage += "  -rpcwait               " + _("Wait for RPC server to start") + "\n";
     }
     strUsage += "  -rpcthreads=<n>        " + _("Set the number of threads to service RPC calls (default: 4)") + "\n";
+    strUsage += "  -rpcworkqueue=<n>      " + _("Set the depth of the work queue to service RPC calls (default: 16)") + "\n";
+    strUsage += "  -rpcservertimeout=<n>  " + _("Close RPC connections that are idle or slow to send a request for <n> seconds (default: 30)") + "\n";
     strUsage += "  -blocknotify=<cmd>     " + _("Execute command when the best block changes (%s in cmd is replaced by block hash)") + "\n";
     strUsage += "  -walletnotify=<cmd>    " + _("Execute command when a wallet transaction changes (%s in cmd is replaced by TxID)") + "\n";
     strUsage += "  -confchange            " + _("Require a confirmations for change (default: 0)") + "\n";
     strUsage += "  -upgradewallet         " + _("Upgrade wallet to latest format") + "\n";
     strUsage += "  -keypool=<n>           " + _("Set key pool size to <n> (default: 100)") + "\n";
     strUsage += "  -rescan                " + _("Rescan the block chain for missing wallet transactions") + "\n";
+    strUsage += "  -rescanthreads=<n>     " + _("Number of threads reading blocks ahead during a wallet rescan (default: up to 4)") + "\n";
     strUsage += "  -salvagewallet         " + _("Attempt to recover private keys from a corrupt wallet.dat") + "\n";
+    strUsage += "  -walletbackend=<name>  " + _("Store the wallet in bdb or leveldb; changing it migrates the wallet (default: bdb)") + "\n";
     strUsage += "  -checkblocks=<n>       " + _("How many blocks to check at startup (default: 500, 0 = all)") + "\n";
     strUsage += "  -checklevel=<n>        " + _("How thorough the block verification is (0-6, default: 1)") + "\n";
     strUsage += "  -loadblock=<file>      " + _("Imports blocks from external blk000?.dat file") + "\n";
     strUsage += "  -maxorphanblocksmib=<n> " + strprintf(_("Keep at most <n> MiB of unconnectable blocks in memory (default: %u)"), DEFAULT_MAX_ORPHAN_BLOCKS) + "\n";
+    strUsage += "  -maxorphantxkb=<n>     " + strprintf(_("Keep at most <n> kB of transactions with missing inputs in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TX_KB) + "\n";
+    strUsage += "  -maxorphantxpeerkb=<n> " + strprintf(_("Keep at most <n> kB of transactions with missing inputs from any one peer (default: %u)"), DEFAULT_MAX_ORPHAN_TX_PEER_KB) + "\n";
 
     strUsage += "  -datacarriersize       " + strprintf(_("Maximum size of data in data carrier transactions we relay and mine (default: %u)"), MAX_OP_RETURN_RELAY) + "\n";
 
@@ -426,8 +451,19 @@ bool AppInit2(boost::thread_group& threadGroup)
         if (nTransactionFee > 0.25 * COIN)
             InitWarning(_("Warning: -paytxfee is set very high! This is the transaction fee you will pay if you send a transaction."));
     }
+
+    std::string strCoinSelection = GetArg("-coinselection", "bnb");
+    if (strCoinSelection == "knapsack")
+        nCoinSelection = COINSELECT_KNAPSACK;
+    else if (strCoinSelection != "bnb")
+        return InitError(strprintf(_("Unknown -coinselection: '%s'"), strCoinSelection));
 #endif
 
+    // The bundled LevelDB is built with zlib only; snappy is not linked
+    std::string strCompression = GetArg("-dbcompression", "none");
+    if (strCompression != "none" && strCompression != "zlib")
+        return InitError(strprintf(_("Unsupported -dbcompression: '%s'"), strCompression));
+
     fConfChange = GetBoolArg("-confchange", false);
 
 #ifdef ENABLE_WALLET
@@ -452,6 +488,12 @@ bool AppInit2(boost::thread_group& threadGroup)
     // strWalletFileName must be a plain filename without a directory
     if (strWalletFileName != boost::filesystem::basename(strWalletFileName) + boost::filesystem::extension(strWalletFileName))
         return InitError(strprintf(_("Wallet %s resides outside data directory %s."), strWalletFileName, strDataDir));
+
+    std::string strWalletBackend = GetArg("-walletbackend", "bdb");
+    if (strWalletBackend == "leveldb")
+        nWalletBackend = WALLET_BACKEND_LEVELDB;
+    else if (strWalletBackend != "bdb")
+        return InitError(strprintf(_("Unknown -walletbackend: '%s'"), strWalletBackend));
 #endif
     // Make sure only a single Era process is using the data directory.
     boost::filesystem::path pathLockFile = GetDataDir() / ".lock";
@@ -466,6 +508,7 @@ bool AppInit2(boost::thread_group& threadGroup)
     LogPrintf("\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n");
     LogPrintf("Era version %s (%s)\n", FormatFullVersion(), CLIENT_DATE);
     LogPrintf("Using OpenSSL version %s\n", SSLeay_version(SSLEAY_VERSION));
+    LogPrintf("Using the '%s' SHA256 implementation\n", SHA256AutoDetect());
     if (!fLogTimestamps)
         LogPrintf("Startup time: %s\n", DateTimeStrFormat("%x %H:%M:%S", GetTime()));
     LogPrintf("Default data directory %s\n", GetDefaultDataDir().string());
@@ -501,10 +544,17 @@ bool AppInit2(boost::thread_group& threadGroup)
             }
         }
 
+        bool fStoreExists = boost::filesystem::exists(GetWalletStorePath(strWalletFileName));
         if (GetBoolArg("-salvagewallet", false)) {
-            // Recover readable keypairs:
-            if (!CWalletDB::Recover(bitdb, strWalletFileName, true))
-                return false;
+            if (nWalletBackend == WALLET_BACKEND_LEVELDB && fStoreExists) {
+                // Rebuild the store from whatever tables and logs are readable
+                if (!bitdb.RepairStore(strWalletFileName))
+                    return false;
+            } else {
+                // Recover readable keypairs:
+                if (!CWalletDB::Recover(bitdb, strWalletFileName, true))
+                    return false;
+            }
         }
 
         if (boost::filesystem::exists(GetDataDir() / strWalletFileName)) {
@@ -520,6 +570,15 @@ bool AppInit2(boost::thread_group& threadGroup)
             if (r == CDBEnv::RECOVER_FAIL)
                 return InitError(_("wallet.dat corrupt, salvage failed"));
         }
+
+        // Moving between -walletbackend settings copies the wallet across
+        bool fFileExists = boost::filesystem::exists(GetDataDir() / strWalletFileName);
+        if ((nWalletBackend == WALLET_BACKEND_LEVELDB && fFileExists && !fStoreExists) ||
+            (nWalletBackend == WALLET_BACKEND_BDB && fStoreExists && !fFileExists)) {
+            uiInterface.InitMessage(_("Migrating wallet..."));
+            if (!CDB::Migrate(strWalletFileName, nWalletBackend))
+                return InitError(_("Error migrating wallet to the selected -walletbackend"));
+        }
     } // (!fDisableWallet)
 #endif // ENABLE_WALLET
     // ********************************************************* Step 6: network initialization
@@ -573,6 +632,9 @@ bool AppInit2(boost::thread_group& threadGroup)
     fNoListen = !GetBoolArg("-listen", true);
     fDiscover = GetBoolArg("-discover", true);
     fNameLookup = GetBoolArg("-dns", true);
+    fUseCompactBlocks = GetBoolArg("-compactblocks", true);
+    orphanTxPool.SetLimits(std::max((int64_t)0, GetArg("-maxorphantxkb", DEFAULT_MAX_ORPHAN_TX_KB)) * 1000,
+                           std::max((int64_t)0, GetArg("-maxorphantxpeerkb", DEFAULT_MAX_ORPHAN_TX_PEER_KB)) * 1000);
 
     bool fBound = false;
     if (!fNoListen) {
@@ -613,6 +675,11 @@ bool AppInit2(boost::thread_group& threadGroup)
             return false;
         }
     }
+
+    if (mapArgs.count("-staketarget")) {
+        if (!ParseMoney(mapArgs["-staketarget"], nStakeTargetSize) || nStakeTargetSize <= 0)
+            return InitError(strprintf(_("Invalid amount for -staketarget=<amount>: '%s'"), mapArgs["-staketarget"]));
+    }
 #endif
 
     BOOST_FOREACH (string strDest, mapMultiArgs["-seednode"])
@@ -642,6 +709,7 @@ bool AppInit2(boost::thread_group& threadGroup)
         return false;
     }
     LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
+    UpdateTxDBTuning(IsInitialBlockDownload());
 
     if (GetBoolArg("-printblockindex", false) || GetBoolArg("-printblocktree", false)) {
         PrintBlockTree();
@@ -796,6 +864,7 @@ bool AppInit2(boost::thread_group& threadGroup)
     LogPrintf("mapAddressBook.size() = %u\n", pwalletMain ? pwalletMain->mapAddressBook.size() : 0);
 #endif
 
+    txValidationQueue.Start(threadGroup, std::max(0, std::min(16, (int)GetArg("-txvalidationthreads", DEFAULT_TX_VALIDATION_THREADS))));
     StartNode(threadGroup);
 #ifdef ENABLE_WALLET
     // InitRPCMining is needed here so getwork/getblocktemplate in the GUI debug console works properly.
@@ -804,12 +873,26 @@ bool AppInit2(boost::thread_group& threadGroup)
     if (fServer)
         StartRPCThreads();
 
+    // Snapshot network telemetry for external monitoring
+    if (mapArgs.count("-statsfile")) {
+        int64_t nStatsInterval = std::max((int64_t)1, GetArg("-statsinterval", 60));
+        boost::function<void()> fn = boost::bind(&DumpNetStats);
+        threadGroup.create_thread(boost::bind(&LoopForever<boost::function<void()>>, "netstats", fn, nStatsInterval * 1000));
+    }
+
 #ifdef ENABLE_WALLET
     // Mine proof-of-stake blocks in the background
     if (!GetBoolArg("-staking", true))
         LogPrintf("Staking disabled\n");
     else if (pwalletMain)
         threadGroup.create_thread(boost::bind(&ThreadStakeMiner, pwalletMain));
+
+    // Consolidate and split staking outputs in the background
+    int64_t nStakePlanMinutes = GetArg("-stakeplanner", 0);
+    if (pwalletMain && nStakePlanMinutes > 0) {
+        boost::function<void()> fn = boost::bind(&RunStakePlanner, pwalletMain);
+        threadGroup.create_thread(boost::bind(&LoopForever<boost::function<void()>>, "stakeplan", fn, nStakePlanMinutes * 60 * 1000));
+    }
 #endif
 
     // ********************************************************* Step 12: finished
@@ -26,12 +26,18 @@ static bool GetLastStakeModifier(const CBlockIndex* pindex, uint64_t& nStakeModi
 {
     if (!pindex)
         return error("GetLastStakeModifier: null pindex");
-    while (pindex && pindex->pprev && !pindex->GeneratedStakeModifier())
-        pindex = pindex->pprev;
-    if (!pindex->GeneratedStakeModifier())
+    // Walk back to the generating block, or to a block that already knows it
+    const CBlockIndex* pindexWalk = pindex;
+    while (pindexWalk->pprev && !pindexWalk->GeneratedStakeModifier() && !pindexWalk->pindexStakeModifier)
+        pindexWalk = pindexWalk->pprev;
+    const CBlockIndex* pindexModifier = pindexWalk->GeneratedStakeModifier() ? pindexWalk : pindexWalk->pindexStakeModifier;
+    if (!pindexModifier)
         return error("GetLastStakeModifier: no generation at genesis block");
-    nStakeModifier = pindex->nStakeModifier;
-    nModifierTime = pindex->GetBlockTime();
+    for (const CBlockIndex* p = pindex; p != pindexWalk; p = p->pprev)
+        p->pindexStakeModifier = pindexModifier;
+    pindexWalk->pindexStakeModifier = pindexModifier;
+    nStakeModifier = pindexModifier->nStakeModifier;
+    nModifierTime = pindexModifier->GetBlockTime();
     return true;
 }
 
@@ -51,43 +57,83 @@ static int64_t GetStakeModifierSelectionInterval()
     return nSelectionInterval;
 }
 
-// select a block from the candidate blocks in vSortedByTimestamp, excluding
-// already selected blocks in vSelectedBlocks, and with timestamp up to
-// nSelectionIntervalStop.
-static bool SelectBlockFromCandidates(vector<pair<int64_t, uint256>>& vSortedByTimestamp, map<uint256, const CBlockIndex*>& mapSelectedBlocks, int64_t nSelectionIntervalStop, uint64_t nStakeModifierPrev, const CBlockIndex** pindexSelected)
+// Selection hash of a candidate block: its proof-hash hashed with the
+// previous stake modifier
+uint256 GetStakeModifierSelectionHash(const CBlockIndex* pindex, uint64_t nStakeModifierPrev)
 {
-    bool fSelected = false;
-    uint256 hashBest = 0;
-    *pindexSelected = (const CBlockIndex*)0;
-    BOOST_FOREACH (const PAIRTYPE(int64_t, uint256) & item, vSortedByTimestamp) {
-        if (!mapBlockIndex.count(item.second))
-            return error("SelectBlockFromCandidates: failed to find block index for candidate block %s", item.second.ToString());
-        const CBlockIndex* pindex = mapBlockIndex[item.second];
-        if (fSelected && pindex->GetBlockTime() > nSelectionIntervalStop)
-            break;
-        if (mapSelectedBlocks.count(pindex->GetBlockHash()) > 0)
-            continue;
-        // compute the selection hash by hashing its proof-hash and the
-        // previous proof-of-stake modifier
-        CDataStream ss(SER_GETHASH, 0);
-        ss << pindex->hashProof << nStakeModifierPrev;
-        uint256 hashSelection = HMQ1725(ss.begin(), ss.end());
-        // the selection hash is divided by 2**32 so that proof-of-stake block
-        // is always favored over proof-of-work block. this is to preserve
-        // the energy efficiency property
-        if (pindex->IsProofOfStake())
-            hashSelection >>= 32;
-        if (fSelected && hashSelection < hashBest) {
-            hashBest = hashSelection;
-            *pindexSelected = (const CBlockIndex*)pindex;
-        } else if (!fSelected) {
-            fSelected = true;
-            hashBest = hashSelection;
-            *pindexSelected = (const CBlockIndex*)pindex;
-        }
+    CDataStream ss(SER_GETHASH, 0);
+    ss << pindex->hashProof << nStakeModifierPrev;
+    uint256 hashSelection = HMQ1725(ss.begin(), ss.end());
+    // the selection hash is divided by 2**32 so that proof-of-stake block
+    // is always favored over proof-of-work block. this is to preserve
+    // the energy efficiency property
+    if (pindex->IsProofOfStake())
+        hashSelection >>= 32;
+    return hashSelection;
+}
+
+void CStakeModifierCandidates::Prepare(uint64_t nStakeModifierPrev)
+{
+    sort(vSorted.begin(), vSorted.end());
+    vHash.resize(vSorted.size());
+    vSelected.assign(vSorted.size(), false);
+    nFirst = 0;
+    for (nLeaves = 1; nLeaves < vSorted.size(); nLeaves <<= 1)
+        ;
+    vTree.assign(2 * nLeaves, -1);
+    for (unsigned int i = 0; i < vSorted.size(); i++) {
+        vHash[i] = GetStakeModifierSelectionHash(vSorted[i].second, nStakeModifierPrev);
+        vTree[nLeaves + i] = i;
+    }
+    for (unsigned int n = nLeaves - 1; n > 0; n--)
+        vTree[n] = Better(vTree[2 * n], vTree[2 * n + 1]);
+}
+
+int CStakeModifierCandidates::Select(int64_t nSelectionIntervalStop)
+{
+    while (nFirst < vSorted.size() && vSelected[nFirst])
+        nFirst++;
+    if (nFirst == vSorted.size())
+        return -1;
+    // candidates with a timestamp up to the stop
+    unsigned int nEnd = upper_bound(vSorted.begin(), vSorted.end(), make_pair(make_pair(nSelectionIntervalStop, ~uint256(0)), (const CBlockIndex*)NULL), CompareTime) - vSorted.begin();
+    if (nFirst >= nEnd)
+        return nFirst;
+    int nBest = -1;
+    for (unsigned int l = nLeaves, r = nLeaves + nEnd; l < r; l >>= 1, r >>= 1) {
+        if (l & 1)
+            nBest = Better(nBest, vTree[l++]);
+        if (r & 1)
+            nBest = Better(nBest, vTree[--r]);
     }
-    LogPrint("stakemodifier", "SelectBlockFromCandidates: selection hash=%s\n", hashBest.ToString());
-    return fSelected;
+    return nBest;
+}
+
+void CStakeModifierCandidates::MarkSelected(int i)
+{
+    vSelected[i] = true;
+    unsigned int n = nLeaves + i;
+    vTree[n] = -1;
+    for (n >>= 1; n > 0; n >>= 1)
+        vTree[n] = Better(vTree[2 * n], vTree[2 * n + 1]);
+}
+
+int CStakeModifierCandidates::Better(int a, int b) const
+{
+    if (a < 0)
+        return b;
+    if (b < 0)
+        return a;
+    if (vHash[a] < vHash[b])
+        return a;
+    if (vHash[b] < vHash[a])
+        return b;
+    return min(a, b);
+}
+
+bool CStakeModifierCandidates::CompareTime(const pair<pair<int64_t, uint256>, const CBlockIndex*>& a, const pair<pair<int64_t, uint256>, const CBlockIndex*>& b)
+{
+    return a.first.first < b.first.first;
 }
 
 // Stake Modifier (hash modifier of proof-of-stake):
@@ -120,34 +166,37 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeMod
     if (nModifierTime / nModifierInterval >= pindexPrev->GetBlockTime() / nModifierInterval)
         return true;
 
-    // Sort candidate blocks by timestamp
-    vector<pair<int64_t, uint256>> vSortedByTimestamp;
-    vSortedByTimestamp.reserve(64 * nModifierInterval / GetTargetSpacing(pindexPrev->nHeight));
+    // Collect candidate blocks
+    CStakeModifierCandidates candidates;
+    candidates.vSorted.reserve(64 * nModifierInterval / GetTargetSpacing(pindexPrev->nHeight));
     int64_t nSelectionInterval = GetStakeModifierSelectionInterval();
     int64_t nSelectionIntervalStart = (pindexPrev->GetBlockTime() / nModifierInterval) * nModifierInterval - nSelectionInterval;
     const CBlockIndex* pindex = pindexPrev;
     while (pindex && pindex->GetBlockTime() >= nSelectionIntervalStart) {
-        vSortedByTimestamp.push_back(make_pair(pindex->GetBlockTime(), pindex->GetBlockHash()));
+        candidates.vSorted.push_back(make_pair(make_pair(pindex->GetBlockTime(), pindex->GetBlockHash()), pindex));
         pindex = pindex->pprev;
     }
     int nHeightFirstCandidate = pindex ? (pindex->nHeight + 1) : 0;
-    reverse(vSortedByTimestamp.begin(), vSortedByTimestamp.end());
-    sort(vSortedByTimestamp.begin(), vSortedByTimestamp.end());
+    candidates.Prepare(nStakeModifier);
 
     // Select 64 blocks from candidate blocks to generate stake modifier
     uint64_t nStakeModifierNew = 0;
     int64_t nSelectionIntervalStop = nSelectionIntervalStart;
-    map<uint256, const CBlockIndex*> mapSelectedBlocks;
-    for (int nRound = 0; nRound < min(64, (int)vSortedByTimestamp.size()); nRound++) {
+    vector<const CBlockIndex*> vSelectedBlocks;
+    for (int nRound = 0; nRound < min(64, (int)candidates.vSorted.size()); nRound++) {
         // add an interval section to the current selection round
         nSelectionIntervalStop += GetStakeModifierSelectionIntervalSection(nRound);
         // select a block from the candidates of current round
-        if (!SelectBlockFromCandidates(vSortedByTimestamp, mapSelectedBlocks, nSelectionIntervalStop, nStakeModifier, &pindex))
+        int nSelected = candidates.Select(nSelectionIntervalStop);
+        if (nSelected < 0)
             return error("ComputeNextStakeModifier: unable to select block at round %d", nRound);
+        pindex = candidates.vSorted[nSelected].second;
+        LogPrint("stakemodifier", "SelectBlockFromCandidates: selection hash=%s\n", candidates.vHash[nSelected].ToString());
         // write the entropy bit of the selected block
         nStakeModifierNew |= (((uint64_t)pindex->GetStakeEntropyBit()) << nRound);
         // add the selected block from candidates to selected list
-        mapSelectedBlocks.insert(make_pair(pindex->GetBlockHash(), pindex));
+        candidates.MarkSelected(nSelected);
+        vSelectedBlocks.push_back(pindex);
         LogPrint("stakemodifier", "ComputeNextStakeModifier: selected round %d stop=%s height=%d bit=%d\n", nRound, DateTimeStrFormat(nSelectionIntervalStop), pindex->nHeight, pindex->GetStakeEntropyBit());
     }
 
@@ -163,10 +212,10 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeMod
                 strSelectionMap.replace(pindex->nHeight - nHeightFirstCandidate, 1, "=");
             pindex = pindex->pprev;
         }
-        BOOST_FOREACH (const PAIRTYPE(uint256, const CBlockIndex*) & item, mapSelectedBlocks) {
+        BOOST_FOREACH (const CBlockIndex* pindexSelected, vSelectedBlocks) {
             // 'S' indicates selected proof-of-stake blocks
             // 'W' indicates selected proof-of-work blocks
-            strSelectionMap.replace(item.second->nHeight - nHeightFirstCandidate, 1, item.second->IsProofOfStake() ? "S" : "W");
+            strSelectionMap.replace(pindexSelected->nHeight - nHeightFirstCandidate, 1, pindexSelected->IsProofOfStake() ? "S" : "W");
         }
         LogPrintf("ComputeNextStakeModifier: selection height [%d, %d] map %s\n", nHeightFirstCandidate, pindexPrev->nHeight, strSelectionMap);
     }
@@ -285,7 +334,7 @@ bool CheckProofOfStake(CBlockIndex* pindexPrev, const CTransaction& tx, unsigned
     const CTxIn& txin = tx.vin[0];
 
     // First try finding the previous transaction in database
-    CTxDB txdb("r");
+    CTxDB& txdb = GetReadTxDB();
     CTransaction txPrev;
     CTxIndex txindex;
     if (!txPrev.ReadFromDisk(txdb, txin.prevout, txindex))
@@ -321,7 +370,7 @@ bool CheckKernel(CBlockIndex* pindexPrev, unsigned int nBits, int64_t nTime, con
 {
     uint256 hashProofOfStake, targetProofOfStake;
 
-    CTxDB txdb("r");
+    CTxDB& txdb = GetReadTxDB();
     CTransaction txPrev;
     CTxIndex txindex;
     if (!txPrev.ReadFromDisk(txdb, prevout, txindex))
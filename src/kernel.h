@@ -21,6 +21,39 @@ static const int MODIFIER_INTERVAL_RATIO = 3;
 bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeModifier, bool& fGeneratedStakeModifier);
 uint256 ComputeStakeModifierV2(const CBlockIndex* pindexPrev, const uint256& kernel);
 
+// Selection hash of a stake modifier candidate under the previous modifier
+uint256 GetStakeModifierSelectionHash(const CBlockIndex* pindex, uint64_t nStakeModifierPrev);
+
+// Candidate blocks for the stake modifier, sorted by timestamp and then
+// hash, with their selection hashes. The previous modifier is the same for
+// every round, so each hash is computed once; a segment tree over the
+// candidates answers the per-round minimum in O(log n).
+class CStakeModifierCandidates
+{
+public:
+    std::vector<std::pair<std::pair<int64_t, uint256>, const CBlockIndex*>> vSorted;
+    std::vector<uint256> vHash;
+
+    // Sort the candidates added to vSorted and hash them
+    void Prepare(uint64_t nStakeModifierPrev);
+
+    // Same choice as scanning in order: the first unselected candidate,
+    // replaced by any later one up to nSelectionIntervalStop with a strictly
+    // lower hash. Returns -1 when every candidate has been selected.
+    int Select(int64_t nSelectionIntervalStop);
+
+    void MarkSelected(int i);
+
+private:
+    unsigned int nLeaves;
+    unsigned int nFirst;    // no candidate before this one is unselected
+    std::vector<int> vTree; // candidate with the lowest hash in each node, -1 if none
+    std::vector<bool> vSelected;
+
+    int Better(int a, int b) const;
+    static bool CompareTime(const std::pair<std::pair<int64_t, uint256>, const CBlockIndex*>& a, const std::pair<std::pair<int64_t, uint256>, const CBlockIndex*>& b);
+};
+
 // Check whether stake kernel meets hash target
 // Sets hashProofOfStake on success return
 bool CheckStakeKernelHash(CBlockIndex* pindexPrev, unsigned int nBits, const CBlock& blockFrom, unsigned int nTxPrevOffset, const CTransaction& txPrev, const COutPoint& prevout, unsigned int nTimeTx, uint256& hashProofOfStake, uint256& targetProofOfStake, bool fPrintProofOfStake = false);
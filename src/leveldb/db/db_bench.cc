@@ -12,7 +12,9 @@
 #include "leveldb/env.h"
 #include "leveldb/write_batch.h"
 #include "port/port.h"
+#include "util/coding.h"
 #include "util/crc32c.h"
+#include "util/hash.h"
 #include "util/histogram.h"
 #include "util/mutexlock.h"
 #include "util/random.h"
@@ -33,7 +35,11 @@
 //      readmissing   -- read N missing keys in random order
 //      readhot       -- read N times in random order from 1% section of DB
 //      seekrandom    -- N random seeks
+//      filltxindex   -- write N transaction index records (hashed keys)
+//      readtxindex   -- read N transaction index records in random order
 //      crc32c        -- repeated crc32c of 4K of data
+//      snappycomp    -- repeated snappy compression of one block
+//      zlibcomp      -- repeated zlib compression of one block
 //      acquireload   -- load N*1000 times
 //   Meta operations:
 //      compact     -- Compact the entire DB
@@ -57,6 +63,8 @@ static const char* FLAGS_benchmarks =
     "crc32c,"
     "snappycomp,"
     "snappyuncomp,"
+    "zlibcomp,"
+    "zlibuncomp,"
     "acquireload,"
     ;
 
@@ -76,6 +84,9 @@ static int FLAGS_value_size = 100;
 // their original size after compression
 static double FLAGS_compression_ratio = 0.5;
 
+// Block compression used by the database (none, snappy or zlib)
+static leveldb::CompressionType FLAGS_compression = leveldb::kSnappyCompression;
+
 // Print histogram of operation timings
 static bool FLAGS_histogram = false;
 
@@ -489,6 +500,12 @@ class Benchmark {
         method = &Benchmark::ReadWhileWriting;
       } else if (name == Slice("compact")) {
         method = &Benchmark::Compact;
+      } else if (name == Slice("filltxindex")) {
+        fresh_db = true;
+        entries_per_batch_ = 1000;
+        method = &Benchmark::WriteTxIndex;
+      } else if (name == Slice("readtxindex")) {
+        method = &Benchmark::ReadTxIndex;
       } else if (name == Slice("crc32c")) {
         method = &Benchmark::Crc32c;
       } else if (name == Slice("acquireload")) {
@@ -497,6 +514,10 @@ class Benchmark {
         method = &Benchmark::SnappyCompress;
       } else if (name == Slice("snappyuncomp")) {
         method = &Benchmark::SnappyUncompress;
+      } else if (name == Slice("zlibcomp")) {
+        method = &Benchmark::ZlibCompress;
+      } else if (name == Slice("zlibuncomp")) {
+        method = &Benchmark::ZlibUncompress;
       } else if (name == Slice("heapprofile")) {
         HeapProfile();
       } else if (name == Slice("stats")) {
@@ -640,7 +661,10 @@ class Benchmark {
     if (ptr == NULL) exit(1); // Disable unused variable warning.
   }
 
-  void SnappyCompress(ThreadState* thread) {
+  typedef bool (*CompressFunction)(const char*, size_t, std::string*);
+  typedef bool (*UncompressFunction)(const char*, size_t, char*);
+
+  void DoCompress(ThreadState* thread, CompressFunction compress) {
     RandomGenerator gen;
     Slice input = gen.Generate(Options().block_size);
     int64_t bytes = 0;
@@ -648,14 +672,14 @@ class Benchmark {
     bool ok = true;
     std::string compressed;
     while (ok && bytes < 1024 * 1048576) {  // Compress 1G
-      ok = port::Snappy_Compress(input.data(), input.size(), &compressed);
+      ok = compress(input.data(), input.size(), &compressed);
       produced += compressed.size();
       bytes += input.size();
       thread->stats.FinishedSingleOp();
     }
 
     if (!ok) {
-      thread->stats.AddMessage("(snappy failure)");
+      thread->stats.AddMessage("(compression failure)");
     } else {
       char buf[100];
       snprintf(buf, sizeof(buf), "(output: %.1f%%)",
@@ -665,28 +689,44 @@ class Benchmark {
     }
   }
 
-  void SnappyUncompress(ThreadState* thread) {
+  void DoUncompress(ThreadState* thread, CompressFunction compress,
+                    UncompressFunction uncompress) {
     RandomGenerator gen;
     Slice input = gen.Generate(Options().block_size);
     std::string compressed;
-    bool ok = port::Snappy_Compress(input.data(), input.size(), &compressed);
+    bool ok = compress(input.data(), input.size(), &compressed);
     int64_t bytes = 0;
     char* uncompressed = new char[input.size()];
     while (ok && bytes < 1024 * 1048576) {  // Compress 1G
-      ok =  port::Snappy_Uncompress(compressed.data(), compressed.size(),
-                                    uncompressed);
+      ok =  uncompress(compressed.data(), compressed.size(), uncompressed);
       bytes += input.size();
       thread->stats.FinishedSingleOp();
     }
     delete[] uncompressed;
 
     if (!ok) {
-      thread->stats.AddMessage("(snappy failure)");
+      thread->stats.AddMessage("(compression failure)");
     } else {
       thread->stats.AddBytes(bytes);
     }
   }
 
+  void SnappyCompress(ThreadState* thread) {
+    DoCompress(thread, port::Snappy_Compress);
+  }
+
+  void SnappyUncompress(ThreadState* thread) {
+    DoUncompress(thread, port::Snappy_Compress, port::Snappy_Uncompress);
+  }
+
+  void ZlibCompress(ThreadState* thread) {
+    DoCompress(thread, port::Zlib_Compress);
+  }
+
+  void ZlibUncompress(ThreadState* thread) {
+    DoUncompress(thread, port::Zlib_Compress, port::Zlib_Uncompress);
+  }
+
   void Open() {
     assert(db_ == NULL);
     Options options;
@@ -695,6 +735,7 @@ class Benchmark {
     options.write_buffer_size = FLAGS_write_buffer_size;
     options.max_open_files = FLAGS_open_files;
     options.filter_policy = filter_policy_;
+    options.compression = FLAGS_compression;
     Status s = DB::Open(options, FLAGS_db, &db_);
     if (!s.ok()) {
       fprintf(stderr, "open error: %s\n", s.ToString().c_str());
@@ -740,6 +781,84 @@ class Benchmark {
     thread->stats.AddBytes(bytes);
   }
 
+  // Records shaped like the transaction index kept by txdb-leveldb.cpp:
+  // the key is a serialized ("tx", txid) pair, so keys are uniformly
+  // distributed, and the value is a serialized CTxIndex (version, disk
+  // position and one spent-position per output).
+  static void TxIndexKey(int k, char* key) {
+    key[0] = 2;
+    key[1] = 't';
+    key[2] = 'x';
+    for (uint32_t j = 0; j < 8; j++) {
+      EncodeFixed32(key + 3 + 4 * j,
+                    Hash(reinterpret_cast<const char*>(&k), sizeof(k), j));
+    }
+  }
+  static const int kTxIndexKeySize = 35;
+
+  static void TxIndexValue(Random* rnd, std::string* value) {
+    value->clear();
+    PutFixed32(value, 60000);               // nVersion
+    PutFixed32(value, 1 + rnd->Uniform(4)); // pos.nFile
+    PutFixed32(value, rnd->Next() % 1000000000);  // pos.nBlockPos
+    PutFixed32(value, rnd->Uniform(1000000));     // pos.nTxPos
+    const int outputs = 1 + rnd->Skewed(4);
+    value->push_back(static_cast<char>(outputs));
+    for (int i = 0; i < outputs; i++) {
+      if (rnd->OneIn(2)) {
+        // Unspent: a null CDiskTxPos
+        PutFixed32(value, 0xffffffffu);
+        PutFixed32(value, 0);
+        PutFixed32(value, 0);
+      } else {
+        PutFixed32(value, 1 + rnd->Uniform(4));
+        PutFixed32(value, rnd->Next() % 1000000000);
+        PutFixed32(value, rnd->Uniform(1000000));
+      }
+    }
+  }
+
+  void WriteTxIndex(ThreadState* thread) {
+    WriteBatch batch;
+    Status s;
+    std::string value;
+    int64_t bytes = 0;
+    for (int i = 0; i < num_; i += entries_per_batch_) {
+      batch.Clear();
+      for (int j = 0; j < entries_per_batch_; j++) {
+        char key[kTxIndexKeySize];
+        TxIndexKey(i + j, key);
+        TxIndexValue(&thread->rand, &value);
+        batch.Put(Slice(key, sizeof(key)), value);
+        bytes += sizeof(key) + value.size();
+        thread->stats.FinishedSingleOp();
+      }
+      s = db_->Write(write_options_, &batch);
+      if (!s.ok()) {
+        fprintf(stderr, "put error: %s\n", s.ToString().c_str());
+        exit(1);
+      }
+    }
+    thread->stats.AddBytes(bytes);
+  }
+
+  void ReadTxIndex(ThreadState* thread) {
+    ReadOptions options;
+    std::string value;
+    int found = 0;
+    for (int i = 0; i < reads_; i++) {
+      char key[kTxIndexKeySize];
+      TxIndexKey(thread->rand.Next() % FLAGS_num, key);
+      if (db_->Get(options, Slice(key, sizeof(key)), &value).ok()) {
+        found++;
+      }
+      thread->stats.FinishedSingleOp();
+    }
+    char msg[100];
+    snprintf(msg, sizeof(msg), "(%d of %d found)", found, num_);
+    thread->stats.AddMessage(msg);
+  }
+
   void ReadSequential(ThreadState* thread) {
     Iterator* iter = db_->NewIterator(ReadOptions());
     int i = 0;
@@ -935,6 +1054,12 @@ int main(int argc, char** argv) {
       FLAGS_benchmarks = argv[i] + strlen("--benchmarks=");
     } else if (sscanf(argv[i], "--compression_ratio=%lf%c", &d, &junk) == 1) {
       FLAGS_compression_ratio = d;
+    } else if (strcmp(argv[i], "--compression=none") == 0) {
+      FLAGS_compression = leveldb::kNoCompression;
+    } else if (strcmp(argv[i], "--compression=snappy") == 0) {
+      FLAGS_compression = leveldb::kSnappyCompression;
+    } else if (strcmp(argv[i], "--compression=zlib") == 0) {
+      FLAGS_compression = leveldb::kZlibCompression;
     } else if (sscanf(argv[i], "--histogram=%d%c", &n, &junk) == 1 &&
                (n == 0 || n == 1)) {
       FLAGS_histogram = n;
@@ -97,6 +97,11 @@ Options SanitizeOptions(const std::string& dbname,
   ClipToRange(&result.max_open_files,    64 + kNumNonTableCacheFiles, 50000);
   ClipToRange(&result.write_buffer_size, 64<<10,                      1<<30);
   ClipToRange(&result.block_size,        1<<10,                       4<<20);
+  ClipToRange(&result.l0_compaction_trigger, 1, 1000);
+  ClipToRange(&result.l0_slowdown_writes_trigger,
+              result.l0_compaction_trigger, 1000);
+  ClipToRange(&result.l0_stop_writes_trigger,
+              result.l0_slowdown_writes_trigger, 1000);
   if (result.info_log == NULL) {
     // Open a log file in the same directory as the db
     src.env->CreateDir(dbname);  // In case it does not exist
@@ -133,7 +138,10 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
       seed_(0),
       tmp_batch_(new WriteBatch),
       bg_compaction_scheduled_(false),
-      manual_compaction_(NULL) {
+      manual_compaction_(NULL),
+      stall_slowdowns_(0),
+      stall_memtable_micros_(0),
+      stall_l0_micros_(0) {
   mem_->Ref();
   has_imm_.Release_Store(NULL);
 
@@ -1295,13 +1303,14 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       break;
     } else if (
         allow_delay &&
-        versions_->NumLevelFiles(0) >= config::kL0_SlowdownWritesTrigger) {
+        versions_->NumLevelFiles(0) >= options_.l0_slowdown_writes_trigger) {
       // We are getting close to hitting a hard limit on the number of
       // L0 files.  Rather than delaying a single write by several
       // seconds when we hit the hard limit, start delaying each
       // individual write by 1ms to reduce latency variance.  Also,
       // this delay hands over some CPU to the compaction thread in
       // case it is sharing the same core as the writer.
+      stall_slowdowns_++;
       mutex_.Unlock();
       env_->SleepForMicroseconds(1000);
       allow_delay = false;  // Do not delay a single write more than once
@@ -1314,11 +1323,15 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       // We have filled up the current memtable, but the previous
       // one is still being compacted, so we wait.
       Log(options_.info_log, "Current memtable full; waiting...\n");
+      const uint64_t start = env_->NowMicros();
       bg_cv_.Wait();
-    } else if (versions_->NumLevelFiles(0) >= config::kL0_StopWritesTrigger) {
+      stall_memtable_micros_ += env_->NowMicros() - start;
+    } else if (versions_->NumLevelFiles(0) >= options_.l0_stop_writes_trigger) {
       // There are too many level-0 files.
       Log(options_.info_log, "Too many L0 files; waiting...\n");
+      const uint64_t start = env_->NowMicros();
       bg_cv_.Wait();
+      stall_l0_micros_ += env_->NowMicros() - start;
     } else {
       // Attempt to switch to a new memtable and trigger compaction of old
       assert(versions_->PrevLogNumber() == 0);
@@ -1395,6 +1408,17 @@ bool DBImpl::GetProperty(const Slice& property, std::string* value) {
   } else if (in == "sstables") {
     *value = versions_->current()->DebugString();
     return true;
+  } else if (in == "writestalls") {
+    char buf[200];
+    snprintf(buf, sizeof(buf),
+             "Slowdowns: %lld\n"
+             "Memtable waits(sec): %.3f\n"
+             "L0 stop waits(sec): %.3f\n",
+             static_cast<long long>(stall_slowdowns_),
+             stall_memtable_micros_ / 1e6,
+             stall_l0_micros_ / 1e6);
+    *value = buf;
+    return true;
   }
 
   return false;
@@ -1426,6 +1450,33 @@ void DBImpl::GetApproximateSizes(
   }
 }
 
+Status DBImpl::SetTuning(const Options& options) {
+  MutexLock l(&mutex_);
+  options_.write_buffer_size = options.write_buffer_size;
+  options_.l0_compaction_trigger = options.l0_compaction_trigger;
+  options_.l0_slowdown_writes_trigger = options.l0_slowdown_writes_trigger;
+  options_.l0_stop_writes_trigger = options.l0_stop_writes_trigger;
+  ClipToRange(&options_.write_buffer_size, 64<<10, 1<<30);
+  ClipToRange(&options_.l0_compaction_trigger, 1, 1000);
+  ClipToRange(&options_.l0_slowdown_writes_trigger,
+              options_.l0_compaction_trigger, 1000);
+  ClipToRange(&options_.l0_stop_writes_trigger,
+              options_.l0_slowdown_writes_trigger, 1000);
+  Log(options_.info_log, "Tuning: write buffer %d, L0 triggers %d/%d/%d\n",
+      static_cast<int>(options_.write_buffer_size),
+      options_.l0_compaction_trigger,
+      options_.l0_slowdown_writes_trigger,
+      options_.l0_stop_writes_trigger);
+
+  // The level-0 score depends on the trigger; rescore so a lowered
+  // trigger starts a compaction, and wake writers that are waiting on
+  // a stop trigger that may have been raised.
+  versions_->RescoreCurrent();
+  MaybeScheduleCompaction();
+  bg_cv_.SignalAll();
+  return Status::OK();
+}
+
 // Default implementations of convenience methods that subclasses of DB
 // can call if they wish
 Status DB::Put(const WriteOptions& opt, const Slice& key, const Slice& value) {
@@ -1442,6 +1493,10 @@ Status DB::Delete(const WriteOptions& opt, const Slice& key) {
 
 DB::~DB() { }
 
+Status DB::SetTuning(const Options& options) {
+  return Status::NotSupported("SetTuning");
+}
+
 Status DB::Open(const Options& options, const std::string& dbname,
                 DB** dbptr) {
   *dbptr = NULL;
@@ -42,6 +42,7 @@ public:
     virtual bool GetProperty(const Slice& property, std::string* value);
     virtual void GetApproximateSizes(const Range* range, int n, uint64_t* sizes);
     virtual void CompactRange(const Slice* begin, const Slice* end);
+    virtual Status SetTuning(const Options& options);
 
     // Extra methods (for testing) that are not in the public DB interface
 
@@ -119,11 +120,12 @@ private:
     Status InstallCompactionResults(CompactionState* compact)
         EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
-    // Constant after construction
+    // Constant after construction, except for the fields changed by
+    // SetTuning(), which are only read and written with mutex_ held
     Env* const env_;
     const InternalKeyComparator internal_comparator_;
     const InternalFilterPolicy internal_filter_policy_;
-    const Options options_; // options_.comparator == &internal_comparator_
+    Options options_; // options_.comparator == &internal_comparator_
     bool owns_info_log_;
     bool owns_cache_;
     const std::string dbname_;
@@ -192,6 +194,11 @@ private:
     };
     CompactionStats stats_[config::kNumLevels];
 
+    // Write stalls caused by compactions falling behind
+    int64_t stall_slowdowns_;      // Writes delayed by 1ms at the L0 slowdown trigger
+    int64_t stall_memtable_micros_; // Time blocked waiting for the memtable flush
+    int64_t stall_l0_micros_;       // Time blocked at the L0 stop trigger
+
     // No copying allowed
     DBImpl(const DBImpl&);
     void operator=(const DBImpl&);
@@ -1005,6 +1005,35 @@ TEST(DBTest, RepeatedWritesToSameKey) {
   }
 }
 
+TEST(DBTest, SetTuning) {
+  Options options = CurrentOptions();
+  options.env = env_;
+  Reopen(&options);
+  ASSERT_EQ(0, TotalTableFiles());
+
+  // Shrink the write buffer of the open database so that the writes
+  // below are flushed to tables instead of staying in the memtable.
+  Options tuning;
+  tuning.write_buffer_size = 100000;
+  tuning.l0_compaction_trigger = 2;
+  tuning.l0_slowdown_writes_trigger = 1;  // Clipped up to the trigger
+  tuning.l0_stop_writes_trigger = 3;
+  ASSERT_OK(db_->SetTuning(tuning));
+
+  Random rnd(301);
+  for (int i = 0; i < 20; i++) {
+    ASSERT_OK(Put(Key(i), RandomString(&rnd, 50000)));
+  }
+  ASSERT_GT(TotalTableFiles(), 0);
+  for (int i = 0; i < 20; i++) {
+    ASSERT_EQ(50000, Get(Key(i)).size());
+  }
+
+  std::string stalls;
+  ASSERT_TRUE(db_->GetProperty("leveldb.writestalls", &stalls));
+  ASSERT_TRUE(stalls.find("Slowdowns: ") == 0);
+}
+
 TEST(DBTest, SparseMerge) {
   Options options = CurrentOptions();
   options.compression = kNoCompression;
@@ -16,8 +16,8 @@
 
 namespace leveldb {
 
-// Grouping of constants.  We may want to make some of these
-// parameters set via options.
+// Grouping of constants.  The level-0 triggers are only the defaults for
+// the corresponding Options fields.
 namespace config {
 static const int kNumLevels = 7;
 
@@ -273,6 +273,11 @@ public:
     };
     const char* LevelSummary(LevelSummaryStorage* scratch) const;
 
+    // Recompute the compaction score of the current version, e.g. after
+    // the level-0 compaction trigger was changed.
+    // REQUIRES: mutex is held
+    void RescoreCurrent() { Finalize(current_); }
+
 private:
     class Builder;
 
@@ -118,6 +118,8 @@ public:
     //     about the internal operation of the DB.
     //  "leveldb.sstables" - returns a multi-line string that describes all
     //     of the sstables that make up the db contents.
+    //  "leveldb.writestalls" - returns a multi-line string with the number
+    //     of delayed writes and the time writers spent blocked.
     virtual bool GetProperty(const Slice& property, std::string* value) = 0;
 
     // For each i in [0,n-1], store in "sizes[i]", the approximate
@@ -142,6 +144,12 @@ public:
     //    db->CompactRange(NULL, NULL);
     virtual void CompactRange(const Slice* begin, const Slice* end) = 0;
 
+    // Apply the write_buffer_size and l0_* trigger fields of "options" to
+    // the open database; all other fields are ignored.  Values are clipped
+    // the same way as in Open().  Returns NotSupported if the
+    // implementation cannot retune itself.
+    virtual Status SetTuning(const Options& options);
+
 private:
     // No copying allowed
     DB(const DB&);
@@ -24,7 +24,8 @@ enum CompressionType {
     // NOTE: do not change the values of existing entries, as these are
     // part of the persistent format on disk.
     kNoCompression = 0x0,
-    kSnappyCompression = 0x1
+    kSnappyCompression = 0x1,
+    kZlibCompression = 0x2
 };
 
 // Options to control the behavior of a database (passed to DB::Open)
@@ -82,6 +83,18 @@ struct Options {
     // Default: 4MB
     size_t write_buffer_size;
 
+    // Level-0 file counts at which a compaction is started, at which
+    // each write is delayed by 1ms, and at which writes stop until the
+    // compaction catches up.  Higher values absorb write bursts (such
+    // as a bulk load) at the cost of reads merging more level-0 files.
+    // These and write_buffer_size can be changed on an open database
+    // with DB::SetTuning().
+    //
+    // Default: 4, 8 and 12
+    int l0_compaction_trigger;
+    int l0_slowdown_writes_trigger;
+    int l0_stop_writes_trigger;
+
     // Number of open files that can be used by the DB.  You may need to
     // increase this if your database has a large working set (budget
     // one open file per 2MB of working set).
@@ -126,6 +139,10 @@ struct Options {
     // worth switching to kNoCompression.  Even if the input data is
     // incompressible, the kSnappyCompression implementation will
     // efficiently detect that and will switch to uncompressed mode.
+    //
+    // kZlibCompression trades more CPU for a better ratio and is only
+    // available when the library was built with LEVELDB_ZLIB.  When the
+    // selected codec is not compiled in, blocks are stored uncompressed.
     CompressionType compression;
 
     // If non-NULL, use the specified filter policy to reduce disk reads.
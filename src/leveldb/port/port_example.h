@@ -123,6 +123,18 @@ extern bool Snappy_GetUncompressedLength(const char* input, size_t length, size_
 // Snappy_GetUncompressedLength.
 extern bool Snappy_Uncompress(const char* input_data, size_t input_length, char* output);
 
+// Store the zlib compression of "input[0,input_length-1]", prefixed with
+// its uncompressed length, in *output.  Returns false if zlib is not
+// supported by this port (LEVELDB_ZLIB not defined).
+extern bool Zlib_Compress(const char* input, size_t input_length, std::string* output);
+
+// Read the uncompressed length stored by Zlib_Compress into *result.
+extern bool Zlib_GetUncompressedLength(const char* input, size_t length, size_t* result);
+
+// Attempt to zlib uncompress input[0,input_length-1] into *output.
+// Same contract as Snappy_Uncompress.
+extern bool Zlib_Uncompress(const char* input_data, size_t input_length, char* output);
+
 // ------------------ Miscellaneous -------------------
 
 // If heap profiling is not supported, returns false.
@@ -42,6 +42,9 @@
 #ifdef SNAPPY
 #include <snappy.h>
 #endif
+#ifdef LEVELDB_ZLIB
+#include <zlib.h>
+#endif
 
 namespace leveldb {
 namespace port {
@@ -169,6 +172,52 @@ inline bool Snappy_Uncompress(const char* input, size_t length, char* output)
 #endif
 }
 
+inline bool Zlib_Compress(const char* input, size_t length, ::std::string* output)
+{
+#ifdef LEVELDB_ZLIB
+    // A four byte little-endian length prefix followed by the zlib stream.
+    uLongf outlen = compressBound(length);
+    output->resize(4 + outlen);
+    for (int i = 0; i < 4; i++)
+        (*output)[i] = static_cast<char>((length >> (8 * i)) & 0xff);
+    if (compress2(reinterpret_cast<Bytef*>(&(*output)[4]), &outlen,
+                  reinterpret_cast<const Bytef*>(input), length, Z_BEST_SPEED) != Z_OK)
+        return false;
+    output->resize(4 + outlen);
+    return true;
+#else
+    return false;
+#endif
+}
+
+inline bool Zlib_GetUncompressedLength(const char* input, size_t length, size_t* result)
+{
+#ifdef LEVELDB_ZLIB
+    if (length < 4)
+        return false;
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(input);
+    *result = p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<size_t>(p[3]) << 24);
+    return true;
+#else
+    return false;
+#endif
+}
+
+inline bool Zlib_Uncompress(const char* input, size_t length, char* output)
+{
+#ifdef LEVELDB_ZLIB
+    size_t ulength;
+    if (!Zlib_GetUncompressedLength(input, length, &ulength))
+        return false;
+    uLongf outlen = ulength;
+    return uncompress(reinterpret_cast<Bytef*>(output), &outlen,
+                      reinterpret_cast<const Bytef*>(input + 4), length - 4) == Z_OK &&
+           outlen == ulength;
+#else
+    return false;
+#endif
+}
+
 inline bool GetHeapProfile(void (*func)(void*, const char*, int), void* arg)
 {
     return false;
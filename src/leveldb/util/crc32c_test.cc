@@ -56,6 +56,18 @@ TEST(CRC, Extend) {
             Extend(Value("hello ", 6), "world", 5));
 }
 
+TEST(CRC, Unaligned) {
+  // Same input at every offset so the hardware path's alignment prologue
+  // and tail handling are both exercised.
+  char buf[64 + 8];
+  for (int offset = 0; offset < 8; offset++) {
+    memcpy(buf + offset, "123456789", 9);
+    ASSERT_EQ(0xe3069283, Value(buf + offset, 9));
+    memset(buf + offset, 0xff, 64);
+    ASSERT_EQ(0x2fcd4e66, Value(buf + offset, 64));
+  }
+}
+
 TEST(CRC, Mask) {
   uint32_t crc = Value("foo", 3);
   ASSERT_NE(crc, Mask(crc));
@@ -4,6 +4,7 @@
 
 #include "leveldb/options.h"
 
+#include "db/dbformat.h"
 #include "leveldb/comparator.h"
 #include "leveldb/env.h"
 
@@ -17,6 +18,9 @@ Options::Options()
       env(Env::Default()),
       info_log(NULL),
       write_buffer_size(4<<20),
+      l0_compaction_trigger(config::kL0_CompactionTrigger),
+      l0_slowdown_writes_trigger(config::kL0_SlowdownWritesTrigger),
+      l0_stop_writes_trigger(config::kL0_StopWritesTrigger),
       max_open_files(1000),
       block_cache(NULL),
       block_size(4096),
@@ -7,6 +7,7 @@
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 
+#include "blockencodings.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "db.h"
@@ -14,8 +15,10 @@
 #include "init.h"
 #include "kernel.h"
 #include "net.h"
+#include "orphanpool.h"
 #include "txdb.h"
 #include "txmempool.h"
+#include "txvalidation.h"
 #include "ui_interface.h"
 
 using namespace std;
@@ -60,6 +63,7 @@ int64_t nTimeBestReceived = 0;
 bool fImporting = false;
 bool fReindex = false;
 bool fHaveGUI = false;
+bool fUseCompactBlocks = true;
 
 struct COrphanBlock {
     uint256 hashBlock;
@@ -72,8 +76,11 @@ multimap<uint256, COrphanBlock*> mapOrphanBlocksByPrev;
 set<pair<COutPoint, unsigned int>> setStakeSeenOrphan;
 size_t nOrphanBlocksSize = 0;
 
-map<uint256, CTransaction> mapOrphanTransactions;
-map<uint256, set<uint256>> mapOrphanTransactionsByPrev;
+// Compact blocks waiting for a "blocktxn" with the transactions we lacked
+map<uint256, CPartialBlock> mapPartialBlocks;
+static const unsigned int MAX_PARTIAL_BLOCKS = 16;
+// Seconds to wait for a "blocktxn" before fetching the full block instead
+static const int64_t PARTIAL_BLOCK_TIMEOUT = 10;
 
 // Constant stuff for coinbase transactions we create:
 CScript COINBASE_FLAGS;
@@ -150,83 +157,52 @@ void ResendWalletTransactions(bool fForce)
 // Registration of network node signals.
 //
 
-void RegisterNodeSignals(CNodeSignals& nodeSignals)
-{
-    nodeSignals.ProcessMessages.connect(&ProcessMessages);
-    nodeSignals.SendMessages.connect(&SendMessages);
-}
-
-void UnregisterNodeSignals(CNodeSignals& nodeSignals)
-{
-    nodeSignals.ProcessMessages.disconnect(&ProcessMessages);
-    nodeSignals.SendMessages.disconnect(&SendMessages);
-}
-
-
-//////////////////////////////////////////////////////////////////////////////
-//
-// mapOrphanTransactions
-//
-
-bool AddOrphanTx(const CTransaction& tx)
+void static FinalizeNode(NodeId nodeid)
 {
-    uint256 hash = tx.GetHash();
-    if (mapOrphanTransactions.count(hash))
-        return false;
-
-    // Ignore big transactions, to avoid a
-    // send-big-orphans memory exhaustion attack. If a peer has a legitimate
-    // large transaction with a missing parent then we assume
-    // it will rebroadcast it later, after the parent transaction(s)
-    // have been mined or received.
-    // 10,000 orphans, each of which is at most 5,000 bytes big is
-    // at most 500 megabytes of orphans:
+    orphanTxPool.EraseForPeer(nodeid);
 
-    size_t nSize = tx.GetSerializeSize(SER_NETWORK, CTransaction::CURRENT_VERSION);
-
-    if (nSize > 5000) {
-        LogPrint("mempool", "ignoring large orphan tx (size: %u, hash: %s)\n", nSize, hash.ToString());
-        return false;
+    // Compact blocks the peer was completing are fetched in full from
+    // another peer that announced them
+    vector<uint256> vRefetch;
+    {
+        LOCK(cs_main);
+        map<uint256, CPartialBlock>::iterator mi = mapPartialBlocks.begin();
+        while (mi != mapPartialBlocks.end()) {
+            if (mi->second.nodeRequested == nodeid) {
+                vRefetch.push_back(mi->first);
+                mapPartialBlocks.erase(mi++);
+            } else
+                ++mi;
+        }
     }
+    if (vRefetch.empty())
+        return;
 
-    mapOrphanTransactions[hash] = tx;
-    BOOST_FOREACH (const CTxIn& txin, tx.vin)
-        mapOrphanTransactionsByPrev[txin.prevout.hash].insert(hash);
-
-    LogPrint("mempool", "stored orphan tx %s (mapsz %u)\n", hash.ToString(),
-             mapOrphanTransactions.size());
-    return true;
+    LOCK(cs_vNodes);
+    BOOST_FOREACH (const uint256& hashBlock, vRefetch) {
+        CInv inv(MSG_BLOCK, hashBlock);
+        BOOST_FOREACH (CNode* pnode, vNodes) {
+            if (!pnode->fDisconnect && pnode->IsInventoryKnown(inv)) {
+                LogPrint("net", "peer=%d disconnected, fetching block %s from %s\n", nodeid, hashBlock.ToString(), pnode->addr.ToString());
+                pnode->PushMessage("getdata", vector<CInv>(1, inv));
+                break;
+            }
+        }
+    }
 }
 
-void static EraseOrphanTx(uint256 hash)
+void RegisterNodeSignals(CNodeSignals& nodeSignals)
 {
-    map<uint256, CTransaction>::iterator it = mapOrphanTransactions.find(hash);
-    if (it == mapOrphanTransactions.end())
-        return;
-    BOOST_FOREACH (const CTxIn& txin, it->second.vin) {
-        map<uint256, set<uint256>>::iterator itPrev = mapOrphanTransactionsByPrev.find(txin.prevout.hash);
-        if (itPrev == mapOrphanTransactionsByPrev.end())
-            continue;
-        itPrev->second.erase(hash);
-        if (itPrev->second.empty())
-            mapOrphanTransactionsByPrev.erase(itPrev);
-    }
-    mapOrphanTransactions.erase(it);
+    nodeSignals.ProcessMessages.connect(&ProcessMessages);
+    nodeSignals.SendMessages.connect(&SendMessages);
+    nodeSignals.FinalizeNode.connect(&FinalizeNode);
 }
 
-unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans)
+void UnregisterNodeSignals(CNodeSignals& nodeSignals)
 {
-    unsigned int nEvicted = 0;
-    while (mapOrphanTransactions.size() > nMaxOrphans) {
-        // Evict a random orphan:
-        uint256 randomhash = GetRandHash();
-        map<uint256, CTransaction>::iterator it = mapOrphanTransactions.lower_bound(randomhash);
-        if (it == mapOrphanTransactions.end())
-            it = mapOrphanTransactions.begin();
-        EraseOrphanTx(it->first);
-        ++nEvicted;
-    }
-    return nEvicted;
+    nodeSignals.ProcessMessages.disconnect(&ProcessMessages);
+    nodeSignals.SendMessages.disconnect(&SendMessages);
+    nodeSignals.FinalizeNode.disconnect(&FinalizeNode);
 }
 
 
@@ -257,7 +233,7 @@ bool CTransaction::ReadFromDisk(CTxDB& txdb, COutPoint prevout)
 
 bool CTransaction::ReadFromDisk(COutPoint prevout)
 {
-    CTxDB txdb("r");
+    CTxDB& txdb = GetReadTxDB();
     CTxIndex txindex;
     return ReadFromDisk(txdb, prevout, txindex);
 }
@@ -472,7 +448,7 @@ int CMerkleTx::SetMerkleBranch(const CBlock* pblock)
     if (pblock == NULL) {
         // Load the block this tx is in
         CTxIndex txindex;
-        if (!CTxDB("r").ReadTxIndex(GetHash(), txindex))
+        if (!GetReadTxDB().ReadTxIndex(GetHash(), txindex))
             return 0;
         if (!blockTmp.ReadFromDisk(txindex.pos.nFile, txindex.pos.nBlockPos))
             return 0;
@@ -575,7 +551,7 @@ int64_t GetMinFee(const CTransaction& tx, unsigned int nBlockSize, enum GetMinFe
 }
 
 
-bool AcceptToMemoryPool(CTxMemPool& pool, CTransaction& tx, bool fLimitFree, bool* pfMissingInputs)
+bool AcceptToMemoryPool(CTxMemPool& pool, CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fCheckScripts)
 {
     AssertLockHeld(cs_main);
     if (pfMissingInputs)
@@ -616,7 +592,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CTransaction& tx, bool fLimitFree, boo
     }
 
     {
-        CTxDB txdb("r");
+        CTxDB& txdb = GetReadTxDB();
 
         // do we already have it?
         if (txdb.ContainsTx(hash))
@@ -683,7 +659,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CTransaction& tx, bool fLimitFree, boo
 
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-        if (!tx.ConnectInputs(txdb, mapInputs, mapUnused, CDiskTxPos(1, 1, 1), pindexBest, false, false, STANDARD_SCRIPT_VERIFY_FLAGS)) {
+        if (!tx.ConnectInputs(txdb, mapInputs, mapUnused, CDiskTxPos(1, 1, 1), pindexBest, false, false, STANDARD_SCRIPT_VERIFY_FLAGS, fCheckScripts)) {
             return error("AcceptToMemoryPool : ConnectInputs failed %s", hash.ToString());
         }
 
@@ -696,7 +672,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CTransaction& tx, bool fLimitFree, boo
         // There is a similar check in CreateNewBlock() to prevent creating
         // invalid blocks, however allowing such transactions into the mempool
         // can be exploited as a DoS attack.
-        if (!tx.ConnectInputs(txdb, mapInputs, mapUnused, CDiskTxPos(1, 1, 1), pindexBest, false, false, MANDATORY_SCRIPT_VERIFY_FLAGS)) {
+        if (fCheckScripts && !tx.ConnectInputs(txdb, mapInputs, mapUnused, CDiskTxPos(1, 1, 1), pindexBest, false, false, MANDATORY_SCRIPT_VERIFY_FLAGS)) {
             return error("AcceptToMemoryPool: : BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s", hash.ToString());
         }
     }
@@ -752,7 +728,15 @@ int CMerkleTx::GetBlocksToMaturity() const
 {
     if (!(IsCoinBase() || IsCoinStake()))
         return 0;
-    return max(0, (nCoinbaseMaturity + 45) - GetDepthInMainChain());
+    return GetBlocksToMaturity(GetDepthInMainChain());
+}
+
+// Same as above for callers that already know the depth
+int CMerkleTx::GetBlocksToMaturity(int nDepth) const
+{
+    if (!(IsCoinBase() || IsCoinStake()))
+        return 0;
+    return max(0, (nCoinbaseMaturity + 45) - nDepth);
 }
 
 
@@ -780,7 +764,7 @@ bool CWalletTx::AcceptWalletTransaction(CTxDB& txdb)
 
 bool CWalletTx::AcceptWalletTransaction()
 {
-    CTxDB txdb("r");
+    CTxDB& txdb = GetReadTxDB();
     return AcceptWalletTransaction(txdb);
 }
 
@@ -803,21 +787,18 @@ int CTxIndex::GetDepthInMainChain() const
 // Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock
 bool GetTransaction(const uint256& hash, CTransaction& tx, uint256& hashBlock)
 {
-    {
-        LOCK(cs_main);
-        {
-            if (mempool.lookup(hash, tx)) {
-                return true;
-            }
-        }
-        CTxDB txdb("r");
-        CTxIndex txindex;
-        if (tx.ReadFromDisk(txdb, COutPoint(hash, 0), txindex)) {
-            CBlock block;
-            if (block.ReadFromDisk(txindex.pos.nFile, txindex.pos.nBlockPos, false))
-                hashBlock = block.GetHash();
-            return true;
-        }
+    if (mempool.lookup(hash, tx))
+        return true;
+
+    // The transaction index and the block files are safe to read
+    // concurrently, so this does not need cs_main.
+    CTxDB& txdb = GetReadTxDB();
+    CTxIndex txindex;
+    if (tx.ReadFromDisk(txdb, COutPoint(hash, 0), txindex)) {
+        CBlock block;
+        if (block.ReadFromDisk(txindex.pos.nFile, txindex.pos.nBlockPos, false))
+            hashBlock = block.GetHash();
+        return true;
     }
     return false;
 }
@@ -984,6 +965,10 @@ unsigned int GetNextTargetRequired(const CBlockIndex* pindexLast, bool fProofOfS
     CBigNum PastDifficultyAverage;
     CBigNum PastDifficultyAveragePrev;
 
+    // Private chains stay at minimum difficulty
+    if (Params().MineBlocksOnDemand())
+        return nProofOfWorkLimit.GetCompact();
+
     // Reset difficulty during halving fork
     if (nCurrentBlockHeight == nUpgrade_01) {
         return nProofOfWorkLimit.GetCompact();
@@ -1225,7 +1210,7 @@ int64_t CTransaction::GetValueIn(const MapPrevTx& inputs) const
     return nResult;
 }
 
-bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTxIndex>& mapTestPool, const CDiskTxPos& posThisTx, const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, unsigned int flags)
+bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTxIndex>& mapTestPool, const CDiskTxPos& posThisTx, const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, unsigned int flags, bool fCheckScripts)
 {
     // Take over previous transactions' spent pointers
     // fBlock is true when this is called from AcceptBlock when a new best-block is added to the blockchain
@@ -1280,7 +1265,7 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTx
             // Skip ECDSA signature verification when connecting blocks (fBlock=true)
             // before the last blockchain checkpoint. This is safe because block merkle hashes are
             // still computed and checked, and any change will be caught at the next checkpoint.
-            if (!(fBlock && (nBestHeight < Checkpoints::GetTotalBlocksEstimate()))) {
+            if (fCheckScripts && !(fBlock && (nBestHeight < Checkpoints::GetTotalBlocksEstimate()))) {
                 // Verify signature
                 if (!VerifySignature(txPrev, *this, i, flags, 0)) {
                     if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
@@ -1693,6 +1678,8 @@ bool CBlock::SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew)
     nBestChainTrust = pindexNew->nChainTrust;
     nTimeBestReceived = GetTime();
     mempool.AddTransactionsUpdated(1);
+    UpdateTxDBTuning(fIsInitialDownload);
+    uiInterface.NotifyBlockTip(nBestHeight);
 
     uint256 nBestBlockTrust = pindexBest->nHeight != 0 ? (pindexBest->nChainTrust - pindexBest->pprev->nChainTrust) : pindexBest->nChainTrust;
 
@@ -2190,38 +2177,48 @@ bool CBlock::SignBlock(CWallet& wallet, int64_t nFees)
 
     static int64_t nLastCoinStakeSearchTime = GetAdjustedTime(); // startup timestamp
 
-    CKey key;
-    CTransaction txCoinStake;
-    txCoinStake.nTime &= ~STAKE_TIMESTAMP_MASK;
-
-    int64_t nSearchTime = txCoinStake.nTime; // search to current time
+    int64_t nSearchTime = GetAdjustedTime() & ~STAKE_TIMESTAMP_MASK; // search to current time
 
     if (nSearchTime > nLastCoinStakeSearchTime) {
-        int64_t nSearchInterval = 1;
-        if (wallet.CreateCoinStake(wallet, nBits, nSearchInterval, nFees, txCoinStake, key)) {
-            if (txCoinStake.nTime >= pindexBest->GetPastTimeLimit() + 1) {
-                // make sure coinstake would meet timestamp protocol
-                //    as it would be the same as the block timestamp
-                vtx[0].nTime = nTime = txCoinStake.nTime;
-
-                // we have to make sure that we have no future timestamps in
-                //    our transactions set
-                for (vector<CTransaction>::iterator it = vtx.begin(); it != vtx.end();)
-                    if (it->nTime > nTime) {
-                        it = vtx.erase(it);
-                    } else {
-                        ++it;
-                    }
+        if (SignBlockAt(wallet, nFees, nSearchTime))
+            return true;
+        nLastCoinStakeSearchInterval = nSearchTime - nLastCoinStakeSearchTime;
+        nLastCoinStakeSearchTime = nSearchTime;
+    }
 
-                vtx.insert(vtx.begin() + 1, txCoinStake);
-                hashMerkleRoot = BuildMerkleTree();
+    return false;
+}
 
-                // append a signature to our block
-                return key.Sign(GetHash(), vchBlockSig);
-            }
+// Look for a kernel at exactly nStakeTime and, if one is found, make this
+// proof-of-stake template a complete signed block
+bool CBlock::SignBlockAt(CWallet& wallet, int64_t nFees, int64_t nStakeTime)
+{
+    CKey key;
+    CTransaction txCoinStake;
+    txCoinStake.nTime = nStakeTime;
+
+    int64_t nSearchInterval = 1;
+    if (wallet.CreateCoinStake(wallet, nBits, nSearchInterval, nFees, txCoinStake, key)) {
+        if (txCoinStake.nTime >= pindexBest->GetPastTimeLimit() + 1) {
+            // make sure coinstake would meet timestamp protocol
+            //    as it would be the same as the block timestamp
+            vtx[0].nTime = nTime = txCoinStake.nTime;
+
+            // we have to make sure that we have no future timestamps in
+            //    our transactions set
+            for (vector<CTransaction>::iterator it = vtx.begin(); it != vtx.end();)
+                if (it->nTime > nTime) {
+                    it = vtx.erase(it);
+                } else {
+                    ++it;
+                }
+
+            vtx.insert(vtx.begin() + 1, txCoinStake);
+            hashMerkleRoot = BuildMerkleTree();
+
+            // append a signature to our block
+            return key.Sign(GetHash(), vchBlockSig);
         }
-        nLastCoinStakeSearchInterval = nSearchTime - nLastCoinStakeSearchTime;
-        nLastCoinStakeSearchTime = nSearchTime;
     }
 
     return false;
@@ -2337,6 +2334,12 @@ bool LoadBlockIndex(bool fAllowNew)
         nStakeMinConfirmations = 3;
         nCoinbaseMaturity = 3; // test maturity is 10 blocks
     }
+    if (RegTest()) {
+        // any kernel meets the stake target, and new outputs stake right away
+        bnProofOfStakeLimit = CBigNum(~uint256(0) >> 1);
+        nStakeMinConfirmations = 2;
+        nCoinbaseMaturity = 1;
+    }
 
     //
     // Load block index
@@ -2571,7 +2574,7 @@ bool static AlreadyHave(CTxDB& txdb, const CInv& inv)
         bool txInMap = false;
         txInMap = mempool.exists(inv.hash);
         return txInMap ||
-               mapOrphanTransactions.count(inv.hash) ||
+               orphanTxPool.Exists(inv.hash) ||
                txdb.ContainsTx(inv.hash);
     }
 
@@ -2584,14 +2587,53 @@ bool static AlreadyHave(CTxDB& txdb, const CInv& inv)
 }
 
 
+// Serialized "block" messages for the most recently requested blocks. A new
+// block is fetched by most peers right after it is announced; this way it is
+// read, serialized and checksummed once rather than once per peer.
+static std::deque<std::pair<uint256, CSharedMessage>> vBlockMessageCache;
+static const unsigned int BLOCK_MESSAGE_CACHE_SIZE = 4;
+
+static void ReadBlockForRelay(const CBlockIndex* pindex, CBlock& block)
+{
+    block.ReadFromDisk(pindex);
+
+    // previous versions could accept sigs with high s
+    if (!IsCanonicalBlockSignature(&block, true)) {
+        bool ret = EnsureLowS(block.vchBlockSig);
+        assert(ret);
+    }
+}
+
+// requires LOCK(cs_main)
+static CSharedMessage GetBlockMessage(const CBlockIndex* pindex)
+{
+    uint256 hash = pindex->GetBlockHash();
+    BOOST_FOREACH (const PAIRTYPE(uint256, CSharedMessage)& item, vBlockMessageCache)
+        if (item.first == hash)
+            return item.second;
+
+    CBlock block;
+    ReadBlockForRelay(pindex, block);
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss.reserve(::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
+    ss << block;
+    CSharedMessage msg = MakeSharedMessage("block", ss);
+
+    vBlockMessageCache.push_back(std::make_pair(hash, msg));
+    if (vBlockMessageCache.size() > BLOCK_MESSAGE_CACHE_SIZE)
+        vBlockMessageCache.pop_front();
+    return msg;
+}
+
 void static ProcessGetData(CNode* pfrom)
 {
     std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
 
     vector<CInv> vNotFound;
 
-    LOCK(cs_main);
-
+    // Only blocks need cs_main; relayed transactions come from mapRelay and
+    // the mempool, which have their own locks.
     while (it != pfrom->vRecvGetData.end()) {
         // Don't bother if send buffer is too full to respond anyway
         if (pfrom->nSendSize >= SendBufferSize())
@@ -2602,20 +2644,17 @@ void static ProcessGetData(CNode* pfrom)
             boost::this_thread::interruption_point();
             it++;
 
-            if (inv.type == MSG_BLOCK) {
+            if (inv.type == MSG_BLOCK || inv.type == MSG_CMPCT_BLOCK) {
                 // Send block from disk
+                LOCK(cs_main);
                 map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(inv.hash);
                 if (mi != mapBlockIndex.end()) {
-                    CBlock block;
-                    block.ReadFromDisk((*mi).second);
-
-                    // previous versions could accept sigs with high s
-                    if (!IsCanonicalBlockSignature(&block, true)) {
-                        bool ret = EnsureLowS(block.vchBlockSig);
-                        assert(ret);
-                    }
-
-                    pfrom->PushMessage("block", block);
+                    if (inv.type == MSG_CMPCT_BLOCK) {
+                        CBlock block;
+                        ReadBlockForRelay((*mi).second, block);
+                        pfrom->PushMessage("cmpctblock", CBlockCompact(block));
+                    } else
+                        pfrom->PushMessage(GetBlockMessage((*mi).second));
 
                     // Trigger them to send a getblocks request for the next batch of inventory
                     if (inv.hash == pfrom->hashContinue) {
@@ -2633,9 +2672,9 @@ void static ProcessGetData(CNode* pfrom)
                 bool pushed = false;
                 {
                     LOCK(cs_mapRelay);
-                    map<CInv, CDataStream>::iterator mi = mapRelay.find(inv);
+                    map<CInv, CSharedMessage>::iterator mi = mapRelay.find(inv);
                     if (mi != mapRelay.end()) {
-                        pfrom->PushMessage(inv.GetCommand(), (*mi).second);
+                        pfrom->PushMessage((*mi).second);
                         pushed = true;
                     }
                 }
@@ -2657,7 +2696,7 @@ void static ProcessGetData(CNode* pfrom)
             // Track requests for our stuff.
             g_signals.Inventory(inv.hash);
 
-            if (inv.type == MSG_BLOCK /* || inv.type == MSG_FILTERED_BLOCK */)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_CMPCT_BLOCK)
                 break;
         }
     }
@@ -2676,6 +2715,32 @@ void static ProcessGetData(CNode* pfrom)
     }
 }
 
+// requires LOCK(cs_main)
+static void ProcessReceivedBlock(CNode* pfrom, CBlock& block)
+{
+    if (ProcessBlock(pfrom, &block))
+        mapAlreadyAskedFor.erase(CInv(MSG_BLOCK, block.GetHash()));
+    if (block.nDoS) pfrom->Misbehaving(block.nDoS);
+}
+
+// The header checks of AcceptBlock that a compact block can pass before its
+// transactions are known; the header alone does not say whether the block is
+// proof-of-stake, so its target must match one of the two
+static bool CheckCompactBlockHeader(const CBlock& header, const CBlockIndex* pindexPrev)
+{
+    bool fStakeTarget = header.nBits == GetNextTargetRequired(pindexPrev, true);
+    bool fWorkTarget = header.nBits == GetNextTargetRequired(pindexPrev, false) &&
+                       pindexPrev->nHeight + 1 <= Params().LastPOWBlock() &&
+                       CheckProofOfWork(header.GetHash(), header.nBits);
+    if (!fStakeTarget && !fWorkTarget)
+        return false;
+
+    if (header.GetBlockTime() <= pindexPrev->GetPastTimeLimit() || FutureDrift(header.GetBlockTime()) < pindexPrev->GetBlockTime())
+        return false;
+
+    return true;
+}
+
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
 {
     RandAddSeedPerfmon();
@@ -2811,7 +2876,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 {
                     LOCK(cs_vNodes);
                     // Use deterministic randomness to send to the same nodes for 24 hours
-                    // at a time so the setAddrKnowns of the chosen nodes prevent repeats
+                    // at a time so the addrKnown filters of the chosen nodes prevent repeats
                     static uint256 hashSalt;
                     if (hashSalt == 0)
                         hashSalt = GetRandHash();
@@ -2862,7 +2927,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         }
 
         LOCK(cs_main);
-        CTxDB txdb("r");
+        CTxDB& txdb = GetReadTxDB();
 
         for (unsigned int nInv = 0; nInv < vInv.size(); nInv++) {
             const CInv& inv = vInv[nInv];
@@ -2976,80 +3041,170 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
 
     else if (strCommand == "tx") {
-        vector<uint256> vWorkQueue;
-        vector<uint256> vEraseQueue;
         CTransaction tx;
         vRecv >> tx;
 
         CInv inv(MSG_TX, tx.GetHash());
         pfrom->AddInventoryKnown(inv);
 
+        // Scripts are checked off the message thread; see txvalidation.h
+        txValidationQueue.Push(tx, pfrom);
+    }
+
+
+    else if (strCommand == "block" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        CBlock block;
+        vRecv >> block;
+        uint256 hashBlock = block.GetHash();
+
+        LogPrint("net", "received block %s\n", hashBlock.ToString());
+
+        CInv inv(MSG_BLOCK, hashBlock);
+        pfrom->AddInventoryKnown(inv);
+
         LOCK(cs_main);
 
-        bool fMissingInputs = false;
+        pfrom->setCmpctBlockRequested.erase(hashBlock);
+        mapPartialBlocks.erase(hashBlock);
+        ProcessReceivedBlock(pfrom, block);
+    }
 
-        mapAlreadyAskedFor.erase(inv);
 
-        if (AcceptToMemoryPool(mempool, tx, true, &fMissingInputs)) {
-            RelayTransaction(tx, inv.hash);
-            vWorkQueue.push_back(inv.hash);
-            vEraseQueue.push_back(inv.hash);
+    else if (strCommand == "cmpctblock" && !fImporting && !fReindex) {
+        CBlockCompact cmpctblock;
+        vRecv >> cmpctblock;
+        CBlock block = cmpctblock.GetHeader();
+        uint256 hashBlock = block.GetHash();
 
-            // Recursively process any orphan transactions that depended on this one
-            for (unsigned int i = 0; i < vWorkQueue.size(); i++) {
-                map<uint256, set<uint256>>::iterator itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue[i]);
-                if (itByPrev == mapOrphanTransactionsByPrev.end())
-                    continue;
-                for (set<uint256>::iterator mi = itByPrev->second.begin();
-                     mi != itByPrev->second.end();
-                     ++mi) {
-                    const uint256& orphanTxHash = *mi;
-                    CTransaction& orphanTx = mapOrphanTransactions[orphanTxHash];
-                    bool fMissingInputs2 = false;
-
-                    if (AcceptToMemoryPool(mempool, orphanTx, true, &fMissingInputs2)) {
-                        LogPrint("mempool", "   accepted orphan tx %s\n", orphanTxHash.ToString());
-                        RelayTransaction(orphanTx, orphanTxHash);
-                        vWorkQueue.push_back(orphanTxHash);
-                        vEraseQueue.push_back(orphanTxHash);
-                    } else if (!fMissingInputs2) {
-                        // invalid or too-little-fee orphan
-                        vEraseQueue.push_back(orphanTxHash);
-                        LogPrint("mempool", "   removed orphan tx %s\n", orphanTxHash.ToString());
-                    }
+        LogPrint("net", "received compact block %s (%u txs, %u prefilled)\n", hashBlock.ToString(), cmpctblock.GetTxCount(), cmpctblock.vPrefilledTx.size());
+
+        CInv inv(MSG_BLOCK, hashBlock);
+        pfrom->AddInventoryKnown(inv);
+
+        LOCK(cs_main);
+
+        // Reconstruction scans the mempool, so it is only done for blocks
+        // we asked this peer for
+        if (!pfrom->setCmpctBlockRequested.erase(hashBlock)) {
+            LogPrint("net", "ignoring unrequested compact block %s from %s\n", hashBlock.ToString(), pfrom->addr.ToString());
+            return true;
+        }
+
+        if (mapBlockIndex.count(hashBlock) || mapOrphanBlocks.count(hashBlock) || mapPartialBlocks.count(hashBlock))
+            return true;
+
+        // An orphan or a header that fails the cheap checks is fetched in
+        // full and goes through the usual block checks
+        map<uint256, CBlockIndex*>::iterator miPrev = mapBlockIndex.find(block.hashPrevBlock);
+        if (miPrev == mapBlockIndex.end() || !CheckCompactBlockHeader(block, miPrev->second)) {
+            pfrom->PushMessage("getdata", vector<CInv>(1, inv));
+            return true;
+        }
+
+        CPartialBlock partial;
+        CompactReadStatus status = partial.InitData(cmpctblock, mempool);
+        if (status == READ_STATUS_INVALID) {
+            pfrom->Misbehaving(100);
+            return error("ProcessMessage() : invalid compact block %s from %s", hashBlock.ToString(), pfrom->addr.ToString());
+        }
+
+        vector<unsigned int> vMissing;
+        if (status == READ_STATUS_OK) {
+            vMissing = partial.GetMissing();
+            if (vMissing.empty())
+                status = partial.FillBlock(block, vector<CTransaction>());
+        }
+
+        if (status == READ_STATUS_FAILED) {
+            pfrom->PushMessage("getdata", vector<CInv>(1, inv));
+        } else if (!vMissing.empty()) {
+            LogPrint("net", "compact block %s missing %u txs\n", hashBlock.ToString(), vMissing.size());
+
+            // One reconstruction per peer; an earlier one is fetched in full
+            for (map<uint256, CPartialBlock>::iterator mi = mapPartialBlocks.begin(); mi != mapPartialBlocks.end(); ++mi) {
+                if (mi->second.nodeRequested == pfrom->GetId()) {
+                    pfrom->PushMessage("getdata", vector<CInv>(1, CInv(MSG_BLOCK, mi->first)));
+                    mapPartialBlocks.erase(mi);
+                    break;
                 }
             }
 
-            BOOST_FOREACH (uint256 hash, vEraseQueue)
-                EraseOrphanTx(hash);
-        } else if (fMissingInputs) {
-            AddOrphanTx(tx);
-
-            // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
-            unsigned int nEvicted = LimitOrphanTxSize(MAX_ORPHAN_TRANSACTIONS);
-            if (nEvicted > 0)
-                LogPrint("mempool", "mapOrphan overflow, removed %u tx\n", nEvicted);
+            // Make room by dropping the longest outstanding reconstruction
+            if (mapPartialBlocks.size() >= MAX_PARTIAL_BLOCKS) {
+                map<uint256, CPartialBlock>::iterator itOldest = mapPartialBlocks.begin();
+                for (map<uint256, CPartialBlock>::iterator mi = mapPartialBlocks.begin(); mi != mapPartialBlocks.end(); ++mi)
+                    if (mi->second.nTimeRequested < itOldest->second.nTimeRequested)
+                        itOldest = mi;
+                mapPartialBlocks.erase(itOldest);
+            }
+            partial.nodeRequested = pfrom->GetId();
+            partial.nTimeRequested = GetTime();
+            mapPartialBlocks[hashBlock] = partial;
+
+            CBlockTxRequest req;
+            req.hashBlock = hashBlock;
+            req.vIndexes = vMissing;
+            pfrom->PushMessage("getblocktxn", req);
+        } else {
+            ProcessReceivedBlock(pfrom, block);
         }
-        if (tx.nDoS) pfrom->Misbehaving(tx.nDoS);
     }
 
 
-    else if (strCommand == "block" && !fImporting && !fReindex) // Ignore blocks received while importing
-    {
+    else if (strCommand == "getblocktxn") {
+        CBlockTxRequest req;
+        vRecv >> req;
+
+        LOCK(cs_main);
+
+        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(req.hashBlock);
+        if (mi == mapBlockIndex.end())
+            return true;
+
         CBlock block;
-        vRecv >> block;
-        uint256 hashBlock = block.GetHash();
+        ReadBlockForRelay((*mi).second, block);
+
+        CBlockTxResponse resp;
+        resp.hashBlock = req.hashBlock;
+        resp.vtx.reserve(req.vIndexes.size());
+        BOOST_FOREACH (unsigned int nIndex, req.vIndexes) {
+            if (nIndex >= block.vtx.size()) {
+                pfrom->Misbehaving(100);
+                return error("ProcessMessage() : getblocktxn index %u out of range for %s", nIndex, req.hashBlock.ToString());
+            }
+            resp.vtx.push_back(block.vtx[nIndex]);
+        }
+        pfrom->PushMessage("blocktxn", resp);
+    }
 
-        LogPrint("net", "received block %s\n", hashBlock.ToString());
 
-        CInv inv(MSG_BLOCK, hashBlock);
-        pfrom->AddInventoryKnown(inv);
+    else if (strCommand == "blocktxn" && !fImporting && !fReindex) {
+        CBlockTxResponse resp;
+        vRecv >> resp;
 
         LOCK(cs_main);
 
-        if (ProcessBlock(pfrom, &block))
-            mapAlreadyAskedFor.erase(inv);
-        if (block.nDoS) pfrom->Misbehaving(block.nDoS);
+        map<uint256, CPartialBlock>::iterator mi = mapPartialBlocks.find(resp.hashBlock);
+        if (mi == mapPartialBlocks.end())
+            return true;
+        // Only the peer we asked may complete the block
+        if (mi->second.nodeRequested != pfrom->GetId()) {
+            LogPrint("net", "ignoring unrequested blocktxn for %s from %s\n", resp.hashBlock.ToString(), pfrom->addr.ToString());
+            return true;
+        }
+
+        CBlock block;
+        CompactReadStatus status = mi->second.FillBlock(block, resp.vtx);
+        mapPartialBlocks.erase(mi);
+        if (status == READ_STATUS_INVALID) {
+            pfrom->Misbehaving(100);
+            return error("ProcessMessage() : invalid blocktxn for %s from %s", resp.hashBlock.ToString(), pfrom->addr.ToString());
+        }
+        if (status == READ_STATUS_FAILED)
+            pfrom->PushMessage("getdata", vector<CInv>(1, CInv(MSG_BLOCK, resp.hashBlock)));
+        else
+            ProcessReceivedBlock(pfrom, block);
     }
 
 
@@ -3061,7 +3216,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     else if ((strCommand == "getaddr") && (pfrom->fInbound)) {
         // Don't return addresses older than nCutOff timestamp
         int64_t nCutOff = GetTime() - (nNodeLifespan * 24 * 60 * 60);
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_vAddrToSend);
+            pfrom->vAddrToSend.clear();
+        }
         vector<CAddress> vAddr = addrman.GetAddr();
         BOOST_FOREACH (const CAddress& addr, vAddr)
             if (addr.nTime > nCutOff)
@@ -3070,8 +3228,6 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
 
     else if (strCommand == "mempool") {
-        LOCK(cs_main);
-
         std::vector<uint256> vtxid;
         mempool.queryHashes(vtxid);
         vector<CInv> vInv;
@@ -3229,6 +3385,7 @@ bool ProcessMessages(CNode* pfrom)
 
         // Message size
         unsigned int nMessageSize = hdr.nMessageSize;
+        pfrom->RecordMessageRecv(strCommand, nMessageSize + CMessageHeader::HEADER_SIZE);
 
         // Checksum
         CDataStream& vRecv = msg.vRecv;
@@ -3243,8 +3400,10 @@ bool ProcessMessages(CNode* pfrom)
 
         // Process message
         bool fRet = false;
+        int64_t nProcessStart = GetTimeMicros();
         try {
             fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
+            RecordMessageProcessTime(strCommand, GetTimeMicros() - nProcessStart);
             boost::this_thread::interruption_point();
         } catch (std::ios_base::failure& e) {
             if (strstr(e.what(), "end of data")) {
@@ -3280,62 +3439,77 @@ bool ProcessMessages(CNode* pfrom)
 
 bool SendMessages(CNode* pto, bool fSendTrickle)
 {
-    TRY_LOCK(cs_main, lockMain);
-    if (lockMain) {
-        // Don't send anything until we get their version message
-        if (pto->nVersion == 0)
-            return true;
+    // Don't send anything until we get their version message
+    if (pto->nVersion == 0)
+        return true;
 
-        //
-        // Message: ping
-        //
-        bool pingSend = false;
-        if (pto->fPingQueued) {
-            // RPC ping request by user
-            pingSend = true;
-        }
-        if (pto->nPingNonceSent == 0 && pto->nPingUsecStart + PING_INTERVAL * 1000000 < GetTimeMicros()) {
-            // Ping automatically sent as a latency probe & keepalive.
-            pingSend = true;
-        }
-        if (pingSend) {
-            uint64_t nonce = 0;
-            while (nonce == 0) {
-                RAND_bytes((unsigned char*)&nonce, sizeof(nonce));
-            }
-            pto->fPingQueued = false;
-            pto->nPingUsecStart = GetTimeMicros();
-            if (pto->nVersion > BIP0031_VERSION) {
-                pto->nPingNonceSent = nonce;
-                pto->PushMessage("ping", nonce);
-            } else {
-                // Peer is too old to support ping command with nonce, pong will never arrive.
-                pto->nPingNonceSent = 0;
-                pto->PushMessage("ping");
-            }
-        }
+    int64_t nPhaseStart = GetTimeMicros();
 
-        // Start block sync
-        if (pto->fStartSync && !fImporting && !fReindex) {
-            pto->fStartSync = false;
-            PushGetBlocks(pto, pindexBest, uint256(0));
+    //
+    // Message: ping
+    //
+    bool pingSend = false;
+    if (pto->fPingQueued) {
+        // RPC ping request by user
+        pingSend = true;
+    }
+    if (pto->nPingNonceSent == 0 && pto->nPingUsecStart + PING_INTERVAL * 1000000 < GetTimeMicros()) {
+        // Ping automatically sent as a latency probe & keepalive.
+        pingSend = true;
+    }
+    if (pingSend) {
+        uint64_t nonce = 0;
+        while (nonce == 0) {
+            RAND_bytes((unsigned char*)&nonce, sizeof(nonce));
+        }
+        pto->fPingQueued = false;
+        pto->nPingUsecStart = GetTimeMicros();
+        if (pto->nVersion > BIP0031_VERSION) {
+            pto->nPingNonceSent = nonce;
+            pto->PushMessage("ping", nonce);
+        } else {
+            // Peer is too old to support ping command with nonce, pong will never arrive.
+            pto->nPingNonceSent = 0;
+            pto->PushMessage("ping");
         }
+    }
+    RecordSendPhaseTime("ping", nPhaseStart);
+
+    // Only block sync, wallet resends and getdata need the chain or the
+    // mempool. They take cs_main, and wait for the next pass while another
+    // thread holds it; ping, addr and inv go out regardless
+    bool fInitialDownload = true;
+    {
+        TRY_LOCK(cs_main, lockMain);
+        if (lockMain) {
+            fInitialDownload = IsInitialBlockDownload();
+
+            // Start block sync
+            if (pto->fStartSync && !fImporting && !fReindex) {
+                pto->fStartSync = false;
+                PushGetBlocks(pto, pindexBest, uint256(0));
+            }
 
-        // Resend wallet transactions that haven't gotten in a block yet
-        // Except during reindex, importing and IBD, when old wallet
-        // transactions become unconfirmed and spams other nodes.
-        if (!fReindex && !fImporting && !IsInitialBlockDownload()) {
-            ResendWalletTransactions();
+            // Resend wallet transactions that haven't gotten in a block yet
+            // Except during reindex, importing and IBD, when old wallet
+            // transactions become unconfirmed and spams other nodes.
+            if (!fReindex && !fImporting && !fInitialDownload) {
+                ResendWalletTransactions();
+            }
         }
+    }
 
-        // Address refresh broadcast
-        static int64_t nLastRebroadcast;
-        if (!IsInitialBlockDownload() && (GetTime() - nLastRebroadcast > 24 * 60 * 60)) {
-            LOCK(cs_vNodes);
+    // Address refresh broadcast; nLastRebroadcast is guarded by cs_vNodes
+    static int64_t nLastRebroadcast;
+    if (!fInitialDownload && (GetTime() - nLastRebroadcast > 24 * 60 * 60)) {
+        LOCK(cs_vNodes);
+        if (GetTime() - nLastRebroadcast > 24 * 60 * 60) {
             BOOST_FOREACH (CNode* pnode, vNodes) {
-                // Periodically clear setAddrKnown to allow refresh broadcasts
-                if (nLastRebroadcast)
-                    pnode->setAddrKnown.clear();
+                // Periodically clear addrKnown to allow refresh broadcasts
+                if (nLastRebroadcast) {
+                    LOCK(pnode->cs_vAddrToSend);
+                    pnode->addrKnown.reset();
+                }
 
                 // Rebroadcast our address
                 AdvertizeLocal(pnode);
@@ -3343,96 +3517,119 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             if (!vNodes.empty())
                 nLastRebroadcast = GetTime();
         }
+    }
+    RecordSendPhaseTime("rebroadcast", nPhaseStart);
 
-        //
-        // Message: addr
-        //
-        if (fSendTrickle) {
-            vector<CAddress> vAddr;
-            vAddr.reserve(pto->vAddrToSend.size());
-            BOOST_FOREACH (const CAddress& addr, pto->vAddrToSend) {
-                // returns true if wasn't already contained in the set
-                if (pto->setAddrKnown.insert(addr).second) {
-                    vAddr.push_back(addr);
-                    // receiver rejects addr messages larger than 1000
-                    if (vAddr.size() >= 1000) {
-                        pto->PushMessage("addr", vAddr);
-                        vAddr.clear();
-                    }
+    //
+    // Message: addr
+    //
+    if (fSendTrickle) {
+        LOCK(pto->cs_vAddrToSend);
+        vector<CAddress> vAddr;
+        vAddr.reserve(pto->vAddrToSend.size());
+        BOOST_FOREACH (const CAddress& addr, pto->vAddrToSend) {
+            if (!pto->addrKnown.contains(addr.GetKey())) {
+                pto->addrKnown.insert(addr.GetKey());
+                vAddr.push_back(addr);
+                // receiver rejects addr messages larger than 1000
+                if (vAddr.size() >= 1000) {
+                    pto->PushMessage("addr", vAddr);
+                    vAddr.clear();
                 }
             }
-            pto->vAddrToSend.clear();
-            if (!vAddr.empty())
-                pto->PushMessage("addr", vAddr);
         }
+        pto->vAddrToSend.clear();
+        if (!vAddr.empty())
+            pto->PushMessage("addr", vAddr);
+    }
+    RecordSendPhaseTime("addr", nPhaseStart);
 
 
-        //
-        // Message: inventory
-        //
-        vector<CInv> vInv;
-        vector<CInv> vInvWait;
-        {
-            LOCK(pto->cs_inventory);
-            vInv.reserve(pto->vInventoryToSend.size());
-            vInvWait.reserve(pto->vInventoryToSend.size());
-            BOOST_FOREACH (const CInv& inv, pto->vInventoryToSend) {
-                if (pto->setInventoryKnown.count(inv))
+    //
+    // Message: inventory
+    //
+    vector<CInv> vInv;
+    vector<CInv> vInvWait;
+    {
+        LOCK(pto->cs_inventory);
+        vInv.reserve(pto->vInventoryToSend.size());
+        vInvWait.reserve(pto->vInventoryToSend.size());
+        BOOST_FOREACH (const CInv& inv, pto->vInventoryToSend) {
+            if (pto->filterInventoryKnown.contains(inv.hash))
+                continue;
+
+            // trickle out tx inv to protect privacy
+            if (inv.type == MSG_TX && !fSendTrickle) {
+                // 1/4 of tx invs blast to all immediately
+                static const uint256 hashSalt = GetRandHash();
+                uint256 hashRand = inv.hash ^ hashSalt;
+                hashRand = Hash(BEGIN(hashRand), END(hashRand));
+                bool fTrickleWait = ((hashRand & 3) != 0);
+
+                if (fTrickleWait) {
+                    vInvWait.push_back(inv);
                     continue;
-
-                // trickle out tx inv to protect privacy
-                if (inv.type == MSG_TX && !fSendTrickle) {
-                    // 1/4 of tx invs blast to all immediately
-                    static uint256 hashSalt;
-                    if (hashSalt == 0)
-                        hashSalt = GetRandHash();
-                    uint256 hashRand = inv.hash ^ hashSalt;
-                    hashRand = Hash(BEGIN(hashRand), END(hashRand));
-                    bool fTrickleWait = ((hashRand & 3) != 0);
-
-                    if (fTrickleWait) {
-                        vInvWait.push_back(inv);
-                        continue;
-                    }
                 }
+            }
 
-                // returns true if wasn't already contained in the set
-                if (pto->setInventoryKnown.insert(inv).second) {
-                    vInv.push_back(inv);
-                    if (vInv.size() >= 1000) {
-                        pto->PushMessage("inv", vInv);
-                        vInv.clear();
-                    }
-                }
+            pto->filterInventoryKnown.insert(inv.hash);
+            vInv.push_back(inv);
+            if (vInv.size() >= 1000) {
+                pto->PushMessage("inv", vInv);
+                vInv.clear();
             }
-            pto->vInventoryToSend = vInvWait;
         }
-        if (!vInv.empty())
-            pto->PushMessage("inv", vInv);
+        pto->vInventoryToSend = vInvWait;
+    }
+    if (!vInv.empty())
+        pto->PushMessage("inv", vInv);
+    RecordSendPhaseTime("inv", nPhaseStart);
 
 
-        //
-        // Message: getdata
-        //
-        vector<CInv> vGetData;
-        int64_t nNow = GetTime() * 1000000;
-        CTxDB txdb("r");
-        while (!pto->mapAskFor.empty() && (*pto->mapAskFor.begin()).first <= nNow) {
-            const CInv& inv = (*pto->mapAskFor.begin()).second;
-            if (!AlreadyHave(txdb, inv)) {
-                if (fDebug)
-                    LogPrint("net", "sending getdata: %s\n", inv.ToString());
-                vGetData.push_back(inv);
-                if (vGetData.size() >= 1000) {
-                    pto->PushMessage("getdata", vGetData);
-                    vGetData.clear();
+    //
+    // Message: getdata
+    //
+    {
+        TRY_LOCK(cs_main, lockMain);
+        if (lockMain) {
+            vector<CInv> vGetData;
+            int64_t nNow = GetTime() * 1000000;
+            CTxDB& txdb = GetReadTxDB();
+            while (!pto->mapAskFor.empty() && (*pto->mapAskFor.begin()).first <= nNow) {
+                const CInv& inv = (*pto->mapAskFor.begin()).second;
+                if (!AlreadyHave(txdb, inv)) {
+                    if (fDebug)
+                        LogPrint("net", "sending getdata: %s\n", inv.ToString());
+                    // Near the tip the peer's block is mostly in our mempool already
+                    if (inv.type == MSG_BLOCK && fUseCompactBlocks && pto->nVersion >= COMPACT_BLOCK_VERSION && !IsInitialBlockDownload() &&
+                        pto->setCmpctBlockRequested.size() < MAX_PARTIAL_BLOCKS) {
+                        vGetData.push_back(CInv(MSG_CMPCT_BLOCK, inv.hash));
+                        pto->setCmpctBlockRequested.insert(inv.hash);
+                    } else
+                        vGetData.push_back(inv);
+                    if (vGetData.size() >= 1000) {
+                        pto->PushMessage("getdata", vGetData);
+                        vGetData.clear();
+                    }
+                    mapAlreadyAskedFor[inv] = nNow;
                 }
-                mapAlreadyAskedFor[inv] = nNow;
+                pto->mapAskFor.erase(pto->mapAskFor.begin());
+            }
+
+            // Fetch in full the compact blocks the peer never completed
+            map<uint256, CPartialBlock>::iterator mi = mapPartialBlocks.begin();
+            while (mi != mapPartialBlocks.end()) {
+                if (mi->second.nodeRequested == pto->GetId() && mi->second.nTimeRequested + PARTIAL_BLOCK_TIMEOUT < GetTime()) {
+                    LogPrint("net", "blocktxn for %s timed out, fetching the block\n", mi->first.ToString());
+                    vGetData.push_back(CInv(MSG_BLOCK, mi->first));
+                    mapPartialBlocks.erase(mi++);
+                } else
+                    ++mi;
             }
-            pto->mapAskFor.erase(pto->mapAskFor.begin());
+            if (!vGetData.empty())
+                pto->PushMessage("getdata", vGetData);
+            RecordSendPhaseTime("getdata", nPhaseStart);
         }
-        if (!vGetData.empty())
-            pto->PushMessage("getdata", vGetData);
     }
     return true;
 }
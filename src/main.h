@@ -42,8 +42,6 @@ static const unsigned int MAX_BLOCK_SIGOPS = MAX_BLOCK_SIZE / 50;
 static const unsigned int MAX_P2SH_SIGOPS = 15;
 /** The maximum number of sigops we're willing to relay/mine in a single tx */
 static const unsigned int MAX_TX_SIGOPS = MAX_BLOCK_SIGOPS / 5;
-/** The maximum number of orphan transactions kept in memory */
-static const unsigned int MAX_ORPHAN_TRANSACTIONS = MAX_BLOCK_SIZE / 100;
 /** Default for -maxorphanblocksmib, maximum number of memory to keep orphan blocks */
 static const unsigned int DEFAULT_MAX_ORPHAN_BLOCKS = 40;
 /** The maximum number of entries in an 'inv' protocol message */
@@ -87,6 +85,7 @@ extern bool fReindex;
 struct COrphanBlock;
 extern std::map<uint256, COrphanBlock*> mapOrphanBlocks;
 extern bool fHaveGUI;
+extern bool fUseCompactBlocks;
 
 // Settings
 extern bool fUseFastIndex;
@@ -143,8 +142,8 @@ const CBlockIndex* GetLastBlockIndex(const CBlockIndex* pindex, bool fProofOfSta
 void ThreadStakeMiner(CWallet* pwallet);
 
 
-/** (try to) add transaction to memory pool **/
-bool AcceptToMemoryPool(CTxMemPool& pool, CTransaction& tx, bool fLimitFree, bool* pfMissingInputs);
+/** (try to) add transaction to memory pool; fCheckScripts=false when the caller already verified every input script **/
+bool AcceptToMemoryPool(CTxMemPool& pool, CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fCheckScripts = true);
 
 
 /** Position on disk for a particular transaction. */
@@ -387,9 +386,10 @@ public:
         @param[in] pindexBlock
         @param[in] fBlock	true if called from ConnectBlock
         @param[in] fMiner	true if called from CreateNewBlock
+        @param[in] fCheckScripts	false to skip signature checks already done by the caller
         @return Returns true if all checks succeed
      */
-    bool ConnectInputs(CTxDB& txdb, MapPrevTx inputs, std::map<uint256, CTxIndex>& mapTestPool, const CDiskTxPos& posThisTx, const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, unsigned int flags = STANDARD_SCRIPT_VERIFY_FLAGS);
+    bool ConnectInputs(CTxDB& txdb, MapPrevTx inputs, std::map<uint256, CTxIndex>& mapTestPool, const CDiskTxPos& posThisTx, const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, unsigned int flags = STANDARD_SCRIPT_VERIFY_FLAGS, bool fCheckScripts = true);
     bool CheckTransaction() const;
     bool GetCoinAge(CTxDB& txdb, const CBlockIndex* pindexPrev, uint64_t& nCoinAge) const;
 
@@ -499,6 +499,7 @@ public:
         return GetDepthInMainChainINTERNAL(pindexRet) > 0;
     }
     int GetBlocksToMaturity() const;
+    int GetBlocksToMaturity(int nDepth) const;
     bool AcceptToMemoryPool(bool fLimitFree = true);
 };
 
@@ -685,15 +686,24 @@ public:
     uint256 BuildMerkleTree() const
     {
         vMerkleTree.clear();
+        vMerkleTree.reserve(vtx.size() * 2 + 16);
         BOOST_FOREACH (const CTransaction& tx, vtx)
             vMerkleTree.push_back(tx.GetHash());
         int j = 0;
+        std::vector<uint256> vPairs;
         for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2) {
+            // Lay out the 64-byte node pairs of this level back to back and
+            // hash the whole level in one SHA256D64 batch.
+            int nPairs = (nSize + 1) / 2;
+            vPairs.resize(nPairs * 2);
             for (int i = 0; i < nSize; i += 2) {
                 int i2 = std::min(i + 1, nSize - 1);
-                vMerkleTree.push_back(Hash(BEGIN(vMerkleTree[j + i]), END(vMerkleTree[j + i]),
-                                           BEGIN(vMerkleTree[j + i2]), END(vMerkleTree[j + i2])));
+                vPairs[i] = vMerkleTree[j + i];
+                vPairs[i + 1] = vMerkleTree[j + i2];
             }
+            size_t nPos = vMerkleTree.size();
+            vMerkleTree.resize(nPos + nPairs);
+            SHA256D64(vMerkleTree[nPos].begin(), vPairs[0].begin(), nPairs);
             j += nSize;
         }
         return (vMerkleTree.empty() ? 0 : vMerkleTree.back());
@@ -811,6 +821,7 @@ public:
     bool CheckBlock(bool fCheckPOW = true, bool fCheckMerkleRoot = true, bool fCheckSig = true) const;
     bool AcceptBlock();
     bool SignBlock(CWallet& keystore, int64_t nFees);
+    bool SignBlockAt(CWallet& wallet, int64_t nFees, int64_t nStakeTime);
     bool CheckBlockSignature() const;
 
 private:
@@ -848,6 +859,9 @@ public:
 
     uint64_t nStakeModifier; // hash modifier for proof-of-stake
     uint256 bnStakeModifierV2;
+    // memory only: block that generated the stake modifier in effect here,
+    // filled in by GetLastStakeModifier so later lookups skip the walk back
+    mutable const CBlockIndex* pindexStakeModifier;
 
     // proof-of-stake specific fields
     COutPoint prevoutStake;
@@ -876,6 +890,7 @@ public:
         nFlags = 0;
         nStakeModifier = 0;
         bnStakeModifierV2 = 0;
+        pindexStakeModifier = NULL;
         hashProof = 0;
         prevoutStake.SetNull();
         nStakeTime = 0;
@@ -901,6 +916,7 @@ public:
         nFlags = 0;
         nStakeModifier = 0;
         bnStakeModifierV2 = 0;
+        pindexStakeModifier = NULL;
         hashProof = 0;
         if (block.IsProofOfStake()) {
             SetProofOfStake();
@@ -143,7 +143,7 @@ CBlock* CreateNewBlock(CReserveKey& reservekey, bool fProofOfStake, int64_t* pFe
     int64_t nFees = 0;
     {
         LOCK2(cs_main, mempool.cs);
-        CTxDB txdb("r");
+        CTxDB& txdb = GetReadTxDB();
 
         // Priority order to process transactions
         list<COrphan> vOrphan; // list memory doesn't move
@@ -14,6 +14,10 @@
 #include <string.h>
 #endif
 
+#ifndef WIN32
+#include <sys/uio.h>
+#endif
+
 #ifdef USE_UPNP
 #include <miniupnpc/miniupnpc.h>
 #include <miniupnpc/miniwget.h>
@@ -54,7 +58,7 @@ CAddrMan addrman;
 
 vector<CNode*> vNodes;
 CCriticalSection cs_vNodes;
-map<CInv, CDataStream> mapRelay;
+map<CInv, CSharedMessage> mapRelay;
 deque<pair<int64_t, CInv>> vRelayExpiration;
 CCriticalSection cs_mapRelay;
 map<CInv, int64_t> mapAlreadyAskedFor;
@@ -293,6 +297,9 @@ void AddressCurrentlyConnected(const CService& addr)
 }
 
 
+NodeId CNode::nLastNodeId = 0;
+CCriticalSection CNode::cs_nLastNodeId;
+
 uint64_t CNode::nTotalBytesRecv = 0;
 uint64_t CNode::nTotalBytesSent = 0;
 CCriticalSection CNode::cs_totalBytesRecv;
@@ -466,6 +473,109 @@ bool CNode::Misbehaving(int howmuch)
     return false;
 }
 
+// Commands seen past this many distinct names are counted together, so a
+// peer sending made-up commands can't grow the maps without bound
+static const unsigned int MAX_TRACKED_COMMANDS = 64;
+static const char* OTHER_COMMAND = "*other*";
+
+static CCriticalSection cs_netTelemetry;
+static CNetTelemetry netTelemetry;
+
+CTimingHistogram::CTimingHistogram()
+{
+    memset(vBucket, 0, sizeof(vBucket));
+    nCount = 0;
+    nTotalMicros = 0;
+    nMaxMicros = 0;
+}
+
+void CTimingHistogram::Add(int64_t nMicros)
+{
+    int nBucket = 0;
+    while (nBucket < NUM_BUCKETS - 1 && nMicros >= ((int64_t)2 << nBucket))
+        nBucket++;
+    vBucket[nBucket]++;
+    nCount++;
+    nTotalMicros += nMicros;
+    nMaxMicros = std::max(nMaxMicros, nMicros);
+}
+
+template <typename T>
+static T& GetTracked(std::map<std::string, T>& mapStats, const std::string& strKey)
+{
+    typename std::map<std::string, T>::iterator it = mapStats.find(strKey);
+    if (it != mapStats.end())
+        return it->second;
+    return mapStats[mapStats.size() < MAX_TRACKED_COMMANDS ? strKey : OTHER_COMMAND];
+}
+
+static void AddMessage(mapMsgTypeStats& mapStats, const std::string& strCommand, uint64_t nBytes)
+{
+    CMessageTypeStats& stats = GetTracked(mapStats, strCommand);
+    stats.nMsgs++;
+    stats.nBytes += nBytes;
+}
+
+void RecordMessageProcessTime(const std::string& strCommand, int64_t nMicros)
+{
+    LOCK(cs_netTelemetry);
+    GetTracked(netTelemetry.mapProcessTime, strCommand).Add(nMicros);
+}
+
+void RecordSendPhaseTime(const char* pszPhase, int64_t& nPhaseStart)
+{
+    int64_t nNow = GetTimeMicros();
+    {
+        LOCK(cs_netTelemetry);
+        netTelemetry.mapSendPhaseTime[pszPhase].Add(nNow - nPhaseStart);
+    }
+    nPhaseStart = nNow;
+}
+
+static void InitMsgHandlerStats(int nThreads)
+{
+    LOCK(cs_netTelemetry);
+    netTelemetry.vMsgHandler.assign(nThreads, CMsgHandlerStats());
+    netTelemetry.nMsgHandlerStartMicros = GetTimeMicros();
+}
+
+static void RecordMsgHandlerPass(int nThread, unsigned int nPeers, uint64_t nMessages, int64_t nBusyMicros)
+{
+    LOCK(cs_netTelemetry);
+    CMsgHandlerStats& stats = netTelemetry.vMsgHandler[nThread];
+    stats.nPeers = nPeers;
+    stats.nMessages += nMessages;
+    stats.nBusyMicros += nBusyMicros;
+}
+
+void GetNetTelemetry(CNetTelemetry& telemetry)
+{
+    LOCK(cs_netTelemetry);
+    telemetry = netTelemetry;
+}
+
+void CNode::RecordMessageRecv(const std::string& strCommand, uint64_t nBytes)
+{
+    {
+        LOCK(cs_msgStats);
+        AddMessage(mapRecvStats, strCommand, nBytes);
+    }
+    LOCK(cs_netTelemetry);
+    AddMessage(netTelemetry.mapRecv, strCommand, nBytes);
+}
+
+void CNode::RecordMessageSent(const char* pchHeader, uint64_t nBytes)
+{
+    const char* pchCommand = pchHeader + MESSAGE_START_SIZE;
+    std::string strCommand(pchCommand, strnlen(pchCommand, CMessageHeader::COMMAND_SIZE));
+    {
+        LOCK(cs_msgStats);
+        AddMessage(mapSendStats, strCommand, nBytes);
+    }
+    LOCK(cs_netTelemetry);
+    AddMessage(netTelemetry.mapSend, strCommand, nBytes);
+}
+
 #undef X
 #define X(name) stats.name = name
 void CNode::copyStats(CNodeStats& stats)
@@ -483,6 +593,11 @@ void CNode::copyStats(CNodeStats& stats)
     X(nMisbehavior);
     X(nSendBytes);
     X(nRecvBytes);
+    {
+        LOCK(cs_msgStats);
+        X(mapRecvStats);
+        X(mapSendStats);
+    }
     stats.fSyncNode = (this == pnodeSync);
 
     // It is common for nodes with good ping times to suddenly become lagged,
@@ -512,7 +627,7 @@ bool CNode::ReceiveMsgBytes(const char* pch, unsigned int nBytes)
         // get current incomplete message, or create a new one
         if (vRecvMsg.empty() ||
             vRecvMsg.back().complete())
-            vRecvMsg.push_back(CNetMessage(SER_NETWORK, nRecvVersion));
+            vRecvMsg.emplace_back(SER_NETWORK, nRecvVersion);
 
         CNetMessage& msg = vRecvMsg.back();
 
@@ -536,25 +651,27 @@ bool CNode::ReceiveMsgBytes(const char* pch, unsigned int nBytes)
     return true;
 }
 
+// Receive buffers grow by at most this much ahead of the data actually received
+static const unsigned int RECV_ALLOC_STEP = 256 * 1024;
+
 int CNetMessage::readHeader(const char* pch, unsigned int nBytes)
 {
     // copy data to temporary parsing buffer
-    unsigned int nRemaining = 24 - nHdrPos;
+    unsigned int nRemaining = CMessageHeader::HEADER_SIZE - nHdrPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
     memcpy(&hdrbuf[nHdrPos], pch, nCopy);
     nHdrPos += nCopy;
 
     // if header incomplete, exit
-    if (nHdrPos < 24)
+    if (nHdrPos < CMessageHeader::HEADER_SIZE)
         return nCopy;
 
-    // deserialize to CMessageHeader
-    try {
-        hdrbuf >> hdr;
-    } catch (std::exception& e) {
-        return -1;
-    }
+    // deserialize to CMessageHeader; same layout EndMessage writes
+    memcpy(hdr.pchMessageStart, &hdrbuf[0], MESSAGE_START_SIZE);
+    memcpy(hdr.pchCommand, &hdrbuf[MESSAGE_START_SIZE], CMessageHeader::COMMAND_SIZE);
+    memcpy(&hdr.nMessageSize, &hdrbuf[CMessageHeader::MESSAGE_SIZE_OFFSET], sizeof(hdr.nMessageSize));
+    memcpy(&hdr.nChecksum, &hdrbuf[CMessageHeader::CHECKSUM_OFFSET], sizeof(hdr.nChecksum));
 
     // reject messages larger than MAX_SIZE
     if (hdr.nMessageSize > MAX_SIZE)
@@ -563,6 +680,12 @@ int CNetMessage::readHeader(const char* pch, unsigned int nBytes)
     // switch state to reading message data
     in_data = true;
 
+    if (hdr.nMessageSize > 0) {
+        CSerializeData data;
+        netBufferPool.Acquire(data, std::min(hdr.nMessageSize, RECV_ALLOC_STEP));
+        vRecv.SwapBuffer(data);
+    }
+
     return nCopy;
 }
 
@@ -573,7 +696,7 @@ int CNetMessage::readData(const char* pch, unsigned int nBytes)
 
     if (vRecv.size() < nDataPos + nCopy) {
         // Allocate up to 256 KiB ahead, but never more than the total message size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
+        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + RECV_ALLOC_STEP));
     }
 
     memcpy(&vRecv[nDataPos], pch, nCopy);
@@ -582,25 +705,153 @@ int CNetMessage::readData(const char* pch, unsigned int nBytes)
     return nCopy;
 }
 
+CNetBufferPool netBufferPool;
+
+const size_t CNetBufferPool::vClassSize[NUM_CLASSES] = {512, 4 * 1024, 32 * 1024, RECV_ALLOC_STEP, 2 * 1024 * 1024};
+const size_t CNetBufferPool::vClassMaxBuffers[NUM_CLASSES] = {256, 128, 32, 8, 4};
+// Grown block buffers above this are freed rather than kept
+static const size_t MAX_POOLED_BUFFER = 8 * 1024 * 1024;
+
+CNetBufferPool::CNetBufferPool()
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+void CNetBufferPool::Acquire(CSerializeData& data, size_t nSize)
+{
+    assert(data.empty());
+
+    int nClass = 0;
+    while (nClass < NUM_CLASSES && vClassSize[nClass] < nSize)
+        nClass++;
+
+    {
+        LOCK(cs);
+        // Any bigger free buffer will do too
+        for (int i = nClass; i < NUM_CLASSES; i++) {
+            if (vFree[i].empty())
+                continue;
+            data.swap(vFree[i].back());
+            vFree[i].pop_back();
+            stats.nHits++;
+            stats.nCachedBuffers--;
+            stats.nCachedBytes -= data.capacity();
+            return;
+        }
+        stats.nMisses++;
+    }
+
+    // Round up to the class size so the buffer comes back to this class
+    data.reserve(nClass < NUM_CLASSES ? vClassSize[nClass] : nSize);
+}
+
+void CNetBufferPool::Release(CSerializeData& data)
+{
+    size_t nCapacity = data.capacity();
+    int nClass = NUM_CLASSES - 1;
+    while (nClass >= 0 && vClassSize[nClass] > nCapacity)
+        nClass--;
+
+    if (nClass >= 0 && nCapacity <= MAX_POOLED_BUFFER) {
+        data.clear();
+        LOCK(cs);
+        if (vFree[nClass].size() < vClassMaxBuffers[nClass]) {
+            vFree[nClass].push_back(CSerializeData());
+            vFree[nClass].back().swap(data);
+            stats.nReturned++;
+            stats.nCachedBuffers++;
+            stats.nCachedBytes += nCapacity;
+        } else
+            stats.nDiscarded++;
+    }
+
+    // Whatever was not kept is freed outside the lock
+    CSerializeData().swap(data);
+}
+
+CNetBufferPoolStats CNetBufferPool::GetStats() const
+{
+    LOCK(cs);
+    return stats;
+}
+
+void SetMessageSizeAndChecksum(CDataStream& ss)
+{
+    // Set the size
+    unsigned int nSize = ss.size() - CMessageHeader::HEADER_SIZE;
+    memcpy((char*)&ss[CMessageHeader::MESSAGE_SIZE_OFFSET], &nSize, sizeof(nSize));
+
+    // Set the checksum
+    uint256 hash = Hash(ss.begin() + CMessageHeader::HEADER_SIZE, ss.end());
+    unsigned int nChecksum = 0;
+    memcpy(&nChecksum, &hash, sizeof(nChecksum));
+    assert(ss.size() >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
+    memcpy((char*)&ss[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
+}
+
+CSharedMessage MakeSharedMessage(const char* pszCommand, const CDataStream& ssPayload)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss.reserve(CMessageHeader::HEADER_SIZE + ssPayload.size());
+    ss << CMessageHeader(pszCommand, 0);
+    ss << ssPayload;
+    SetMessageSizeAndChecksum(ss);
+
+    boost::shared_ptr<CSerializeData> pmsg(new CSerializeData());
+    ss.GetAndClear(*pmsg);
+    return pmsg;
+}
+
+#ifndef WIN32
+// Most queued messages handed to the kernel in one sendmsg() call
+static const int SEND_MAX_IOV = 64;
+#endif
+
 // requires LOCK(cs_vSend)
 void SocketSendData(CNode* pnode)
 {
-    std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
+    std::deque<CSharedMessage>::iterator it = pnode->vSendMsg.begin();
 
     while (it != pnode->vSendMsg.end()) {
-        const CSerializeData& data = *it;
-        assert(data.size() > pnode->nSendOffset);
+        assert((*it)->size() > pnode->nSendOffset);
+#ifdef WIN32
+        const CSerializeData& data = **it;
         int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+        // Gather the queued messages into one call so a backlog of small
+        // messages does not cost a syscall each
+        struct iovec iov[SEND_MAX_IOV];
+        int nIov = 0;
+        for (std::deque<CSharedMessage>::iterator itv = it; itv != pnode->vSendMsg.end() && nIov < SEND_MAX_IOV; ++itv, ++nIov) {
+            size_t nOffset = (nIov == 0 ? pnode->nSendOffset : 0);
+            iov[nIov].iov_base = (void*)&(**itv)[nOffset];
+            iov[nIov].iov_len = (*itv)->size() - nOffset;
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = nIov;
+        int nBytes = (int)sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
         if (nBytes > 0) {
             pnode->nLastSend = GetTime();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             pnode->RecordBytesSent(nBytes);
-            if (pnode->nSendOffset == data.size()) {
+
+            // Retire every message that went out completely
+            size_t nLeft = nBytes;
+            while (nLeft > 0) {
+                size_t nRemaining = (*it)->size() - pnode->nSendOffset;
+                if (nLeft < nRemaining) {
+                    pnode->nSendOffset += nLeft;
+                    break;
+                }
+                nLeft -= nRemaining;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
+                pnode->nSendSize -= (*it)->size();
                 it++;
-            } else {
+            }
+            if (pnode->nSendOffset != 0) {
                 // could not send full message; stop sending more
                 break;
             }
@@ -1293,32 +1544,48 @@ void static StartSync(const vector<CNode*>& vNodes)
     }
 }
 
-void ThreadMessageHandler()
+// Each thread serves the peers whose id falls in its shard. A peer's messages
+// are therefore handled in order, by the same thread that sends to it, and a
+// peer stuck on a slow request only holds up the peers in its own shard.
+// Handlers that touch the block chain take cs_main, so those still run one
+// at a time; ping, addr, getaddr, mempool and relay lookups do not.
+// The one peer, across all message handler threads, picked to get
+// trickled inventory and addresses; -1 once its thread has taken it
+static NodeId nodeTrickle = -1; // guarded by cs_vNodes
+
+void ThreadMessageHandler(int nThread, int nThreads)
 {
     SetThreadPriority(THREAD_PRIORITY_BELOW_NORMAL);
     while (true) {
-        bool fHaveSyncNode = false;
-
         vector<CNode*> vNodesCopy;
+        CNode* pnodeTrickle = NULL;
         {
             LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            BOOST_FOREACH (CNode* pnode, vNodesCopy) {
-                pnode->AddRef();
+            // Picking the sync node and the trickle node compares all peers,
+            // so one thread does it for every shard, once per pass
+            bool fHaveSyncNode = false;
+            if (nThread == 0 && !vNodes.empty())
+                nodeTrickle = vNodes[GetRand(vNodes.size())]->GetId();
+            BOOST_FOREACH (CNode* pnode, vNodes) {
                 if (pnode == pnodeSync)
                     fHaveSyncNode = true;
+                if (pnode->GetId() % nThreads == nThread) {
+                    vNodesCopy.push_back(pnode->AddRef());
+                    if (pnode->GetId() == nodeTrickle) {
+                        pnodeTrickle = pnode;
+                        nodeTrickle = -1;
+                    }
+                }
             }
-        }
 
-        if (!fHaveSyncNode)
-            StartSync(vNodesCopy);
+            if (nThread == 0 && !fHaveSyncNode)
+                StartSync(vNodes);
+        }
 
         // Poll the connected nodes for messages
-        CNode* pnodeTrickle = NULL;
-        if (!vNodesCopy.empty())
-            pnodeTrickle = vNodesCopy[GetRand(vNodesCopy.size())];
-
         bool fSleep = true;
+        uint64_t nMessages = 0;
+        int64_t nPassStart = GetTimeMicros();
 
         BOOST_FOREACH (CNode* pnode, vNodesCopy) {
             if (pnode->fDisconnect)
@@ -1328,7 +1595,10 @@ void ThreadMessageHandler()
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
                 if (lockRecv) {
-                    if (!g_signals.ProcessMessages(pnode))
+                    size_t nQueued = pnode->vRecvMsg.size();
+                    bool fFailed = !g_signals.ProcessMessages(pnode);
+                    nMessages += nQueued - std::min(nQueued, pnode->vRecvMsg.size());
+                    if (fFailed)
                         pnode->CloseSocketDisconnect();
 
                     if (pnode->nSendSize < SendBufferSize()) {
@@ -1348,6 +1618,7 @@ void ThreadMessageHandler()
             }
             boost::this_thread::interruption_point();
         }
+        RecordMsgHandlerPass(nThread, vNodesCopy.size(), nMessages, GetTimeMicros() - nPassStart);
 
         {
             LOCK(cs_vNodes);
@@ -1529,7 +1800,13 @@ void StartNode(boost::thread_group& threadGroup)
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "opencon", &ThreadOpenConnections));
 
     // Process messages
-    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
+    int nMsgHandlerThreads = std::max(1, std::min(16, (int)GetArg("-msghandlerthreads", DEFAULT_MSG_HANDLER_THREADS)));
+    InitMsgHandlerStats(nMsgHandlerThreads);
+    for (int i = 0; i < nMsgHandlerThreads; i++) {
+        boost::function<void()> fn = boost::bind(&ThreadMessageHandler, i, nMsgHandlerThreads);
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()>>, "msghand", fn));
+    }
+    LogPrintf("Using %d message handler threads\n", nMsgHandlerThreads);
 
     // Dump network addresses
     threadGroup.create_thread(boost::bind(&LoopForever<void (*)()>, "dumpaddr", &DumpAddresses, DUMP_ADDRESSES_INTERVAL * 1000));
@@ -1590,8 +1867,10 @@ void RelayTransaction(const CTransaction& tx, const uint256& hash, const CDataSt
             vRelayExpiration.pop_front();
         }
 
-        // Save original serialized message so newer versions are preserved
-        mapRelay.insert(std::make_pair(inv, ss));
+        // Save original serialized message so newer versions are preserved.
+        // The header and checksum are built here once; every peer that asks
+        // for it gets the same buffer.
+        mapRelay.insert(std::make_pair(inv, MakeSharedMessage("tx", ss)));
         vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
     }
 
@@ -7,6 +7,7 @@
 
 #include <boost/array.hpp>
 #include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/signals2/signal.hpp>
 #include <deque>
 #include <openssl/rand.h>
@@ -17,8 +18,8 @@
 #endif
 
 #include "addrman.h"
+#include "bloom.h"
 #include "hash.h"
-#include "mruset.h"
 #include "netbase.h"
 #include "protocol.h"
 
@@ -31,6 +32,8 @@ extern int nBestHeight;
 static const int PING_INTERVAL = 2 * 60;
 /** Time after which to disconnect, after waiting for a ping response (or inactivity). */
 static const int TIMEOUT_INTERVAL = 20 * 60;
+/** Default for -msghandlerthreads, threads processing peer messages; peers are split between them */
+static const int DEFAULT_MSG_HANDLER_THREADS = 2;
 
 inline unsigned int ReceiveFloodSize() { return 1000 * GetArg("-maxreceivebuffer", 5 * 1000); }
 inline unsigned int SendBufferSize() { return 1000 * GetArg("-maxsendbuffer", 1 * 1000); }
@@ -49,10 +52,22 @@ void StartNode(boost::thread_group& threadGroup);
 bool StopNode();
 void SocketSendData(CNode* pnode);
 
+/** A complete wire message (header with size and checksum, then payload).
+ * Serialized once and shared read-only between the send queues of every
+ * peer it goes to. */
+typedef boost::shared_ptr<const CSerializeData> CSharedMessage;
+
+/** Fill in the size and checksum of a header+payload stream */
+void SetMessageSizeAndChecksum(CDataStream& ss);
+CSharedMessage MakeSharedMessage(const char* pszCommand, const CDataStream& ssPayload);
+
+typedef int NodeId;
+
 // Signals for message handling
 struct CNodeSignals {
     boost::signals2::signal<bool(CNode*)> ProcessMessages;
     boost::signals2::signal<bool(CNode*, bool)> SendMessages;
+    boost::signals2::signal<void(NodeId)> FinalizeNode;
 };
 
 CNodeSignals& GetNodeSignals();
@@ -86,6 +101,8 @@ CAddress GetLocalAddress(const CNetAddr* paddrPeer = NULL);
 enum {
     MSG_TX = 1,
     MSG_BLOCK,
+    // Only in getdata: answered with "cmpctblock" instead of "block"
+    MSG_CMPCT_BLOCK,
 };
 
 extern bool fDiscover;
@@ -95,7 +112,7 @@ extern CAddrMan addrman;
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
-extern std::map<CInv, CDataStream> mapRelay;
+extern std::map<CInv, CSharedMessage> mapRelay;
 extern std::deque<std::pair<int64_t, CInv>> vRelayExpiration;
 extern CCriticalSection cs_mapRelay;
 extern std::map<CInv, int64_t> mapAlreadyAskedFor;
@@ -104,6 +121,62 @@ extern std::vector<std::string> vAddedNodes;
 extern CCriticalSection cs_vAddedNodes;
 
 
+/** Message count and bytes (header included) for one command */
+class CMessageTypeStats
+{
+public:
+    uint64_t nMsgs;
+    uint64_t nBytes;
+
+    CMessageTypeStats() : nMsgs(0), nBytes(0) {}
+};
+
+typedef std::map<std::string, CMessageTypeStats> mapMsgTypeStats;
+
+/** Durations in power-of-two microsecond buckets: bucket i counts times below 2^(i+1) us */
+class CTimingHistogram
+{
+public:
+    static const int NUM_BUCKETS = 24;
+    uint64_t vBucket[NUM_BUCKETS];
+    uint64_t nCount;
+    int64_t nTotalMicros;
+    int64_t nMaxMicros;
+
+    CTimingHistogram();
+    void Add(int64_t nMicros);
+};
+
+/** Work done by one message handler thread */
+class CMsgHandlerStats
+{
+public:
+    unsigned int nPeers; // in its shard at the last pass
+    uint64_t nMessages;
+    int64_t nBusyMicros; // processing and sending, lock waits included; not sleeping
+
+    CMsgHandlerStats() : nPeers(0), nMessages(0), nBusyMicros(0) {}
+};
+
+/** Global per-command traffic and timing, for getnetstats */
+class CNetTelemetry
+{
+public:
+    mapMsgTypeStats mapRecv;
+    mapMsgTypeStats mapSend;
+    std::map<std::string, CTimingHistogram> mapProcessTime; // ProcessMessage, by command
+    std::map<std::string, CTimingHistogram> mapSendPhaseTime; // SendMessages, by phase
+    std::vector<CMsgHandlerStats> vMsgHandler; // by thread
+    int64_t nMsgHandlerStartMicros;
+
+    CNetTelemetry() : nMsgHandlerStartMicros(0) {}
+};
+
+void RecordMessageProcessTime(const std::string& strCommand, int64_t nMicros);
+/** Charge the time since nPhaseStart to pszPhase and restart the clock */
+void RecordSendPhaseTime(const char* pszPhase, int64_t& nPhaseStart);
+void GetNetTelemetry(CNetTelemetry& telemetry);
+
 class CNodeStats
 {
 public:
@@ -124,32 +197,80 @@ public:
     double dPingTime;
     double dPingWait;
     std::string addrLocal;
+    mapMsgTypeStats mapRecvStats;
+    mapMsgTypeStats mapSendStats;
 };
 
 
+class CNetBufferPoolStats
+{
+public:
+    uint64_t nHits;      // buffers handed out again
+    uint64_t nMisses;    // fresh allocations
+    uint64_t nReturned;  // buffers taken back for reuse
+    uint64_t nDiscarded; // buffers freed because their class was full
+    size_t nCachedBuffers;
+    size_t nCachedBytes;
+};
+
+/**
+ * Recycles the receive buffers of CNetMessage. Every message used to get a
+ * new buffer, grown as data arrived, and freed through the zeroing
+ * allocator once processed. Buffers now go back into size classes when a
+ * message is destroyed and are handed to the next message that fits.
+ */
+class CNetBufferPool
+{
+public:
+    CNetBufferPool();
+
+    /** Give data (which must be empty) room for at least nSize bytes */
+    void Acquire(CSerializeData& data, size_t nSize);
+    /** Take back data's buffer; data is left empty */
+    void Release(CSerializeData& data);
+    CNetBufferPoolStats GetStats() const;
+
+private:
+    static const int NUM_CLASSES = 5;
+    static const size_t vClassSize[NUM_CLASSES];
+    static const size_t vClassMaxBuffers[NUM_CLASSES];
+
+    mutable CCriticalSection cs;
+    std::vector<CSerializeData> vFree[NUM_CLASSES];
+    CNetBufferPoolStats stats;
+};
+
+extern CNetBufferPool netBufferPool;
+
 class CNetMessage
 {
 public:
     bool in_data; // parsing header (false) or data (true)
 
-    CDataStream hdrbuf; // partially received header
-    CMessageHeader hdr; // complete header
+    char hdrbuf[CMessageHeader::HEADER_SIZE]; // partially received header
+    CMessageHeader hdr;                       // complete header
     unsigned int nHdrPos;
 
-    CDataStream vRecv; // received message data
+    CDataStream vRecv; // received message data, buffer from netBufferPool
     unsigned int nDataPos;
 
     int64_t nTime; // time (in microseconds) of message receipt.
 
-    CNetMessage(int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), vRecv(nTypeIn, nVersionIn)
+    CNetMessage(int nTypeIn, int nVersionIn) : vRecv(nTypeIn, nVersionIn)
     {
-        hdrbuf.resize(24);
         in_data = false;
         nHdrPos = 0;
         nDataPos = 0;
         nTime = 0;
     }
 
+    ~CNetMessage()
+    {
+        CSerializeData data;
+        vRecv.SwapBuffer(data);
+        netBufferPool.Release(data);
+    }
+
     bool complete() const
     {
         if (!in_data)
@@ -159,7 +280,6 @@ public:
 
     void SetVersion(int nVersionIn)
     {
-        hdrbuf.SetVersion(nVersionIn);
         vRecv.SetVersion(nVersionIn);
     }
 
@@ -179,7 +299,7 @@ public:
     size_t nSendSize;   // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<CSerializeData> vSendMsg;
+    std::deque<CSharedMessage> vSendMsg;
     CCriticalSection cs_vSend;
 
     std::deque<CInv> vRecvGetData;
@@ -188,6 +308,11 @@ public:
     uint64_t nRecvBytes;
     int nRecvVersion;
 
+    // per-command traffic
+    CCriticalSection cs_msgStats;
+    mapMsgTypeStats mapRecvStats;
+    mapMsgTypeStats mapSendStats;
+
     int64_t nLastSend;
     int64_t nLastRecv;
     int64_t nTimeConnected;
@@ -205,6 +330,7 @@ public:
     bool fDisconnect;
     CSemaphoreGrant grantOutbound;
     int nRefCount;
+    NodeId id;
 
 protected:
     // Denial-of-service detection/prevention
@@ -220,17 +346,20 @@ public:
     int nStartingHeight;
     bool fStartSync;
 
-    // flood relay
+    // flood relay; other peers' message handlers push addresses here
     std::vector<CAddress> vAddrToSend;
-    mruset<CAddress> setAddrKnown;
+    CRollingBloomFilter addrKnown;
+    CCriticalSection cs_vAddrToSend; // guards vAddrToSend and addrKnown
     bool fGetAddr;
     std::set<uint256> setKnown;
 
     // inventory based relay
-    mruset<CInv> setInventoryKnown;
+    CRollingBloomFilter filterInventoryKnown;
     std::vector<CInv> vInventoryToSend;
     CCriticalSection cs_inventory;
     std::multimap<int64_t, CInv> mapAskFor;
+    // compact blocks asked of this peer and not yet received (cs_main)
+    std::set<uint256> setCmpctBlockRequested;
 
     // Ping time measurement:
     // The pong reply we're expecting, or 0 if no pong expected.
@@ -242,7 +371,7 @@ public:
     // Whether a ping is requested.
     bool fPingQueued;
 
-    CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn = "", bool fInboundIn = false) : ssSend(SER_NETWORK, INIT_PROTO_VERSION), setAddrKnown(5000)
+    CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn = "", bool fInboundIn = false) : ssSend(SER_NETWORK, INIT_PROTO_VERSION), addrKnown(5000, 0.001), filterInventoryKnown(SendBufferSize() / 1000, 0.000001)
     {
         nServices = 0;
         hSocket = hSocketIn;
@@ -273,12 +402,16 @@ public:
         fStartSync = false;
         fGetAddr = false;
         nMisbehavior = 0;
-        setInventoryKnown.max_size(SendBufferSize() / 1000);
         nPingNonceSent = 0;
         nPingUsecStart = 0;
         nPingUsecTime = 0;
         fPingQueued = false;
 
+        {
+            LOCK(cs_nLastNodeId);
+            id = nLastNodeId++;
+        }
+
         // Be shy and don't send version until we hear
         if (hSocket != INVALID_SOCKET && !fInbound)
             PushVersion();
@@ -290,9 +423,13 @@ public:
             closesocket(hSocket);
             hSocket = INVALID_SOCKET;
         }
+        GetNodeSignals().FinalizeNode(GetId());
     }
 
 private:
+    static NodeId nLastNodeId;
+    static CCriticalSection cs_nLastNodeId;
+
     // Network usage totals
     static CCriticalSection cs_totalBytesRecv;
     static CCriticalSection cs_totalBytesSent;
@@ -303,6 +440,11 @@ private:
     void operator=(const CNode&);
 
 public:
+    NodeId GetId() const
+    {
+        return id;
+    }
+
     int GetRefCount()
     {
         assert(nRefCount >= 0);
@@ -343,7 +485,8 @@ public:
 
     void AddAddressKnown(const CAddress& addr)
     {
-        setAddrKnown.insert(addr);
+        LOCK(cs_vAddrToSend);
+        addrKnown.insert(addr.GetKey());
     }
 
     void PushAddress(const CAddress& addr)
@@ -351,7 +494,8 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
-        if (addr.IsValid() && !setAddrKnown.count(addr))
+        LOCK(cs_vAddrToSend);
+        if (addr.IsValid() && !addrKnown.contains(addr.GetKey()))
             vAddrToSend.push_back(addr);
     }
 
@@ -360,15 +504,21 @@ public:
     {
         {
             LOCK(cs_inventory);
-            setInventoryKnown.insert(inv);
+            filterInventoryKnown.insert(inv.hash);
         }
     }
 
+    bool IsInventoryKnown(const CInv& inv)
+    {
+        LOCK(cs_inventory);
+        return filterInventoryKnown.contains(inv.hash);
+    }
+
     void PushInventory(const CInv& inv)
     {
         {
             LOCK(cs_inventory);
-            if (!setInventoryKnown.count(inv))
+            if (!filterInventoryKnown.contains(inv.hash))
                 vInventoryToSend.push_back(inv);
         }
     }
@@ -424,28 +574,37 @@ public:
         if (ssSend.size() == 0)
             return;
 
-        // Set the size
         unsigned int nSize = ssSend.size() - CMessageHeader::HEADER_SIZE;
-        memcpy((char*)&ssSend[CMessageHeader::MESSAGE_SIZE_OFFSET], &nSize, sizeof(nSize));
-
-        // Set the checksum
-        uint256 hash = Hash(ssSend.begin() + CMessageHeader::HEADER_SIZE, ssSend.end());
-        unsigned int nChecksum = 0;
-        memcpy(&nChecksum, &hash, sizeof(nChecksum));
-        assert(ssSend.size() >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
-        memcpy((char*)&ssSend[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
+        SetMessageSizeAndChecksum(ssSend);
 
         LogPrint("net", "(%d bytes)\n", nSize);
+        RecordMessageSent(&ssSend[0], ssSend.size());
+
+        boost::shared_ptr<CSerializeData> pmsg(new CSerializeData());
+        ssSend.GetAndClear(*pmsg);
+        QueueMessage(pmsg);
 
-        std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
-        ssSend.GetAndClear(*it);
-        nSendSize += (*it).size();
+        LEAVE_CRITICAL_SECTION(cs_vSend);
+    }
+
+    // requires LOCK(cs_vSend)
+    void QueueMessage(const CSharedMessage& msg)
+    {
+        vSendMsg.push_back(msg);
+        nSendSize += msg->size();
 
         // If write queue empty, attempt "optimistic write"
-        if (it == vSendMsg.begin())
+        if (vSendMsg.size() == 1)
             SocketSendData(this);
+    }
 
-        LEAVE_CRITICAL_SECTION(cs_vSend);
+    /** Queue a message that was serialized once for several peers */
+    void PushMessage(const CSharedMessage& msg)
+    {
+        LOCK(cs_vSend);
+        LogPrint("net", "sending: shared (%u bytes)\n", msg->size() - CMessageHeader::HEADER_SIZE);
+        RecordMessageSent(&(*msg)[0], msg->size());
+        QueueMessage(msg);
     }
 
     void PushVersion();
@@ -606,6 +765,10 @@ public:
     // Network stats
     static void RecordBytesRecv(uint64_t bytes);
     static void RecordBytesSent(uint64_t bytes);
+    /** Count a complete message, by command, for this peer and globally */
+    void RecordMessageRecv(const std::string& strCommand, uint64_t nBytes);
+    /** Same for a queued message; pchHeader points at its serialized header */
+    void RecordMessageSent(const char* pchHeader, uint64_t nBytes);
 
     static uint64_t GetTotalBytesRecv();
     static uint64_t GetTotalBytesSent();
@@ -0,0 +1,191 @@
+// Copyright (c) 2018 The Era developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "orphanpool.h"
+
+#include "util.h"
+
+using namespace std;
+
+COrphanTxPool orphanTxPool;
+
+COrphanTxPool::COrphanTxPool()
+{
+    nBytes = 0;
+    nNextSweep = 0;
+    memset(&stats, 0, sizeof(stats));
+    stats.nMaxBytes = (uint64_t)DEFAULT_MAX_ORPHAN_TX_KB * 1000;
+    stats.nMaxPeerBytes = (uint64_t)DEFAULT_MAX_ORPHAN_TX_PEER_KB * 1000;
+}
+
+void COrphanTxPool::SetLimits(uint64_t nMaxBytesIn, uint64_t nMaxPeerBytesIn)
+{
+    LOCK(cs);
+    stats.nMaxBytes = nMaxBytesIn;
+    stats.nMaxPeerBytes = nMaxPeerBytesIn;
+    LimitSize();
+}
+
+bool COrphanTxPool::Add(const CTransaction& tx, NodeId peer)
+{
+    uint256 hash = tx.GetHash();
+    unsigned int nSize = tx.GetSerializeSize(SER_NETWORK, CTransaction::CURRENT_VERSION);
+    int64_t nNow = GetTime();
+
+    LOCK(cs);
+    if (mapOrphans.count(hash))
+        return false;
+
+    if (nNow >= nNextSweep) {
+        unsigned int nExpired = ExpireOrphans(nNow);
+        if (nExpired > 0)
+            LogPrint("mempool", "expired %u orphan tx\n", nExpired);
+    }
+
+    if (nSize > MAX_ORPHAN_TX_SIZE) {
+        LogPrint("mempool", "ignoring large orphan tx (size: %u, hash: %s)\n", nSize, hash.ToString());
+        stats.nRejectedSize++;
+        return false;
+    }
+
+    CPeerOrphans& peerOrphans = mapPeerOrphans[peer];
+    if (peerOrphans.nBytes + nSize > stats.nMaxPeerBytes) {
+        LogPrint("mempool", "ignoring orphan tx %s, peer=%d is over its orphan quota (%u bytes)\n", hash.ToString(), peer, peerOrphans.nBytes);
+        if (peerOrphans.setHashes.empty())
+            mapPeerOrphans.erase(peer);
+        stats.nRejectedQuota++;
+        return false;
+    }
+    peerOrphans.nBytes += nSize;
+    peerOrphans.setHashes.insert(hash);
+
+    COrphanTx& orphan = mapOrphans[hash];
+    orphan.tx = tx;
+    orphan.fromPeer = peer;
+    orphan.nTimeExpire = nNow + ORPHAN_TX_EXPIRE_TIME;
+    orphan.nSize = nSize;
+    BOOST_FOREACH (const CTxIn& txin, tx.vin)
+        mapOrphansByPrev[txin.prevout.hash].insert(hash);
+    setByExpiry.insert(make_pair(orphan.nTimeExpire, hash));
+    nBytes += nSize;
+    stats.nAdded++;
+
+    unsigned int nEvicted = LimitSize();
+    if (nEvicted > 0)
+        LogPrint("mempool", "orphan pool full, evicted %u tx\n", nEvicted);
+
+    LogPrint("mempool", "stored orphan tx %s (mapsz %u, %u bytes)\n", hash.ToString(), mapOrphans.size(), nBytes);
+    return mapOrphans.count(hash) > 0;
+}
+
+bool COrphanTxPool::Exists(const uint256& hash) const
+{
+    LOCK(cs);
+    return mapOrphans.count(hash) > 0;
+}
+
+bool COrphanTxPool::Erase(const uint256& hash, bool fAccepted)
+{
+    LOCK(cs);
+    mapOrphan_t::iterator it = mapOrphans.find(hash);
+    if (it == mapOrphans.end())
+        return false;
+    EraseOrphan(it);
+    if (fAccepted)
+        stats.nAccepted++;
+    else
+        stats.nRemoved++;
+    return true;
+}
+
+unsigned int COrphanTxPool::EraseForPeer(NodeId peer)
+{
+    LOCK(cs);
+    map<NodeId, CPeerOrphans>::iterator itPeer = mapPeerOrphans.find(peer);
+    if (itPeer == mapPeerOrphans.end())
+        return 0;
+
+    // EraseOrphan drops the peer's entry along with its last orphan
+    vector<uint256> vErase(itPeer->second.setHashes.begin(), itPeer->second.setHashes.end());
+    BOOST_FOREACH (const uint256& hash, vErase)
+        EraseOrphan(mapOrphans.find(hash));
+    stats.nPeerErased += vErase.size();
+    LogPrint("mempool", "erased %u orphan tx from peer=%d\n", vErase.size(), peer);
+    return vErase.size();
+}
+
+void COrphanTxPool::GetChildren(const uint256& hashParent, vector<CTransaction>& vChildrenRet) const
+{
+    LOCK(cs);
+    map<uint256, set<uint256>>::const_iterator itByPrev = mapOrphansByPrev.find(hashParent);
+    if (itByPrev == mapOrphansByPrev.end())
+        return;
+    BOOST_FOREACH (const uint256& hash, itByPrev->second) {
+        mapOrphan_t::const_iterator it = mapOrphans.find(hash);
+        if (it != mapOrphans.end())
+            vChildrenRet.push_back(it->second.tx);
+    }
+}
+
+COrphanTxPoolStats COrphanTxPool::GetStats() const
+{
+    LOCK(cs);
+    COrphanTxPoolStats ret = stats;
+    ret.nOrphans = mapOrphans.size();
+    ret.nBytes = nBytes;
+    ret.nPeers = mapPeerOrphans.size();
+    return ret;
+}
+
+void COrphanTxPool::EraseOrphan(mapOrphan_t::iterator it)
+{
+    const COrphanTx& orphan = it->second;
+    BOOST_FOREACH (const CTxIn& txin, orphan.tx.vin) {
+        map<uint256, set<uint256>>::iterator itPrev = mapOrphansByPrev.find(txin.prevout.hash);
+        if (itPrev == mapOrphansByPrev.end())
+            continue;
+        itPrev->second.erase(it->first);
+        if (itPrev->second.empty())
+            mapOrphansByPrev.erase(itPrev);
+    }
+    setByExpiry.erase(make_pair(orphan.nTimeExpire, it->first));
+
+    map<NodeId, CPeerOrphans>::iterator itPeer = mapPeerOrphans.find(orphan.fromPeer);
+    if (itPeer != mapPeerOrphans.end()) {
+        itPeer->second.nBytes -= orphan.nSize;
+        itPeer->second.setHashes.erase(it->first);
+        if (itPeer->second.setHashes.empty())
+            mapPeerOrphans.erase(itPeer);
+    }
+    nBytes -= orphan.nSize;
+    mapOrphans.erase(it);
+}
+
+unsigned int COrphanTxPool::ExpireOrphans(int64_t nNow)
+{
+    unsigned int nExpired = 0;
+    while (!setByExpiry.empty() && setByExpiry.begin()->first <= nNow) {
+        EraseOrphan(mapOrphans.find(setByExpiry.begin()->second));
+        nExpired++;
+    }
+    stats.nExpired += nExpired;
+
+    // Sweep again once the next orphan is due, but not too often
+    int64_t nNextExpire = setByExpiry.empty() ? nNow + ORPHAN_TX_EXPIRE_TIME : setByExpiry.begin()->first;
+    nNextSweep = max(nNextExpire, nNow + ORPHAN_TX_EXPIRE_INTERVAL);
+    return nExpired;
+}
+
+unsigned int COrphanTxPool::LimitSize()
+{
+    // Oldest first: each peer is held to its quota already, so whatever is
+    // left the longest is the least likely to be resolved
+    unsigned int nEvicted = 0;
+    while (!setByExpiry.empty() && (nBytes > stats.nMaxBytes || mapOrphans.size() > MAX_ORPHAN_TRANSACTIONS)) {
+        EraseOrphan(mapOrphans.find(setByExpiry.begin()->second));
+        nEvicted++;
+    }
+    stats.nEvicted += nEvicted;
+    return nEvicted;
+}
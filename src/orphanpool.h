@@ -0,0 +1,108 @@
+// Copyright (c) 2018 The Era developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef ERA_ORPHANPOOL_H
+#define ERA_ORPHANPOOL_H
+
+#include "main.h"
+
+#include <map>
+#include <set>
+
+/** Larger orphans are not kept; a peer with a legitimate one will announce it again once its parents are known */
+static const unsigned int MAX_ORPHAN_TX_SIZE = 5000;
+/** Most orphans kept, whatever their size */
+static const unsigned int MAX_ORPHAN_TRANSACTIONS = MAX_BLOCK_SIZE / 100;
+/** Default for -maxorphantxkb, serialized bytes kept for all peers together */
+static const unsigned int DEFAULT_MAX_ORPHAN_TX_KB = 5000;
+/** Default for -maxorphantxpeerkb, serialized bytes kept for any one peer */
+static const unsigned int DEFAULT_MAX_ORPHAN_TX_PEER_KB = 500;
+/** Orphans whose parents have not shown up by then are dropped (seconds) */
+static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
+/** Minimum time between sweeps for expired orphans (seconds) */
+static const int64_t ORPHAN_TX_EXPIRE_INTERVAL = 5 * 60;
+
+/** A transaction waiting for a parent, and who sent it */
+class COrphanTx
+{
+public:
+    CTransaction tx;
+    NodeId fromPeer; // -1 when not from a peer
+    int64_t nTimeExpire;
+    unsigned int nSize;
+};
+
+class COrphanTxPoolStats
+{
+public:
+    unsigned int nOrphans;
+    uint64_t nBytes;
+    unsigned int nPeers;
+    uint64_t nMaxBytes;
+    uint64_t nMaxPeerBytes;
+
+    uint64_t nAdded;
+    uint64_t nAccepted;   // parent arrived and the orphan made it into the mempool
+    uint64_t nRemoved;    // parent arrived but the orphan was invalid
+    uint64_t nExpired;
+    uint64_t nEvicted;    // dropped to stay within the byte or count budget
+    uint64_t nPeerErased; // dropped when the sending peer disconnected
+    uint64_t nRejectedSize;
+    uint64_t nRejectedQuota;
+};
+
+/**
+ * Transactions received before their parents. Each orphan is charged to the
+ * peer that sent it: a peer over its byte quota has new orphans refused, and
+ * its orphans go when it disconnects. Past the overall budget the oldest
+ * orphans are evicted first, and anything not resolved within
+ * ORPHAN_TX_EXPIRE_TIME expires.
+ *
+ * Orphans are indexed by the txid of every parent, so when a transaction is
+ * accepted only its own children are looked at.
+ */
+class COrphanTxPool
+{
+public:
+    COrphanTxPool();
+
+    void SetLimits(uint64_t nMaxBytesIn, uint64_t nMaxPeerBytesIn);
+
+    /** Store tx until a parent arrives; false if it is already here or refused */
+    bool Add(const CTransaction& tx, NodeId peer);
+    bool Exists(const uint256& hash) const;
+    /** Forget an orphan that was just accepted (fAccepted) or found invalid */
+    bool Erase(const uint256& hash, bool fAccepted);
+    /** Forget everything a disconnected peer sent; returns the number erased */
+    unsigned int EraseForPeer(NodeId peer);
+    /** Orphans that spend an output of hashParent */
+    void GetChildren(const uint256& hashParent, std::vector<CTransaction>& vChildrenRet) const;
+
+    COrphanTxPoolStats GetStats() const;
+
+private:
+    typedef std::map<uint256, COrphanTx> mapOrphan_t;
+    struct CPeerOrphans {
+        uint64_t nBytes;
+        std::set<uint256> setHashes;
+        CPeerOrphans() : nBytes(0) {}
+    };
+
+    mutable CCriticalSection cs;
+    mapOrphan_t mapOrphans;
+    std::map<uint256, std::set<uint256>> mapOrphansByPrev;
+    std::set<std::pair<int64_t, uint256>> setByExpiry;
+    std::map<NodeId, CPeerOrphans> mapPeerOrphans;
+    uint64_t nBytes;
+    int64_t nNextSweep;
+    COrphanTxPoolStats stats;
+
+    // requires cs
+    void EraseOrphan(mapOrphan_t::iterator it);
+    unsigned int ExpireOrphans(int64_t nNow);
+    unsigned int LimitSize();
+};
+
+extern COrphanTxPool orphanTxPool;
+
+#endif // ERA_ORPHANPOOL_H
@@ -76,17 +76,17 @@ public:
     /** Number of confirmation recommended for accepting a transaction */
     static const int RecommendedNumConfirmations = 10;
 
-    TransactionRecord() : hash(), time(0), type(Other), address(""), debit(0), credit(0), idx(0)
+    TransactionRecord() : hash(), time(0), type(Other), address(""), debit(0), credit(0), idx(0), labelGeneration(-1)
     {
     }
 
     TransactionRecord(uint256 hash, int64_t time) : hash(hash), time(time), type(Other), address(""), debit(0),
-                                                    credit(0), idx(0)
+                                                    credit(0), idx(0), labelGeneration(-1)
     {
     }
 
     TransactionRecord(uint256 hash, int64_t time, Type type, const std::string& address, int64_t debit, int64_t credit) : hash(hash), time(time), type(type), address(address), debit(debit), credit(credit),
-                                                                                                                          idx(0)
+                                                                                                                          idx(0), labelGeneration(-1)
     {
     }
 
@@ -111,6 +111,11 @@ public:
     /** Status: can change with block chain update */
     TransactionStatus status;
 
+    /** Address book label of address, looked up when first shown and kept
+        until the model's label generation moves on */
+    mutable QString label;
+    mutable int labelGeneration;
+
     /** Return the unique identifier for this transaction (part) */
     QString getTxID() const;
 
@@ -17,6 +17,12 @@
 #include <QDebug>
 #include <QIcon>
 #include <QList>
+#include <QThread>
+
+#include <set>
+
+// Wallet transactions decomposed per lock acquisition while loading
+static const unsigned int LOAD_BATCH_SIZE = 250;
 
 // Amount column is right-aligned it contains numbers
 static int column_alignments[] = {
@@ -42,12 +48,67 @@ struct TxLessThan {
     }
 };
 
+/** Decomposes the wallet's transactions on a worker thread, a batch per
+ * lock acquisition, so opening a large wallet stalls neither the GUI nor
+ * block processing.
+ */
+class TransactionTableLoader : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit TransactionTableLoader(CWallet* wallet) : wallet(wallet), fStop(0) {}
+
+    /* Ask a running load() to return after the current batch; any thread */
+    void stop() { fStop.fetchAndStoreOrdered(1); }
+
+public slots:
+    void load();
+
+signals:
+    void batchLoaded(const QList<TransactionRecord>& records, bool fDone);
+
+private:
+    CWallet* wallet;
+    QAtomicInt fStop;
+};
+
+#include "transactiontablemodel.moc"
+
+void TransactionTableLoader::load()
+{
+    // mapWallet is keyed by hash, so batches come out in the model's order
+    std::vector<uint256> vHashes;
+    {
+        LOCK(wallet->cs_wallet);
+        vHashes.reserve(wallet->mapWallet.size());
+        for (std::map<uint256, CWalletTx>::iterator it = wallet->mapWallet.begin(); it != wallet->mapWallet.end(); ++it)
+            vHashes.push_back(it->first);
+    }
+    qDebug() << "TransactionTableLoader::load : " + QString::number(vHashes.size()) + " transactions";
+
+    size_t i = 0;
+    do {
+        QList<TransactionRecord> batch;
+        {
+            LOCK2(cs_main, wallet->cs_wallet);
+            for (unsigned int n = 0; n < LOAD_BATCH_SIZE && i < vHashes.size(); n++, i++) {
+                std::map<uint256, CWalletTx>::iterator mi = wallet->mapWallet.find(vHashes[i]);
+                if (mi != wallet->mapWallet.end() && TransactionRecord::showTransaction(mi->second))
+                    batch.append(TransactionRecord::decomposeTransaction(wallet, mi->second));
+            }
+        }
+        emit batchLoaded(batch, i >= vHashes.size());
+    } while (i < vHashes.size() && fStop.fetchAndAddOrdered(0) == 0);
+}
+
 // Private implementation
 class TransactionTablePriv
 {
 public:
     TransactionTablePriv(CWallet* wallet, TransactionTableModel* parent) : wallet(wallet),
-                                                                           parent(parent)
+                                                                           parent(parent),
+                                                                           fLoading(true)
     {
     }
 
@@ -60,19 +121,45 @@ public:
      */
     QList<TransactionRecord> cachedWallet;
 
-    /* Query entire wallet anew from core.
+    /* Whether the loader is still filling cachedWallet, and the transactions
+     * removed in the meantime, which a batch decomposed earlier may still carry.
+     */
+    bool fLoading;
+    std::set<uint256> setDeletedWhileLoading;
+
+    /* Merge a batch from the loader. Records already put in place by
+     * updateWallet are kept; consecutive records that land at the same
+     * position go in with a single insert notification.
      */
-    void refreshWallet()
+    void insertBatch(const QList<TransactionRecord>& batch)
     {
-        qDebug() << "TransactionTablePriv::refreshWallet";
-        cachedWallet.clear();
-        {
-            LOCK2(cs_main, wallet->cs_wallet);
-            for (std::map<uint256, CWalletTx>::iterator it = wallet->mapWallet.begin(); it != wallet->mapWallet.end(); ++it) {
-                if (TransactionRecord::showTransaction(it->second))
-                    cachedWallet.append(TransactionRecord::decomposeTransaction(wallet, it->second));
+        QList<TransactionRecord> run;
+        int runIndex = -1;
+        for (int i = 0; i < batch.size(); i++) {
+            const TransactionRecord& rec = batch[i];
+            int idx = qLowerBound(cachedWallet.begin(), cachedWallet.end(), rec.hash, TxLessThan()) - cachedWallet.begin();
+            bool inModel = idx < cachedWallet.size() && cachedWallet[idx].hash == rec.hash;
+            if (!run.isEmpty() && (inModel || idx != runIndex)) {
+                flushRun(run, runIndex);
+                idx = qLowerBound(cachedWallet.begin(), cachedWallet.end(), rec.hash, TxLessThan()) - cachedWallet.begin();
+                inModel = idx < cachedWallet.size() && cachedWallet[idx].hash == rec.hash;
             }
+            if (inModel || setDeletedWhileLoading.count(rec.hash))
+                continue;
+            runIndex = idx;
+            run.append(rec);
         }
+        if (!run.isEmpty())
+            flushRun(run, runIndex);
+    }
+
+    void flushRun(QList<TransactionRecord>& run, int runIndex)
+    {
+        parent->beginInsertRows(QModelIndex(), runIndex, runIndex + run.size() - 1);
+        for (int k = 0; k < run.size(); k++)
+            cachedWallet.insert(runIndex + k, run[k]);
+        parent->endInsertRows();
+        run.clear();
     }
 
     /* Update our model of the wallet incrementally, to synchronize our model of the wallet
@@ -141,7 +228,10 @@ public:
                 break;
             case CT_DELETED:
                 if (!inModel) {
-                    qDebug() << "TransactionTablePriv::updateWallet : Warning: Got CT_DELETED, but transaction is not in model";
+                    if (fLoading)
+                        setDeletedWhileLoading.insert(hash);
+                    else
+                        qDebug() << "TransactionTablePriv::updateWallet : Warning: Got CT_DELETED, but transaction is not in model";
                     break;
                 }
                 // Removed -- remove entire transaction from table
@@ -207,20 +297,45 @@ public:
 TransactionTableModel::TransactionTableModel(CWallet* wallet, WalletModel* parent) : QAbstractTableModel(parent),
                                                                                      wallet(wallet),
                                                                                      walletModel(parent),
-                                                                                     priv(new TransactionTablePriv(wallet, this))
+                                                                                     priv(new TransactionTablePriv(wallet, this)),
+                                                                                     labelGeneration(0)
 {
     columns << QString() << tr("Date") << tr("Type") << tr("Address") << tr("Amount");
 
-    priv->refreshWallet();
+    // Fill the table from a worker thread; rows appear as batches arrive
+    qRegisterMetaType<QList<TransactionRecord>>("QList<TransactionRecord>");
+    loaderThread = new QThread;
+    loader = new TransactionTableLoader(wallet);
+    loader->moveToThread(loaderThread);
+    connect(loaderThread, SIGNAL(started()), loader, SLOT(load()));
+    connect(loader, SIGNAL(batchLoaded(QList<TransactionRecord>, bool)), this, SLOT(insertTransactions(QList<TransactionRecord>, bool)));
+    loaderThread->start();
 
     connect(walletModel->getOptionsModel(), SIGNAL(displayUnitChanged(int)), this, SLOT(updateDisplayUnit()));
 }
 
 TransactionTableModel::~TransactionTableModel()
 {
+    // Let the loader finish its batch; batches still queued for this object
+    // are dropped with it
+    loader->stop();
+    loaderThread->quit();
+    loaderThread->wait();
+    delete loader;
+    delete loaderThread;
     delete priv;
 }
 
+void TransactionTableModel::insertTransactions(const QList<TransactionRecord>& records, bool fDone)
+{
+    priv->insertBatch(records);
+    if (fDone) {
+        qDebug() << "TransactionTableModel::insertTransactions : loaded " + QString::number(priv->size()) + " records";
+        priv->fLoading = false;
+        priv->setDeletedWhileLoading.clear();
+    }
+}
+
 void TransactionTableModel::updateTransaction(const QString& hash, int status)
 {
     uint256 updated;
@@ -300,18 +415,30 @@ QString TransactionTableModel::formatTxDate(const TransactionRecord* wtx) const
     }
 }
 
+/* Address book label of the record's address, cached in the record until
+   the address book changes
+ */
+QString TransactionTableModel::labelForRecord(const TransactionRecord* wtx) const
+{
+    if (wtx->labelGeneration != labelGeneration) {
+        wtx->label = walletModel->getAddressTableModel()->labelForAddress(QString::fromStdString(wtx->address));
+        wtx->labelGeneration = labelGeneration;
+    }
+    return wtx->label;
+}
+
 /* Look up address in address book, if found return label (address)
    otherwise just return (address)
  */
-QString TransactionTableModel::lookupAddress(const std::string& address, bool tooltip) const
+QString TransactionTableModel::lookupAddress(const TransactionRecord* wtx, bool tooltip) const
 {
-    QString label = walletModel->getAddressTableModel()->labelForAddress(QString::fromStdString(address));
+    QString label = labelForRecord(wtx);
     QString description;
     if (!label.isEmpty()) {
         description += label + QString(" ");
     }
     if (label.isEmpty() || tooltip) {
-        description += QString("(") + QString::fromStdString(address) + QString(")");
+        description += QString("(") + QString::fromStdString(wtx->address) + QString(")");
     }
     return description;
 }
@@ -360,7 +487,7 @@ QString TransactionTableModel::formatTxToAddress(const TransactionRecord* wtx, b
     case TransactionRecord::RecvWithAddress:
     case TransactionRecord::SendToAddress:
     case TransactionRecord::Generated:
-        return lookupAddress(wtx->address, tooltip);
+        return lookupAddress(wtx, tooltip);
     case TransactionRecord::SendToOther:
         return QString::fromStdString(wtx->address);
     case TransactionRecord::SendToSelf:
@@ -376,8 +503,7 @@ QVariant TransactionTableModel::addressColor(const TransactionRecord* wtx) const
     case TransactionRecord::RecvWithAddress:
     case TransactionRecord::SendToAddress:
     case TransactionRecord::Generated: {
-        QString label = walletModel->getAddressTableModel()->labelForAddress(QString::fromStdString(wtx->address));
-        if (label.isEmpty())
+        if (labelForRecord(wtx).isEmpty())
             return COLOR_BAREADDRESS;
     } break;
     case TransactionRecord::SendToSelf:
@@ -513,7 +639,7 @@ QVariant TransactionTableModel::data(const QModelIndex& index, int role) const
     case AddressRole:
         return QString::fromStdString(rec->address);
     case LabelRole:
-        return walletModel->getAddressTableModel()->labelForAddress(QString::fromStdString(rec->address));
+        return labelForRecord(rec);
     case AmountRole:
         return rec->credit + rec->debit;
     case TxIDRole:
@@ -569,3 +695,10 @@ void TransactionTableModel::updateDisplayUnit()
     // emit dataChanged to update Amount column with the current unit
     emit dataChanged(index(0, Amount), index(priv->size() - 1, Amount));
 }
+
+void TransactionTableModel::updateAddressLabels()
+{
+    // Labels are looked up again as rows are shown
+    labelGeneration++;
+    emit dataChanged(index(0, ToAddress), index(priv->size() - 1, ToAddress));
+}
@@ -2,13 +2,19 @@
 #define TRANSACTIONTABLEMODEL_H
 
 #include <QAbstractTableModel>
+#include <QList>
 #include <QStringList>
 
 class CWallet;
+class TransactionTableLoader;
 class TransactionTablePriv;
 class TransactionRecord;
 class WalletModel;
 
+QT_BEGIN_NAMESPACE
+class QThread;
+QT_END_NAMESPACE
+
 /** UI model for the transaction table of a wallet.
  */
 class TransactionTableModel : public QAbstractTableModel
@@ -64,8 +70,13 @@ private:
     WalletModel* walletModel;
     QStringList columns;
     TransactionTablePriv* priv;
+    QThread* loaderThread;
+    TransactionTableLoader* loader;
+    // Bumped on address book changes to invalidate the labels cached in records
+    int labelGeneration;
 
-    QString lookupAddress(const std::string& address, bool tooltip) const;
+    QString labelForRecord(const TransactionRecord* wtx) const;
+    QString lookupAddress(const TransactionRecord* wtx, bool tooltip) const;
     QVariant addressColor(const TransactionRecord* wtx) const;
     QString formatTxStatus(const TransactionRecord* wtx) const;
     QString formatTxDate(const TransactionRecord* wtx) const;
@@ -80,6 +91,9 @@ public slots:
     void updateTransaction(const QString& hash, int status);
     void updateConfirmations();
     void updateDisplayUnit();
+    void updateAddressLabels();
+    /* Batch of records from the background loader */
+    void insertTransactions(const QList<TransactionRecord>& records, bool fDone);
 
     friend class TransactionTablePriv;
 };
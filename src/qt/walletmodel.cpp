@@ -17,19 +17,16 @@ WalletModel::WalletModel(CWallet* wallet, OptionsModel* optionsModel, QObject* p
                                                                                          transactionTableModel(0),
                                                                                          cachedBalance(0), cachedStake(0), cachedUnconfirmedBalance(0), cachedImmatureBalance(0),
                                                                                          cachedEncryptionStatus(Unencrypted),
-                                                                                         cachedNumBlocks(0)
+                                                                                         cachedNumBlocks(0),
+                                                                                         balanceCheckQueued(0), nLastBalanceCheck(0)
 {
-    fForceCheckBalanceChanged = false;
-
     addressTableModel = new AddressTableModel(wallet, this);
     transactionTableModel = new TransactionTableModel(wallet, this);
 
-    // This timer will be fired repeatedly to update the balance
-    pollTimer = new QTimer(this);
-    connect(pollTimer, SIGNAL(timeout()), this, SLOT(pollBalanceChanged()));
-    pollTimer->start(MODEL_UPDATE_DELAY);
-
+    // Balances are checked when the chain tip or a wallet transaction
+    // changes instead of on a timer
     subscribeToCoreSignals();
+    requestBalanceCheck();
 }
 
 WalletModel::~WalletModel()
@@ -75,25 +72,43 @@ void WalletModel::updateStatus()
         emit encryptionStatusChanged(newEncryptionStatus);
 }
 
+void WalletModel::requestBalanceCheck()
+{
+    if (balanceCheckQueued.testAndSetOrdered(0, 1))
+        QMetaObject::invokeMethod(this, "pollBalanceChanged", Qt::QueuedConnection);
+}
+
 void WalletModel::pollBalanceChanged()
 {
-    // Get required locks upfront. This avoids the GUI from getting stuck on
-    // periodical polls if the core is holding the locks for a longer time -
-    // for example, during a wallet rescan.
+    // At most one check per MODEL_UPDATE_DELAY; notifications in between
+    // are folded into the deferred one
+    int64_t nWait = nLastBalanceCheck + MODEL_UPDATE_DELAY - GetTimeMillis();
+    if (nWait > 0) {
+        QTimer::singleShot((int)nWait, this, SLOT(pollBalanceChanged()));
+        return;
+    }
+
+    // Get required locks upfront. This avoids the GUI from getting stuck
+    // if the core is holding the locks for a longer time - for example,
+    // during a wallet rescan. Try again shortly instead.
     TRY_LOCK(cs_main, lockMain);
-    if (!lockMain)
+    if (!lockMain) {
+        QTimer::singleShot(MODEL_UPDATE_DELAY, this, SLOT(pollBalanceChanged()));
         return;
+    }
     TRY_LOCK(wallet->cs_wallet, lockWallet);
-    if (!lockWallet)
+    if (!lockWallet) {
+        QTimer::singleShot(MODEL_UPDATE_DELAY, this, SLOT(pollBalanceChanged()));
         return;
+    }
 
-    if (fForceCheckBalanceChanged || nBestHeight != cachedNumBlocks) {
-        fForceCheckBalanceChanged = false;
+    // Changes from here on need a check of their own
+    balanceCheckQueued.fetchAndStoreOrdered(0);
+    nLastBalanceCheck = GetTimeMillis();
 
-        // Balance and number of transactions might have changed
+    checkBalanceChanged();
+    if (nBestHeight != cachedNumBlocks) {
         cachedNumBlocks = nBestHeight;
-
-        checkBalanceChanged();
         if (transactionTableModel)
             transactionTableModel->updateConfirmations();
     }
@@ -121,13 +136,15 @@ void WalletModel::updateTransaction(const QString& hash, int status)
         transactionTableModel->updateTransaction(hash, status);
 
     // Balance and number of transactions might have changed
-    fForceCheckBalanceChanged = true;
+    requestBalanceCheck();
 }
 
 void WalletModel::updateAddressBook(const QString& address, const QString& label, bool isMine, int status)
 {
     if (addressTableModel)
         addressTableModel->updateEntry(address, label, isMine, status);
+    if (transactionTableModel)
+        transactionTableModel->updateAddressLabels();
 }
 
 bool WalletModel::validateAddress(const QString& address)
@@ -310,6 +327,12 @@ static void NotifyAddressBookChanged(WalletModel* walletmodel, CWallet* wallet,
                               Q_ARG(int, status));
 }
 
+static void NotifyBlockTip(WalletModel* walletmodel, int nHeight)
+{
+    // Called with cs_main held; the check itself runs on the GUI thread
+    walletmodel->requestBalanceCheck();
+}
+
 static void NotifyTransactionChanged(WalletModel* walletmodel, CWallet* wallet, const uint256& hash, ChangeType status)
 {
     QString strHash = QString::fromStdString(hash.GetHex());
@@ -326,6 +349,7 @@ void WalletModel::subscribeToCoreSignals()
     wallet->NotifyStatusChanged.connect(boost::bind(&NotifyKeyStoreStatusChanged, this, boost::placeholders::_1));
     wallet->NotifyAddressBookChanged.connect(boost::bind(NotifyAddressBookChanged, this, boost::placeholders::_1, boost::placeholders::_2, boost::placeholders::_3, boost::placeholders::_4, boost::placeholders::_5));
     wallet->NotifyTransactionChanged.connect(boost::bind(NotifyTransactionChanged, this, boost::placeholders::_1, boost::placeholders::_2, boost::placeholders::_3));
+    uiInterface.NotifyBlockTip.connect(boost::bind(NotifyBlockTip, this, boost::placeholders::_1));
 }
 
 void WalletModel::unsubscribeFromCoreSignals()
@@ -334,6 +358,7 @@ void WalletModel::unsubscribeFromCoreSignals()
     wallet->NotifyStatusChanged.disconnect(boost::bind(&NotifyKeyStoreStatusChanged, this, boost::placeholders::_1));
     wallet->NotifyAddressBookChanged.disconnect(boost::bind(NotifyAddressBookChanged, this, boost::placeholders::_1, boost::placeholders::_2, boost::placeholders::_3, boost::placeholders::_4, boost::placeholders::_5));
     wallet->NotifyTransactionChanged.disconnect(boost::bind(NotifyTransactionChanged, this, boost::placeholders::_1, boost::placeholders::_2, boost::placeholders::_3));
+    uiInterface.NotifyBlockTip.disconnect(boost::bind(NotifyBlockTip, this, boost::placeholders::_1));
 }
 
 // WalletModel::UnlockContext implementation
@@ -1,6 +1,7 @@
 #ifndef WALLETMODEL_H
 #define WALLETMODEL_H
 
+#include <QAtomicInt>
 #include <QObject>
 #include <map>
 #include <vector>
@@ -18,10 +19,6 @@ class COutPoint;
 class uint256;
 class CCoinControl;
 
-QT_BEGIN_NAMESPACE
-class QTimer;
-QT_END_NAMESPACE
-
 class SendCoinsRecipient
 {
 public:
@@ -127,9 +124,11 @@ public:
     void unlockCoin(COutPoint& output);
     void listLockedCoins(std::vector<COutPoint>& vOutpts);
 
+    // Queue a balance check on the GUI thread unless one is pending; any thread
+    void requestBalanceCheck();
+
 private:
     CWallet* wallet;
-    bool fForceCheckBalanceChanged;
 
     // Wallet has an options model for wallet-specific options
     // (transaction fee, for example)
@@ -146,7 +145,10 @@ private:
     EncryptionStatus cachedEncryptionStatus;
     int cachedNumBlocks;
 
-    QTimer* pollTimer;
+    // Set while a balance check is queued, so bursts of notifications
+    // (initial download, rescans) collapse into one
+    QAtomicInt balanceCheckQueued;
+    int64_t nLastBalanceCheck;
 
     void subscribeToCoreSignals();
     void unsubscribeFromCoreSignals();
@@ -6,7 +6,10 @@
 #include "checkpoints.h"
 #include "kernel.h"
 #include "main.h"
+#include "orphanpool.h"
 #include "rpcserver.h"
+#include "txdb.h"
+#include "txvalidation.h"
 
 using namespace json_spirit;
 using namespace std;
@@ -101,32 +104,39 @@ Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool fPri
 {
     Object result;
     result.push_back(Pair("hash", block.GetHash().GetHex()));
-    int confirmations = -1;
-    // Only report confirmations if the block is on the main chain
-    if (blockindex->IsInMainChain())
-        confirmations = nBestHeight - blockindex->nHeight + 1;
-    result.push_back(Pair("confirmations", confirmations));
-    result.push_back(Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION)));
-    result.push_back(Pair("height", blockindex->nHeight));
-    result.push_back(Pair("version", block.nVersion));
-    result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
-    result.push_back(Pair("mint", ValueFromAmount(blockindex->nMint)));
-    result.push_back(Pair("time", (int64_t)block.GetBlockTime()));
-    result.push_back(Pair("nonce", (uint64_t)block.nNonce));
-    result.push_back(Pair("bits", strprintf("%08x", block.nBits)));
-    result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
-    result.push_back(Pair("blocktrust", leftTrim(blockindex->GetBlockTrust().GetHex(), '0')));
-    result.push_back(Pair("chaintrust", leftTrim(blockindex->nChainTrust.GetHex(), '0')));
-    if (blockindex->pprev)
-        result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
-    if (blockindex->pnext)
-        result.push_back(Pair("nextblockhash", blockindex->pnext->GetBlockHash().GetHex()));
-
-    result.push_back(Pair("flags", strprintf("%s%s", blockindex->IsProofOfStake() ? "proof-of-stake" : "proof-of-work", blockindex->GeneratedStakeModifier() ? " stake-modifier" : "")));
-    result.push_back(Pair("proofhash", blockindex->hashProof.GetHex()));
-    result.push_back(Pair("entropybit", (int)blockindex->GetStakeEntropyBit()));
-    result.push_back(Pair("modifier", strprintf("%016x", blockindex->nStakeModifier)));
-    result.push_back(Pair("modifierv2", blockindex->bnStakeModifierV2.GetHex()));
+
+    // Chain state is only needed for the header fields; the transactions
+    // are encoded without cs_main.
+    {
+        LOCK(cs_main);
+        int confirmations = -1;
+        // Only report confirmations if the block is on the main chain
+        if (blockindex->IsInMainChain())
+            confirmations = nBestHeight - blockindex->nHeight + 1;
+        result.push_back(Pair("confirmations", confirmations));
+        result.push_back(Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION)));
+        result.push_back(Pair("height", blockindex->nHeight));
+        result.push_back(Pair("version", block.nVersion));
+        result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
+        result.push_back(Pair("mint", ValueFromAmount(blockindex->nMint)));
+        result.push_back(Pair("time", (int64_t)block.GetBlockTime()));
+        result.push_back(Pair("nonce", (uint64_t)block.nNonce));
+        result.push_back(Pair("bits", strprintf("%08x", block.nBits)));
+        result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
+        result.push_back(Pair("blocktrust", leftTrim(blockindex->GetBlockTrust().GetHex(), '0')));
+        result.push_back(Pair("chaintrust", leftTrim(blockindex->nChainTrust.GetHex(), '0')));
+        if (blockindex->pprev)
+            result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
+        if (blockindex->pnext)
+            result.push_back(Pair("nextblockhash", blockindex->pnext->GetBlockHash().GetHex()));
+
+        result.push_back(Pair("flags", strprintf("%s%s", blockindex->IsProofOfStake() ? "proof-of-stake" : "proof-of-work", blockindex->GeneratedStakeModifier() ? " stake-modifier" : "")));
+        result.push_back(Pair("proofhash", blockindex->hashProof.GetHex()));
+        result.push_back(Pair("entropybit", (int)blockindex->GetStakeEntropyBit()));
+        result.push_back(Pair("modifier", strprintf("%016x", blockindex->nStakeModifier)));
+        result.push_back(Pair("modifierv2", blockindex->bnStakeModifierV2.GetHex()));
+    }
+
     Array txinfo;
     BOOST_FOREACH (const CTransaction& tx, block.vtx) {
         if (fPrintTransactionDetail) {
@@ -200,6 +210,52 @@ Value getrawmempool(const Array& params, bool fHelp)
     return a;
 }
 
+Value gettxqueueinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "gettxqueueinfo\n"
+            "Returns the state of the queue relayed transactions wait in before entering the memory pool.");
+
+    CTxValidationStats stats = txValidationQueue.GetStats();
+
+    Object obj;
+    obj.push_back(Pair("queued", (int)stats.nQueued));
+    obj.push_back(Pair("validating", (int)stats.nInFlight));
+    obj.push_back(Pair("processed", (int64_t)stats.nProcessed));
+    obj.push_back(Pair("accepted", (int64_t)stats.nAccepted));
+    obj.push_back(Pair("dropped", (int64_t)stats.nDropped));
+    obj.push_back(Pair("avglatencyms", stats.dAvgLatencyMs));
+    obj.push_back(Pair("maxlatencyms", stats.dMaxLatencyMs));
+    return obj;
+}
+
+Value getorphaninfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getorphaninfo\n"
+            "Returns the state of the pool of transactions waiting for their parents.");
+
+    COrphanTxPoolStats stats = orphanTxPool.GetStats();
+
+    Object obj;
+    obj.push_back(Pair("size", (int)stats.nOrphans));
+    obj.push_back(Pair("bytes", (int64_t)stats.nBytes));
+    obj.push_back(Pair("maxbytes", (int64_t)stats.nMaxBytes));
+    obj.push_back(Pair("peers", (int)stats.nPeers));
+    obj.push_back(Pair("maxpeerbytes", (int64_t)stats.nMaxPeerBytes));
+    obj.push_back(Pair("added", (int64_t)stats.nAdded));
+    obj.push_back(Pair("accepted", (int64_t)stats.nAccepted));
+    obj.push_back(Pair("removed", (int64_t)stats.nRemoved));
+    obj.push_back(Pair("expired", (int64_t)stats.nExpired));
+    obj.push_back(Pair("evicted", (int64_t)stats.nEvicted));
+    obj.push_back(Pair("peererased", (int64_t)stats.nPeerErased));
+    obj.push_back(Pair("rejectedsize", (int64_t)stats.nRejectedSize));
+    obj.push_back(Pair("rejectedquota", (int64_t)stats.nRejectedQuota));
+    return obj;
+}
+
 Value getblockhash(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -226,11 +282,18 @@ Value getblock(const Array& params, bool fHelp)
     std::string strHash = params[0].get_str();
     uint256 hash(strHash);
 
-    if (mapBlockIndex.count(hash) == 0)
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+    CBlockIndex* pblockindex;
+    {
+        LOCK(cs_main);
+        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+        if (mi == mapBlockIndex.end())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+        pblockindex = mi->second;
+    }
 
+    // Index entries are never freed and their disk position never changes,
+    // so the block is read without holding cs_main.
     CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
     block.ReadFromDisk(pblockindex, true);
 
     return blockToJSON(block, pblockindex, params.size() > 1 ? params[1].get_bool() : false);
@@ -245,17 +308,19 @@ Value getblockbynumber(const Array& params, bool fHelp)
             "Returns details of a block with given block-number.");
 
     int nHeight = params[0].get_int();
-    if (nHeight < 0 || nHeight > nBestHeight)
-        throw runtime_error("Block number out of range.");
 
-    CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hashBestChain];
-    while (pblockindex->nHeight > nHeight)
-        pblockindex = pblockindex->pprev;
+    CBlockIndex* pblockindex;
+    {
+        LOCK(cs_main);
+        if (nHeight < 0 || nHeight > nBestHeight)
+            throw runtime_error("Block number out of range.");
 
-    uint256 hash = *pblockindex->phashBlock;
+        pblockindex = pindexBest;
+        while (pblockindex->nHeight > nHeight)
+            pblockindex = pblockindex->pprev;
+    }
 
-    pblockindex = mapBlockIndex[hash];
+    CBlock block;
     block.ReadFromDisk(pblockindex, true);
 
     return blockToJSON(block, pblockindex, params.size() > 1 ? params[1].get_bool() : false);
@@ -280,3 +345,36 @@ Value getcheckpoint(const Array& params, bool fHelp)
 
     return result;
 }
+
+Value getdbstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getdbstats\n"
+            "Returns the tuning profile and internal statistics of the block index database.\n");
+
+    leveldb::Options options;
+    string strProfile = GetTxDBTuning(options);
+
+    Object result;
+    result.push_back(Pair("profile", strProfile));
+    result.push_back(Pair("writebuffer", (int64_t)options.write_buffer_size));
+    result.push_back(Pair("l0compactiontrigger", options.l0_compaction_trigger));
+    result.push_back(Pair("l0slowdowntrigger", options.l0_slowdown_writes_trigger));
+    result.push_back(Pair("l0stoptrigger", options.l0_stop_writes_trigger));
+    result.push_back(Pair("blocksize", (int64_t)options.block_size));
+    result.push_back(Pair("maxopenfiles", options.max_open_files));
+
+    CTxDB txdb("r");
+    string strValue;
+    Array files;
+    for (int nLevel = 0; txdb.GetProperty(strprintf("leveldb.num-files-at-level%d", nLevel), strValue); nLevel++)
+        files.push_back(atoi(strValue));
+    result.push_back(Pair("filesperlevel", files));
+    if (txdb.GetProperty("leveldb.stats", strValue))
+        result.push_back(Pair("stats", strValue));
+    if (txdb.GetProperty("leveldb.writestalls", strValue))
+        result.push_back(Pair("writestalls", strValue));
+
+    return result;
+}
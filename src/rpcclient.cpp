@@ -112,6 +112,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     {
         {"stop", 0},
         {"getaddednodeinfo", 0},
+        {"getnetstats", 0},
         {"setgenerate", 0},
         {"setgenerate", 1},
         {"sendtoaddress", 1},
@@ -143,6 +144,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
         {"sendmany", 2},
         {"reservebalance", 0},
         {"reservebalance", 1},
+        {"getstakeplan", 0},
         {"addmultisigaddress", 0},
         {"addmultisigaddress", 1},
         {"listunspent", 0},
@@ -155,9 +157,13 @@ static const CRPCConvertParam vRPCConvertParams[] =
         {"signrawtransaction", 2},
         {"keypoolrefill", 0},
         {"importprivkey", 2},
+        {"rescanblockchain", 0},
+        {"rescanblockchain", 1},
         {"checkkernel", 0},
         {"checkkernel", 1},
         {"submitblock", 1},
+        {"generate", 0},
+        {"setmocktime", 0},
 };
 
 class CRPCConvertTable
@@ -134,7 +134,6 @@ Value importprivkey(const Array& params, bool fHelp)
     {
         LOCK2(cs_main, pwalletMain->cs_wallet);
 
-        pwalletMain->MarkDirty();
         pwalletMain->SetAddressBookName(vchAddress, strLabel);
 
         // Don't throw error in case a key is already there
@@ -146,13 +145,20 @@ Value importprivkey(const Array& params, bool fHelp)
         if (!pwalletMain->AddKeyPubKey(key, pubkey))
             throw JSONRPCError(RPC_WALLET_ERROR, "Error adding key to wallet");
 
+        // Rebuild the coin index now that the key counts as ours, so outputs
+        // of transactions already in the wallet are picked up without a rescan
+        pwalletMain->MarkDirty();
+
         // whenever a key is imported, we need to scan the whole chain
         pwalletMain->nTimeFirstKey = 1; // 0 would be considered 'no value'
+    }
 
-        if (fRescan) {
-            pwalletMain->ScanForWalletTransactions(pindexGenesisBlock, true);
-            pwalletMain->ReacceptWalletTransactions();
-        }
+    // The rescan takes cs_main and cs_wallet per batch of blocks, so the
+    // node keeps running while it is in progress
+    if (fRescan) {
+        if (pwalletMain->ScanForWalletTransactions(pindexGenesisBlock, true) < 0)
+            throw JSONRPCError(RPC_MISC_ERROR, "Key imported, but the rescan was aborted; use rescanblockchain");
+        pwalletMain->ReacceptWalletTransactions();
     }
 
     return Value::null;
@@ -172,75 +178,160 @@ Value importwallet(const Array& params, bool fHelp)
     if (!file.is_open())
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot open wallet dump file");
 
-    int64_t nTimeBegin = pindexBest->nTime;
-
+    int64_t nTimeBegin;
     bool fGood = true;
-
-    while (file.good()) {
-        std::string line;
-        std::getline(file, line);
-        if (line.empty() || line[0] == '#')
-            continue;
-
-        std::vector<std::string> vstr;
-        boost::split(vstr, line, boost::is_any_of(" "));
-        if (vstr.size() < 2)
-            continue;
-        CEraSecret vchSecret;
-        if (!vchSecret.SetString(vstr[0]))
-            continue;
-        CKey key = vchSecret.GetKey();
-        CPubKey pubkey = key.GetPubKey();
-        CKeyID keyid = pubkey.GetID();
-        if (pwalletMain->HaveKey(keyid)) {
-            LogPrintf("Skipping import of %s (key already present)\n", CEraAddress(keyid).ToString());
-            continue;
-        }
-        int64_t nTime = DecodeDumpTime(vstr[1]);
-        std::string strLabel;
-        bool fLabel = true;
-        for (unsigned int nStr = 2; nStr < vstr.size(); nStr++) {
-            if (boost::algorithm::starts_with(vstr[nStr], "#"))
-                break;
-            if (vstr[nStr] == "change=1")
-                fLabel = false;
-            if (vstr[nStr] == "reserve=1")
-                fLabel = false;
-            if (boost::algorithm::starts_with(vstr[nStr], "label=")) {
-                strLabel = DecodeDumpString(vstr[nStr].substr(6));
-                fLabel = true;
+    CBlockIndex* pindex;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        nTimeBegin = pindexBest->nTime;
+
+        while (file.good()) {
+            std::string line;
+            std::getline(file, line);
+            if (line.empty() || line[0] == '#')
+                continue;
+
+            std::vector<std::string> vstr;
+            boost::split(vstr, line, boost::is_any_of(" "));
+            if (vstr.size() < 2)
+                continue;
+            CEraSecret vchSecret;
+            if (!vchSecret.SetString(vstr[0]))
+                continue;
+            CKey key = vchSecret.GetKey();
+            CPubKey pubkey = key.GetPubKey();
+            CKeyID keyid = pubkey.GetID();
+            if (pwalletMain->HaveKey(keyid)) {
+                LogPrintf("Skipping import of %s (key already present)\n", CEraAddress(keyid).ToString());
+                continue;
             }
+            int64_t nTime = DecodeDumpTime(vstr[1]);
+            std::string strLabel;
+            bool fLabel = true;
+            for (unsigned int nStr = 2; nStr < vstr.size(); nStr++) {
+                if (boost::algorithm::starts_with(vstr[nStr], "#"))
+                    break;
+                if (vstr[nStr] == "change=1")
+                    fLabel = false;
+                if (vstr[nStr] == "reserve=1")
+                    fLabel = false;
+                if (boost::algorithm::starts_with(vstr[nStr], "label=")) {
+                    strLabel = DecodeDumpString(vstr[nStr].substr(6));
+                    fLabel = true;
+                }
+            }
+            LogPrintf("Importing %s...\n", CEraAddress(keyid).ToString());
+            if (!pwalletMain->AddKey(key)) {
+                fGood = false;
+                continue;
+            }
+            pwalletMain->mapKeyMetadata[keyid].nCreateTime = nTime;
+            if (fLabel)
+                pwalletMain->SetAddressBookName(keyid, strLabel);
+            nTimeBegin = std::min(nTimeBegin, nTime);
         }
-        LogPrintf("Importing %s...\n", CEraAddress(keyid).ToString());
-        if (!pwalletMain->AddKey(key)) {
-            fGood = false;
-            continue;
-        }
-        pwalletMain->mapKeyMetadata[keyid].nCreateTime = nTime;
-        if (fLabel)
-            pwalletMain->SetAddressBookName(keyid, strLabel);
-        nTimeBegin = std::min(nTimeBegin, nTime);
-    }
-    file.close();
+        file.close();
 
-    CBlockIndex* pindex = pindexBest;
-    while (pindex && pindex->pprev && pindex->nTime > nTimeBegin - 7200)
-        pindex = pindex->pprev;
+        pindex = pindexBest;
+        while (pindex && pindex->pprev && pindex->nTime > nTimeBegin - 7200)
+            pindex = pindex->pprev;
 
-    if (!pwalletMain->nTimeFirstKey || nTimeBegin < pwalletMain->nTimeFirstKey)
-        pwalletMain->nTimeFirstKey = nTimeBegin;
+        if (!pwalletMain->nTimeFirstKey || nTimeBegin < pwalletMain->nTimeFirstKey)
+            pwalletMain->nTimeFirstKey = nTimeBegin;
 
-    LogPrintf("Rescanning last %i blocks\n", pindexBest->nHeight - pindex->nHeight + 1);
-    pwalletMain->ScanForWalletTransactions(pindex);
-    pwalletMain->ReacceptWalletTransactions();
+        LogPrintf("Rescanning last %i blocks\n", pindexBest->nHeight - pindex->nHeight + 1);
+    }
+
+    bool fScanned = pwalletMain->ScanForWalletTransactions(pindex) >= 0;
+    if (fScanned)
+        pwalletMain->ReacceptWalletTransactions();
     pwalletMain->MarkDirty();
 
+    if (!fScanned)
+        throw JSONRPCError(RPC_MISC_ERROR, "Keys imported, but the rescan was aborted; use rescanblockchain");
+
     if (!fGood)
         throw JSONRPCError(RPC_WALLET_ERROR, "Error adding some keys to wallet");
 
     return Value::null;
 }
 
+Value rescanblockchain(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 2)
+        throw runtime_error(
+            "rescanblockchain [startheight] [stopheight]\n"
+            "Rescan the main chain from startheight (default 0) to stopheight\n"
+            "(default the tip) for wallet transactions. Progress is reported\n"
+            "by getrescaninfo and the scan can be stopped with abortrescan.");
+
+    if (pwalletMain->GetRescanStatus().fScanning)
+        throw JSONRPCError(RPC_WALLET_ERROR, "Wallet is currently rescanning");
+
+    CBlockIndex* pindexStart;
+    CBlockIndex* pindexStop = NULL;
+    {
+        LOCK(cs_main);
+        int nStartHeight = params.size() > 0 ? params[0].get_int() : 0;
+        int nStopHeight = params.size() > 1 ? params[1].get_int() : nBestHeight;
+        if (nStartHeight < 0 || nStartHeight > nBestHeight)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid start height");
+        if (nStopHeight < nStartHeight || nStopHeight > nBestHeight)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid stop height");
+        pindexStart = FindBlockByHeight(nStartHeight);
+        if (params.size() > 1)
+            pindexStop = FindBlockByHeight(nStopHeight);
+    }
+
+    int nFound = pwalletMain->ScanForWalletTransactions(pindexStart, true, pindexStop);
+    if (nFound < 0)
+        throw JSONRPCError(RPC_MISC_ERROR, "Rescan aborted");
+    pwalletMain->ReacceptWalletTransactions();
+
+    CRescanStatus status = pwalletMain->GetRescanStatus();
+    Object result;
+    result.push_back(Pair("startheight", status.nStartHeight));
+    result.push_back(Pair("stopheight", status.nStopHeight));
+    result.push_back(Pair("found", nFound));
+    return result;
+}
+
+Value abortrescan(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "abortrescan\n"
+            "Stop the wallet rescan in progress, if any.\n"
+            "Returns true if a rescan was running.");
+
+    return pwalletMain->AbortRescan();
+}
+
+Value getrescaninfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getrescaninfo\n"
+            "Returns progress of the running or last wallet rescan.");
+
+    CRescanStatus status = pwalletMain->GetRescanStatus();
+    Object obj;
+    obj.push_back(Pair("scanning", status.fScanning));
+    obj.push_back(Pair("startheight", status.nStartHeight));
+    obj.push_back(Pair("stopheight", status.nStopHeight));
+    obj.push_back(Pair("height", status.nHeight));
+    double dProgress = 0;
+    if (status.nStopHeight > status.nStartHeight)
+        dProgress = std::max(0, status.nHeight - status.nStartHeight) / (double)(status.nStopHeight - status.nStartHeight);
+    else if (!status.fScanning && status.nHeight >= 0)
+        dProgress = 1;
+    obj.push_back(Pair("progress", dProgress));
+    obj.push_back(Pair("found", status.nFound));
+    if (status.nStartTime)
+        obj.push_back(Pair("duration", (status.fScanning ? GetTimeMillis() : status.nEndTime) - status.nStartTime));
+    return obj;
+}
+
 
 Value dumpprivkey(const Array& params, bool fHelp)
 {
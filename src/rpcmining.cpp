@@ -69,7 +69,7 @@ Value getstakesubsidy(const Array& params, bool fHelp)
     }
 
     uint64_t nCoinAge;
-    CTxDB txdb("r");
+    CTxDB& txdb = GetReadTxDB();
     if (!tx.GetCoinAge(txdb, pindexBest, nCoinAge))
         throw JSONRPCError(RPC_MISC_ERROR, "GetCoinAge failed");
 
@@ -547,7 +547,8 @@ Value getblocktemplate(const Array& params, bool fHelp)
     Array transactions;
     map<uint256, int64_t> setTxIndex;
     int i = 0;
-    CTxDB txdb("r");
+    CTxDB& txdb = GetReadTxDB();
+    CTxDBSnapshot snapshot(txdb);
     BOOST_FOREACH (CTransaction& tx, pblock->vtx) {
         uint256 txHash = tx.GetHash();
         setTxIndex[txHash] = i++;
@@ -615,6 +616,79 @@ Value getblocktemplate(const Array& params, bool fHelp)
     return result;
 }
 
+Value generate(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "generate <numblocks>\n"
+            "Mine <numblocks> proof-of-work blocks on top of the best chain (regtest only).\n"
+            "Returns the hashes of the new blocks.");
+
+    if (!Params().MineBlocksOnDemand())
+        throw JSONRPCError(RPC_METHOD_NOT_FOUND, "This method can only be used on regtest");
+
+    int nGenerate = params[0].get_int();
+    if (nGenerate < 1)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, numblocks must be positive");
+
+    CReserveKey reservekey(pwalletMain);
+    unsigned int nExtraNonce = 0;
+    Array blockHashes;
+    for (int i = 0; i < nGenerate; i++) {
+        unique_ptr<CBlock> pblock(CreateNewBlock(reservekey));
+        if (!pblock.get())
+            throw JSONRPCError(RPC_WALLET_KEYPOOL_RAN_OUT, "Keypool ran out, please call keypoolrefill first");
+        {
+            LOCK(cs_main);
+            IncrementExtraNonce(pblock.get(), pindexBest, nExtraNonce);
+        }
+
+        // Half of all hashes meet the regtest target
+        uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+        while (pblock->GetHash() > hashTarget)
+            pblock->nNonce++;
+
+        if (!CheckWork(pblock.get(), *pwalletMain, reservekey))
+            throw JSONRPCError(RPC_MISC_ERROR, "Generated block was not accepted");
+        blockHashes.push_back(pblock->GetHash().GetHex());
+    }
+    return blockHashes;
+}
+
+Value generatestake(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "generatestake\n"
+            "Mint one proof-of-stake block from the wallet's stakeable outputs (regtest only).\n"
+            "The block takes the current 16-second stake timestamp slot, which must be\n"
+            "later than the best block; use setmocktime to step time forward.\n"
+            "Returns the hash of the new block.");
+
+    if (!Params().MineBlocksOnDemand())
+        throw JSONRPCError(RPC_METHOD_NOT_FOUND, "This method can only be used on regtest");
+
+    EnsureWalletIsUnlocked();
+
+    int64_t nStakeTime = GetAdjustedTime() & ~STAKE_TIMESTAMP_MASK;
+    if (nStakeTime <= pindexBest->GetPastTimeLimit())
+        throw JSONRPCError(RPC_MISC_ERROR, "Stake timestamp slot is not past the best block yet");
+
+    CReserveKey reservekey(pwalletMain);
+    int64_t nFees;
+    unique_ptr<CBlock> pblock(CreateNewBlock(reservekey, true, &nFees));
+    if (!pblock.get())
+        throw JSONRPCError(RPC_MISC_ERROR, "CreateNewBlock failed");
+
+    if (!pblock->SignBlockAt(*pwalletMain, nFees, nStakeTime))
+        throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS, "No stakeable output in the wallet");
+
+    if (!CheckStake(pblock.get(), *pwalletMain))
+        throw JSONRPCError(RPC_MISC_ERROR, "Staked block was not accepted");
+
+    return pblock->GetHash().GetHex();
+}
+
 Value submitblock(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
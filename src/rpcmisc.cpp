@@ -4,6 +4,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "base58.h"
+#include "chainparams.h"
 #include "init.h"
 #include "main.h"
 #include "net.h"
@@ -217,3 +218,22 @@ Value verifymessage(const Array& params, bool fHelp)
 
     return (pubkey.GetID() == keyID);
 }
+
+Value setmocktime(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "setmocktime <timestamp>\n"
+            "Set the local clock to <timestamp> (seconds since epoch), 0 to go back\n"
+            "to the system clock (regtest only).");
+
+    if (!Params().MineBlocksOnDemand())
+        throw JSONRPCError(RPC_METHOD_NOT_FOUND, "This method can only be used on regtest");
+
+    RPCTypeCheck(params, list_of(int_type));
+
+    LOCK(cs_main);
+    SetMockTime(params[0].get_int64());
+
+    return Value::null;
+}
@@ -13,6 +13,9 @@
 #include "util.h"
 
 #include "json/json_spirit_value.h"
+#include "json/json_spirit_writer_template.h"
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
 #include <boost/foreach.hpp>
 
 using namespace json_spirit;
@@ -227,11 +230,145 @@ Value getnettotals(const Array& params, bool fHelp)
         throw runtime_error(
             "getnettotals\n"
             "Returns information about network traffic, including bytes in, bytes out,\n"
-            "and current time.");
+            "current time, and receive buffer reuse.");
 
     Object obj;
     obj.push_back(Pair("totalbytesrecv", CNode::GetTotalBytesRecv()));
     obj.push_back(Pair("totalbytessent", CNode::GetTotalBytesSent()));
     obj.push_back(Pair("timemillis", GetTimeMillis()));
+
+    CNetBufferPoolStats poolStats = netBufferPool.GetStats();
+    Object pool;
+    pool.push_back(Pair("hits", (int64_t)poolStats.nHits));
+    pool.push_back(Pair("misses", (int64_t)poolStats.nMisses));
+    pool.push_back(Pair("returned", (int64_t)poolStats.nReturned));
+    pool.push_back(Pair("discarded", (int64_t)poolStats.nDiscarded));
+    pool.push_back(Pair("cachedbuffers", (int64_t)poolStats.nCachedBuffers));
+    pool.push_back(Pair("cachedbytes", (int64_t)poolStats.nCachedBytes));
+    obj.push_back(Pair("recvbufferpool", pool));
     return obj;
 }
+
+static Object MsgTypeStatsToJSON(const mapMsgTypeStats& mapStats)
+{
+    Object obj;
+    BOOST_FOREACH (const PAIRTYPE(std::string, CMessageTypeStats) & item, mapStats) {
+        Object entry;
+        entry.push_back(Pair("msgs", (int64_t)item.second.nMsgs));
+        entry.push_back(Pair("bytes", (int64_t)item.second.nBytes));
+        obj.push_back(Pair(item.first, entry));
+    }
+    return obj;
+}
+
+static Object TimingToJSON(const std::map<std::string, CTimingHistogram>& mapTiming)
+{
+    Object obj;
+    BOOST_FOREACH (const PAIRTYPE(std::string, CTimingHistogram) & item, mapTiming) {
+        const CTimingHistogram& hist = item.second;
+        Object entry;
+        entry.push_back(Pair("count", (int64_t)hist.nCount));
+        entry.push_back(Pair("totalus", hist.nTotalMicros));
+        entry.push_back(Pair("avgus", hist.nCount ? hist.nTotalMicros / (int64_t)hist.nCount : 0));
+        entry.push_back(Pair("maxus", hist.nMaxMicros));
+        // Only the occupied buckets, as [upper bound in us, count]
+        Array buckets;
+        for (int i = 0; i < CTimingHistogram::NUM_BUCKETS; i++) {
+            if (hist.vBucket[i] == 0)
+                continue;
+            Array bucket;
+            bucket.push_back((int64_t)2 << i);
+            bucket.push_back((int64_t)hist.vBucket[i]);
+            buckets.push_back(bucket);
+        }
+        entry.push_back(Pair("buckets", buckets));
+        obj.push_back(Pair(item.first, entry));
+    }
+    return obj;
+}
+
+static Object NetStatsToJSON(bool fPeers)
+{
+    CNetTelemetry telemetry;
+    GetNetTelemetry(telemetry);
+
+    Object obj;
+    obj.push_back(Pair("timemillis", GetTimeMillis()));
+    obj.push_back(Pair("recv", MsgTypeStatsToJSON(telemetry.mapRecv)));
+    obj.push_back(Pair("sent", MsgTypeStatsToJSON(telemetry.mapSend)));
+    obj.push_back(Pair("processtime", TimingToJSON(telemetry.mapProcessTime)));
+    obj.push_back(Pair("sendphasetime", TimingToJSON(telemetry.mapSendPhaseTime)));
+
+    Array threads;
+    int64_t nBusyMicros = 0;
+    BOOST_FOREACH (const CMsgHandlerStats& stats, telemetry.vMsgHandler) {
+        Object thread;
+        thread.push_back(Pair("peers", (int)stats.nPeers));
+        thread.push_back(Pair("messages", (int64_t)stats.nMessages));
+        thread.push_back(Pair("busyms", stats.nBusyMicros / 1000));
+        threads.push_back(thread);
+        nBusyMicros += stats.nBusyMicros;
+    }
+    int64_t nElapsedMicros = GetTimeMicros() - telemetry.nMsgHandlerStartMicros;
+    Object handler;
+    handler.push_back(Pair("threads", threads));
+    handler.push_back(Pair("avgbusythreads", nElapsedMicros > 0 ? (double)nBusyMicros / nElapsedMicros : 0.0));
+    obj.push_back(Pair("msghandler", handler));
+
+    if (fPeers) {
+        vector<CNodeStats> vstats;
+        CopyNodeStats(vstats);
+
+        Array peers;
+        BOOST_FOREACH (const CNodeStats& stats, vstats) {
+            Object peer;
+            peer.push_back(Pair("addr", stats.addrName));
+            peer.push_back(Pair("recv", MsgTypeStatsToJSON(stats.mapRecvStats)));
+            peer.push_back(Pair("sent", MsgTypeStatsToJSON(stats.mapSendStats)));
+            peers.push_back(peer);
+        }
+        obj.push_back(Pair("peers", peers));
+    }
+    return obj;
+}
+
+Value getnetstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getnetstats [peers]\n"
+            "Returns message counts and bytes per command, in both directions,\n"
+            "with histograms of message processing time per command and of\n"
+            "time spent in each phase of sending. Bucket bounds are in microseconds.\n"
+            "msghandler shows the work of each message handler thread; avgbusythreads\n"
+            "is how many of them were busy at once on average since startup.\n"
+            "If [peers] is true, per-peer message counts are included as well.");
+
+    bool fPeers = false;
+    if (params.size() > 0)
+        fPeers = params[0].get_bool();
+
+    return NetStatsToJSON(fPeers);
+}
+
+void DumpNetStats()
+{
+    boost::filesystem::path pathStats = GetArg("-statsfile", "");
+    if (pathStats.empty())
+        return;
+    if (!pathStats.is_complete())
+        pathStats = GetDataDir() / pathStats;
+
+    // Write to a temp file and rename, so readers never see a partial file
+    boost::filesystem::path pathTmp = pathStats.string() + ".new";
+    {
+        boost::filesystem::ofstream file(pathTmp, std::ios_base::out | std::ios_base::trunc);
+        if (!file.good()) {
+            LogPrintf("DumpNetStats() : cannot open %s\n", pathTmp.string());
+            return;
+        }
+        file << write_string(Value(NetStatsToJSON(true)), true) << "\n";
+    }
+    if (!RenameOver(pathTmp, pathStats))
+        LogPrintf("DumpNetStats() : rename to %s failed\n", pathStats.string());
+}
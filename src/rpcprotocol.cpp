@@ -88,6 +88,8 @@ string HTTPReply(int nStatus, const string& strMsg, bool keepalive)
         cStatus = "Not Found";
     else if (nStatus == HTTP_INTERNAL_SERVER_ERROR)
         cStatus = "Internal Server Error";
+    else if (nStatus == HTTP_SERVICE_UNAVAILABLE)
+        cStatus = "Service Unavailable";
     else
         cStatus = "";
     return strprintf(
@@ -20,12 +20,16 @@
 #include <boost/asio/ip/v6_only.hpp>
 #include <boost/asio/ssl.hpp>
 #include <boost/bind/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/foreach.hpp>
 #include <boost/iostreams/concepts.hpp>
 #include <boost/iostreams/stream.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <deque>
 #include <list>
 
 using namespace std;
@@ -35,11 +39,20 @@ using namespace json_spirit;
 
 static std::string strRPCUserColonPass;
 
+class CRPCBatch;
+class CRPCWorkQueue;
+static void RPCWorkerThread();
+
 // These are created by StartRPCThreads, destroyed in StopRPCThreads
 static asio::io_service* rpc_io_service = NULL;
 static map<string, boost::shared_ptr<deadline_timer>> deadlineTimers;
 static ssl::context* rpc_ssl_context = NULL;
 static boost::thread_group* rpc_worker_group = NULL;
+static CRPCWorkQueue* rpc_work_queue = NULL;
+static int nRPCWorkers = 0;
+
+// Seconds a connection may stay idle, or take to send a request, before it is closed
+static int nRPCServerTimeout = 30;
 
 void RPCTypeCheck(const Array& params,
                   const list<Value_type>& typesExpected,
@@ -174,6 +187,97 @@ string CRPCTable::help(string strCommand) const
     return strRet;
 }
 
+//
+// Per-method latency statistics, reported by getrpcstats
+//
+
+// Upper bounds of the latency histogram buckets in microseconds; one more
+// open-ended bucket follows the last bound.
+static const int64_t RPC_LATENCY_BOUNDS[] = {100, 1000, 10000, 100000, 1000000, 10000000};
+static const char* RPC_LATENCY_LABELS[] = {"<0.1ms", "<1ms", "<10ms", "<100ms", "<1s", "<10s", ">=10s"};
+static const int RPC_LATENCY_BUCKETS = sizeof(RPC_LATENCY_LABELS) / sizeof(RPC_LATENCY_LABELS[0]);
+
+struct CRPCMethodStats {
+    int64_t nCalls;
+    int64_t nTotalMicros;
+    int64_t nMaxMicros;
+    int64_t vBuckets[RPC_LATENCY_BUCKETS];
+
+    CRPCMethodStats() : nCalls(0), nTotalMicros(0), nMaxMicros(0)
+    {
+        memset(vBuckets, 0, sizeof(vBuckets));
+    }
+
+    void Add(int64_t nMicros)
+    {
+        nCalls++;
+        nTotalMicros += nMicros;
+        nMaxMicros = max(nMaxMicros, nMicros);
+        int nBucket = 0;
+        while (nBucket < RPC_LATENCY_BUCKETS - 1 && nMicros >= RPC_LATENCY_BOUNDS[nBucket])
+            nBucket++;
+        vBuckets[nBucket]++;
+    }
+};
+
+static CCriticalSection cs_rpcStats;
+static map<string, CRPCMethodStats> mapRPCStats;
+static int nRPCConnections = 0;
+static int64_t nRPCRejected = 0;
+
+/** Records its own lifetime as one call of a method, however the call ends. */
+class CRPCLatencyTimer
+{
+public:
+    CRPCLatencyTimer(const string& strMethodIn) : strMethod(strMethodIn), nStart(GetTimeMicros()) {}
+    ~CRPCLatencyTimer()
+    {
+        int64_t nMicros = GetTimeMicros() - nStart;
+        LOCK(cs_rpcStats);
+        mapRPCStats[strMethod].Add(nMicros);
+    }
+
+private:
+    const string strMethod;
+    const int64_t nStart;
+};
+
+Value getrpcstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getrpcstats\n"
+            "Returns RPC server load and per-method call latency histograms.");
+
+    Object server;
+    Object methods;
+    {
+        LOCK(cs_rpcStats);
+        server.push_back(Pair("connections", nRPCConnections));
+        server.push_back(Pair("rejected", nRPCRejected));
+
+        for (map<string, CRPCMethodStats>::const_iterator it = mapRPCStats.begin(); it != mapRPCStats.end(); ++it) {
+            const CRPCMethodStats& stats = it->second;
+            Object method;
+            method.push_back(Pair("calls", stats.nCalls));
+            method.push_back(Pair("averagems", (double)stats.nTotalMicros / stats.nCalls / 1000));
+            method.push_back(Pair("maxms", (double)stats.nMaxMicros / 1000));
+            Object histogram;
+            for (int i = 0; i < RPC_LATENCY_BUCKETS; i++)
+                histogram.push_back(Pair(RPC_LATENCY_LABELS[i], stats.vBuckets[i]));
+            method.push_back(Pair("histogram", histogram));
+            methods.push_back(Pair(it->first, method));
+        }
+    }
+    server.push_back(Pair("workers", GetArg("-rpcthreads", 4)));
+    server.push_back(Pair("workqueue", GetArg("-rpcworkqueue", 16)));
+
+    Object result;
+    result.push_back(Pair("server", server));
+    result.push_back(Pair("methods", methods));
+    return result;
+}
+
 Value help(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() > 1)
@@ -213,6 +317,7 @@ static const CRPCCommand vRPCCommands[] =
         //  ------------------------  -----------------------  ---------- ---------- ---------
         {"help", &help, true, true, false},
         {"stop", &stop, true, true, false},
+        {"getrpcstats", &getrpcstats, true, true, false},
         {"getbestblockhash", &getbestblockhash, true, false, false},
         {"getblockcount", &getblockcount, true, false, false},
         {"getconnectioncount", &getconnectioncount, true, false, false},
@@ -221,22 +326,27 @@ static const CRPCCommand vRPCCommands[] =
         {"getaddednodeinfo", &getaddednodeinfo, true, true, false},
         {"ping", &ping, true, false, false},
         {"getnettotals", &getnettotals, true, true, false},
+        {"getnetstats", &getnetstats, true, false, false},
         {"getdifficulty", &getdifficulty, true, false, false},
         {"getinfo", &getinfo, true, false, false},
         {"getrawmempool", &getrawmempool, true, false, false},
-        {"getblock", &getblock, false, false, false},
-        {"getblockbynumber", &getblockbynumber, false, false, false},
+        {"gettxqueueinfo", &gettxqueueinfo, true, true, false},
+        {"getorphaninfo", &getorphaninfo, true, true, false},
+        {"getblock", &getblock, false, true, false},
+        {"getblockbynumber", &getblockbynumber, false, true, false},
         {"getblockhash", &getblockhash, false, false, false},
-        {"getrawtransaction", &getrawtransaction, false, false, false},
+        {"getrawtransaction", &getrawtransaction, false, true, false},
         {"createrawtransaction", &createrawtransaction, false, false, false},
-        {"decoderawtransaction", &decoderawtransaction, false, false, false},
-        {"decodescript", &decodescript, false, false, false},
+        {"decoderawtransaction", &decoderawtransaction, false, true, false},
+        {"decodescript", &decodescript, false, true, false},
         {"signrawtransaction", &signrawtransaction, false, false, false},
         {"sendrawtransaction", &sendrawtransaction, false, false, false},
         {"getcheckpoint", &getcheckpoint, true, false, false},
+        {"getdbstats", &getdbstats, true, false, false},
         {"validateaddress", &validateaddress, true, false, false},
         {"validatepubkey", &validatepubkey, true, false, false},
         {"verifymessage", &verifymessage, false, false, false},
+        {"setmocktime", &setmocktime, true, false, false},
 
 #ifdef ENABLE_WALLET
         {"getmininginfo", &getmininginfo, true, false, false},
@@ -254,7 +364,7 @@ static const CRPCCommand vRPCCommands[] =
         {"listreceivedbyaddress", &listreceivedbyaddress, false, false, true},
         {"listreceivedbyaccount", &listreceivedbyaccount, false, false, true},
         {"backupwallet", &backupwallet, true, false, true},
-        {"keypoolrefill", &keypoolrefill, true, false, true},
+        {"keypoolrefill", &keypoolrefill, true, true, true},
         {"walletpassphrase", &walletpassphrase, true, false, true},
         {"walletpassphrasechange", &walletpassphrasechange, false, false, true},
         {"walletlock", &walletlock, true, false, true},
@@ -274,16 +384,22 @@ static const CRPCCommand vRPCCommands[] =
         {"listaccounts", &listaccounts, false, false, true},
         {"getblocktemplate", &getblocktemplate, true, false, false},
         {"submitblock", &submitblock, false, false, false},
+        {"generate", &generate, true, false, true},
+        {"generatestake", &generatestake, true, false, true},
         {"listsinceblock", &listsinceblock, false, false, true},
         {"dumpprivkey", &dumpprivkey, false, false, true},
         {"dumpwallet", &dumpwallet, true, false, true},
-        {"importprivkey", &importprivkey, false, false, true},
-        {"importwallet", &importwallet, false, false, true},
+        {"importprivkey", &importprivkey, false, true, true},
+        {"importwallet", &importwallet, false, true, true},
+        {"rescanblockchain", &rescanblockchain, false, true, true},
+        {"abortrescan", &abortrescan, false, true, true},
+        {"getrescaninfo", &getrescaninfo, true, true, true},
         {"listunspent", &listunspent, false, false, true},
         {"settxfee", &settxfee, false, false, true},
         {"getsubsidy", &getsubsidy, true, true, false},
         {"getstakesubsidy", &getstakesubsidy, true, true, false},
         {"reservebalance", &reservebalance, false, true, true},
+        {"getstakeplan", &getstakeplan, false, false, true},
         {"checkwallet", &checkwallet, false, true, true},
         {"repairwallet", &repairwallet, false, true, true},
         {"resendtx", &resendtx, false, true, true},
@@ -323,9 +439,9 @@ bool HTTPAuthorized(map<string, string>& mapHeaders)
     return TimingResistantEqual(strUserPass, strRPCUserColonPass);
 }
 
-void ErrorReply(std::ostream& stream, const Object& objError, const Value& id)
+string ErrorReply(const Object& objError, const Value& id)
 {
-    // Send error reply from json-rpc error object
+    // HTTP error reply from json-rpc error object
     int nStatus = HTTP_INTERNAL_SERVER_ERROR;
     int code = find_value(objError, "code").get_int();
     if (code == RPC_INVALID_REQUEST)
@@ -333,7 +449,7 @@ void ErrorReply(std::ostream& stream, const Object& objError, const Value& id)
     else if (code == RPC_METHOD_NOT_FOUND)
         nStatus = HTTP_NOT_FOUND;
     string strReply = JSONRPCReply(Value::null, objError, id);
-    stream << HTTPReply(nStatus, strReply, false) << std::flush;
+    return HTTPReply(nStatus, strReply, false);
 }
 
 bool ClientAllowed(const boost::asio::ip::address& address)
@@ -355,16 +471,129 @@ bool ClientAllowed(const boost::asio::ip::address& address)
     return false;
 }
 
-class AcceptedConnection
+//
+// Requests are read and parsed on a single event loop thread and executed by
+// -rpcthreads workers fed through a bounded queue. An idle keep-alive
+// connection only costs a pending read, so it can no longer pin a thread.
+//
+
+class AcceptedConnection : public boost::enable_shared_from_this<AcceptedConnection>
 {
 public:
     virtual ~AcceptedConnection() {}
 
-    virtual std::iostream& stream() = 0;
     virtual std::string peer_address_to_string() const = 0;
+
+    // Start reading requests. Called on the event loop once accepted.
+    virtual void start() = 0;
+
+    // Write a complete HTTP reply, then read the next request unless
+    // fKeepAlive is false. Must be called on the event loop.
+    virtual void reply(const std::string& strReply, bool fKeepAlive) = 0;
+
     virtual void close() = 0;
 };
 
+typedef boost::shared_ptr<AcceptedConnection> AcceptedConnectionPtr;
+
+// A request that was read and authorized, waiting for a worker, or an
+// invitation to help execute a running batch
+struct CRPCWorkItem {
+    AcceptedConnectionPtr conn;
+    string strRequest;
+    bool fKeepAlive;
+    boost::shared_ptr<CRPCBatch> batch;
+};
+
+/**
+ * Bounded FIFO between the event loop and the worker threads. Enqueue()
+ * fails instead of blocking when the queue is full, so overload is answered
+ * with an immediate 503 rather than a backlog of hanging clients.
+ */
+class CRPCWorkQueue
+{
+public:
+    CRPCWorkQueue(size_t nMaxDepthIn) : nMaxDepth(nMaxDepthIn), fRunning(true) {}
+
+    bool Enqueue(const CRPCWorkItem& item)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (!fRunning || queue.size() >= nMaxDepth)
+            return false;
+        queue.push_back(item);
+        cond.notify_one();
+        return true;
+    }
+
+    // Batch invitations go ahead of new requests and do not count towards
+    // the depth limit; a batch still finishes if nobody picks them up.
+    void EnqueueBatch(const boost::shared_ptr<CRPCBatch>& batch, int nCopies)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (!fRunning)
+            return;
+        for (int i = 0; i < nCopies; i++)
+            batches.push_back(batch);
+        cond.notify_all();
+    }
+
+    // Blocks until an item is available; returns false once interrupted
+    bool Dequeue(CRPCWorkItem& item)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (fRunning && queue.empty() && batches.empty())
+            cond.wait(lock);
+        if (!fRunning)
+            return false;
+        if (!batches.empty()) {
+            item = CRPCWorkItem();
+            item.batch = batches.front();
+            batches.pop_front();
+        } else {
+            item = queue.front();
+            queue.pop_front();
+        }
+        return true;
+    }
+
+    void Interrupt()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fRunning = false;
+        queue.clear();
+        batches.clear();
+        cond.notify_all();
+    }
+
+private:
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::deque<CRPCWorkItem> queue;
+    std::deque<boost::shared_ptr<CRPCBatch>> batches;
+    const size_t nMaxDepth;
+    bool fRunning;
+};
+
+typedef asio::buffers_iterator<asio::streambuf::const_buffers_type> HTTPBufferIterator;
+
+// async_read_until match condition for the blank line that ends the HTTP
+// headers. Like ReadHTTPHeaders() it accepts both CRLF and bare LF endings.
+static std::pair<HTTPBufferIterator, bool> MatchHTTPHeadersEnd(HTTPBufferIterator begin, HTTPBufferIterator end)
+{
+    for (HTTPBufferIterator it = begin; it != end; ++it) {
+        if (*it != '\n')
+            continue;
+        HTTPBufferIterator next = it;
+        if (++next != end && *next == '\r')
+            ++next;
+        if (next == end)
+            return std::make_pair(it, false); // Resume the search from this line break
+        if (*next == '\n')
+            return std::make_pair(++next, true);
+    }
+    return std::make_pair(end, false);
+}
+
 template <typename Protocol>
 class AcceptedConnectionImpl : public AcceptedConnection
 {
@@ -372,15 +601,21 @@ public:
     AcceptedConnectionImpl(
         asio::io_service& io_service,
         ssl::context& context,
-        bool fUseSSL) : sslStream(io_service, context),
-                        _d(sslStream, fUseSSL),
-                        _stream(_d)
+        bool fUseSSLIn) : sslStream(io_service, context),
+                          fUseSSL(fUseSSLIn),
+                          fStarted(false),
+                          fKeepAlive(false),
+                          buffer(MAX_SIZE + 65536),
+                          timer(io_service)
     {
     }
 
-    virtual std::iostream& stream()
+    ~AcceptedConnectionImpl()
     {
-        return _stream;
+        if (fStarted) {
+            LOCK(cs_rpcStats);
+            nRPCConnections--;
+        }
     }
 
     virtual std::string peer_address_to_string() const
@@ -388,27 +623,190 @@ public:
         return peer.address().to_string();
     }
 
+    virtual void start()
+    {
+        fStarted = true;
+        {
+            LOCK(cs_rpcStats);
+            nRPCConnections++;
+        }
+        if (fUseSSL) {
+            setTimeout(nRPCServerTimeout);
+            sslStream.async_handshake(ssl::stream_base::server,
+                                      boost::bind(&AcceptedConnectionImpl::handleHandshake, self(), asio::placeholders::error));
+        } else
+            readRequest();
+    }
+
+    virtual void reply(const std::string& strReplyIn, bool fKeepAliveIn)
+    {
+        strReply = strReplyIn;
+        fKeepAlive = fKeepAliveIn;
+        if (fUseSSL)
+            asio::async_write(sslStream, asio::buffer(strReply),
+                              boost::bind(&AcceptedConnectionImpl::handleWrite, self(), asio::placeholders::error));
+        else
+            asio::async_write(sslStream.next_layer(), asio::buffer(strReply),
+                              boost::bind(&AcceptedConnectionImpl::handleWrite, self(), asio::placeholders::error));
+    }
+
     virtual void close()
     {
-        _stream.close();
+        boost::system::error_code ec;
+        timer.cancel(ec);
+        sslStream.lowest_layer().shutdown(socket_base::shutdown_both, ec);
+        sslStream.lowest_layer().close(ec);
     }
 
     typename Protocol::endpoint peer;
     asio::ssl::stream<typename Protocol::socket> sslStream;
 
 private:
-    SSLIOStreamDevice<Protocol> _d;
-    iostreams::stream<SSLIOStreamDevice<Protocol>> _stream;
-};
+    const bool fUseSSL;
+    bool fStarted;
+    bool fKeepAlive;
+    asio::streambuf buffer;
+    deadline_timer timer;
+    map<string, string> mapHeaders;
+    string strURI;
+    string strReply;
+
+    boost::shared_ptr<AcceptedConnectionImpl> self()
+    {
+        return boost::static_pointer_cast<AcceptedConnectionImpl>(shared_from_this());
+    }
+
+    void setTimeout(int nSeconds)
+    {
+        timer.expires_from_now(posix_time::seconds(nSeconds));
+        timer.async_wait(boost::bind(&AcceptedConnectionImpl::handleTimeout, self(), asio::placeholders::error));
+    }
+
+    void handleTimeout(const boost::system::error_code& error)
+    {
+        // The timer may have been re-armed after this wait completed
+        if (error != asio::error::operation_aborted && timer.expires_at() <= deadline_timer::traits_type::now())
+            close();
+    }
+
+    void handleHandshake(const boost::system::error_code& error)
+    {
+        if (error)
+            close();
+        else
+            readRequest();
+    }
 
-void ServiceConnection(AcceptedConnection* conn);
+    void readRequest()
+    {
+        setTimeout(nRPCServerTimeout);
+        if (fUseSSL)
+            asio::async_read_until(sslStream, buffer, MatchHTTPHeadersEnd,
+                                   boost::bind(&AcceptedConnectionImpl::handleHeaders, self(), asio::placeholders::error));
+        else
+            asio::async_read_until(sslStream.next_layer(), buffer, MatchHTTPHeadersEnd,
+                                   boost::bind(&AcceptedConnectionImpl::handleHeaders, self(), asio::placeholders::error));
+    }
+
+    void handleHeaders(const boost::system::error_code& error)
+    {
+        if (error) {
+            close();
+            return;
+        }
+
+        std::istream stream(&buffer);
+        int nProto = 0;
+        string strMethod;
+        if (!ReadHTTPRequestLine(stream, nProto, strMethod, strURI)) {
+            close();
+            return;
+        }
+        mapHeaders.clear();
+        int nLen = ReadHTTPHeaders(stream, mapHeaders);
+        if (nLen < 0 || nLen > (int)MAX_SIZE) {
+            close();
+            return;
+        }
+
+        string strConnection = mapHeaders["connection"];
+        fKeepAlive = (strConnection == "keep-alive" || (strConnection != "close" && nProto >= 1));
+
+        // Part or all of the body may have arrived with the headers
+        if (buffer.size() >= (size_t)nLen)
+            handleBody(boost::system::error_code(), nLen);
+        else if (fUseSSL)
+            asio::async_read(sslStream, buffer, asio::transfer_exactly(nLen - buffer.size()),
+                             boost::bind(&AcceptedConnectionImpl::handleBody, self(), asio::placeholders::error, nLen));
+        else
+            asio::async_read(sslStream.next_layer(), buffer, asio::transfer_exactly(nLen - buffer.size()),
+                             boost::bind(&AcceptedConnectionImpl::handleBody, self(), asio::placeholders::error, nLen));
+    }
+
+    void handleBody(const boost::system::error_code& error, int nLen)
+    {
+        if (error) {
+            close();
+            return;
+        }
+        timer.cancel();
+
+        string strRequest(nLen, '\0');
+        if (nLen > 0)
+            std::istream(&buffer).read(&strRequest[0], nLen);
+
+        if (strURI != "/") {
+            reply(HTTPReply(HTTP_NOT_FOUND, "", false), false);
+            return;
+        }
+
+        // Check authorization
+        if (mapHeaders.count("authorization") == 0) {
+            reply(HTTPReply(HTTP_UNAUTHORIZED, "", false), false);
+            return;
+        }
+        if (!HTTPAuthorized(mapHeaders)) {
+            LogPrintf("ThreadRPCServer incorrect password attempt from %s\n", peer_address_to_string());
+            /* Deter brute-forcing short passwords.
+               If this results in a DoS the user really
+               shouldn't have their RPC port exposed.
+               The delay runs on the timer so that it does not stall
+               the event loop. */
+            timer.expires_from_now(posix_time::milliseconds(mapArgs["-rpcpassword"].size() < 20 ? 250 : 0));
+            timer.async_wait(boost::bind(&AcceptedConnectionImpl::reply, self(), HTTPReply(HTTP_UNAUTHORIZED, "", false), false));
+            return;
+        }
+
+        CRPCWorkItem item;
+        item.conn = shared_from_this();
+        item.strRequest = strRequest;
+        item.fKeepAlive = fKeepAlive;
+        if (!rpc_work_queue->Enqueue(item)) {
+            {
+                LOCK(cs_rpcStats);
+                nRPCRejected++;
+            }
+            LogPrint("rpc", "ThreadRPCServer work queue full, rejecting request from %s\n", peer_address_to_string());
+            reply(HTTPReply(HTTP_SERVICE_UNAVAILABLE, "", false), false);
+        }
+    }
+
+    void handleWrite(const boost::system::error_code& error)
+    {
+        strReply.clear();
+        if (error || !fKeepAlive)
+            close();
+        else
+            readRequest(); // A pipelined request may already be buffered
+    }
+};
 
 // Forward declaration required for RPCListen
 template <typename Protocol>
 static void RPCAcceptHandler(boost::shared_ptr<basic_socket_acceptor<Protocol>> acceptor,
                              ssl::context& context,
                              bool fUseSSL,
-                             AcceptedConnection* conn,
+                             AcceptedConnectionPtr conn,
                              const boost::system::error_code& error);
 
 /**
@@ -427,7 +825,7 @@ static void RPCListen(boost::shared_ptr<basic_socket_acceptor<Protocol>> accepto
                       const bool fUseSSL)
 {
     // Accept connection
-    AcceptedConnectionImpl<Protocol>* conn = new AcceptedConnectionImpl<Protocol>(GET_IO_SERVICE(acceptor), context, fUseSSL);
+    boost::shared_ptr<AcceptedConnectionImpl<Protocol>> conn(new AcceptedConnectionImpl<Protocol>(GET_IO_SERVICE(acceptor), context, fUseSSL));
 
     acceptor->async_accept(
         conn->sslStream.lowest_layer(),
@@ -436,7 +834,7 @@ static void RPCListen(boost::shared_ptr<basic_socket_acceptor<Protocol>> accepto
                     acceptor,
                     boost::ref(context),
                     fUseSSL,
-                    conn,
+                    AcceptedConnectionPtr(conn),
                     boost::asio::placeholders::error));
 }
 #undef GET_IO_SERVICE
@@ -448,18 +846,18 @@ template <typename Protocol>
 static void RPCAcceptHandler(boost::shared_ptr<basic_socket_acceptor<Protocol>> acceptor,
                              ssl::context& context,
                              const bool fUseSSL,
-                             AcceptedConnection* conn,
+                             AcceptedConnectionPtr conn,
                              const boost::system::error_code& error)
 {
     // Immediately start accepting new connections, except when we're cancelled or our socket is closed.
     if (error != asio::error::operation_aborted && acceptor->is_open())
         RPCListen(acceptor, context, fUseSSL);
 
-    AcceptedConnectionImpl<ip::tcp>* tcp_conn = dynamic_cast<AcceptedConnectionImpl<ip::tcp>*>(conn);
+    AcceptedConnectionImpl<ip::tcp>* tcp_conn = dynamic_cast<AcceptedConnectionImpl<ip::tcp>*>(conn.get());
 
     // TODO: Actually handle errors
     if (error) {
-        delete conn;
+        return;
     }
 
     // Restrict callers by IP.  It is important to
@@ -468,12 +866,9 @@ static void RPCAcceptHandler(boost::shared_ptr<basic_socket_acceptor<Protocol>>
     else if (tcp_conn && !ClientAllowed(tcp_conn->peer.address())) {
         // Only send a 403 if we're not using SSL to prevent a DoS during the SSL handshake.
         if (!fUseSSL)
-            conn->stream() << HTTPReply(HTTP_FORBIDDEN, "", false) << std::flush;
-        delete conn;
+            conn->reply(HTTPReply(HTTP_FORBIDDEN, "", false), false);
     } else {
-        ServiceConnection(conn);
-        conn->close();
-        delete conn;
+        conn->start();
     }
 }
 
@@ -573,9 +968,13 @@ void StartRPCThreads()
         return;
     }
 
+    nRPCServerTimeout = GetArg("-rpcservertimeout", 30);
+    nRPCWorkers = GetArg("-rpcthreads", 4);
+    rpc_work_queue = new CRPCWorkQueue(max((int64_t)1, GetArg("-rpcworkqueue", 16)));
     rpc_worker_group = new boost::thread_group();
-    for (int i = 0; i < GetArg("-rpcthreads", 4); i++)
-        rpc_worker_group->create_thread(boost::bind(&asio::io_service::run, rpc_io_service));
+    rpc_worker_group->create_thread(boost::bind(&asio::io_service::run, rpc_io_service));
+    for (int i = 0; i < nRPCWorkers; i++)
+        rpc_worker_group->create_thread(&RPCWorkerThread);
 }
 
 void StopRPCThreads()
@@ -585,10 +984,13 @@ void StopRPCThreads()
     deadlineTimers.clear();
     DeleteAuthCookie();
     rpc_io_service->stop();
+    rpc_work_queue->Interrupt();
     if (rpc_worker_group != NULL)
         rpc_worker_group->join_all();
     delete rpc_worker_group;
     rpc_worker_group = NULL;
+    delete rpc_work_queue;
+    rpc_work_queue = NULL;
     delete rpc_ssl_context;
     rpc_ssl_context = NULL;
     delete rpc_io_service;
@@ -675,86 +1077,153 @@ static Object JSONRPCExecOne(const Value& req)
     return rpc_result;
 }
 
-static string JSONRPCExecBatch(const Array& vReq)
+/**
+ * A run of batch elements shared by the worker that received the batch and
+ * any idle workers that join in. Elements are claimed one at a time and
+ * their results stored by index, so the reply keeps the request order.
+ */
+class CRPCBatch
 {
-    Array ret;
-    for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+public:
+    CRPCBatch(const Array& vReqIn, size_t nBeginIn, size_t nEndIn, Array& vResultIn)
+        : vReq(vReqIn), vResult(vResultIn), nNext(nBeginIn), nEnd(nEndIn), nPending(nEndIn - nBeginIn) {}
 
-    return write_string(Value(ret), false) + "\n";
-}
+    // Execute unclaimed elements until there are none left
+    void Work()
+    {
+        while (true) {
+            size_t n;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                if (nNext >= nEnd)
+                    return;
+                n = nNext++;
+            }
+            Object result = JSONRPCExecOne(vReq[n]);
+            boost::unique_lock<boost::mutex> lock(mutex);
+            vResult[n] = result;
+            if (--nPending == 0)
+                cond.notify_all();
+        }
+    }
 
-void ServiceConnection(AcceptedConnection* conn)
-{
-    bool fRun = true;
-    while (fRun) {
-        int nProto = 0;
-        map<string, string> mapHeaders;
-        string strRequest, strMethod, strURI;
+    // Wait for elements claimed by other workers
+    void Wait()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (nPending > 0)
+            cond.wait(lock);
+    }
 
-        // Read HTTP request line
-        if (!ReadHTTPRequestLine(conn->stream(), nProto, strMethod, strURI))
-            break;
+private:
+    const Array& vReq;
+    Array& vResult;
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    size_t nNext;
+    const size_t nEnd;
+    size_t nPending;
+};
 
-        // Read HTTP message headers and body
-        ReadHTTPMessage(conn->stream(), mapHeaders, strRequest, nProto);
+// Read-only calls whose relative order within a batch does not matter.
+// Consecutive runs of these are spread over the worker pool; anything else
+// runs on its own, after everything before it, to keep batch semantics.
+static const char* const pszParallelBatchCommands[] = {
+    "getbestblockhash", "getblockcount", "getblockhash", "getblock", "getblockbynumber",
+    "getrawtransaction", "decoderawtransaction", "decodescript"};
 
-        if (strURI != "/") {
-            conn->stream() << HTTPReply(HTTP_NOT_FOUND, "", false) << std::flush;
-            break;
-        }
+static bool IsParallelBatchCommand(const Value& req)
+{
+    if (req.type() != obj_type)
+        return false;
+    const Value& valMethod = find_value(req.get_obj(), "method");
+    if (valMethod.type() != str_type)
+        return false;
+    for (unsigned int i = 0; i < sizeof(pszParallelBatchCommands) / sizeof(pszParallelBatchCommands[0]); i++)
+        if (valMethod.get_str() == pszParallelBatchCommands[i])
+            return true;
+    return false;
+}
 
-        // Check authorization
-        if (mapHeaders.count("authorization") == 0) {
-            conn->stream() << HTTPReply(HTTP_UNAUTHORIZED, "", false) << std::flush;
-            break;
+static string JSONRPCExecBatch(const Array& vReq)
+{
+    Array ret(vReq.size());
+    size_t nBegin = 0;
+    while (nBegin < vReq.size()) {
+        size_t nEnd = nBegin;
+        while (nEnd < vReq.size() && IsParallelBatchCommand(vReq[nEnd]))
+            nEnd++;
+
+        if (nEnd - nBegin < 2 || rpc_work_queue == NULL) {
+            // Not worth sharing; this also covers every non-parallel element
+            nEnd = max(nEnd, nBegin + 1);
+            for (size_t n = nBegin; n < nEnd; n++)
+                ret[n] = JSONRPCExecOne(vReq[n]);
+        } else {
+            boost::shared_ptr<CRPCBatch> batch(new CRPCBatch(vReq, nBegin, nEnd, ret));
+            rpc_work_queue->EnqueueBatch(batch, min((size_t)nRPCWorkers, nEnd - nBegin) - 1);
+            batch->Work();
+            batch->Wait();
         }
-        if (!HTTPAuthorized(mapHeaders)) {
-            LogPrintf("ThreadRPCServer incorrect password attempt from %s\n", conn->peer_address_to_string());
-            /* Deter brute-forcing short passwords.
-               If this results in a DoS the user really
-               shouldn't have their RPC port exposed. */
-            if (mapArgs["-rpcpassword"].size() < 20)
-                MilliSleep(250);
+        nBegin = nEnd;
+    }
 
-            conn->stream() << HTTPReply(HTTP_UNAUTHORIZED, "", false) << std::flush;
-            break;
-        }
-        if (mapHeaders["connection"] == "close")
-            fRun = false;
+    return write_string(Value(ret), false) + "\n";
+}
 
-        JSONRequest jreq;
-        try {
-            // Parse request
-            Value valRequest;
-            if (!read_string(strRequest, valRequest))
-                throw JSONRPCError(RPC_PARSE_ERROR, "Parse error");
+// Executes the body of an HTTP request and returns the complete HTTP reply.
+// Errors clear fKeepAlive so that the connection is closed after the reply.
+static string JSONRPCExecHTTP(const string& strRequest, bool& fKeepAlive)
+{
+    JSONRequest jreq;
+    try {
+        // Parse request
+        Value valRequest;
+        if (!read_string(strRequest, valRequest))
+            throw JSONRPCError(RPC_PARSE_ERROR, "Parse error");
 
-            string strReply;
+        string strReply;
 
-            // singleton request
-            if (valRequest.type() == obj_type) {
-                jreq.parse(valRequest);
+        // singleton request
+        if (valRequest.type() == obj_type) {
+            jreq.parse(valRequest);
 
-                Value result = tableRPC.execute(jreq.strMethod, jreq.params);
+            Value result = tableRPC.execute(jreq.strMethod, jreq.params);
 
-                // Send reply
-                strReply = JSONRPCReply(result, Value::null, jreq.id);
+            // Send reply
+            strReply = JSONRPCReply(result, Value::null, jreq.id);
 
-                // array of requests
-            } else if (valRequest.type() == array_type)
-                strReply = JSONRPCExecBatch(valRequest.get_array());
-            else
-                throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
+            // array of requests
+        } else if (valRequest.type() == array_type)
+            strReply = JSONRPCExecBatch(valRequest.get_array());
+        else
+            throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
 
-            conn->stream() << HTTPReply(HTTP_OK, strReply, fRun) << std::flush;
-        } catch (Object& objError) {
-            ErrorReply(conn->stream(), objError, jreq.id);
-            break;
-        } catch (std::exception& e) {
-            ErrorReply(conn->stream(), JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id);
-            break;
+        return HTTPReply(HTTP_OK, strReply, fKeepAlive);
+    } catch (Object& objError) {
+        fKeepAlive = false;
+        return ErrorReply(objError, jreq.id);
+    } catch (std::exception& e) {
+        fKeepAlive = false;
+        return ErrorReply(JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id);
+    }
+}
+
+static void RPCWorkerThread()
+{
+    RenameThread("era-rpcworker");
+
+    CRPCWorkItem item;
+    while (rpc_work_queue->Dequeue(item)) {
+        if (item.batch) {
+            item.batch->Work();
+            item.batch.reset();
+            continue;
         }
+        bool fKeepAlive = item.fKeepAlive;
+        string strReply = JSONRPCExecHTTP(item.strRequest, fKeepAlive);
+        rpc_io_service->post(boost::bind(&AcceptedConnection::reply, item.conn, strReply, fKeepAlive));
+        item.conn.reset();
     }
 }
 
@@ -779,6 +1248,7 @@ json_spirit::Value CRPCTable::execute(const std::string& strMethod, const json_s
         // Execute
         Value result;
         {
+            CRPCLatencyTimer timer(strMethod);
             if (pcmd->threadSafe)
                 result = pcmd->actor(params, false);
 #ifdef ENABLE_WALLET
@@ -599,6 +599,9 @@ Value movecmd(const Array& params, bool fHelp)
     if (!walletdb.TxnCommit())
         throw JSONRPCError(RPC_DATABASE_ERROR, "database error");
 
+    pwalletMain->AddAccountingEntry(debit);
+    pwalletMain->AddAccountingEntry(credit);
+
     return true;
 }
 
@@ -1032,11 +1035,10 @@ Value listtransactions(const Array& params, bool fHelp)
 
     Array ret;
 
-    std::list<CAccountingEntry> acentries;
-    CWallet::TxItems txOrdered = pwalletMain->OrderedTxItems(acentries, strAccount);
+    const CWallet::TxItems& txOrdered = pwalletMain->wtxOrdered;
 
     // iterate backwards until we have nCount items to return:
-    for (CWallet::TxItems::reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it) {
+    for (CWallet::TxItems::const_reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it) {
         CWalletTx* const pwtx = (*it).second.first;
         if (pwtx != 0)
             ListTransactions(*pwtx, strAccount, 0, true, ret);
@@ -1146,11 +1148,21 @@ Value listsinceblock(const Array& params, bool fHelp)
 
     Array transactions;
 
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); it++) {
-        CWalletTx tx = (*it).second;
-
-        if (depth == -1 || tx.GetDepthInMainChain() < depth)
-            ListTransactions(tx, "*", 0, true, transactions);
+    if (depth == -1) {
+        for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); it++)
+            ListTransactions((*it).second, "*", 0, true, transactions);
+    } else {
+        // Only transactions confirmed above pindex, or not at all, can be
+        // shallower than it; collect those by txid to keep mapWallet order
+        set<uint256> setHash;
+        set<pair<int, uint256>>::const_iterator it = pwalletMain->setTxByHeight.lower_bound(make_pair(pindex->nHeight + 1, uint256(0)));
+        for (; it != pwalletMain->setTxByHeight.end(); ++it)
+            setHash.insert((*it).second);
+        BOOST_FOREACH (const uint256& hash, setHash) {
+            const CWalletTx& wtx = pwalletMain->mapWallet[hash];
+            if (wtx.GetDepthInMainChain() < depth)
+                ListTransactions(wtx, "*", 0, true, transactions);
+        }
     }
 
     uint256 lastblock;
@@ -1265,8 +1277,10 @@ Value keypoolrefill(const Array& params, bool fHelp)
 
     EnsureWalletIsUnlocked();
 
-    pwalletMain->TopUpKeyPool(nSize);
+    // Runs without cs_wallet held so the wallet stays usable between batches
+    pwalletMain->TopUpKeyPool(nSize, true);
 
+    LOCK(pwalletMain->cs_wallet);
     if (pwalletMain->GetKeyPoolSize() < nSize)
         throw JSONRPCError(RPC_WALLET_ERROR, "Error refreshing keypool.");
 
@@ -1453,6 +1467,52 @@ Value reservebalance(const Array& params, bool fHelp)
     return result;
 }
 
+Value getstakeplan(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getstakeplan [target]\n"
+            "Shows how the stake planner would combine small staking outputs and split large\n"
+            "ones toward [target] (default: -staketarget), and the kernel checks it would save\n"
+            "each stake search round. Nothing is sent.");
+
+    int64_t nTarget = nStakeTargetSize;
+    if (params.size() > 0)
+        nTarget = AmountFromValue(params[0]);
+
+    CStakePlan plan;
+    if (!pwalletMain->PlanStakeOutputs(nTarget, plan))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid target");
+
+    unsigned int nCombine = 0, nSplit = 0;
+    BOOST_FOREACH (const CStakePlanTx& ptx, plan.vTx) {
+        if (ptx.nOutputs > 1)
+            nSplit++;
+        else
+            nCombine++;
+    }
+
+    // Every stakeable output is checked once per timestamp searched
+    int64_t nSearch = max((int64_t)1, min(nLastCoinStakeSearchInterval, (int64_t)60));
+    int64_t nChecksBefore = plan.nCoinsBefore * nSearch;
+    int64_t nChecksAfter = plan.nCoinsAfter * nSearch;
+
+    Object result;
+    result.push_back(Pair("enabled", GetArg("-stakeplanner", 0) > 0));
+    result.push_back(Pair("target", ValueFromAmount(plan.nTarget)));
+    result.push_back(Pair("reserve", ValueFromAmount(nReserveBalance)));
+    result.push_back(Pair("outputs", (int)plan.nCoinsBefore));
+    result.push_back(Pair("outputsafter", (int)plan.nCoinsAfter));
+    result.push_back(Pair("combinetxs", (int)nCombine));
+    result.push_back(Pair("splittxs", (int)nSplit));
+    result.push_back(Pair("valuemoved", ValueFromAmount(plan.nValueMoved)));
+    result.push_back(Pair("fees", ValueFromAmount(plan.nFees)));
+    result.push_back(Pair("kernelchecks", nChecksBefore));
+    result.push_back(Pair("kernelchecksafter", nChecksAfter));
+    result.push_back(Pair("kernelcheckssaved", nChecksBefore - nChecksAfter));
+    return result;
+}
+
 
 // ppcoin: check wallet integrity
 Value checkwallet(const Array& params, bool fHelp)
@@ -1238,6 +1238,14 @@ public:
         data.insert(data.end(), begin(), end());
         clear();
     }
+
+    // Exchange the underlying buffer with data and rewind, so callers can
+    // recycle buffers instead of copying or reallocating them
+    void SwapBuffer(CSerializeData& data)
+    {
+        vch.swap(data);
+        nReadPos = 0;
+    }
 };
 
 
@@ -119,4 +119,34 @@ BOOST_AUTO_TEST_CASE(acc_orderupgrade)
     BOOST_CHECK(6 == vpwtx[1]->nOrderPos);
 }
 
+BOOST_AUTO_TEST_CASE(acc_ordered_log)
+{
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+    pwalletMain->RebuildTxOrder();
+    size_t nItems = pwalletMain->wtxOrdered.size();
+
+    CWalletTx wtx;
+    wtx.nLockTime = 1234567;
+    wtx.mapValue["comment"] = "ordered";
+    pwalletMain->AddToWallet(wtx);
+    const CWalletTx* pwtx = &pwalletMain->mapWallet[wtx.GetHash()];
+
+    CAccountingEntry ae;
+    ae.strAccount = "f";
+    ae.nCreditDebit = 1;
+    ae.nTime = 1333333340;
+    ae.nOrderPos = pwalletMain->IncOrderPosNext();
+    pwalletMain->AddAccountingEntry(ae);
+
+    // newest entries are at the end of the log without rebuilding it
+    BOOST_CHECK(pwalletMain->wtxOrdered.size() == nItems + 2);
+    CWallet::TxItems::reverse_iterator it = pwalletMain->wtxOrdered.rbegin();
+    BOOST_CHECK(it->second.second && it->second.second->strAccount == "f");
+    ++it;
+    BOOST_CHECK(it->second.first == pwtx);
+
+    // unconfirmed transactions sort last in the height index
+    BOOST_CHECK(pwalletMain->setTxByHeight.count(std::make_pair(std::numeric_limits<int>::max(), wtx.GetHash())));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
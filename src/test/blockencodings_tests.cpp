@@ -0,0 +1,95 @@
+#include <boost/test/unit_test.hpp>
+
+#include "blockencodings.h"
+#include "util.h"
+
+using namespace std;
+
+static CTransaction MakeTx(int n)
+{
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout.hash = GetRandHash();
+    tx.vin[0].prevout.n = n;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = n * CENT;
+    tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    return tx;
+}
+
+static CBlock MakeBlock(unsigned int nTx)
+{
+    CBlock block;
+    block.nTime = GetTime();
+    block.nBits = 0x1e0fffff;
+    block.hashPrevBlock = GetRandHash();
+    for (unsigned int i = 0; i < nTx; i++)
+        block.vtx.push_back(MakeTx(i));
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+BOOST_AUTO_TEST_SUITE(blockencodings_tests)
+
+BOOST_AUTO_TEST_CASE(compact_block_roundtrip)
+{
+    CBlock block = MakeBlock(10);
+    CBlockCompact cmpctblock(block);
+    BOOST_CHECK_EQUAL(cmpctblock.GetTxCount(), block.vtx.size());
+    BOOST_CHECK_EQUAL(cmpctblock.vPrefilledTx.size(), 1U);
+    BOOST_CHECK(cmpctblock.GetHeader().GetHash() == block.GetHash());
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << cmpctblock;
+    CBlockCompact cmpctblock2;
+    ss >> cmpctblock2;
+
+    // All but two transactions are already known
+    CTxMemPool pool;
+    for (unsigned int i = 1; i < block.vtx.size(); i++)
+        if (i != 3 && i != 7)
+            pool.addUnchecked(block.vtx[i].GetHash(), block.vtx[i]);
+    CTransaction txUnrelated = MakeTx(99);
+    pool.addUnchecked(txUnrelated.GetHash(), txUnrelated);
+
+    CPartialBlock partial;
+    BOOST_CHECK(partial.InitData(cmpctblock2, pool) == READ_STATUS_OK);
+    vector<unsigned int> vMissing = partial.GetMissing();
+    BOOST_CHECK_EQUAL(vMissing.size(), 2U);
+    BOOST_CHECK_EQUAL(vMissing[0], 3U);
+    BOOST_CHECK_EQUAL(vMissing[1], 7U);
+
+    vector<CTransaction> vtxMissing;
+    CBlock blockOut;
+    BOOST_CHECK(partial.FillBlock(blockOut, vtxMissing) == READ_STATUS_INVALID);
+
+    vtxMissing.push_back(block.vtx[3]);
+    vtxMissing.push_back(block.vtx[7]);
+    BOOST_CHECK(partial.FillBlock(blockOut, vtxMissing) == READ_STATUS_OK);
+    BOOST_CHECK(blockOut.GetHash() == block.GetHash());
+    BOOST_CHECK(blockOut.BuildMerkleTree() == block.hashMerkleRoot);
+
+    // Wrong transactions are caught by the merkle root
+    swap(vtxMissing[0], vtxMissing[1]);
+    BOOST_CHECK(partial.FillBlock(blockOut, vtxMissing) == READ_STATUS_FAILED);
+}
+
+BOOST_AUTO_TEST_CASE(compact_block_invalid)
+{
+    CBlock block = MakeBlock(4);
+    CBlockCompact cmpctblock(block);
+    CTxMemPool pool;
+
+    // Prefilled index out of range
+    CBlockCompact cmpctBad = cmpctblock;
+    cmpctBad.vPrefilledTx[0].nIndex = 10;
+    CPartialBlock partial;
+    BOOST_CHECK(partial.InitData(cmpctBad, pool) == READ_STATUS_INVALID);
+
+    // Duplicate short ids need the full block
+    cmpctBad = cmpctblock;
+    cmpctBad.vShortTxIds[1] = cmpctBad.vShortTxIds[0];
+    BOOST_CHECK(partial.InitData(cmpctBad, pool) == READ_STATUS_FAILED);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,94 @@
+#include <boost/test/unit_test.hpp>
+
+#include "bloom.h"
+#include "uint256.h"
+#include "util.h"
+
+using namespace std;
+
+static uint256 RandomHash()
+{
+    return GetRandHash();
+}
+
+BOOST_AUTO_TEST_SUITE(bloom_tests)
+
+// Everything inserted in the last nElements calls must still be found
+BOOST_AUTO_TEST_CASE(rolling_bloom_window)
+{
+    const unsigned int nElements = 1000;
+    CRollingBloomFilter rb(nElements, 0.000001);
+    vector<uint256> vInserted;
+    for (unsigned int i = 0; i < 5 * nElements; i++) {
+        vInserted.push_back(RandomHash());
+        rb.insert(vInserted.back());
+    }
+    for (unsigned int i = vInserted.size() - nElements; i < vInserted.size(); i++)
+        BOOST_CHECK(rb.contains(vInserted[i]));
+
+    // Old entries are eventually forgotten
+    unsigned int nOldFound = 0;
+    for (unsigned int i = 0; i < nElements; i++)
+        if (rb.contains(vInserted[i]))
+            nOldFound++;
+    BOOST_CHECK(nOldFound < 10);
+
+    rb.reset();
+    BOOST_CHECK(!rb.contains(vInserted.back()));
+}
+
+// The false positive rate stays within budget, and memory does not grow
+BOOST_AUTO_TEST_CASE(rolling_bloom_fp_rate)
+{
+    const unsigned int nElements = 5000;
+    const double fpRate = 0.001;
+    CRollingBloomFilter rb(nElements, fpRate);
+    size_t nMemory = rb.GetMemoryUsage();
+
+    for (unsigned int i = 0; i < 3 * nElements; i++) {
+        vector<unsigned char> vKey(18);
+        uint256 hash = RandomHash();
+        memcpy(&vKey[0], hash.begin(), vKey.size());
+        rb.insert(vKey);
+    }
+    BOOST_CHECK_EQUAL(rb.GetMemoryUsage(), nMemory);
+
+    const unsigned int nProbes = 200000;
+    unsigned int nFalsePositives = 0;
+    for (unsigned int i = 0; i < nProbes; i++)
+        if (rb.contains(RandomHash()))
+            nFalsePositives++;
+    BOOST_CHECK(nFalsePositives < 2 * fpRate * nProbes);
+}
+
+// Entries live for two to three generations of nElements / 2 inserts. A
+// generation is still found after two newer ones have filled, and is
+// forgotten, down to the false positive rate, once a fourth one starts
+BOOST_AUTO_TEST_CASE(rolling_bloom_rollover)
+{
+    const unsigned int nElements = 1000;
+    const unsigned int nGeneration = nElements / 2;
+    const double fpRate = 0.001;
+    CRollingBloomFilter rb(nElements, fpRate);
+
+    vector<uint256> vFirst;
+    for (unsigned int i = 0; i < nGeneration; i++) {
+        vFirst.push_back(RandomHash());
+        rb.insert(vFirst.back());
+    }
+    for (unsigned int i = 0; i < 2 * nGeneration; i++)
+        rb.insert(RandomHash());
+    for (unsigned int i = 0; i < vFirst.size(); i++)
+        BOOST_CHECK(rb.contains(vFirst[i]));
+
+    uint256 hashNext = RandomHash();
+    rb.insert(hashNext);
+    BOOST_CHECK(rb.contains(hashNext));
+    unsigned int nFirstFound = 0;
+    for (unsigned int i = 0; i < vFirst.size(); i++)
+        if (rb.contains(vFirst[i]))
+            nFirstFound++;
+    BOOST_CHECK(nFirstFound <= 5);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,96 @@
+#include <boost/test/unit_test.hpp>
+
+#include "kernel.h"
+#include "util.h"
+
+using namespace std;
+
+// The linear scan CStakeModifierCandidates replaced: the first unselected
+// candidate, replaced by any later unselected one up to the stop with a
+// strictly lower selection hash
+static const CBlockIndex* SelectLinear(const vector<pair<int64_t, uint256>>& vSortedByTimestamp, const map<uint256, const CBlockIndex*>& mapCandidates, const set<uint256>& setSelected, int64_t nSelectionIntervalStop, uint64_t nStakeModifierPrev)
+{
+    bool fSelected = false;
+    uint256 hashBest = 0;
+    const CBlockIndex* pindexSelected = NULL;
+    BOOST_FOREACH (const PAIRTYPE(int64_t, uint256) & item, vSortedByTimestamp) {
+        const CBlockIndex* pindex = mapCandidates.find(item.second)->second;
+        if (fSelected && pindex->GetBlockTime() > nSelectionIntervalStop)
+            break;
+        if (setSelected.count(pindex->GetBlockHash()))
+            continue;
+        uint256 hashSelection = GetStakeModifierSelectionHash(pindex, nStakeModifierPrev);
+        if (!fSelected || hashSelection < hashBest) {
+            fSelected = true;
+            hashBest = hashSelection;
+            pindexSelected = pindex;
+        }
+    }
+    return pindexSelected;
+}
+
+BOOST_AUTO_TEST_SUITE(kernel_tests)
+
+BOOST_AUTO_TEST_CASE(stake_modifier_selection_equivalence)
+{
+    seed_insecure_rand(true);
+
+    for (int nTest = 0; nTest < 50; nTest++) {
+        // A candidate window with clustered timestamps so that ties on time
+        // and stops between equal timestamps come up, and a mix of stake
+        // and work blocks
+        int nCandidates = 1 + insecure_rand() % 150;
+        vector<uint256> vBlockHash(nCandidates);
+        vector<CBlockIndex> vIndex(nCandidates);
+        map<uint256, const CBlockIndex*> mapCandidates;
+        int64_t nTimeStart = 1500000000;
+        for (int i = 0; i < nCandidates; i++) {
+            vBlockHash[i] = GetRandHash();
+            vIndex[i].phashBlock = &vBlockHash[i];
+            vIndex[i].nTime = nTimeStart + insecure_rand() % (nCandidates * 4);
+            vIndex[i].hashProof = GetRandHash();
+            if (insecure_rand() & 1)
+                vIndex[i].SetProofOfStake();
+            mapCandidates[vBlockHash[i]] = &vIndex[i];
+        }
+        uint64_t nStakeModifierPrev = ((uint64_t)insecure_rand() << 32) | insecure_rand();
+
+        vector<pair<int64_t, uint256>> vSortedByTimestamp;
+        CStakeModifierCandidates candidates;
+        for (int i = 0; i < nCandidates; i++) {
+            vSortedByTimestamp.push_back(make_pair(vIndex[i].GetBlockTime(), vIndex[i].GetBlockHash()));
+            candidates.vSorted.push_back(make_pair(vSortedByTimestamp.back(), &vIndex[i]));
+        }
+        sort(vSortedByTimestamp.begin(), vSortedByTimestamp.end());
+        candidates.Prepare(nStakeModifierPrev);
+
+        // Start from a random selection mask
+        set<uint256> setSelected;
+        for (int i = 0; i < nCandidates; i++)
+            if (insecure_rand() % 4 == 0) {
+                setSelected.insert(candidates.vSorted[i].second->GetBlockHash());
+                candidates.MarkSelected(i);
+            }
+
+        // then select rounds as ComputeNextStakeModifier does, with stops
+        // that move forward unevenly, until every candidate is taken
+        int64_t nSelectionIntervalStop = nTimeStart - 1;
+        while (true) {
+            nSelectionIntervalStop += insecure_rand() % 12;
+            const CBlockIndex* pindexLinear = SelectLinear(vSortedByTimestamp, mapCandidates, setSelected, nSelectionIntervalStop, nStakeModifierPrev);
+            int nSelected = candidates.Select(nSelectionIntervalStop);
+            if (!pindexLinear) {
+                BOOST_CHECK_EQUAL(nSelected, -1);
+                BOOST_CHECK_EQUAL(setSelected.size(), (size_t)nCandidates);
+                break;
+            }
+            BOOST_REQUIRE(nSelected >= 0);
+            BOOST_CHECK(candidates.vSorted[nSelected].second == pindexLinear);
+            BOOST_CHECK(candidates.vHash[nSelected] == GetStakeModifierSelectionHash(pindexLinear, nStakeModifierPrev));
+            setSelected.insert(pindexLinear->GetBlockHash());
+            candidates.MarkSelected(nSelected);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,148 @@
+#include <boost/test/unit_test.hpp>
+
+#include "orphanpool.h"
+#include "util.h"
+
+using namespace std;
+
+static CTransaction MakeTx(const uint256& hashPrev, unsigned int nScriptBytes = 0)
+{
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout.hash = hashPrev;
+    tx.vin[0].prevout.n = 0;
+    tx.vin[0].scriptSig = CScript(vector<unsigned char>(nScriptBytes, 0x51));
+    tx.vout.resize(1);
+    tx.vout[0].nValue = CENT;
+    tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    return tx;
+}
+
+static unsigned int TxSize(const CTransaction& tx)
+{
+    return tx.GetSerializeSize(SER_NETWORK, CTransaction::CURRENT_VERSION);
+}
+
+BOOST_AUTO_TEST_SUITE(orphanpool_tests)
+
+BOOST_AUTO_TEST_CASE(orphanpool_add_children)
+{
+    COrphanTxPool pool;
+    uint256 hashParent = GetRandHash();
+    CTransaction child1 = MakeTx(hashParent);
+    CTransaction child2 = MakeTx(hashParent, 10);
+    CTransaction other = MakeTx(GetRandHash());
+
+    BOOST_CHECK(pool.Add(child1, 1));
+    BOOST_CHECK(!pool.Add(child1, 2));
+    BOOST_CHECK(pool.Add(child2, 2));
+    BOOST_CHECK(pool.Add(other, 1));
+    BOOST_CHECK(pool.Exists(child1.GetHash()));
+
+    vector<CTransaction> vChildren;
+    pool.GetChildren(hashParent, vChildren);
+    BOOST_CHECK_EQUAL(vChildren.size(), 2U);
+
+    BOOST_CHECK(pool.Erase(child1.GetHash(), true));
+    BOOST_CHECK(!pool.Erase(child1.GetHash(), true));
+    BOOST_CHECK(pool.Erase(child2.GetHash(), false));
+    vChildren.clear();
+    pool.GetChildren(hashParent, vChildren);
+    BOOST_CHECK(vChildren.empty());
+
+    COrphanTxPoolStats stats = pool.GetStats();
+    BOOST_CHECK_EQUAL(stats.nOrphans, 1U);
+    BOOST_CHECK_EQUAL(stats.nBytes, TxSize(other));
+    BOOST_CHECK_EQUAL(stats.nPeers, 1U);
+    BOOST_CHECK_EQUAL(stats.nAdded, 3U);
+    BOOST_CHECK_EQUAL(stats.nAccepted, 1U);
+    BOOST_CHECK_EQUAL(stats.nRemoved, 1U);
+}
+
+BOOST_AUTO_TEST_CASE(orphanpool_rejects_large)
+{
+    COrphanTxPool pool;
+    CTransaction tx = MakeTx(GetRandHash(), MAX_ORPHAN_TX_SIZE);
+    BOOST_CHECK(!pool.Add(tx, 1));
+    BOOST_CHECK(!pool.Exists(tx.GetHash()));
+    BOOST_CHECK_EQUAL(pool.GetStats().nRejectedSize, 1U);
+}
+
+BOOST_AUTO_TEST_CASE(orphanpool_peer_quota)
+{
+    COrphanTxPool pool;
+    unsigned int nSize = TxSize(MakeTx(0));
+    pool.SetLimits(100 * nSize, 3 * nSize);
+
+    for (int i = 0; i < 3; i++)
+        BOOST_CHECK(pool.Add(MakeTx(GetRandHash()), 1));
+    BOOST_CHECK(!pool.Add(MakeTx(GetRandHash()), 1));
+    BOOST_CHECK(pool.Add(MakeTx(GetRandHash()), 2));
+
+    COrphanTxPoolStats stats = pool.GetStats();
+    BOOST_CHECK_EQUAL(stats.nOrphans, 4U);
+    BOOST_CHECK_EQUAL(stats.nRejectedQuota, 1U);
+
+    BOOST_CHECK_EQUAL(pool.EraseForPeer(1), 3U);
+    BOOST_CHECK_EQUAL(pool.EraseForPeer(1), 0U);
+    stats = pool.GetStats();
+    BOOST_CHECK_EQUAL(stats.nOrphans, 1U);
+    BOOST_CHECK_EQUAL(stats.nPeers, 1U);
+    BOOST_CHECK_EQUAL(stats.nPeerErased, 3U);
+
+    // the peer's quota is free again
+    BOOST_CHECK(pool.Add(MakeTx(GetRandHash()), 1));
+}
+
+BOOST_AUTO_TEST_CASE(orphanpool_evicts_oldest)
+{
+    COrphanTxPool pool;
+    unsigned int nSize = TxSize(MakeTx(0));
+    pool.SetLimits(3 * nSize, 3 * nSize);
+
+    int64_t nTime = GetTime();
+    vector<CTransaction> vTx;
+    for (int i = 0; i < 4; i++) {
+        SetMockTime(nTime + i);
+        vTx.push_back(MakeTx(GetRandHash()));
+        pool.Add(vTx.back(), i);
+    }
+    SetMockTime(0);
+
+    BOOST_CHECK(!pool.Exists(vTx[0].GetHash()));
+    for (int i = 1; i < 4; i++)
+        BOOST_CHECK(pool.Exists(vTx[i].GetHash()));
+    COrphanTxPoolStats stats = pool.GetStats();
+    BOOST_CHECK_EQUAL(stats.nBytes, 3U * nSize);
+    BOOST_CHECK_EQUAL(stats.nEvicted, 1U);
+
+    // lowering the budget evicts right away
+    pool.SetLimits(nSize, nSize);
+    BOOST_CHECK(pool.Exists(vTx[3].GetHash()));
+    BOOST_CHECK_EQUAL(pool.GetStats().nOrphans, 1U);
+}
+
+BOOST_AUTO_TEST_CASE(orphanpool_expiry)
+{
+    COrphanTxPool pool;
+    int64_t nTime = GetTime();
+
+    SetMockTime(nTime);
+    CTransaction tx1 = MakeTx(GetRandHash());
+    BOOST_CHECK(pool.Add(tx1, 1));
+
+    SetMockTime(nTime + ORPHAN_TX_EXPIRE_TIME / 2);
+    CTransaction tx2 = MakeTx(GetRandHash());
+    BOOST_CHECK(pool.Add(tx2, 1));
+
+    // the sweep runs from Add
+    SetMockTime(nTime + ORPHAN_TX_EXPIRE_TIME);
+    BOOST_CHECK(pool.Add(MakeTx(GetRandHash()), 2));
+    SetMockTime(0);
+
+    BOOST_CHECK(!pool.Exists(tx1.GetHash()));
+    BOOST_CHECK(pool.Exists(tx2.GetHash()));
+    BOOST_CHECK_EQUAL(pool.GetStats().nExpired, 1U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,113 @@
+#include <boost/test/unit_test.hpp>
+
+#include "crypto/sha256.h"
+#include "hash.h"
+#include "util.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(sha256_tests)
+
+typedef struct {
+    const char* pszData;
+    const char* pszHash;
+} testvec_t;
+
+// FIPS 180-2 examples plus a few lengths around the padding boundaries
+static const testvec_t vtest[] = {
+    {"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+    {"abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+    {"message digest", "f7846f55cf23e14eebeab5b4e1550cad5b509e3348fbc4efa3a1413d393cb650"},
+    {"secure hash algorithm", "f30ceb2bb2829e79e4ca9753d35a8ecc00262d164cc077080295381cbd643f0d"},
+    {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+     "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+    {"For this sample, this 63-byte string will be used as input data",
+     "f08a78cbbaee082b052ae0708f32fa1e50c5c421aa772ba5dbb406a2ea6be342"},
+    {"This is exactly 64 bytes long, not counting the terminating byte",
+     "ab64eff7e88e2e46165e29f2bce41826bd4c7b3552f6b382a9e7d3af47c245f8"},
+};
+
+static string HashString(const string& str, size_t nSplit)
+{
+    unsigned char hash[CSHA256::OUTPUT_SIZE];
+    CSHA256 hasher;
+    hasher.Write((const unsigned char*)str.data(), nSplit);
+    hasher.Write((const unsigned char*)str.data() + nSplit, str.size() - nSplit);
+    hasher.Finalize(hash);
+    return HexStr(hash, hash + sizeof(hash));
+}
+
+static void CheckVectors()
+{
+    for (unsigned int n = 0; n < sizeof(vtest) / sizeof(vtest[0]); n++) {
+        string str(vtest[n].pszData);
+        // Every split point must give the same result
+        for (size_t nSplit = 0; nSplit <= str.size(); nSplit++)
+            BOOST_CHECK_EQUAL(HashString(str, nSplit), vtest[n].pszHash);
+    }
+
+    string strMillion(1000000, 'a');
+    BOOST_CHECK_EQUAL(HashString(strMillion, 333333), "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+}
+
+static void CheckD64()
+{
+    // SHA256D64 must agree with Hash() for every batch size, including the
+    // remainders left over by the 8-way and 4-way transforms.
+    for (int nBlocks = 0; nBlocks <= 32; nBlocks++) {
+        vector<unsigned char> vIn(64 * nBlocks);
+        for (size_t i = 0; i < vIn.size(); i++)
+            vIn[i] = (unsigned char)(i * 7 + nBlocks);
+        vector<unsigned char> vOut(32 * nBlocks);
+        SHA256D64(vOut.empty() ? NULL : &vOut[0], vIn.empty() ? NULL : &vIn[0], nBlocks);
+        for (int i = 0; i < nBlocks; i++) {
+            uint256 hash = Hash(vIn.begin() + 64 * i, vIn.begin() + 64 * (i + 1));
+            BOOST_CHECK(memcmp(hash.begin(), &vOut[32 * i], 32) == 0);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sha256_generic)
+{
+    CheckVectors();
+    CheckD64();
+}
+
+BOOST_AUTO_TEST_CASE(sha256_autodetect)
+{
+    string strImpl = SHA256AutoDetect();
+    BOOST_TEST_MESSAGE("SHA256 implementation: " << strImpl);
+    CheckVectors();
+    CheckD64();
+}
+
+BOOST_AUTO_TEST_CASE(sha256_double)
+{
+    // Hash() is double SHA256
+    string str("abc");
+    uint256 hash = Hash(str.begin(), str.end());
+    BOOST_CHECK_EQUAL(HexStr(hash.begin(), hash.end()), "4f8b42c22dd3729b519ba6f68d2da7cc5b2d606d05daed5ad5128cc03e6c6358");
+
+    CHashWriter ss(SER_GETHASH, 0);
+    ss.write(str.data(), str.size());
+    BOOST_CHECK(ss.GetHash() == hash);
+}
+
+// The batched merkle path matches hashing node pairs one at a time for
+// every pair, at batch sizes that leave remainders for each wide kernel
+BOOST_AUTO_TEST_CASE(sha256d64_batch_tests)
+{
+    const int vPairs[] = {1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 4099};
+    for (unsigned int n = 0; n < sizeof(vPairs) / sizeof(vPairs[0]); n++) {
+        int nPairs = vPairs[n];
+        vector<uint256> vIn(nPairs * 2);
+        for (size_t i = 0; i < vIn.size(); i++)
+            vIn[i] = Hash(BEGIN(i), END(i)) ^ nPairs;
+        vector<uint256> vOut(nPairs);
+        SHA256D64(vOut[0].begin(), vIn[0].begin(), nPairs);
+        for (int i = 0; i < nPairs; i++)
+            BOOST_CHECK(vOut[i] == Hash(BEGIN(vIn[2 * i]), END(vIn[2 * i]), BEGIN(vIn[2 * i + 1]), END(vIn[2 * i + 1])));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
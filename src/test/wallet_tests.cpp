@@ -1,7 +1,10 @@
 #include <boost/test/unit_test.hpp>
 
+#include "base58.h"
+#include "init.h"
 #include "main.h"
 #include "wallet.h"
+#include "walletdb.h"
 
 // how many times to run all the tests to have a chance to catch errors that only show up with particular random shuffles
 #define RUN_TESTS 100
@@ -57,6 +60,10 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     static CoinSet setCoinsRet, setCoinsRet2;
     static int64 nValueRet;
 
+    // These cases pin down the knapsack; branch and bound has its own cases
+    // in coin_selection_bnb_tests
+    nCoinSelection = COINSELECT_KNAPSACK;
+
     // test multiple times to allow for differences in the shuffle order
     for (int i = 0; i < RUN_TESTS; i++) {
         empty_wallet();
@@ -290,6 +297,477 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
             BOOST_CHECK_NE(fails, RANDOM_REPEATS);
         }
     }
+    nCoinSelection = COINSELECT_BNB;
+}
+
+BOOST_AUTO_TEST_CASE(coin_selection_bnb_tests)
+{
+    CoinSet setCoinsRet;
+    int64_t nValueRet;
+    bool fChangeless;
+
+    // same fee per input as SelectCoinsMinConf uses
+    int64_t nInputFee = max(nTransactionFee, MIN_TX_FEE) * 148 / 1000;
+    nCoinSelection = COINSELECT_BNB;
+
+    for (int i = 0; i < RUN_TESTS; i++) {
+        // 3 + 4 cents, each carrying the fee to spend it, pay 7 cents with
+        // nothing left over for change
+        empty_wallet();
+        add_coin(3 * CENT + nInputFee);
+        add_coin(4 * CENT + nInputFee);
+        add_coin(6 * CENT + nInputFee);
+        add_coin(10 * CENT);
+        BOOST_CHECK(wallet.SelectCoinsMinConf(7 * CENT, GetTime(), 1, 1, vCoins, setCoinsRet, nValueRet, &fChangeless));
+        BOOST_CHECK(fChangeless);
+        BOOST_CHECK_EQUAL(nValueRet, 7 * CENT + 2 * nInputFee);
+        BOOST_CHECK_EQUAL(setCoinsRet.size(), 2);
+
+        // 3 + 4 cents make 7 cents on their face but fall short once their
+        // fees are paid; 5 + 2 cents carrying their fees are the match
+        empty_wallet();
+        add_coin(3 * CENT);
+        add_coin(4 * CENT);
+        add_coin(5 * CENT + nInputFee);
+        add_coin(2 * CENT + nInputFee);
+        BOOST_CHECK(wallet.SelectCoinsMinConf(7 * CENT, GetTime(), 1, 1, vCoins, setCoinsRet, nValueRet, &fChangeless));
+        BOOST_CHECK(fChangeless);
+        BOOST_CHECK_EQUAL(nValueRet, 7 * CENT + 2 * nInputFee);
+        BOOST_CHECK_EQUAL(setCoinsRet.size(), 2);
+
+        // no subset of three 5 cent coins lands near 7 cents, so the
+        // knapsack picks two of them and the spend needs change
+        empty_wallet();
+        add_coin(5 * CENT);
+        add_coin(5 * CENT);
+        add_coin(5 * CENT);
+        BOOST_CHECK(wallet.SelectCoinsMinConf(7 * CENT, GetTime(), 1, 1, vCoins, setCoinsRet, nValueRet, &fChangeless));
+        BOOST_CHECK(!fChangeless);
+        BOOST_CHECK_EQUAL(nValueRet, 10 * CENT);
+        BOOST_CHECK_EQUAL(setCoinsRet.size(), 2);
+    }
+    empty_wallet();
+}
+
+// Outputs of one synthetic transaction, with values from a fixed-seed
+// generator so every run sees the same wallet
+static void MakeSyntheticCoins(CWalletTx& wtx, vector<COutput>& vOut, int nDistribution, int nCoins)
+{
+    uint64_t nSeed = 0x5eed + nDistribution;
+    wtx.vout.resize(nCoins);
+    vOut.clear();
+    for (int i = 0; i < nCoins; i++) {
+        nSeed = nSeed * 6364136223846793005ULL + 1442695040888963407ULL;
+        uint64_t r = nSeed >> 33;
+        int64_t nValue;
+        if (nDistribution == 0) // uniform small change
+            nValue = CENT / 10 + r % (5 * CENT);
+        else if (nDistribution == 1) // roughly exponential, many small and few large
+            nValue = (CENT / 10) << (r % 12);
+        else // bimodal, dust plus payments
+            nValue = (r & 1) ? CENT / 20 + r % CENT : 2 * COIN + r % COIN;
+        wtx.vout[i].nValue = nValue;
+        vOut.push_back(COutput(&wtx, i, 100));
+    }
+}
+
+// Both algorithms on a few synthetic wallets large enough to take the
+// largest-first fallback. Every target is covered, only branch and bound
+// reports a changeless spend, and a changeless spend stays within the cost
+// of a change output once the input fees are paid.
+BOOST_AUTO_TEST_CASE(coin_selection_synthetic_tests)
+{
+    const int nCoins = 2000;
+    const int nTargets = 50;
+    int64_t nInputFee = max(nTransactionFee, MIN_TX_FEE) * 148 / 1000;
+    int64_t nCostOfChange = max(nTransactionFee, MIN_TX_FEE) * (148 + 34) / 1000;
+
+    for (int d = 0; d < 3; d++) {
+        CWalletTx wtx;
+        vector<COutput> vSynthetic;
+        MakeSyntheticCoins(wtx, vSynthetic, d, nCoins);
+
+        for (int a = 0; a < 2; a++) {
+            nCoinSelection = a == 0 ? COINSELECT_BNB : COINSELECT_KNAPSACK;
+            int nChangeless = 0;
+            for (int t = 0; t < nTargets; t++) {
+                int64_t nTarget = COIN / 4 + t * (COIN / 7);
+                CoinSet setCoins;
+                int64_t nValueIn = 0;
+                bool fChangeless = false;
+                BOOST_CHECK(wallet.SelectCoinsMinConf(nTarget, GetTime(), 1, 6, vSynthetic, setCoins, nValueIn, &fChangeless));
+                BOOST_CHECK(nValueIn >= nTarget);
+                if (fChangeless) {
+                    int64_t nEffective = nValueIn - (int64_t)setCoins.size() * nInputFee;
+                    BOOST_CHECK(nEffective >= nTarget && nEffective <= nTarget + nCostOfChange);
+                    nChangeless++;
+                }
+            }
+            if (a == 0 && d == 0)
+                BOOST_CHECK_GT(nChangeless, 0);
+            if (a == 1)
+                BOOST_CHECK_EQUAL(nChangeless, 0);
+        }
+    }
+    nCoinSelection = COINSELECT_BNB;
+}
+
+BOOST_AUTO_TEST_CASE(stake_plan_tests)
+{
+    const int64_t nTarget = 100 * COIN;
+    const int64_t nBudget = 100000 * COIN;
+    CStakePlan plan;
+
+    // An empty wallet has nothing to plan or send
+    {
+        CWallet walletEmpty;
+        BOOST_CHECK(walletEmpty.PlanStakeOutputs(nTarget, plan));
+        BOOST_CHECK(plan.vTx.empty());
+        BOOST_CHECK_EQUAL(plan.nCoinsBefore, 0U);
+        BOOST_CHECK_EQUAL(plan.nCoinsAfter, 0U);
+        BOOST_CHECK_EQUAL(walletEmpty.ExecuteStakePlan(plan), 0);
+    }
+    BOOST_CHECK(!wallet.PlanStakeOutputs(0, vCoins, nBudget, plan));
+
+    // Outputs under half the target are merged; one at exactly half is not
+    empty_wallet();
+    add_coin(nTarget / 2 - 1);
+    add_coin(nTarget / 2 - 1);
+    add_coin(nTarget / 2);
+    BOOST_CHECK(wallet.PlanStakeOutputs(nTarget, vCoins, nBudget, plan));
+    BOOST_REQUIRE_EQUAL(plan.vTx.size(), 1U);
+    BOOST_CHECK_EQUAL(plan.vTx[0].vInputs.size(), 2U);
+    BOOST_CHECK_EQUAL(plan.vTx[0].nOutputs, 1U);
+    BOOST_CHECK_EQUAL(plan.vTx[0].nValueIn, nTarget - 2);
+    BOOST_CHECK_EQUAL(plan.nCoinsBefore, 3U);
+    BOOST_CHECK_EQUAL(plan.nCoinsAfter, 2U);
+    BOOST_CHECK_EQUAL(plan.nValueMoved, nTarget - 2);
+
+    // A lone small output has nothing to merge with
+    empty_wallet();
+    add_coin(nTarget / 2 - 1);
+    add_coin(nTarget);
+    BOOST_CHECK(wallet.PlanStakeOutputs(nTarget, vCoins, nBudget, plan));
+    BOOST_CHECK(plan.vTx.empty());
+    BOOST_CHECK_EQUAL(plan.nCoinsAfter, 2U);
+
+    // Outputs of twice the target or more are split into target-sized
+    // pieces, at most STAKE_PLAN_MAX_OUTPUTS of them; one just under twice
+    // the target is left alone
+    empty_wallet();
+    add_coin(2 * nTarget);
+    add_coin(2 * nTarget - 1);
+    add_coin(25 * nTarget);
+    BOOST_CHECK(wallet.PlanStakeOutputs(nTarget, vCoins, nBudget, plan));
+    BOOST_REQUIRE_EQUAL(plan.vTx.size(), 2U);
+    unsigned int nOutputs2 = 0, nOutputs25 = 0;
+    for (unsigned int i = 0; i < plan.vTx.size(); i++) {
+        BOOST_CHECK_EQUAL(plan.vTx[i].vInputs.size(), 1U);
+        if (plan.vTx[i].nValueIn == 2 * nTarget)
+            nOutputs2 = plan.vTx[i].nOutputs;
+        else if (plan.vTx[i].nValueIn == 25 * nTarget)
+            nOutputs25 = plan.vTx[i].nOutputs;
+    }
+    BOOST_CHECK_EQUAL(nOutputs2, 2U);
+    BOOST_CHECK_EQUAL(nOutputs25, 10U);
+    BOOST_CHECK_EQUAL(plan.nCoinsAfter, 3U + 1 + 9);
+    BOOST_CHECK_EQUAL(plan.nValueMoved, 27 * nTarget);
+
+    // Nothing is moved beyond the budget
+    BOOST_CHECK(wallet.PlanStakeOutputs(nTarget, vCoins, 2 * nTarget, plan));
+    BOOST_REQUIRE_EQUAL(plan.vTx.size(), 1U);
+    BOOST_CHECK_EQUAL(plan.vTx[0].nValueIn, 2 * nTarget);
+    BOOST_CHECK(wallet.PlanStakeOutputs(nTarget, vCoins, 0, plan));
+    BOOST_CHECK(plan.vTx.empty());
+
+    empty_wallet();
+}
+
+BOOST_AUTO_TEST_CASE(coin_index_tests)
+{
+    CScript scriptMine;
+    scriptMine.SetDestination(pwalletMain->GenerateNewKey().GetID());
+    CScript scriptOther;
+    scriptOther << OP_TRUE;
+
+    // a payment with one output to us and one to someone else
+    CTransaction txPay;
+    txPay.nLockTime = 0x7fffffff;
+    txPay.vout.resize(2);
+    txPay.vout[0].nValue = 5 * COIN;
+    txPay.vout[0].scriptPubKey = scriptMine;
+    txPay.vout[1].nValue = 3 * COIN;
+    txPay.vout[1].scriptPubKey = scriptOther;
+    uint256 hashPay = txPay.GetHash();
+    pwalletMain->AddToWallet(CWalletTx(pwalletMain, txPay));
+    {
+        LOCK(pwalletMain->cs_wallet);
+        BOOST_CHECK(pwalletMain->mapWalletCoins.count(COutPoint(hashPay, 0)));
+        BOOST_CHECK(!pwalletMain->mapWalletCoins.count(COutPoint(hashPay, 1)));
+        BOOST_CHECK(pwalletMain->mapWalletCoins[COutPoint(hashPay, 0)] == &pwalletMain->mapWallet[hashPay]);
+    }
+
+    // spending our output removes it from the index
+    CTransaction txSpend;
+    txSpend.vin.push_back(CTxIn(COutPoint(hashPay, 0)));
+    txSpend.vout.resize(1);
+    txSpend.vout[0].nValue = 4 * COIN;
+    txSpend.vout[0].scriptPubKey = scriptOther;
+    pwalletMain->AddToWallet(CWalletTx(pwalletMain, txSpend));
+    {
+        LOCK(pwalletMain->cs_wallet);
+        BOOST_CHECK(!pwalletMain->mapWalletCoins.count(COutPoint(hashPay, 0)));
+        BOOST_CHECK(pwalletMain->mapWallet[hashPay].IsSpent(0));
+
+        // and a rebuild from mapWallet agrees with the incremental updates
+        std::map<COutPoint, const CWalletTx*> mapBefore = pwalletMain->mapWalletCoins;
+        pwalletMain->RebuildCoinIndex();
+        BOOST_CHECK(mapBefore == pwalletMain->mapWalletCoins);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(script_index_tests)
+{
+    CWallet wallet;
+    LOCK(wallet.cs_wallet);
+
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    BOOST_CHECK(wallet.AddKeyPubKey(key, pubkey));
+    CKey keyOther;
+    keyOther.MakeNewKey(false);
+
+    CScript scriptP2PKH;
+    scriptP2PKH.SetDestination(pubkey.GetID());
+    CScript scriptP2PK;
+    scriptP2PK << pubkey << OP_CHECKSIG;
+    BOOST_CHECK(wallet.IsMine(scriptP2PKH));
+    BOOST_CHECK(wallet.IsMine(scriptP2PK));
+
+    CScript scriptOther;
+    scriptOther.SetDestination(keyOther.GetPubKey().GetID());
+    BOOST_CHECK(!wallet.IsMine(scriptOther));
+
+    // non-minimal push of our key hash misses the set but is still ours
+    CScript scriptNonMinimal;
+    scriptNonMinimal << OP_DUP << OP_HASH160;
+    scriptNonMinimal.push_back(OP_PUSHDATA1);
+    scriptNonMinimal.push_back(20);
+    CKeyID keyID = pubkey.GetID();
+    scriptNonMinimal.insert(scriptNonMinimal.end(), BEGIN(keyID), END(keyID));
+    scriptNonMinimal << OP_EQUALVERIFY << OP_CHECKSIG;
+    BOOST_CHECK(wallet.IsMine(scriptNonMinimal) == ::IsMine(wallet, scriptNonMinimal));
+
+    // bare multisig only counts when we hold every key
+    std::vector<CPubKey> vKeys(2, pubkey);
+    CScript scriptMulti;
+    scriptMulti.SetMultisig(1, vKeys);
+    BOOST_CHECK(wallet.IsMine(scriptMulti));
+    vKeys[1] = keyOther.GetPubKey();
+    CScript scriptMultiOther;
+    scriptMultiOther.SetMultisig(1, vKeys);
+    BOOST_CHECK(!wallet.IsMine(scriptMultiOther));
+
+    // P2SH needs the redeem script and the keys behind it
+    CScript scriptP2SH;
+    scriptP2SH.SetDestination(scriptMulti.GetID());
+    CScript scriptP2SHOther;
+    scriptP2SHOther.SetDestination(scriptMultiOther.GetID());
+    BOOST_CHECK(!wallet.IsMine(scriptP2SH));
+    BOOST_CHECK(wallet.AddCScript(scriptMulti));
+    BOOST_CHECK(wallet.AddCScript(scriptMultiOther));
+    BOOST_CHECK(wallet.IsMine(scriptP2SH));
+    BOOST_CHECK(!wallet.IsMine(scriptP2SHOther));
+}
+
+// IsMine over a block-sized stream of outputs for a 5,000 key wallet: the
+// index finds every output paying one of the keys and no foreign one, and
+// agrees with the solver on each script
+BOOST_AUTO_TEST_CASE(script_index_bulk_tests)
+{
+    const int nKeys = 5000;
+    const int nOutputs = 20000;
+    CWallet wallet;
+    LOCK(wallet.cs_wallet);
+
+    std::vector<CScript> vScripts;
+    for (int i = 0; i < nKeys; i++) {
+        CKey key;
+        key.MakeNewKey(true);
+        wallet.AddKeyPubKey(key, key.GetPubKey());
+        if (i % 100 == 0) {
+            vScripts.push_back(CScript());
+            vScripts.back().SetDestination(key.GetPubKey().GetID());
+        }
+    }
+    int nHits = vScripts.size();
+    while ((int)vScripts.size() < nOutputs) {
+        uint256 hashRand = GetRandHash();
+        vScripts.push_back(CScript());
+        vScripts.back().SetDestination(CKeyID(Hash160(BEGIN(hashRand), END(hashRand))));
+    }
+
+    int nMine = 0;
+    for (int i = 0; i < nOutputs; i++) {
+        bool fMine = wallet.IsMine(vScripts[i]);
+        BOOST_CHECK_EQUAL(fMine, i < nHits);
+        BOOST_CHECK_EQUAL(fMine, ::IsMine(wallet, vScripts[i]));
+        nMine += fMine;
+    }
+    BOOST_CHECK_EQUAL(nMine, nKeys / 100);
+}
+
+BOOST_AUTO_TEST_CASE(keypool_batch_tests)
+{
+    CWallet walletPool;
+    set<CKeyID> setKeys;
+
+    // A synchronous refill spanning several batches
+    BOOST_CHECK(walletPool.TopUpKeyPool(1200, true));
+    {
+        LOCK(walletPool.cs_wallet);
+        BOOST_CHECK_EQUAL(walletPool.GetKeyPoolSize(), 1201U);
+        BOOST_CHECK_EQUAL(*walletPool.setKeyPool.begin(), 1);
+        BOOST_CHECK_EQUAL(*walletPool.setKeyPool.rbegin(), 1201);
+        walletPool.GetKeys(setKeys);
+        BOOST_CHECK_EQUAL(setKeys.size(), 1201U);
+    }
+
+    // With keys still in the pool a large refill returns at once and
+    // finishes in the background
+    BOOST_CHECK(walletPool.TopUpKeyPool(3000));
+    while (true) {
+        {
+            LOCK(walletPool.cs_wallet);
+            if (!walletPool.fKeyPoolRefilling)
+                break;
+        }
+        MilliSleep(10);
+    }
+    {
+        LOCK(walletPool.cs_wallet);
+        BOOST_CHECK_EQUAL(walletPool.GetKeyPoolSize(), 3001U);
+        BOOST_CHECK_EQUAL(*walletPool.setKeyPool.rbegin(), 3001);
+        walletPool.GetKeys(setKeys);
+        BOOST_CHECK_EQUAL(setKeys.size(), 3001U);
+    }
+
+    // Handing out a few keys leaves a gap of less than one batch, which is
+    // refilled before TopUpKeyPool returns, continuing the pool indexes
+    {
+        LOCK(walletPool.cs_wallet);
+        for (int i = 0; i < 10; i++)
+            walletPool.setKeyPool.erase(walletPool.setKeyPool.begin());
+    }
+    BOOST_CHECK(walletPool.TopUpKeyPool(3000));
+    {
+        LOCK(walletPool.cs_wallet);
+        BOOST_CHECK(!walletPool.fKeyPoolRefilling);
+        BOOST_CHECK_EQUAL(walletPool.GetKeyPoolSize(), 3001U);
+        BOOST_CHECK_EQUAL(*walletPool.setKeyPool.begin(), 11);
+        BOOST_CHECK_EQUAL(*walletPool.setKeyPool.rbegin(), 3011);
+        walletPool.GetKeys(setKeys);
+        BOOST_CHECK_EQUAL(setKeys.size(), 3011U);
+    }
+}
+
+// Single writes and a grouped transaction on each wallet backend load back
+// in full, and a BDB wallet carried over to LevelDB keeps its records
+BOOST_AUTO_TEST_CASE(walletdb_backend_tests)
+{
+    const int nRecords = 2000;
+    const WalletBackend vBackends[] = {WALLET_BACKEND_BDB, WALLET_BACKEND_LEVELDB};
+    const char* vNames[] = {"bdb", "leveldb"};
+
+    vector<string> vAddresses;
+    for (int i = 0; i < nRecords; i++) {
+        uint256 hashRand = GetRandHash();
+        vAddresses.push_back(CEraAddress(CKeyID(Hash160(BEGIN(hashRand), END(hashRand)))).ToString());
+    }
+
+    for (int n = 0; n < 2; n++) {
+        string strFile = strprintf("walletbackend_%s.dat", vNames[n]);
+        {
+            CWalletDB walletdb(strFile, "cr+", vBackends[n]);
+            for (int i = 0; i < nRecords; i++)
+                BOOST_CHECK(walletdb.WriteName(vAddresses[i], "backend"));
+
+            BOOST_CHECK(walletdb.TxnBegin());
+            for (int i = 0; i < nRecords; i++)
+                BOOST_CHECK(walletdb.WritePool(i + 1, CKeyPool(CPubKey())));
+            BOOST_CHECK(walletdb.TxnCommit());
+        }
+
+        nWalletBackend = vBackends[n];
+        CWallet walletLoad(strFile);
+        bool fFirstRun;
+        BOOST_CHECK(walletLoad.LoadWallet(fFirstRun) == DB_LOAD_OK);
+        BOOST_CHECK_EQUAL(walletLoad.mapAddressBook.size(), (size_t)nRecords);
+        BOOST_CHECK_EQUAL(walletLoad.setKeyPool.size(), (size_t)nRecords);
+        nWalletBackend = WALLET_BACKEND_BDB;
+    }
+
+    // The BDB wallet written above, carried over to LevelDB
+    string strFile = "walletbackend_bdb.dat";
+    BOOST_CHECK(CDB::Migrate(strFile, WALLET_BACKEND_LEVELDB));
+
+    nWalletBackend = WALLET_BACKEND_LEVELDB;
+    CWallet walletMigrated(strFile);
+    bool fFirstRun;
+    BOOST_CHECK(walletMigrated.LoadWallet(fFirstRun) == DB_LOAD_OK);
+    BOOST_CHECK_EQUAL(walletMigrated.mapAddressBook.size(), (size_t)nRecords);
+    BOOST_CHECK_EQUAL(walletMigrated.setKeyPool.size(), (size_t)nRecords);
+    nWalletBackend = WALLET_BACKEND_BDB;
+}
+
+// A key, a transaction and an address book entry written to a LevelDB
+// wallet store read back after the store is reopened, and again from a
+// backupwallet copy of it
+BOOST_AUTO_TEST_CASE(walletdb_leveldb_roundtrip)
+{
+    const string strFile = "walletstore_roundtrip.dat";
+    const string strBackup = "walletstore_backup.dat";
+
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    CTransaction tx;
+    tx.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 5 * COIN;
+    tx.vout[0].scriptPubKey.SetDestination(pubkey.GetID());
+    CWalletTx wtx(NULL, tx);
+    wtx.mapValue["comment"] = "roundtrip";
+    uint256 hashTx = wtx.GetHash();
+    {
+        CWalletDB walletdb(strFile, "cr+", WALLET_BACKEND_LEVELDB);
+        BOOST_CHECK(walletdb.WriteKey(pubkey, key.GetPrivKey(), CKeyMetadata(GetTime())));
+        BOOST_CHECK(walletdb.WriteTx(hashTx, wtx));
+        BOOST_CHECK(walletdb.WriteName(CEraAddress(pubkey.GetID()).ToString(), "roundtrip"));
+    }
+
+    // A mock store lives in memory and has no files for backupwallet to copy
+    int nPasses = bitdb.IsMock() ? 1 : 2;
+    nWalletBackend = WALLET_BACKEND_LEVELDB;
+    for (int n = 0; n < nPasses; n++) {
+        CWallet walletLoad(n == 0 ? strFile : strBackup);
+        bool fFirstRun;
+        BOOST_CHECK(walletLoad.LoadWallet(fFirstRun) == DB_LOAD_OK);
+        {
+            LOCK(walletLoad.cs_wallet);
+            CKey keyLoaded;
+            BOOST_CHECK(walletLoad.GetKey(pubkey.GetID(), keyLoaded));
+            BOOST_CHECK(keyLoaded.GetPubKey() == pubkey);
+            BOOST_REQUIRE(walletLoad.mapWallet.count(hashTx));
+            BOOST_CHECK_EQUAL(walletLoad.mapWallet[hashTx].vout[0].nValue, 5 * COIN);
+            BOOST_CHECK_EQUAL(walletLoad.mapWallet[hashTx].mapValue["comment"], "roundtrip");
+            BOOST_CHECK_EQUAL(walletLoad.mapAddressBook[pubkey.GetID()], "roundtrip");
+        }
+        if (n == 0 && nPasses > 1)
+            BOOST_CHECK(BackupWallet(walletLoad, GetWalletStorePath(strBackup).string()));
+    }
+    nWalletBackend = WALLET_BACKEND_BDB;
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -7,6 +7,7 @@
 
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
+#include <boost/thread/tss.hpp>
 #include <boost/version.hpp>
 
 #include <leveldb/cache.h>
@@ -25,12 +26,73 @@ using namespace boost;
 
 leveldb::DB* txdb; // global pointer for LevelDB object instance
 
+// Tuning profiles. The write buffer size and the level-0 compaction triggers
+// can be changed while the database is open; block size and the open file
+// limit are fixed when it is opened and so are not part of a profile.
+struct CTxDBProfile {
+    const char* pszName;
+    int nWriteBufferMB;
+    int nL0Compaction;
+    int nL0Slowdown;
+    int nL0Stop;
+};
+
+// Initial sync: a large write buffer and room for level-0 files to pile up,
+// so that connecting blocks in bulk is not throttled by compactions.
+static const CTxDBProfile profileInitialSync = {"initialsync", 64, 8, 20, 32};
+
+// Steady state: LevelDB's default triggers keep the number of level-0 files
+// each read has to merge low, and a smaller write buffer bounds memory use.
+static const CTxDBProfile profileSteady = {"steady", 8, 4, 8, 12};
+
+static CCriticalSection cs_txdbTuning;
+static const CTxDBProfile* pprofileActive = NULL;
+static leveldb::Options optionsActive;
+
+static const CTxDBProfile& SelectProfile(bool fInitialDownload)
+{
+    string strProfile = GetArg("-dbprofile", "auto");
+    if (strProfile == "initialsync")
+        return profileInitialSync;
+    if (strProfile == "steady")
+        return profileSteady;
+    return fInitialDownload ? profileInitialSync : profileSteady;
+}
+
+// Explicit -dbwritebuffer and -dbl0trigger settings override both profiles
+static void ApplyProfile(leveldb::Options& options, const CTxDBProfile& profile)
+{
+    options.write_buffer_size = GetArg("-dbwritebuffer", profile.nWriteBufferMB) * 1048576;
+    options.l0_compaction_trigger = GetArg("-dbl0trigger", profile.nL0Compaction);
+    options.l0_slowdown_writes_trigger = max(profile.nL0Slowdown, options.l0_compaction_trigger);
+    options.l0_stop_writes_trigger = max(profile.nL0Stop, options.l0_slowdown_writes_trigger);
+}
+
 static leveldb::Options GetOptions()
 {
     leveldb::Options options;
     int nCacheSizeMB = GetArg("-dbcache", 25);
     options.block_cache = leveldb::NewLRUCache(nCacheSizeMB * 1048576);
     options.filter_policy = leveldb::NewBloomFilterPolicy(10);
+    options.block_size = GetArg("-dbblocksize", 4) * 1024;
+    options.max_open_files = GetArg("-dbmaxopenfiles", 1000);
+
+    // The block index is not loaded yet, so open in the initial sync profile
+    // unless one is forced; UpdateTxDBTuning() moves on from there.
+    {
+        LOCK(cs_txdbTuning);
+        pprofileActive = &SelectProfile(true);
+        ApplyProfile(options, *pprofileActive);
+        optionsActive = options;
+    }
+
+    // Block compression. Transaction index keys are hashes and compress
+    // poorly, so the default stays uncompressed; zlib trades CPU for disk.
+    // AppInit2() has already rejected any other codec.
+    if (GetArg("-dbcompression", "none") == "zlib")
+        options.compression = leveldb::kZlibCompression;
+    else
+        options.compression = leveldb::kNoCompression;
     return options;
 }
 
@@ -75,6 +137,7 @@ CTxDB::CTxDB(const char* pszMode)
 {
     assert(pszMode);
     activeBatch = NULL;
+    nSnapshotDepth = 0;
     fReadOnly = (!strchr(pszMode, '+') && !strchr(pszMode, 'w'));
 
     if (txdb) {
@@ -124,6 +187,10 @@ CTxDB::CTxDB(const char* pszMode)
 
 void CTxDB::Close()
 {
+    {
+        LOCK(cs_txdbTuning);
+        pprofileActive = NULL;
+    }
     delete txdb;
     txdb = pdb = NULL;
     delete options.filter_policy;
@@ -134,8 +201,65 @@ void CTxDB::Close()
     activeBatch = NULL;
 }
 
+void UpdateTxDBTuning(bool fInitialDownload)
+{
+    LOCK(cs_txdbTuning);
+    const CTxDBProfile& profile = SelectProfile(fInitialDownload);
+    if (!txdb || &profile == pprofileActive)
+        return;
+
+    leveldb::Options options = optionsActive;
+    ApplyProfile(options, profile);
+    leveldb::Status status = txdb->SetTuning(options);
+    if (!status.ok())
+        LogPrintf("UpdateTxDBTuning() : %s\n", status.ToString());
+    else
+        LogPrintf("Switched transaction index to the %s tuning profile\n", profile.pszName);
+
+    // Do not retry a failed switch on every block
+    pprofileActive = &profile;
+    optionsActive = options;
+}
+
+string GetTxDBTuning(leveldb::Options& options)
+{
+    LOCK(cs_txdbTuning);
+    options = optionsActive;
+    return pprofileActive ? pprofileActive->pszName : "";
+}
+
+static boost::thread_specific_ptr<CTxDB> ptxdbRead;
+
+CTxDB& GetReadTxDB()
+{
+    // The index is opened once at startup and never reopened while the
+    // node runs, so the handle stays valid for the life of the thread.
+    CTxDB* ptxdb = ptxdbRead.get();
+    if (!ptxdb) {
+        ptxdb = new CTxDB("r");
+        ptxdbRead.reset(ptxdb);
+    }
+    return *ptxdb;
+}
+
+void CTxDB::BeginSnapshot()
+{
+    if (nSnapshotDepth++ == 0)
+        readOptions.snapshot = pdb->GetSnapshot();
+}
+
+void CTxDB::EndSnapshot()
+{
+    assert(nSnapshotDepth > 0);
+    if (--nSnapshotDepth == 0) {
+        pdb->ReleaseSnapshot(readOptions.snapshot);
+        readOptions.snapshot = NULL;
+    }
+}
+
 bool CTxDB::TxnBegin()
 {
+    assert(!fReadOnly);
     assert(!activeBatch);
     activeBatch = new leveldb::WriteBatch();
     return true;
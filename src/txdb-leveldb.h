@@ -36,6 +36,8 @@ public:
         // Note that this is not the same as Close() because it deletes only
         // data scoped to this TxDB object.
         delete activeBatch;
+        if (readOptions.snapshot)
+            pdb->ReleaseSnapshot(readOptions.snapshot);
     }
 
     // Destroys the underlying shared global state accessed by this TxDB.
@@ -47,6 +49,9 @@ private:
     // A batch stores up writes and deletes for atomic application. When this
     // field is non-NULL, writes/deletes go there instead of directly to disk.
     leveldb::WriteBatch* activeBatch;
+    // Used for every read; carries the snapshot while one is held.
+    leveldb::ReadOptions readOptions;
+    int nSnapshotDepth;
     leveldb::Options options;
     bool fReadOnly;
     int nVersion;
@@ -76,8 +81,7 @@ protected:
             }
         }
         if (readFromDb) {
-            leveldb::Status status = pdb->Get(leveldb::ReadOptions(),
-                                              ssKey.str(), &strValue);
+            leveldb::Status status = pdb->Get(readOptions, ssKey.str(), &strValue);
             if (!status.ok()) {
                 if (status.IsNotFound())
                     return false;
@@ -157,7 +161,7 @@ protected:
         }
 
 
-        leveldb::Status status = pdb->Get(leveldb::ReadOptions(), ssKey.str(), &unused);
+        leveldb::Status status = pdb->Get(readOptions, ssKey.str(), &unused);
         return status.IsNotFound() == false;
     }
 
@@ -172,6 +176,12 @@ public:
         return true;
     }
 
+    // Until the matching EndSnapshot(), reads see the database as it was at
+    // the outermost BeginSnapshot(). Pending batch writes are still seen.
+    // Use CTxDBSnapshot rather than calling these directly.
+    void BeginSnapshot();
+    void EndSnapshot();
+
     bool ReadVersion(int& nVersion)
     {
         nVersion = 0;
@@ -199,9 +209,47 @@ public:
     bool WriteBestInvalidTrust(CBigNum bnBestInvalidTrust);
     bool LoadBlockIndex();
 
+    // Reads a LevelDB property such as "leveldb.stats"; see leveldb/db.h.
+    bool GetProperty(const std::string& strName, std::string& strValue)
+    {
+        return pdb->GetProperty(strName, &strValue);
+    }
+
 private:
     bool LoadBlockIndexGuts();
 };
 
+// Returns a read-only CTxDB owned by the calling thread. The network,
+// validation and staking paths look things up many times a second; this
+// saves them constructing and tearing down a CTxDB for every lookup. Only
+// for reads: never start a transaction on it.
+CTxDB& GetReadTxDB();
+
+// Holds a snapshot on txdb for the lifetime of the object, so that a series
+// of reads is consistent even while blocks are being connected. Nests: an
+// inner snapshot on the same CTxDB keeps the outer one's view.
+class CTxDBSnapshot
+{
+public:
+    explicit CTxDBSnapshot(CTxDB& txdbIn) : txdbHeld(txdbIn)
+    {
+        txdbHeld.BeginSnapshot();
+    }
+    ~CTxDBSnapshot()
+    {
+        txdbHeld.EndSnapshot();
+    }
+
+private:
+    CTxDB& txdbHeld;
+};
+
+// Switches the transaction index between the initial sync and steady state
+// tuning profiles (see -dbprofile). Cheap when the profile does not change.
+void UpdateTxDBTuning(bool fInitialDownload);
+
+// Returns the name of the active tuning profile and the options it applied.
+std::string GetTxDBTuning(leveldb::Options& options);
+
 
 #endif // ERA_DB_H
@@ -0,0 +1,246 @@
+// Copyright (c) 2018 The Era developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txvalidation.h"
+
+#include "orphanpool.h"
+#include "txdb.h"
+#include "util.h"
+
+using namespace std;
+
+CTxValidationQueue txValidationQueue;
+
+CTxValidationQueue::CTxValidationQueue()
+{
+    nThreads = 0;
+    stats.nQueued = 0;
+    stats.nInFlight = 0;
+    stats.nProcessed = 0;
+    stats.nAccepted = 0;
+    stats.nDropped = 0;
+    stats.dAvgLatencyMs = 0;
+    stats.dMaxLatencyMs = 0;
+}
+
+void CTxValidationQueue::Start(boost::thread_group& threadGroup, int nThreadsIn)
+{
+    nThreads = nThreadsIn;
+    for (int i = 0; i < nThreads; i++)
+        threadGroup.create_thread(boost::bind(&CTxValidationQueue::ThreadWorker, this));
+    LogPrintf("Using %d transaction validation threads\n", nThreads);
+}
+
+void CTxValidationQueue::Enqueue(const CTransaction& tx, CNode* pfrom, bool fOrphan)
+{
+    CQueuedTx entry;
+    entry.tx = tx;
+    entry.fOrphan = fOrphan;
+    entry.nTimeQueued = GetTimeMicros();
+    if (pfrom) {
+        LOCK(cs_vNodes);
+        entry.pfrom = pfrom->AddRef();
+        entry.nPeer = pfrom->GetId();
+    }
+
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (queue.size() < MAX_TX_VALIDATION_QUEUE) {
+            queue.push_back(entry);
+            stats.nQueued = queue.size();
+            entry.pfrom = NULL;
+        } else
+            stats.nDropped++;
+    }
+
+    if (entry.pfrom) {
+        LogPrint("mempool", "transaction validation queue full, dropped %s\n", tx.GetHash().ToString());
+        LOCK(cs_vNodes);
+        entry.pfrom->Release();
+    } else
+        cond.notify_one();
+}
+
+void CTxValidationQueue::Push(const CTransaction& tx, CNode* pfrom, bool fOrphan)
+{
+    Enqueue(tx, pfrom, fOrphan);
+
+    // No workers: validate here, along with any orphans it unlocks
+    if (nThreads == 0)
+        while (ProcessBatch(false)) {
+        }
+}
+
+CTxValidationStats CTxValidationQueue::GetStats() const
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return stats;
+}
+
+void CTxValidationQueue::ThreadWorker()
+{
+    RenameThread("era-txvalid");
+
+    while (true) {
+        boost::this_thread::interruption_point();
+        ProcessBatch(true);
+    }
+}
+
+bool CTxValidationQueue::ProcessBatch(bool fWait)
+{
+    vector<CQueuedTx> vBatch;
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (queue.empty()) {
+            if (!fWait)
+                return false;
+            cond.wait(lock);
+        }
+
+        // Share a burst out between the workers rather than one taking it all
+        size_t nBatch = std::min((size_t)TX_VALIDATION_BATCH_SIZE, std::max((size_t)1, queue.size() / std::max(1, nThreads)));
+        vBatch.assign(queue.begin(), queue.begin() + nBatch);
+        queue.erase(queue.begin(), queue.begin() + nBatch);
+        stats.nQueued = queue.size();
+        stats.nInFlight += nBatch;
+    }
+
+    CheckScripts(vBatch);
+    FinishBatch(vBatch);
+    return true;
+}
+
+void CTxValidationQueue::CheckScripts(vector<CQueuedTx>& vBatch)
+{
+    // Fetch every transaction the batch spends from, once each. std::map
+    // keeps the hashes sorted, so the txdb reads walk the key space in order.
+    map<uint256, CTransaction> mapPrev;
+    map<uint256, const CTransaction*> mapBatch;
+    BOOST_FOREACH (const CQueuedTx& entry, vBatch) {
+        mapBatch[entry.tx.GetHash()] = &entry.tx;
+        BOOST_FOREACH (const CTxIn& txin, entry.tx.vin)
+            mapPrev[txin.prevout.hash];
+    }
+
+    // Blocks may be connected meanwhile; read every parent from one state
+    set<uint256> setMissing;
+    {
+        CTxDB& txdb = GetReadTxDB();
+        CTxDBSnapshot snapshot(txdb);
+        for (map<uint256, CTransaction>::iterator it = mapPrev.begin(); it != mapPrev.end(); ++it) {
+            map<uint256, const CTransaction*>::const_iterator mi = mapBatch.find(it->first);
+            if (mi != mapBatch.end())
+                it->second = *mi->second;
+            else if (!mempool.lookup(it->first, it->second) && !txdb.ReadDiskTx(it->first, it->second))
+                setMissing.insert(it->first);
+        }
+    }
+
+    BOOST_FOREACH (CQueuedTx& entry, vBatch) {
+        const CTransaction& tx = entry.tx;
+        if (tx.IsCoinBase() || tx.IsCoinStake() || mempool.exists(tx.GetHash()) || !tx.CheckTransaction())
+            continue;
+
+        // Only spend signature checks on transactions that pass the cheap
+        // input checks; anything else is rejected later without them.
+        bool fCheap = true;
+        int64_t nValueIn = 0;
+        BOOST_FOREACH (const CTxIn& txin, tx.vin) {
+            const COutPoint& prevout = txin.prevout;
+            if (setMissing.count(prevout.hash)) {
+                fCheap = false;
+                break;
+            }
+            const CTransaction& txPrev = mapPrev[prevout.hash];
+            if (prevout.n >= txPrev.vout.size() || txPrev.nTime > tx.nTime) {
+                fCheap = false;
+                break;
+            }
+            nValueIn += txPrev.vout[prevout.n].nValue;
+            if (!MoneyRange(txPrev.vout[prevout.n].nValue) || !MoneyRange(nValueIn)) {
+                fCheap = false;
+                break;
+            }
+        }
+        if (!fCheap || nValueIn - tx.GetValueOut() < GetMinFee(tx, 1000, GMF_RELAY, ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION)))
+            continue;
+
+        // Same two passes as ConnectInputs from AcceptToMemoryPool
+        entry.fScriptsChecked = true;
+        for (unsigned int i = 0; i < tx.vin.size(); i++) {
+            const CTransaction& txPrev = mapPrev[tx.vin[i].prevout.hash];
+            if (!VerifySignature(txPrev, tx, i, STANDARD_SCRIPT_VERIFY_FLAGS, 0)) {
+                // Failing only a non-mandatory flag is not the sender's fault
+                bool fMandatoryOk = VerifySignature(txPrev, tx, i, STANDARD_SCRIPT_VERIFY_FLAGS & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, 0);
+                entry.nScriptDoS = fMandatoryOk ? 0 : 100;
+                break;
+            }
+            if (!VerifySignature(txPrev, tx, i, MANDATORY_SCRIPT_VERIFY_FLAGS, 0)) {
+                LogPrintf("CheckScripts() : BUG! PLEASE REPORT THIS! VerifySignature failed against MANDATORY but not STANDARD flags %s\n", tx.GetHash().ToString());
+                entry.nScriptDoS = 100;
+                break;
+            }
+        }
+    }
+}
+
+void CTxValidationQueue::FinishBatch(vector<CQueuedTx>& vBatch)
+{
+    vector<CTransaction> vOrphans;
+    unsigned int nAccepted = 0;
+    {
+        LOCK(cs_main);
+        BOOST_FOREACH (CQueuedTx& entry, vBatch) {
+            CTransaction& tx = entry.tx;
+            uint256 hash = tx.GetHash();
+            mapAlreadyAskedFor.erase(CInv(MSG_TX, hash));
+
+            bool fAccepted = false;
+            bool fMissingInputs = false;
+            if (entry.nScriptDoS >= 0) {
+                tx.DoS(entry.nScriptDoS, error("FinishBatch() : %s VerifySignature failed", hash.ToString()));
+            } else if (AcceptToMemoryPool(mempool, tx, true, &fMissingInputs, !entry.fScriptsChecked)) {
+                fAccepted = true;
+                nAccepted++;
+                if (entry.fOrphan)
+                    LogPrint("mempool", "   accepted orphan tx %s\n", hash.ToString());
+                RelayTransaction(tx, hash);
+                // Retry whatever was waiting on this one
+                orphanTxPool.GetChildren(hash, vOrphans);
+            }
+
+            if (fAccepted || !fMissingInputs) {
+                if (entry.fOrphan && !fAccepted)
+                    LogPrint("mempool", "   removed orphan tx %s\n", hash.ToString());
+                orphanTxPool.Erase(hash, fAccepted);
+            } else if (!entry.fOrphan) {
+                orphanTxPool.Add(tx, entry.nPeer);
+            }
+            if (tx.nDoS && entry.pfrom)
+                entry.pfrom->Misbehaving(tx.nDoS);
+        }
+    }
+
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH (CQueuedTx& entry, vBatch)
+            if (entry.pfrom)
+                entry.pfrom->Release();
+    }
+
+    BOOST_FOREACH (const CTransaction& tx, vOrphans)
+        Enqueue(tx, NULL, true);
+
+    int64_t nNow = GetTimeMicros();
+    boost::unique_lock<boost::mutex> lock(mutex);
+    stats.nInFlight -= vBatch.size();
+    stats.nProcessed += vBatch.size();
+    stats.nAccepted += nAccepted;
+    BOOST_FOREACH (const CQueuedTx& entry, vBatch) {
+        double dLatencyMs = (nNow - entry.nTimeQueued) / 1000.0;
+        stats.dAvgLatencyMs = stats.dAvgLatencyMs == 0 ? dLatencyMs : 0.95 * stats.dAvgLatencyMs + 0.05 * dLatencyMs;
+        stats.dMaxLatencyMs = std::max(stats.dMaxLatencyMs, dLatencyMs);
+    }
+}
@@ -0,0 +1,86 @@
+// Copyright (c) 2018 The Era developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef ERA_TXVALIDATION_H
+#define ERA_TXVALIDATION_H
+
+#include "main.h"
+
+#include <deque>
+
+#include <boost/thread.hpp>
+
+/** Default for -txvalidationthreads */
+static const int DEFAULT_TX_VALIDATION_THREADS = 2;
+/** Transactions waiting beyond this are dropped; the peer or another will re-announce them */
+static const unsigned int MAX_TX_VALIDATION_QUEUE = 5000;
+/** Most transactions one worker checks and then inserts under a single cs_main */
+static const unsigned int TX_VALIDATION_BATCH_SIZE = 64;
+
+/** A transaction on its way into the mempool */
+class CQueuedTx
+{
+public:
+    CTransaction tx;
+    CNode* pfrom;      // holds a reference; NULL for a retried orphan
+    NodeId nPeer;      // -1 without pfrom
+    bool fOrphan;      // came from the orphan pool
+    int64_t nTimeQueued;
+
+    // Outcome of the off-lock checks
+    bool fScriptsChecked; // every input script verified against its prevout
+    int nScriptDoS;       // >= 0 when a script failed; DoS score for the sender
+
+    CQueuedTx() : pfrom(NULL), nPeer(-1), fOrphan(false), nTimeQueued(0), fScriptsChecked(false), nScriptDoS(-1) {}
+};
+
+class CTxValidationStats
+{
+public:
+    unsigned int nQueued;
+    unsigned int nInFlight;
+    uint64_t nProcessed;
+    uint64_t nAccepted;
+    uint64_t nDropped;
+    double dAvgLatencyMs; // exponential moving average, queue to mempool
+    double dMaxLatencyMs;
+};
+
+/**
+ * Moves signature checking for relayed transactions off the message handler
+ * thread. ProcessMessage only enqueues; worker threads fetch the inputs of a
+ * batch in one pass, verify its scripts without holding cs_main, then take
+ * cs_main once to run the remaining AcceptToMemoryPool checks and insert.
+ * Script results do not depend on chain state (a prevout's script is fixed
+ * by its txid), so they stay valid even if the tip moves in between.
+ *
+ * With no worker threads, Push() processes the transaction before returning.
+ */
+class CTxValidationQueue
+{
+public:
+    CTxValidationQueue();
+
+    void Start(boost::thread_group& threadGroup, int nThreadsIn);
+    /** Queue a transaction received from pfrom (may be NULL) */
+    void Push(const CTransaction& tx, CNode* pfrom, bool fOrphan = false);
+    CTxValidationStats GetStats() const;
+
+private:
+    mutable boost::mutex mutex;
+    boost::condition_variable cond;
+    std::deque<CQueuedTx> queue;
+    int nThreads;
+    CTxValidationStats stats;
+
+    void Enqueue(const CTransaction& tx, CNode* pfrom, bool fOrphan);
+    void ThreadWorker();
+    /** Check and insert up to TX_VALIDATION_BATCH_SIZE queued transactions; false if none */
+    bool ProcessBatch(bool fWait);
+    void CheckScripts(std::vector<CQueuedTx>& vBatch);
+    void FinishBatch(std::vector<CQueuedTx>& vBatch);
+};
+
+extern CTxValidationQueue txValidationQueue;
+
+#endif // ERA_TXVALIDATION_H
@@ -83,6 +83,12 @@ public:
     /** Translate a message to the native language of the user. */
     boost::signals2::signal<std::string(const char* psz)> Translate;
 
+    /**
+     * New best chain tip.
+     * @note called with lock cs_main held.
+     */
+    boost::signals2::signal<void(int nHeight)> NotifyBlockTip;
+
     /** Number of network connections changed. */
     boost::signals2::signal<void(int newNumConnections)> NotifyNumConnectionsChanged;
 
@@ -27,7 +27,7 @@ static const int DATABASE_VERSION = 70001;
 // network protocol versioning
 //
 
-static const int PROTOCOL_VERSION = 60002;
+static const int PROTOCOL_VERSION = 60003;
 
 // intial proto version, to be increased after version/verack negotiation
 static const int INIT_PROTO_VERSION = 100;
@@ -53,4 +53,7 @@ static const int MEMPOOL_GD_VERSION = 60000;
 static const int CANONICAL_BLOCK_SIG_VERSION = 60000;
 static const int CANONICAL_BLOCK_SIG_LOW_S_VERSION = 60000;
 
+// "cmpctblock", "getblocktxn" and "blocktxn" compact block relay starts with this version
+static const int COMPACT_BLOCK_VERSION = 60003;
+
 #endif
@@ -7,6 +7,7 @@
 
 #include "base58.h"
 #include "coincontrol.h"
+#include "init.h"
 #include "kernel.h"
 #include "net.h"
 #include "timedata.h"
@@ -15,6 +16,7 @@
 #include "walletdb.h"
 
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/functional/hash.hpp>
 
 using namespace std;
 
@@ -22,9 +24,11 @@ using namespace std;
 int64_t nTransactionFee = MIN_TX_FEE;
 int64_t nReserveBalance = 0;
 int64_t nMinimumInputValue = 0;
+CoinSelectionAlgorithm nCoinSelection = COINSELECT_BNB;
 
 static int64_t GetStakeCombineThreshold() { return 5000 * COIN; }
 static int64_t GetStakeSplitThreshold() { return 2 * GetStakeCombineThreshold(); }
+int64_t nStakeTargetSize = GetStakeCombineThreshold();
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -65,11 +69,56 @@ CPubKey CWallet::GenerateNewKey()
     return pubkey;
 }
 
+static size_t GetWalletHashSalt()
+{
+    static const size_t nSalt = (size_t)GetRand(std::numeric_limits<uint64_t>::max());
+    return nSalt;
+}
+
+CWalletHasher::CWalletHasher() : nSalt(GetWalletHashSalt())
+{
+}
+
+size_t CWalletHasher::operator()(const CScript& script) const
+{
+    size_t nHash = nSalt;
+    boost::hash_range(nHash, script.begin(), script.end());
+    return nHash;
+}
+
+size_t CWalletHasher::operator()(const COutPoint& outpoint) const
+{
+    size_t nHash = nSalt;
+    boost::hash_combine(nHash, outpoint.hash.GetLow64());
+    boost::hash_combine(nHash, outpoint.n);
+    return nHash;
+}
+
+void CWallet::AddScriptsForKey(const CPubKey& pubkey)
+{
+    LOCK(cs_KeyStore);
+    CScript script;
+    script.SetDestination(pubkey.GetID());
+    setMyScripts.insert(script);
+    script.clear();
+    script << pubkey << OP_CHECKSIG;
+    setMyScripts.insert(script);
+}
+
+void CWallet::AddScriptsForRedeemScript(const CScript& redeemScript)
+{
+    LOCK(cs_KeyStore);
+    CScript script;
+    script.SetDestination(redeemScript.GetID());
+    setMyScripts.insert(script);
+}
+
 bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey& pubkey)
 {
     AssertLockHeld(cs_wallet); // mapKeyMetadata
     if (!CCryptoKeyStore::AddKeyPubKey(secret, pubkey))
         return false;
+    AddScriptsForKey(pubkey);
     if (!fFileBacked)
         return true;
     if (!IsCrypted()) {
@@ -82,6 +131,7 @@ bool CWallet::AddCryptedKey(const CPubKey& vchPubKey, const vector<unsigned char
 {
     if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
         return false;
+    AddScriptsForKey(vchPubKey);
     if (!fFileBacked)
         return true;
     {
@@ -106,13 +156,22 @@ bool CWallet::LoadKeyMetadata(const CPubKey& pubkey, const CKeyMetadata& meta)
 
 bool CWallet::LoadCryptedKey(const CPubKey& vchPubKey, const std::vector<unsigned char>& vchCryptedSecret)
 {
-    return CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret);
+    if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
+        return false;
+    AddScriptsForKey(vchPubKey);
+    return true;
 }
 
 bool CWallet::AddCScript(const CScript& redeemScript)
 {
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    AddScriptsForRedeemScript(redeemScript);
+    {
+        // Outputs we already hold may now be spendable
+        LOCK(cs_wallet);
+        RebuildCoinIndex();
+    }
     if (!fFileBacked)
         return true;
     return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript), redeemScript);
@@ -135,7 +194,10 @@ bool CWallet::LoadCScript(const CScript& redeemScript)
         return true;
     }
 
-    return CCryptoKeyStore::AddCScript(redeemScript);
+    if (!CCryptoKeyStore::AddCScript(redeemScript))
+        return false;
+    AddScriptsForRedeemScript(redeemScript);
+    return true;
 }
 
 bool CWallet::Unlock(const SecureString& strWalletPassphrase)
@@ -334,27 +396,58 @@ int64_t CWallet::IncOrderPosNext(CWalletDB* pwalletdb)
     return nRet;
 }
 
-CWallet::TxItems CWallet::OrderedTxItems(std::list<CAccountingEntry>& acentries, std::string strAccount)
+// Track an accounting entry that has already been written to the wallet database
+void CWallet::AddAccountingEntry(const CAccountingEntry& acentry)
 {
-    AssertLockHeld(cs_wallet); // mapWallet
-    CWalletDB walletdb(strWalletFile);
+    LOCK(cs_wallet);
+    laccentries.push_back(acentry);
+    CAccountingEntry& entry = laccentries.back();
+    wtxOrdered.insert(make_pair(entry.nOrderPos, TxPair((CWalletTx*)0, &entry)));
+}
 
-    // First: get all CWalletTx and CAccountingEntry into a sorted-by-order multimap.
-    TxItems txOrdered;
+// Move a wallet transaction to nHeight in setTxByHeight; pass INT_MAX for
+// transactions that are not (or no longer) in a block
+void CWallet::IndexTxHeight(CWalletTx& wtx, int nHeight)
+{
+    AssertLockHeld(cs_wallet);
+    if (nHeight == wtx.nHeightIndexed)
+        return;
+    uint256 hash = wtx.GetHash();
+    if (wtx.nHeightIndexed != -1)
+        setTxByHeight.erase(make_pair(wtx.nHeightIndexed, hash));
+    setTxByHeight.insert(make_pair(nHeight, hash));
+    wtx.nHeightIndexed = nHeight;
+}
 
-    // Note: maintaining indices in the database of (account,time) --> txid and (account, time) --> acentry
-    // would make this much faster for applications that do this a lot.
+// Height of the block a wallet transaction claims to be in, or INT_MAX
+static int GetTxBlockHeight(const CWalletTx& wtx, bool fMainChainOnly)
+{
+    if (wtx.hashBlock == 0)
+        return std::numeric_limits<int>::max();
+    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(wtx.hashBlock);
+    if (mi == mapBlockIndex.end() || (fMainChainOnly && !(*mi).second->IsInMainChain()))
+        return std::numeric_limits<int>::max();
+    return (*mi).second->nHeight;
+}
+
+// Rebuild wtxOrdered, laccentries and setTxByHeight after the wallet is loaded
+void CWallet::RebuildTxOrder()
+{
+    AssertLockHeld(cs_wallet);
+    wtxOrdered.clear();
+    setTxByHeight.clear();
     for (map<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
         CWalletTx* wtx = &((*it).second);
-        txOrdered.insert(make_pair(wtx->nOrderPos, TxPair(wtx, (CAccountingEntry*)0)));
-    }
-    acentries.clear();
-    walletdb.ListAccountCreditDebit(strAccount, acentries);
-    BOOST_FOREACH (CAccountingEntry& entry, acentries) {
-        txOrdered.insert(make_pair(entry.nOrderPos, TxPair((CWalletTx*)0, &entry)));
+        wtxOrdered.insert(make_pair(wtx->nOrderPos, TxPair(wtx, (CAccountingEntry*)0)));
+        wtx->nHeightIndexed = -1;
+        IndexTxHeight(*wtx, GetTxBlockHeight(*wtx, true));
     }
 
-    return txOrdered;
+    laccentries.clear();
+    if (fFileBacked)
+        CWalletDB(strWalletFile).ListAccountCreditDebit("*", laccentries);
+    BOOST_FOREACH (CAccountingEntry& entry, laccentries)
+        wtxOrdered.insert(make_pair(entry.nOrderPos, TxPair((CWalletTx*)0, &entry)));
 }
 
 void CWallet::WalletUpdateSpent(const CTransaction& tx, bool fBlock)
@@ -365,6 +458,8 @@ void CWallet::WalletUpdateSpent(const CTransaction& tx, bool fBlock)
     {
         LOCK(cs_wallet);
         BOOST_FOREACH (const CTxIn& txin, tx.vin) {
+            if (!setMyOutpoints.count(txin.prevout))
+                continue;
             map<uint256, CWalletTx>::iterator mi = mapWallet.find(txin.prevout.hash);
             if (mi != mapWallet.end()) {
                 CWalletTx& wtx = (*mi).second;
@@ -374,6 +469,7 @@ void CWallet::WalletUpdateSpent(const CTransaction& tx, bool fBlock)
                     LogPrintf("WalletUpdateSpent found spent coin %s ERA %s\n", FormatMoney(wtx.GetCredit()), wtx.GetHash().ToString());
                     wtx.MarkSpent(txin.prevout.n);
                     wtx.WriteToDisk();
+                    UpdateCoinIndex(txin.prevout.hash);
                     NotifyTransactionChanged(this, txin.prevout.hash, CT_UPDATED);
                 }
             }
@@ -391,6 +487,7 @@ void CWallet::WalletUpdateSpent(const CTransaction& tx, bool fBlock)
                     NotifyTransactionChanged(this, hash, CT_UPDATED);
                 }
             }
+            UpdateCoinIndex(hash);
         }
     }
 }
@@ -401,9 +498,45 @@ void CWallet::MarkDirty()
         LOCK(cs_wallet);
         BOOST_FOREACH (PAIRTYPE(const uint256, CWalletTx) & item, mapWallet)
             item.second.MarkDirty();
+        // Called after key imports, which can make existing outputs ours
+        RebuildCoinIndex();
     }
 }
 
+// Re-read the outputs of one transaction into mapWalletCoins and
+// setMyOutpoints. Must be called whenever a wallet transaction is added or
+// has its spent flags changed; EraseFromWallet drops its outpoints itself.
+void CWallet::UpdateCoinIndex(const uint256& hash)
+{
+    AssertLockHeld(cs_wallet);
+    map<COutPoint, const CWalletTx*>::iterator it = mapWalletCoins.lower_bound(COutPoint(hash, 0));
+    while (it != mapWalletCoins.end() && (*it).first.hash == hash)
+        mapWalletCoins.erase(it++);
+
+    map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(hash);
+    if (mi == mapWallet.end())
+        return;
+    const CWalletTx& wtx = (*mi).second;
+    for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+        if (!IsMine(wtx.vout[i])) {
+            setMyOutpoints.erase(COutPoint(hash, i));
+            continue;
+        }
+        setMyOutpoints.insert(COutPoint(hash, i));
+        if (!wtx.IsSpent(i))
+            mapWalletCoins.insert(make_pair(COutPoint(hash, i), &wtx));
+    }
+}
+
+void CWallet::RebuildCoinIndex()
+{
+    AssertLockHeld(cs_wallet);
+    mapWalletCoins.clear();
+    setMyOutpoints.clear();
+    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        UpdateCoinIndex((*it).first);
+}
+
 bool CWallet::AddToWallet(const CWalletTx& wtxIn)
 {
     uint256 hash = wtxIn.GetHash();
@@ -417,6 +550,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn)
         if (fInsertedNew) {
             wtx.nTimeReceived = GetAdjustedTime();
             wtx.nOrderPos = IncOrderPosNext();
+            wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
+            wtx.nHeightIndexed = -1;
 
             wtx.nTimeSmart = wtx.nTimeReceived;
             if (wtxIn.hashBlock != 0) {
@@ -426,13 +561,15 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn)
                     {
                         // Tolerate times up to the last timestamp in the wallet not more than 5 minutes into the future
                         int64_t latestTolerated = latestNow + 300;
-                        std::list<CAccountingEntry> acentries;
-                        TxItems txOrdered = OrderedTxItems(acentries);
-                        for (TxItems::reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it) {
+                        for (TxItems::reverse_iterator it = wtxOrdered.rbegin(); it != wtxOrdered.rend(); ++it) {
                             CWalletTx* const pwtx = (*it).second.first;
                             if (pwtx == &wtx)
                                 continue;
                             CAccountingEntry* const pacentry = (*it).second.second;
+                            // as before the log was kept in memory, only the
+                            // default account's moves count
+                            if (pacentry && !pacentry->strAccount.empty())
+                                continue;
                             int64_t nSmartTime;
                             if (pwtx) {
                                 nSmartTime = pwtx->nTimeSmart;
@@ -485,6 +622,9 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn)
             if (!wtx.WriteToDisk())
                 return false;
 
+        UpdateCoinIndex(hash);
+        IndexTxHeight(wtx, GetTxBlockHeight(wtx, false));
+
         if (!fHaveGUI) {
             // If default receiving address gets used, replace it with a new one
             if (vchDefaultKey.IsValid()) {
@@ -543,6 +683,14 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
 void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock, bool fConnect)
 {
     if (!fConnect) {
+        {
+            // the block is being disconnected; listsinceblock must see it again
+            LOCK(cs_wallet);
+            map<uint256, CWalletTx>::iterator mi = mapWallet.find(tx.GetHash());
+            if (mi != mapWallet.end())
+                IndexTxHeight((*mi).second, std::numeric_limits<int>::max());
+        }
+
         // wallets need to refund inputs when disconnecting coinstake
         if (tx.IsCoinStake()) {
             if (IsFromMe(tx))
@@ -560,38 +708,79 @@ void CWallet::EraseFromWallet(const uint256& hash)
         return;
     {
         LOCK(cs_wallet);
-        if (mapWallet.erase(hash))
+        map<uint256, CWalletTx>::iterator mi = mapWallet.find(hash);
+        if (mi != mapWallet.end()) {
+            CWalletTx& wtx = (*mi).second;
+            for (unsigned int i = 0; i < wtx.vout.size(); i++)
+                setMyOutpoints.erase(COutPoint(hash, i));
+            pair<TxItems::iterator, TxItems::iterator> range = wtxOrdered.equal_range(wtx.nOrderPos);
+            for (TxItems::iterator it = range.first; it != range.second; ++it) {
+                if ((*it).second.first == &wtx) {
+                    wtxOrdered.erase(it);
+                    break;
+                }
+            }
+            if (wtx.nHeightIndexed != -1)
+                setTxByHeight.erase(make_pair(wtx.nHeightIndexed, hash));
+            mapWallet.erase(mi);
             CWalletDB(strWalletFile).EraseTx(hash);
+            UpdateCoinIndex(hash);
+        }
     }
     return;
 }
 
 
-bool CWallet::IsMine(const CTxIn& txin) const
+// Standard output forms for which setMyScripts holds every script that is
+// ours, so a miss there is a definite no. Anything else (multisig,
+// non-minimal pushes) goes through the full Solver-based check.
+static bool IsIndexedScriptForm(const CScript& script)
 {
-    {
-        LOCK(cs_wallet);
-        map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(txin.prevout.hash);
-        if (mi != mapWallet.end()) {
-            const CWalletTx& prev = (*mi).second;
-            if (txin.prevout.n < prev.vout.size())
-                if (IsMine(prev.vout[txin.prevout.n]))
-                    return true;
-        }
+    switch (script.size()) {
+    case 25: // P2PKH
+        return script[0] == OP_DUP && script[1] == OP_HASH160 && script[2] == 20 &&
+               script[23] == OP_EQUALVERIFY && script[24] == OP_CHECKSIG;
+    case 23: // P2SH
+        return script.IsPayToScriptHash();
+    case 35: // P2PK, compressed
+        return script[0] == 33 && script[34] == OP_CHECKSIG;
+    case 67: // P2PK, uncompressed
+        return script[0] == 65 && script[66] == OP_CHECKSIG;
     }
     return false;
 }
 
+bool CWallet::IsMine(const CScript& scriptPubKey) const
+{
+    {
+        LOCK(cs_KeyStore);
+        if (setMyScripts.count(scriptPubKey)) {
+            // Key scripts are exact; P2SH also needs the redeem script to be ours
+            if (!scriptPubKey.IsPayToScriptHash())
+                return true;
+        } else if (IsIndexedScriptForm(scriptPubKey))
+            return false;
+    }
+    return ::IsMine(*this, scriptPubKey);
+}
+
+bool CWallet::IsMine(const CTxIn& txin) const
+{
+    LOCK(cs_wallet);
+    return setMyOutpoints.count(txin.prevout) > 0;
+}
+
 int64_t CWallet::GetDebit(const CTxIn& txin) const
 {
     {
         LOCK(cs_wallet);
+        if (!setMyOutpoints.count(txin.prevout))
+            return 0;
         map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(txin.prevout.hash);
         if (mi != mapWallet.end()) {
             const CWalletTx& prev = (*mi).second;
             if (txin.prevout.n < prev.vout.size())
-                if (IsMine(prev.vout[txin.prevout.n]))
-                    return prev.vout[txin.prevout.n].nValue;
+                return prev.vout[txin.prevout.n].nValue;
         }
     }
     return 0;
@@ -622,6 +811,19 @@ int64_t CWalletTx::GetTxTime() const
     return n ? n : nTimeReceived;
 }
 
+int CWalletTx::GetCachedDepthInMainChain() const
+{
+    AssertLockHeld(cs_main);
+    if (pindexCached && hashBlockCached == hashBlock && pindexCached->IsInMainChain())
+        return pindexBest->nHeight - pindexCached->nHeight + 1;
+
+    CBlockIndex* pindex = NULL;
+    int nDepth = GetDepthInMainChain(pindex);
+    pindexCached = (nDepth > 0 ? pindex : NULL);
+    hashBlockCached = hashBlock;
+    return nDepth;
+}
+
 int CWalletTx::GetRequestCount() const
 {
     // Returns -1 if it wasn't being tracked
@@ -796,31 +998,231 @@ bool CWalletTx::WriteToDisk()
 // Scan the block chain (starting in pindexStart) for transactions
 // from or to us. If fUpdate is true, found transactions that already
 // exist in the wallet will be updated.
-int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
+/** A block read ahead by CWalletScanner, with its outputs already matched */
+class CScanBlock
 {
-    int ret = 0;
+public:
+    CBlock block;
+    std::vector<char> vfMatch; // tx pays to one of our scripts
+    bool fRead;
+    bool fReady;
+
+    CScanBlock() : fRead(false), fReady(false) {}
+};
+
+/**
+ * Read-ahead for wallet rescans. Worker threads claim blocks in chain
+ * order, read them from disk and match their outputs against the wallet's
+ * script set, which needs only cs_KeyStore. At most nWindow blocks are in
+ * flight; the consumer takes them back in order and releases each slot.
+ */
+class CWalletScanner
+{
+private:
+    const CWallet* pwallet;
+    const std::vector<CBlockIndex*>& vIndex;
+    std::vector<CScanBlock> vSlot;
+    size_t nNext;     // next block for a worker to claim
+    size_t nReleased; // blocks the consumer is done with
+    bool fStop;
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    boost::thread_group threads;
+
+    void Worker()
+    {
+        RenameThread("era-rescan");
+        while (true) {
+            size_t i;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!fStop && nNext < vIndex.size() && nNext >= nReleased + vSlot.size())
+                    cond.wait(lock);
+                if (fStop || nNext >= vIndex.size())
+                    return;
+                i = nNext++;
+            }
+
+            CScanBlock& slot = vSlot[i % vSlot.size()];
+            try {
+                slot.fRead = slot.block.ReadFromDisk(vIndex[i], true);
+            } catch (std::exception& e) {
+                slot.fRead = false;
+            }
+            slot.vfMatch.assign(slot.block.vtx.size(), false);
+            if (slot.fRead) {
+                for (unsigned int n = 0; n < slot.block.vtx.size(); n++) {
+                    BOOST_FOREACH (const CTxOut& txout, slot.block.vtx[n].vout) {
+                        if (pwallet->IsMine(txout)) {
+                            slot.vfMatch[n] = true;
+                            break;
+                        }
+                    }
+                }
+            }
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            slot.fReady = true;
+            cond.notify_all();
+        }
+    }
+
+public:
+    CWalletScanner(const CWallet* pwalletIn, const std::vector<CBlockIndex*>& vIndexIn, int nThreads, size_t nWindow)
+        : pwallet(pwalletIn), vIndex(vIndexIn), vSlot(nWindow), nNext(0), nReleased(0), fStop(false)
+    {
+        for (int i = 0; i < nThreads; i++)
+            threads.create_thread(boost::bind(&CWalletScanner::Worker, this));
+    }
+
+    ~CWalletScanner()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStop = true;
+            cond.notify_all();
+        }
+        threads.join_all();
+    }
 
-    CBlockIndex* pindex = pindexStart;
+    /** Wait until block i has been read */
+    CScanBlock& Get(size_t i)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        CScanBlock& slot = vSlot[i % vSlot.size()];
+        while (!slot.fReady)
+            cond.wait(lock);
+        return slot;
+    }
+
+    /** Whether block i is ready, without waiting */
+    bool IsReady(size_t i)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return i < nNext && vSlot[i % vSlot.size()].fReady;
+    }
+
+    /** Hand the slot of block i (the oldest unreleased one) back to the workers */
+    void Release(size_t i)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        CScanBlock& slot = vSlot[i % vSlot.size()];
+        slot.fReady = false;
+        slot.block.SetNull();
+        nReleased = i + 1;
+        cond.notify_all();
+    }
+};
+
+// Scan the main chain from pindexStart to pindexStop (or the tip) for
+// transactions involving us. Blocks are read and pre-matched by worker
+// threads; cs_main and cs_wallet are taken once per batch of ready
+// blocks rather than for the whole scan. Returns the number of wallet
+// transactions added or updated, or -1 if the scan was aborted.
+int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate, CBlockIndex* pindexStop)
+{
+    LOCK(cs_walletScan);
+
+    std::vector<CBlockIndex*> vIndex;
     {
         LOCK2(cs_main, cs_wallet);
-        while (pindex) {
+        for (CBlockIndex* pindex = pindexStart; pindex; pindex = pindex->pnext) {
             // no need to read and scan block, if block was created before
             // our wallet birthday (as adjusted for block time variability)
-            if (nTimeFirstKey && (pindex->nTime < (nTimeFirstKey - 7200))) {
-                pindex = pindex->pnext;
-                continue;
-            }
+            if (!nTimeFirstKey || pindex->nTime >= (nTimeFirstKey - 7200))
+                vIndex.push_back(pindex);
+            if (pindex == pindexStop)
+                break;
+        }
+    }
 
-            CBlock block;
-            block.ReadFromDisk(pindex, true);
-            BOOST_FOREACH (CTransaction& tx, block.vtx) {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
-                    ret++;
+    {
+        LOCK(cs_rescanStatus);
+        fAbortRescan = false;
+        rescanStatus = CRescanStatus();
+        rescanStatus.fScanning = true;
+        rescanStatus.nStartTime = GetTimeMillis();
+        if (pindexStart) {
+            rescanStatus.nStartHeight = pindexStart->nHeight;
+            rescanStatus.nStopHeight = vIndex.empty() ? pindexStart->nHeight : vIndex.back()->nHeight;
+        }
+    }
+
+    int nThreads = GetArg("-rescanthreads", 0);
+    if (nThreads <= 0)
+        nThreads = std::min(4, std::max(1, (int)boost::thread::hardware_concurrency()));
+    const size_t nBatch = 16;
+    int ret = 0;
+    bool fAborted = false;
+    {
+        CWalletScanner scanner(this, vIndex, nThreads, 4 * nBatch);
+        size_t i = 0;
+        while (i < vIndex.size()) {
+            {
+                LOCK(cs_rescanStatus);
+                fAborted = fAbortRescan;
             }
-            pindex = pindex->pnext;
+            if (fAborted || ShutdownRequested()) {
+                fAborted = true;
+                break;
+            }
+
+            // Wait for the next block without holding any locks, then take
+            // whatever is ready behind it in the same lock window
+            scanner.Get(i);
+            LOCK2(cs_main, cs_wallet);
+            size_t nEnd = std::min(i + nBatch, vIndex.size());
+            do {
+                CScanBlock& slot = scanner.Get(i);
+                if (!slot.fRead)
+                    LogPrintf("ScanForWalletTransactions() : failed to read block at height %d\n", vIndex[i]->nHeight);
+                else if (vIndex[i]->IsInMainChain()) {
+                    // blocks reorganized away since the snapshot are skipped;
+                    // their replacements reach us through SyncWithWallets
+                    for (unsigned int n = 0; n < slot.block.vtx.size(); n++) {
+                        const CTransaction& tx = slot.block.vtx[n];
+                        bool fRelevant = slot.vfMatch[n] || mapWallet.count(tx.GetHash());
+                        for (unsigned int k = 0; !fRelevant && k < tx.vin.size(); k++)
+                            fRelevant = setMyOutpoints.count(tx.vin[k].prevout) > 0;
+                        if (fRelevant && AddToWalletIfInvolvingMe(tx, &slot.block, fUpdate))
+                            ret++;
+                    }
+                }
+                scanner.Release(i);
+                i++;
+            } while (i < nEnd && scanner.IsReady(i));
+
+            LOCK(cs_rescanStatus);
+            rescanStatus.nHeight = vIndex[i - 1]->nHeight;
+            rescanStatus.nFound = ret;
         }
     }
-    return ret;
+
+    {
+        LOCK(cs_rescanStatus);
+        rescanStatus.fScanning = false;
+        rescanStatus.nFound = ret;
+        rescanStatus.nEndTime = GetTimeMillis();
+        LogPrintf("ScanForWalletTransactions() : %s at height %d, %d blocks, %d transactions, %dms\n",
+                  fAborted ? "aborted" : "done", rescanStatus.nHeight, (int)vIndex.size(), ret,
+                  rescanStatus.nEndTime - rescanStatus.nStartTime);
+    }
+    return fAborted ? -1 : ret;
+}
+
+CRescanStatus CWallet::GetRescanStatus() const
+{
+    LOCK(cs_rescanStatus);
+    return rescanStatus;
+}
+
+bool CWallet::AbortRescan()
+{
+    LOCK(cs_rescanStatus);
+    if (!rescanStatus.fScanning)
+        return false;
+    fAbortRescan = true;
+    return true;
 }
 
 void CWallet::ReacceptWalletTransactions()
@@ -828,45 +1230,50 @@ void CWallet::ReacceptWalletTransactions()
     CTxDB txdb("r");
     bool fRepeat = true;
     while (fRepeat) {
-        LOCK2(cs_main, cs_wallet);
         fRepeat = false;
         vector<CDiskTxPos> vMissingTx;
-        BOOST_FOREACH (PAIRTYPE(const uint256, CWalletTx) & item, mapWallet) {
-            CWalletTx& wtx = item.second;
-            if ((wtx.IsCoinBase() && wtx.IsSpent(0)) || (wtx.IsCoinStake() && wtx.IsSpent(1)))
-                continue;
-
-            CTxIndex txindex;
-            bool fUpdated = false;
-            if (txdb.ReadTxIndex(wtx.GetHash(), txindex)) {
-                // Update fSpent if a tx got spent somewhere else by a copy of wallet.dat
-                if (txindex.vSpent.size() != wtx.vout.size()) {
-                    LogPrintf("ERROR: ReacceptWalletTransactions() : txindex.vSpent.size() %u != wtx.vout.size() %u\n", txindex.vSpent.size(), wtx.vout.size());
+        {
+            LOCK2(cs_main, cs_wallet);
+            BOOST_FOREACH (PAIRTYPE(const uint256, CWalletTx) & item, mapWallet) {
+                CWalletTx& wtx = item.second;
+                if ((wtx.IsCoinBase() && wtx.IsSpent(0)) || (wtx.IsCoinStake() && wtx.IsSpent(1)))
                     continue;
-                }
-                for (unsigned int i = 0; i < txindex.vSpent.size(); i++) {
-                    if (wtx.IsSpent(i))
+
+                CTxIndex txindex;
+                bool fUpdated = false;
+                if (txdb.ReadTxIndex(wtx.GetHash(), txindex)) {
+                    // Update fSpent if a tx got spent somewhere else by a copy of wallet.dat
+                    if (txindex.vSpent.size() != wtx.vout.size()) {
+                        LogPrintf("ERROR: ReacceptWalletTransactions() : txindex.vSpent.size() %u != wtx.vout.size() %u\n", txindex.vSpent.size(), wtx.vout.size());
                         continue;
-                    if (!txindex.vSpent[i].IsNull() && IsMine(wtx.vout[i])) {
-                        wtx.MarkSpent(i);
-                        fUpdated = true;
-                        vMissingTx.push_back(txindex.vSpent[i]);
                     }
+                    for (unsigned int i = 0; i < txindex.vSpent.size(); i++) {
+                        if (wtx.IsSpent(i))
+                            continue;
+                        if (!txindex.vSpent[i].IsNull() && IsMine(wtx.vout[i])) {
+                            wtx.MarkSpent(i);
+                            fUpdated = true;
+                            vMissingTx.push_back(txindex.vSpent[i]);
+                        }
+                    }
+                    if (fUpdated) {
+                        LogPrintf("ReacceptWalletTransactions found spent coin %s ERA %s\n", FormatMoney(wtx.GetCredit()), wtx.GetHash().ToString());
+                        wtx.MarkDirty();
+                        wtx.WriteToDisk();
+                        UpdateCoinIndex(item.first);
+                    }
+                } else {
+                    // Re-accept any txes of ours that aren't already in a block
+                    if (!(wtx.IsCoinBase() || wtx.IsCoinStake()))
+                        wtx.AcceptWalletTransaction(txdb);
                 }
-                if (fUpdated) {
-                    LogPrintf("ReacceptWalletTransactions found spent coin %s ERA %s\n", FormatMoney(wtx.GetCredit()), wtx.GetHash().ToString());
-                    wtx.MarkDirty();
-                    wtx.WriteToDisk();
-                }
-            } else {
-                // Re-accept any txes of ours that aren't already in a block
-                if (!(wtx.IsCoinBase() || wtx.IsCoinStake()))
-                    wtx.AcceptWalletTransaction(txdb);
             }
         }
+        // The rescan takes cs_walletScan before cs_main and cs_wallet, so it
+        // must run with both released
         if (!vMissingTx.empty()) {
             // TODO: optimize this to scan just part of the block chain?
-            if (ScanForWalletTransactions(pindexGenesisBlock))
+            if (ScanForWalletTransactions(pindexGenesisBlock) > 0)
                 fRepeat = true; // Found missing transactions: re-do re-accept.
         }
     }
@@ -947,15 +1354,35 @@ void CWallet::ResendWalletTransactions(bool fForce)
 //
 
 
+// Value of a mapWalletCoins entry; the index only holds outputs that are ours
+static int64_t CoinValue(const pair<const COutPoint, const CWalletTx*>& coin)
+{
+    const CTxOut& txout = coin.second->vout[coin.first.n];
+    if (!MoneyRange(txout.nValue))
+        throw runtime_error("CoinValue() : value out of range");
+    return txout.nValue;
+}
+
+// IsTrusted() for a transaction whose depth is already known
+static bool IsTrustedAtDepth(const CWalletTx* pcoin, int nDepth)
+{
+    if (nDepth >= 1)
+        return IsFinalTx(*pcoin);
+    if (nDepth < 0)
+        return false;
+    return pcoin->IsTrusted();
+}
+
 int64_t CWallet::GetBalance() const
 {
     int64_t nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableCredit();
+        for (map<COutPoint, const CWalletTx*>::const_iterator it = mapWalletCoins.begin(); it != mapWalletCoins.end(); ++it) {
+            const CWalletTx* pcoin = (*it).second;
+            int nDepth = pcoin->GetCachedDepthInMainChain();
+            if (IsTrustedAtDepth(pcoin, nDepth) && pcoin->GetBlocksToMaturity(nDepth) == 0)
+                nTotal += CoinValue(*it);
         }
     }
 
@@ -967,24 +1394,31 @@ int64_t CWallet::GetUnconfirmedBalance() const
     int64_t nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!IsFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
-                nTotal += pcoin->GetAvailableCredit();
+        for (map<COutPoint, const CWalletTx*>::const_iterator it = mapWalletCoins.begin(); it != mapWalletCoins.end(); ++it) {
+            const CWalletTx* pcoin = (*it).second;
+            int nDepth = pcoin->GetCachedDepthInMainChain();
+            if (pcoin->GetBlocksToMaturity(nDepth) > 0)
+                continue;
+            if (!IsFinalTx(*pcoin) || (nDepth == 0 && !IsTrustedAtDepth(pcoin, nDepth)))
+                nTotal += CoinValue(*it);
         }
     }
     return nTotal;
 }
 
+// Immature outputs can't be spent, so the coin index holds all of them
 int64_t CWallet::GetImmatureBalance() const
 {
     int64_t nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx& pcoin = (*it).second;
-            if (pcoin.IsCoinBase() && pcoin.GetBlocksToMaturity() > 0 && pcoin.IsInMainChain())
-                nTotal += GetCredit(pcoin);
+        for (map<COutPoint, const CWalletTx*>::const_iterator it = mapWalletCoins.begin(); it != mapWalletCoins.end(); ++it) {
+            const CWalletTx* pcoin = (*it).second;
+            if (!pcoin->IsCoinBase())
+                continue;
+            int nDepth = pcoin->GetCachedDepthInMainChain();
+            if (nDepth > 0 && pcoin->GetBlocksToMaturity(nDepth) > 0)
+                nTotal += CoinValue(*it);
         }
     }
     return nTotal;
@@ -997,29 +1431,26 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+        for (map<COutPoint, const CWalletTx*>::const_iterator it = mapWalletCoins.begin(); it != mapWalletCoins.end(); ++it) {
+            const CWalletTx* pcoin = (*it).second;
+            unsigned int i = (*it).first.n;
 
             if (!IsFinalTx(*pcoin))
                 continue;
 
-            if (fOnlyConfirmed && !pcoin->IsTrusted())
+            int nDepth = pcoin->GetCachedDepthInMainChain();
+            if (fOnlyConfirmed && !IsTrustedAtDepth(pcoin, nDepth))
                 continue;
 
-            if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
+            if (pcoin->GetBlocksToMaturity(nDepth) > 0)
                 continue;
 
-            if (pcoin->IsCoinStake() && pcoin->GetBlocksToMaturity() > 0)
-                continue;
-
-            int nDepth = pcoin->GetDepthInMainChain();
             if (nDepth < 0)
                 continue;
 
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++)
-                if (!(pcoin->IsSpent(i)) && IsMine(pcoin->vout[i]) && pcoin->vout[i].nValue >= nMinimumInputValue &&
-                    (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected((*it).first, i)))
-                    vCoins.push_back(COutput(pcoin, i, nDepth));
+            if (pcoin->vout[i].nValue >= nMinimumInputValue &&
+                (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected((*it).first.hash, i)))
+                vCoins.push_back(COutput(pcoin, i, nDepth));
         }
     }
 }
@@ -1030,27 +1461,27 @@ void CWallet::AvailableCoinsForStaking(vector<COutput>& vCoins) const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+        for (map<COutPoint, const CWalletTx*>::const_iterator it = mapWalletCoins.begin(); it != mapWalletCoins.end(); ++it) {
+            const CWalletTx* pcoin = (*it).second;
+            unsigned int i = (*it).first.n;
 
-            int nDepth = pcoin->GetDepthInMainChain();
+            int nDepth = pcoin->GetCachedDepthInMainChain();
             if (nDepth < 1)
                 continue;
 
             if (nDepth < nStakeMinConfirmations)
                 continue;
 
-            if (pcoin->GetBlocksToMaturity() > 0)
+            if (pcoin->GetBlocksToMaturity(nDepth) > 0)
                 continue;
 
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++)
-                if (!(pcoin->IsSpent(i)) && IsMine(pcoin->vout[i]) && pcoin->vout[i].nValue >= nMinimumInputValue)
-                    vCoins.push_back(COutput(pcoin, i, nDepth));
+            if (pcoin->vout[i].nValue >= nMinimumInputValue)
+                vCoins.push_back(COutput(pcoin, i, nDepth));
         }
     }
 }
 
-static void ApproximateBestSubset(vector<pair<int64_t, pair<const CWalletTx*, unsigned int>>> vValue, int64_t nTotalLower, int64_t nTargetValue, vector<char>& vfBest, int64_t& nBest, int iterations = 1000)
+static void ApproximateBestSubset(const vector<pair<int64_t, pair<const CWalletTx*, unsigned int>>>& vValue, int64_t nTotalLower, int64_t nTargetValue, vector<char>& vfBest, int64_t& nBest, int iterations = 1000)
 {
     vector<char> vfIncluded;
 
@@ -1089,15 +1520,108 @@ static void ApproximateBestSubset(vector<pair<int64_t, pair<const CWalletTx*, un
     }
 }
 
+// Sizes of a signed input spending a pay-to-pubkey-hash output and of a
+// pay-to-pubkey-hash output, used to price inputs and change
+static const int64_t SELECT_INPUT_SIZE = 148;
+static const int64_t SELECT_OUTPUT_SIZE = 34;
+
+// Search nodes a single branch and bound run may visit
+static const int BNB_MAX_TRIES = 100000;
+
+// Above this many candidates branch and bound falls back to largest-first
+// rather than the randomized knapsack, which takes longer than it is worth
+static const unsigned int KNAPSACK_MAX_COINS = 1000;
+
+static int64_t GetSelectionFee(int64_t nBytes)
+{
+    return max(nTransactionFee, MIN_TX_FEE) * nBytes / 1000;
+}
+
+/**
+ * Depth-first search over the first nCoins of vValue (sorted by descending
+ * value) for the subset whose effective value, its value less the fee for
+ * spending it, lands in [nTarget, nTarget + nCostOfChange] with the least
+ * excess. Such a subset needs no change output. Gives up after
+ * BNB_MAX_TRIES nodes.
+ */
+static bool SelectCoinsBnB(const vector<pair<int64_t, pair<const CWalletTx*, unsigned int>>>& vValue, unsigned int nCoins, int64_t nTarget, int64_t nInputFee, int64_t nCostOfChange, vector<char>& vfBest)
+{
+    int64_t nAvailable = 0;
+    for (unsigned int i = 0; i < nCoins; i++)
+        nAvailable += vValue[i].first - nInputFee;
+    if (nAvailable < nTarget)
+        return false;
+
+    vector<unsigned int> vSelected, vBest;
+    int64_t nCurrent = 0;
+    int64_t nBestWaste = std::numeric_limits<int64_t>::max();
+    unsigned int i = 0;
+    for (int nTries = 0; nTries < BNB_MAX_TRIES; nTries++, i++) {
+        bool fBacktrack = false;
+        if (nCurrent + nAvailable < nTarget || nCurrent > nTarget + nCostOfChange) {
+            fBacktrack = true;
+        } else if (nCurrent >= nTarget) {
+            if (nCurrent - nTarget < nBestWaste) {
+                vBest = vSelected;
+                nBestWaste = nCurrent - nTarget;
+                if (nBestWaste == 0)
+                    break;
+            }
+            fBacktrack = true;
+        }
+
+        if (fBacktrack) {
+            if (vSelected.empty())
+                break;
+            // Return the coins passed over since the last included one to
+            // the lookahead, then explore the branch without that coin
+            for (--i; i > vSelected.back(); --i)
+                nAvailable += vValue[i].first - nInputFee;
+            nCurrent -= vValue[i].first - nInputFee;
+            vSelected.pop_back();
+        } else {
+            int64_t nEffective = vValue[i].first - nInputFee;
+            nAvailable -= nEffective;
+            // Including a coin equal to one just left out would only repeat
+            // subsets that were already explored
+            if (vSelected.empty() || vSelected.back() == i - 1 || vValue[i - 1].first != vValue[i].first) {
+                vSelected.push_back(i);
+                nCurrent += nEffective;
+            }
+        }
+    }
+
+    if (vBest.empty())
+        return false;
+    vfBest.assign(vValue.size(), false);
+    BOOST_FOREACH (unsigned int n, vBest)
+        vfBest[n] = true;
+    return true;
+}
+
+/** Largest coins first until nTargetValue is reached; vValue is sorted descending */
+static void SelectLargestFirst(const vector<pair<int64_t, pair<const CWalletTx*, unsigned int>>>& vValue, int64_t nTargetValue, vector<char>& vfBest, int64_t& nBest)
+{
+    vfBest.assign(vValue.size(), false);
+    nBest = 0;
+    for (unsigned int i = 0; i < vValue.size() && nBest < nTargetValue; i++) {
+        vfBest[i] = true;
+        nBest += vValue[i].first;
+    }
+}
+
 // ppcoin: total coins staked (non-spendable until maturity)
 int64_t CWallet::GetStake() const
 {
     int64_t nTotal = 0;
     LOCK2(cs_main, cs_wallet);
-    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-        const CWalletTx* pcoin = &(*it).second;
-        if (pcoin->IsCoinStake() && pcoin->GetBlocksToMaturity() > 0 && pcoin->GetDepthInMainChain() > 0)
-            nTotal += CWallet::GetCredit(*pcoin);
+    for (map<COutPoint, const CWalletTx*>::const_iterator it = mapWalletCoins.begin(); it != mapWalletCoins.end(); ++it) {
+        const CWalletTx* pcoin = (*it).second;
+        if (!pcoin->IsCoinStake())
+            continue;
+        int nDepth = pcoin->GetCachedDepthInMainChain();
+        if (nDepth > 0 && pcoin->GetBlocksToMaturity(nDepth) > 0)
+            nTotal += CoinValue(*it);
     }
     return nTotal;
 }
@@ -1106,18 +1630,23 @@ int64_t CWallet::GetNewMint() const
 {
     int64_t nTotal = 0;
     LOCK2(cs_main, cs_wallet);
-    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-        const CWalletTx* pcoin = &(*it).second;
-        if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0 && pcoin->GetDepthInMainChain() > 0)
-            nTotal += CWallet::GetCredit(*pcoin);
+    for (map<COutPoint, const CWalletTx*>::const_iterator it = mapWalletCoins.begin(); it != mapWalletCoins.end(); ++it) {
+        const CWalletTx* pcoin = (*it).second;
+        if (!pcoin->IsCoinBase())
+            continue;
+        int nDepth = pcoin->GetCachedDepthInMainChain();
+        if (nDepth > 0 && pcoin->GetBlocksToMaturity(nDepth) > 0)
+            nTotal += CoinValue(*it);
     }
     return nTotal;
 }
 
-bool CWallet::SelectCoinsMinConf(int64_t nTargetValue, unsigned int nSpendTime, int nConfMine, int nConfTheirs, vector<COutput> vCoins, set<pair<const CWalletTx*, unsigned int>>& setCoinsRet, int64_t& nValueRet) const
+bool CWallet::SelectCoinsMinConf(int64_t nTargetValue, unsigned int nSpendTime, int nConfMine, int nConfTheirs, const vector<COutput>& vCoins, set<pair<const CWalletTx*, unsigned int>>& setCoinsRet, int64_t& nValueRet, bool* pfChangeless) const
 {
     setCoinsRet.clear();
     nValueRet = 0;
+    if (pfChangeless)
+        *pfChangeless = false;
 
     // List of values less than target
     pair<int64_t, pair<const CWalletTx*, unsigned int>> coinLowestLarger;
@@ -1126,9 +1655,7 @@ bool CWallet::SelectCoinsMinConf(int64_t nTargetValue, unsigned int nSpendTime,
     vector<pair<int64_t, pair<const CWalletTx*, unsigned int>>> vValue;
     int64_t nTotalLower = 0;
 
-    random_shuffle(vCoins.begin(), vCoins.end(), GetRandInt);
-
-    BOOST_FOREACH (COutput output, vCoins) {
+    BOOST_FOREACH (const COutput& output, vCoins) {
         const CWalletTx* pcoin = output.tx;
 
         if (output.nDepth < (pcoin->IsFromMe() ? nConfMine : nConfTheirs))
@@ -1172,14 +1699,45 @@ bool CWallet::SelectCoinsMinConf(int64_t nTargetValue, unsigned int nSpendTime,
         return true;
     }
 
-    // Solve subset sum by stochastic approximation
+    // Shuffle first so that coins of equal value are picked at random
+    random_shuffle(vValue.begin(), vValue.end(), GetRandInt);
     sort(vValue.rbegin(), vValue.rend(), CompareValueOnly());
     vector<char> vfBest;
     int64_t nBest;
 
-    ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, 1000);
-    if (nBest != nTargetValue && nTotalLower >= nTargetValue + CENT)
-        ApproximateBestSubset(vValue, nTotalLower, nTargetValue + CENT, vfBest, nBest, 1000);
+    if (nCoinSelection == COINSELECT_BNB) {
+        // Coins worth less than the fee to spend them are never part of a
+        // match; being the smallest, they sit at the end
+        int64_t nInputFee = GetSelectionFee(SELECT_INPUT_SIZE);
+        int64_t nCostOfChange = GetSelectionFee(SELECT_INPUT_SIZE + SELECT_OUTPUT_SIZE);
+        unsigned int nCoins = vValue.size();
+        while (nCoins > 0 && vValue[nCoins - 1].first <= nInputFee)
+            nCoins--;
+
+        if (SelectCoinsBnB(vValue, nCoins, nTargetValue, nInputFee, nCostOfChange, vfBest)) {
+            for (unsigned int i = 0; i < vValue.size(); i++)
+                if (vfBest[i]) {
+                    setCoinsRet.insert(vValue[i].second);
+                    nValueRet += vValue[i].first;
+                }
+            if (pfChangeless)
+                *pfChangeless = true;
+            LogPrint("selectcoins", "SelectCoins() branch and bound: %u inputs, total %s\n", setCoinsRet.size(), FormatMoney(nValueRet));
+            return true;
+        }
+    }
+
+    // Solve subset sum by stochastic approximation. When branch and bound
+    // found nothing in a very large candidate set take the largest coins
+    // instead, which also keeps the transaction small; -coinselection=knapsack
+    // keeps the knapsack whatever the size
+    if (nCoinSelection == COINSELECT_BNB && vValue.size() > KNAPSACK_MAX_COINS) {
+        SelectLargestFirst(vValue, nTargetValue, vfBest, nBest);
+    } else {
+        ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, 1000);
+        if (nBest != nTargetValue && nTotalLower >= nTargetValue + CENT)
+            ApproximateBestSubset(vValue, nTotalLower, nTargetValue + CENT, vfBest, nBest, 1000);
+    }
 
     // If we have a bigger coin and (either the stochastic approximation didn't find a good solution,
     //                                   or the next bigger coin is closer), return the bigger coin
@@ -1204,11 +1762,8 @@ bool CWallet::SelectCoinsMinConf(int64_t nTargetValue, unsigned int nSpendTime,
     return true;
 }
 
-bool CWallet::SelectCoins(int64_t nTargetValue, unsigned int nSpendTime, set<pair<const CWalletTx*, unsigned int>>& setCoinsRet, int64_t& nValueRet, const CCoinControl* coinControl) const
+bool CWallet::SelectCoins(int64_t nTargetValue, unsigned int nSpendTime, const vector<COutput>& vCoins, set<pair<const CWalletTx*, unsigned int>>& setCoinsRet, int64_t& nValueRet, const CCoinControl* coinControl, bool* pfChangeless) const
 {
-    vector<COutput> vCoins;
-    AvailableCoins(vCoins, true, coinControl);
-
     // coin control -> return all selected outputs (we want all selected to go into the transaction for sure)
     if (coinControl && coinControl->HasSelected()) {
         BOOST_FOREACH (const COutput& out, vCoins) {
@@ -1218,11 +1773,9 @@ bool CWallet::SelectCoins(int64_t nTargetValue, unsigned int nSpendTime, set<pai
         return (nValueRet >= nTargetValue);
     }
 
-    boost::function<bool(const CWallet*, int64_t, unsigned int, int, int, std::vector<COutput>, std::set<std::pair<const CWalletTx*, unsigned int>>&, int64_t&)> f = &CWallet::SelectCoinsMinConf;
-
-    return (f(this, nTargetValue, nSpendTime, 1, 10, vCoins, setCoinsRet, nValueRet) ||
-            f(this, nTargetValue, nSpendTime, 1, 1, vCoins, setCoinsRet, nValueRet) ||
-            f(this, nTargetValue, nSpendTime, 0, 1, vCoins, setCoinsRet, nValueRet));
+    return (SelectCoinsMinConf(nTargetValue, nSpendTime, 1, 10, vCoins, setCoinsRet, nValueRet, pfChangeless) ||
+            SelectCoinsMinConf(nTargetValue, nSpendTime, 1, 1, vCoins, setCoinsRet, nValueRet, pfChangeless) ||
+            SelectCoinsMinConf(nTargetValue, nSpendTime, 0, 1, vCoins, setCoinsRet, nValueRet, pfChangeless));
 }
 
 // Select some coins without random shuffle or best subset approximation
@@ -1302,6 +1855,10 @@ bool CWallet::CreateTransaction(const vector<pair<CScript, int64_t>>& vecSend, C
         // txdb must be opened before the mapWallet lock
         CTxDB txdb("r");
         {
+            // The candidates stay the same while the fee is adjusted below
+            vector<COutput> vCoins;
+            AvailableCoins(vCoins, true, coinControl);
+
             nFeeRet = nTransactionFee;
             while (true) {
                 wtxNew.vin.clear();
@@ -1316,11 +1873,19 @@ bool CWallet::CreateTransaction(const vector<pair<CScript, int64_t>>& vecSend, C
                 // Choose coins to use
                 set<pair<const CWalletTx*, unsigned int>> setCoins;
                 int64_t nValueIn = 0;
-                if (!SelectCoins(nTotalValue, wtxNew.nTime, setCoins, nValueIn, coinControl))
+                bool fChangeless = false;
+                if (!SelectCoins(nTotalValue, wtxNew.nTime, vCoins, setCoins, nValueIn, coinControl, &fChangeless))
                     return false;
 
                 int64_t nChange = nValueIn - nValue - nFeeRet;
 
+                // A branch and bound match leaves less than a change output
+                // would cost; it goes to the fee for the inputs instead
+                if (fChangeless) {
+                    nFeeRet += nChange;
+                    nChange = 0;
+                }
+
                 if (nChange > 0) {
                     // Fill a vout to ourself
                     // TODO: pass in scriptChange instead of reservekey so
@@ -1431,6 +1996,170 @@ uint64_t CWallet::GetStakeWeight() const
     return nWeight;
 }
 
+// Limits for one planner run: inputs per consolidation, outputs per split
+// and transactions in all. Moved coins have to mature again before they
+// stake, so a run only touches part of the wallet.
+static const unsigned int STAKE_PLAN_MAX_INPUTS = 50;
+static const unsigned int STAKE_PLAN_MAX_OUTPUTS = 10;
+static const unsigned int STAKE_PLAN_MAX_TXS = 20;
+
+static int64_t GetStakePlanFee(unsigned int nInputs, unsigned int nOutputs)
+{
+    int64_t nBytes = 10 + nInputs * SELECT_INPUT_SIZE + nOutputs * SELECT_OUTPUT_SIZE;
+    return max(nTransactionFee, MIN_TX_FEE) * (1 + nBytes / 1000);
+}
+
+static bool CompareOutputValue(const COutput& a, const COutput& b)
+{
+    return a.tx->vout[a.i].nValue < b.tx->vout[b.i].nValue;
+}
+
+bool CWallet::PlanStakeOutputs(int64_t nTarget, CStakePlan& plan) const
+{
+    plan = CStakePlan();
+    plan.nTarget = nTarget;
+    if (nTarget <= 0)
+        return false;
+
+    LOCK2(cs_main, cs_wallet);
+    vector<COutput> vCoins;
+    AvailableCoinsForStaking(vCoins);
+
+    // Coins worth nReserveBalance are left alone
+    return PlanStakeOutputs(nTarget, vCoins, GetBalance() - nReserveBalance, plan);
+}
+
+bool CWallet::PlanStakeOutputs(int64_t nTarget, const vector<COutput>& vCoins, int64_t nBudget, CStakePlan& plan) const
+{
+    plan = CStakePlan();
+    plan.nTarget = nTarget;
+    if (nTarget <= 0)
+        return false;
+    plan.nCoinsBefore = plan.nCoinsAfter = vCoins.size();
+
+    // Small outputs are combined per address, like the extra inputs
+    // CreateCoinStake adds, so no new address links are made
+    map<CScript, vector<COutput>> mapSmall;
+    vector<COutput> vLarge;
+    BOOST_FOREACH (const COutput& out, vCoins) {
+        const CTxOut& txout = out.tx->vout[out.i];
+        if (txout.nValue < nTarget / 2)
+            mapSmall[txout.scriptPubKey].push_back(out);
+        else if (txout.nValue >= 2 * nTarget)
+            vLarge.push_back(out);
+    }
+
+    for (map<CScript, vector<COutput>>::iterator it = mapSmall.begin(); it != mapSmall.end(); ++it) {
+        vector<COutput>& vSmall = it->second;
+        sort(vSmall.begin(), vSmall.end(), CompareOutputValue);
+        CStakePlanTx ptx;
+        ptx.scriptPubKey = it->first;
+        ptx.nOutputs = 1;
+        for (unsigned int i = 0; i < vSmall.size() && plan.vTx.size() < STAKE_PLAN_MAX_TXS; i++) {
+            ptx.vInputs.push_back(COutPoint(vSmall[i].tx->GetHash(), vSmall[i].i));
+            ptx.nValueIn += vSmall[i].tx->vout[vSmall[i].i].nValue;
+            if (ptx.nValueIn < nTarget && ptx.vInputs.size() < STAKE_PLAN_MAX_INPUTS && i + 1 < vSmall.size())
+                continue;
+
+            // Skip groups that are too few to help or where the fee would
+            // eat more than a percent of the value
+            ptx.nFee = GetStakePlanFee(ptx.vInputs.size(), 1);
+            if (ptx.vInputs.size() >= 2 && ptx.nFee * 100 <= ptx.nValueIn && ptx.nValueIn <= nBudget) {
+                nBudget -= ptx.nValueIn;
+                plan.nCoinsAfter -= ptx.vInputs.size() - 1;
+                plan.nFees += ptx.nFee;
+                plan.nValueMoved += ptx.nValueIn;
+                plan.vTx.push_back(ptx);
+            }
+            ptx.vInputs.clear();
+            ptx.nValueIn = 0;
+        }
+    }
+
+    // Oversized outputs are split into pieces of about nTarget
+    BOOST_FOREACH (const COutput& out, vLarge) {
+        if (plan.vTx.size() >= STAKE_PLAN_MAX_TXS)
+            break;
+        const CTxOut& txout = out.tx->vout[out.i];
+        if (txout.nValue > nBudget)
+            continue;
+        CStakePlanTx ptx;
+        ptx.scriptPubKey = txout.scriptPubKey;
+        ptx.vInputs.push_back(COutPoint(out.tx->GetHash(), out.i));
+        ptx.nValueIn = txout.nValue;
+        ptx.nOutputs = (unsigned int)min((int64_t)STAKE_PLAN_MAX_OUTPUTS, txout.nValue / nTarget);
+        ptx.nFee = GetStakePlanFee(1, ptx.nOutputs);
+        nBudget -= ptx.nValueIn;
+        plan.nCoinsAfter += ptx.nOutputs - 1;
+        plan.nFees += ptx.nFee;
+        plan.nValueMoved += ptx.nValueIn;
+        plan.vTx.push_back(ptx);
+    }
+
+    return true;
+}
+
+int CWallet::ExecuteStakePlan(const CStakePlan& plan)
+{
+    if (IsLocked() || fWalletUnlockStakingOnly)
+        return 0;
+
+    int nSent = 0;
+    BOOST_FOREACH (const CStakePlanTx& ptx, plan.vTx) {
+        CTxDestination dest;
+        if (!ExtractDestination(ptx.scriptPubKey, dest))
+            continue;
+        CCoinControl coinControl;
+        coinControl.destChange = dest;
+        BOOST_FOREACH (COutPoint outpoint, ptx.vInputs)
+            coinControl.Select(outpoint);
+
+        // Start from the minimum fee and take the one CreateTransaction asks
+        // for, so the inputs are spent in full without a change output
+        int64_t nFee = max(nTransactionFee, MIN_TX_FEE);
+        int64_t nFeeRet = 0;
+        CWalletTx wtx;
+        CReserveKey reservekey(this);
+        bool fCreated = false;
+        for (int nTry = 0; nTry < 3 && !fCreated; nTry++) {
+            int64_t nValue = ptx.nValueIn - nFee;
+            if (nValue <= 0)
+                break;
+            vector<pair<CScript, int64_t>> vecSend;
+            for (unsigned int n = 0; n < ptx.nOutputs; n++)
+                vecSend.push_back(make_pair(ptx.scriptPubKey, nValue / ptx.nOutputs + (n == 0 ? nValue % ptx.nOutputs : 0)));
+            wtx = CWalletTx();
+            if (CreateTransaction(vecSend, wtx, reservekey, nFeeRet, &coinControl))
+                fCreated = true;
+            else if (nFeeRet > nFee)
+                nFee = nFeeRet;
+            else
+                break; // inputs spent since planning, or signing failed
+        }
+
+        if (!fCreated || !CommitTransaction(wtx, reservekey)) {
+            LogPrintf("ExecuteStakePlan() : failed to send %u inputs to %u outputs\n", ptx.vInputs.size(), ptx.nOutputs);
+            continue;
+        }
+        LogPrint("coinstake", "ExecuteStakePlan() : %s, %u inputs to %u outputs, fee %s\n", wtx.GetHash().ToString(), ptx.vInputs.size(), ptx.nOutputs, FormatMoney(nFeeRet));
+        nSent++;
+    }
+    return nSent;
+}
+
+void RunStakePlanner(CWallet* pwallet)
+{
+    if (IsInitialBlockDownload() || pwallet->IsLocked() || fWalletUnlockStakingOnly)
+        return;
+
+    CStakePlan plan;
+    if (!pwallet->PlanStakeOutputs(nStakeTargetSize, plan) || plan.vTx.empty())
+        return;
+
+    int nSent = pwallet->ExecuteStakePlan(plan);
+    LogPrintf("RunStakePlanner() : sent %d of %u transactions, stakeable outputs %u -> %u\n", nSent, plan.vTx.size(), plan.nCoinsBefore, plan.nCoinsAfter);
+}
+
 bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int64_t nSearchInterval, int64_t nFees, CTransaction& txNew, CKey& key)
 {
     CBlockIndex* pindexPrev = pindexBest;
@@ -1604,6 +2333,10 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
         }
     }
 
+    // Regression test chains have no dev address
+    if (RegTest())
+        bDevOpsPayment = false;
+
     bool hasdevopsPay = true;
     if (bDevOpsPayment) {
         // define address
@@ -1714,6 +2447,7 @@ bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey)
                 coin.BindWallet(this);
                 coin.MarkSpent(txin.prevout.n);
                 coin.WriteToDisk();
+                UpdateCoinIndex(txin.prevout.hash);
                 NotifyTransactionChanged(this, coin.GetHash(), CT_UPDATED);
             }
 
@@ -1807,6 +2541,12 @@ DBErrors CWallet::LoadWallet(bool& fFirstRunRet)
         return nLoadWalletRet;
     fFirstRunRet = !vchDefaultKey.IsValid();
 
+    {
+        LOCK2(cs_main, cs_wallet);
+        RebuildCoinIndex();
+        RebuildTxOrder();
+    }
+
     return DB_LOAD_OK;
 }
 
@@ -1856,59 +2596,197 @@ bool CWallet::SetDefaultKey(const CPubKey& vchPubKey)
 // Mark old keypool keys as used,
 // and generate all new keys
 //
+// Keys generated and committed per database transaction when the keypool
+// is refilled; refills larger than this go to the background once the pool
+// still has keys to hand out
+static const unsigned int KEYPOOL_BATCH_SIZE = 500;
+
+static void GenerateKeyRange(std::vector<CKey>* pvKeys, std::vector<CPubKey>* pvPubKeys, bool fCompressed, unsigned int nFirst, unsigned int nStride)
+{
+    for (unsigned int i = nFirst; i < pvKeys->size(); i += nStride) {
+        (*pvKeys)[i].MakeNewKey(fCompressed);
+        (*pvPubKeys)[i] = (*pvKeys)[i].GetPubKey();
+    }
+}
+
+/** Fill vKeys and vPubKeys with new key pairs, spread over all cores */
+static void GenerateKeys(std::vector<CKey>& vKeys, std::vector<CPubKey>& vPubKeys, bool fCompressed)
+{
+    // Small batches are not worth the thread start-up
+    unsigned int nThreads = std::min(boost::thread::hardware_concurrency(), (unsigned int)vKeys.size() / 32);
+    boost::thread_group threads;
+    for (unsigned int n = 1; n < nThreads; n++)
+        threads.create_thread(boost::bind(&GenerateKeyRange, &vKeys, &vPubKeys, fCompressed, n, nThreads));
+    GenerateKeyRange(&vKeys, &vPubKeys, fCompressed, 0, std::max(nThreads, 1u));
+
+    // The workers write into vKeys, so they are joined even if interrupted
+    boost::this_thread::disable_interruption di;
+    threads.join_all();
+}
+
 bool CWallet::NewKeyPool()
 {
     {
         LOCK(cs_wallet);
-        CWalletDB walletdb(strWalletFile);
-        BOOST_FOREACH (int64_t nIndex, setKeyPool)
-            walletdb.ErasePool(nIndex);
+        if (fFileBacked) {
+            CWalletDB walletdb(strWalletFile);
+            walletdb.TxnBegin();
+            BOOST_FOREACH (int64_t nIndex, setKeyPool)
+                walletdb.ErasePool(nIndex);
+            walletdb.TxnCommit();
+        }
         setKeyPool.clear();
 
         if (IsLocked())
             return false;
 
-        int64_t nKeys = max(GetArg("-keypool", 100), (int64_t)0);
-        for (int i = 0; i < nKeys; i++) {
-            int64_t nIndex = i + 1;
-            walletdb.WritePool(nIndex, CKeyPool(GenerateNewKey()));
-            setKeyPool.insert(nIndex);
-        }
+        unsigned int nKeys = max(GetArg("-keypool", 100), (int64_t)0);
+        while (setKeyPool.size() < nKeys)
+            if (!AddKeyPoolBatch(min(nKeys - (unsigned int)setKeyPool.size(), KEYPOOL_BATCH_SIZE)))
+                return false;
         LogPrintf("CWallet::NewKeyPool wrote %d new keys\n", nKeys);
     }
     return true;
 }
 
-bool CWallet::TopUpKeyPool(unsigned int nSize)
+bool CWallet::AddKeyPoolBatch(unsigned int nKeys)
 {
+    bool fCompressed;
     {
         LOCK(cs_wallet);
-
         if (IsLocked())
             return false;
+        fCompressed = CanSupportFeature(FEATURE_COMPRPUBKEY); // see GenerateNewKey
+    }
 
-        CWalletDB walletdb(strWalletFile);
+    // The elliptic curve work dominates and needs no wallet state
+    RandAddSeedPerfmon();
+    std::vector<CKey> vKeys(nKeys);
+    std::vector<CPubKey> vPubKeys(nKeys);
+    GenerateKeys(vKeys, vPubKeys, fCompressed);
+
+    LOCK(cs_wallet);
+    std::vector<std::vector<unsigned char>> vCryptedSecrets;
+    if (IsCrypted() && !EncryptSecrets(vKeys, vPubKeys, vCryptedSecrets))
+        return false; // locked while the keys were being generated
+    if (fCompressed)
+        SetMinVersion(FEATURE_COMPRPUBKEY);
 
-        // Top up key pool
-        unsigned int nTargetSize;
-        if (nSize > 0)
-            nTargetSize = nSize;
+    int64_t nCreationTime = GetTime();
+    if (!nTimeFirstKey || nCreationTime < nTimeFirstKey)
+        nTimeFirstKey = nCreationTime;
+    int64_t nFirst = setKeyPool.empty() ? 1 : *setKeyPool.rbegin() + 1;
+
+    // Keys and pool entries go to disk in one transaction, so the base
+    // keystore calls are used to skip CWallet's per-key writes
+    CWalletDB* pwalletdb = fFileBacked ? new CWalletDB(strWalletFile) : NULL;
+    bool fOk = !pwalletdb || pwalletdb->TxnBegin();
+    for (unsigned int i = 0; i < nKeys && fOk; i++) {
+        const CPubKey& pubkey = vPubKeys[i];
+        const CKeyMetadata& meta = mapKeyMetadata[pubkey.GetID()] = CKeyMetadata(nCreationTime);
+        if (IsCrypted())
+            fOk = CCryptoKeyStore::AddCryptedKey(pubkey, vCryptedSecrets[i]);
         else
-            nTargetSize = max(GetArg("-keypool", 100), (int64_t)0);
+            fOk = CCryptoKeyStore::AddKeyPubKey(vKeys[i], pubkey);
+        if (!fOk)
+            break;
+        AddScriptsForKey(pubkey);
+        if (pwalletdb) {
+            if (IsCrypted())
+                fOk = pwalletdb->WriteCryptedKey(pubkey, vCryptedSecrets[i], meta);
+            else
+                fOk = pwalletdb->WriteKey(pubkey, vKeys[i].GetPrivKey(), meta);
+            fOk = fOk && pwalletdb->WritePool(nFirst + i, CKeyPool(pubkey));
+        }
+    }
+    if (pwalletdb) {
+        if (fOk)
+            fOk = pwalletdb->TxnCommit();
+        else
+            pwalletdb->TxnAbort();
+        delete pwalletdb;
+    }
+    if (!fOk)
+        throw runtime_error("AddKeyPoolBatch() : writing generated keys failed");
+
+    for (unsigned int i = 0; i < nKeys; i++)
+        setKeyPool.insert(nFirst + i);
+    LogPrintf("keypool added keys %d-%d, size=%u\n", nFirst, nFirst + nKeys - 1, setKeyPool.size());
+    return true;
+}
 
-        while (setKeyPool.size() < (nTargetSize + 1)) {
-            int64_t nEnd = 1;
-            if (!setKeyPool.empty())
-                nEnd = *(--setKeyPool.end()) + 1;
-            if (!walletdb.WritePool(nEnd, CKeyPool(GenerateNewKey())))
-                throw runtime_error("TopUpKeyPool() : writing generated key failed");
-            setKeyPool.insert(nEnd);
-            LogPrintf("keypool added key %d, size=%u\n", nEnd, setKeyPool.size());
+bool CWallet::TopUpKeyPool(unsigned int nSize, bool fWait)
+{
+    unsigned int nTargetSize;
+    if (nSize > 0)
+        nTargetSize = nSize;
+    else
+        nTargetSize = max(GetArg("-keypool", 100), (int64_t)0);
+
+    while (true) {
+        boost::this_thread::interruption_point();
+        unsigned int nMissing;
+        {
+            LOCK(cs_wallet);
+            if (IsLocked())
+                return false;
+            if (setKeyPool.size() >= nTargetSize + 1)
+                break;
+            nMissing = nTargetSize + 1 - setKeyPool.size();
+
+            // While keys are left to hand out, a large refill carries on in
+            // the background instead of holding up the caller
+            if (!fWait && nMissing > KEYPOOL_BATCH_SIZE && !setKeyPool.empty()) {
+                if (!fKeyPoolRefilling) {
+                    fKeyPoolRefilling = true;
+                    if (pthreadKeyPool) {
+                        // Already finished; it cleared fKeyPoolRefilling on its way out
+                        pthreadKeyPool->join();
+                        delete pthreadKeyPool;
+                    }
+                    pthreadKeyPool = new boost::thread(boost::bind(&CWallet::ThreadTopUpKeyPool, this, nTargetSize));
+                }
+                break;
+            }
         }
+        if (!AddKeyPoolBatch(min(nMissing, KEYPOOL_BATCH_SIZE)))
+            return false;
     }
     return true;
 }
 
+void CWallet::ThreadTopUpKeyPool(unsigned int nTargetSize)
+{
+    RenameThread("era-keypool");
+    int64_t nStart = GetTimeMillis();
+    try {
+        TopUpKeyPool(nTargetSize, true);
+        LogPrintf("keypool refilled to %u in %dms\n", nTargetSize, GetTimeMillis() - nStart);
+    } catch (boost::thread_interrupted) {
+        LogPrintf("keypool refill interrupted\n");
+    } catch (std::exception& e) {
+        PrintExceptionContinue(&e, "ThreadTopUpKeyPool()");
+    }
+
+    LOCK(cs_wallet);
+    fKeyPoolRefilling = false;
+}
+
+void CWallet::StopKeyPoolRefill()
+{
+    boost::thread* pthread;
+    {
+        LOCK(cs_wallet);
+        pthread = pthreadKeyPool;
+        pthreadKeyPool = NULL;
+    }
+    if (pthread) {
+        pthread->interrupt();
+        pthread->join();
+        delete pthread;
+    }
+}
+
 void CWallet::ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool)
 {
     nIndex = -1;
@@ -2142,6 +3020,7 @@ void CWallet::FixSpentCoins(int& nMismatchFound, int64_t& nBalanceInQuestion, bo
                 if (!fCheckOnly) {
                     pcoin->MarkUnspent(n);
                     pcoin->WriteToDisk();
+                    UpdateCoinIndex(pcoin->GetHash());
                 }
             } else if (IsMine(pcoin->vout[n]) && !pcoin->IsSpent(n) && (txindex.vSpent.size() > n && !txindex.vSpent[n].IsNull())) {
                 LogPrintf("FixSpentCoins found spent coin %s ERA %s[%d], %s\n",
@@ -2151,6 +3030,7 @@ void CWallet::FixSpentCoins(int& nMismatchFound, int64_t& nBalanceInQuestion, bo
                 if (!fCheckOnly) {
                     pcoin->MarkSpent(n);
                     pcoin->WriteToDisk();
+                    UpdateCoinIndex(pcoin->GetHash());
                 }
             }
         }
@@ -2171,6 +3051,7 @@ void CWallet::DisableTransaction(const CTransaction& tx)
             if (txin.prevout.n < prev.vout.size() && IsMine(prev.vout[txin.prevout.n])) {
                 prev.MarkUnspent(txin.prevout.n);
                 prev.WriteToDisk();
+                UpdateCoinIndex(txin.prevout.hash);
             }
         }
     }
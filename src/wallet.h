@@ -20,6 +20,8 @@
 #include "ui_interface.h"
 #include "util.h"
 
+#include <boost/unordered_set.hpp>
+
 // Settings
 extern int64_t nTransactionFee;
 extern int64_t nReserveBalance;
@@ -27,6 +29,14 @@ extern int64_t nMinimumInputValue;
 extern bool fWalletUnlockStakingOnly;
 extern bool fConfChange;
 
+/** How SelectCoinsMinConf picks inputs, set with -coinselection */
+enum CoinSelectionAlgorithm {
+    COINSELECT_BNB,      // exact branch and bound match first, no change output
+    COINSELECT_KNAPSACK, // randomized subset sum only
+};
+extern CoinSelectionAlgorithm nCoinSelection;
+extern int64_t nStakeTargetSize;
+
 class CAccountingEntry;
 class CCoinControl;
 class CWalletTx;
@@ -44,6 +54,77 @@ enum WalletFeature {
     FEATURE_LATEST = 60000
 };
 
+/** Salted hash for the wallet's script and outpoint sets. The salt keeps
+ * peers from picking outputs that all land in the same bucket. */
+class CWalletHasher
+{
+private:
+    size_t nSalt;
+
+public:
+    CWalletHasher();
+    size_t operator()(const CScript& script) const;
+    size_t operator()(const COutPoint& outpoint) const;
+};
+
+/** Progress of the running (or last) wallet rescan, reported over RPC */
+class CRescanStatus
+{
+public:
+    bool fScanning;
+    int nStartHeight;
+    int nStopHeight;
+    int nHeight; // last block processed
+    int nFound;  // transactions added or updated so far
+    int64_t nStartTime;
+    int64_t nEndTime;
+
+    CRescanStatus()
+    {
+        fScanning = false;
+        nStartHeight = nStopHeight = nHeight = -1;
+        nFound = 0;
+        nStartTime = nEndTime = 0;
+    }
+};
+
+/** One transaction proposed by the stake planner; every output pays scriptPubKey */
+class CStakePlanTx
+{
+public:
+    CScript scriptPubKey;
+    std::vector<COutPoint> vInputs;
+    int64_t nValueIn;
+    unsigned int nOutputs;
+    int64_t nFee; // estimated
+
+    CStakePlanTx()
+    {
+        nValueIn = 0;
+        nOutputs = 0;
+        nFee = 0;
+    }
+};
+
+/** Consolidations and splits that move staking outputs toward a target size */
+class CStakePlan
+{
+public:
+    int64_t nTarget;
+    unsigned int nCoinsBefore; // stakeable outputs now
+    unsigned int nCoinsAfter;  // and once the plan has confirmed
+    int64_t nFees;
+    int64_t nValueMoved;
+    std::vector<CStakePlanTx> vTx;
+
+    CStakePlan()
+    {
+        nTarget = 0;
+        nCoinsBefore = nCoinsAfter = 0;
+        nFees = nValueMoved = 0;
+    }
+};
+
 /** A key pool entry */
 class CKeyPool
 {
@@ -76,7 +157,7 @@ class CWallet : public CCryptoKeyStore, public CWalletInterface
 {
 private:
     bool SelectCoinsForStaking(int64_t nTargetValue, std::set<std::pair<const CWalletTx*, unsigned int>>& setCoinsRet, int64_t& nValueRet) const;
-    bool SelectCoins(int64_t nTargetValue, unsigned int nSpendTime, std::set<std::pair<const CWalletTx*, unsigned int>>& setCoinsRet, int64_t& nValueRet, const CCoinControl* coinControl = NULL) const;
+    bool SelectCoins(int64_t nTargetValue, unsigned int nSpendTime, const std::vector<COutput>& vCoins, std::set<std::pair<const CWalletTx*, unsigned int>>& setCoinsRet, int64_t& nValueRet, const CCoinControl* coinControl = NULL, bool* pfChangeless = NULL) const;
 
     CWalletDB* pwalletdbEncryption;
 
@@ -100,6 +181,24 @@ public:
     std::set<int64_t> setKeyPool;
     std::map<CKeyID, CKeyMetadata> mapKeyMetadata;
 
+    // Serializes rescans; held for the whole of ScanForWalletTransactions
+    // while cs_main and cs_wallet are only taken per batch of blocks.
+    // Lock order: cs_walletScan before cs_main and cs_wallet, so never
+    // start a rescan while holding either of them.
+    CCriticalSection cs_walletScan;
+    // Protects rescanStatus and fAbortRescan, so progress can be read
+    // without waiting for cs_wallet
+    mutable CCriticalSection cs_rescanStatus;
+    CRescanStatus rescanStatus;
+    bool fAbortRescan;
+
+    // P2PK, P2PKH and P2SH scripts for every key and redeem script we hold,
+    // so IsMine can reject standard outputs with one probe (cs_KeyStore)
+    boost::unordered_set<CScript, CWalletHasher> setMyScripts;
+
+    // Background keypool refill; fKeyPoolRefilling is guarded by cs_wallet
+    boost::thread* pthreadKeyPool;
+    bool fKeyPoolRefilling;
 
     typedef std::map<unsigned int, CMasterKey> MasterKeyMap;
     MasterKeyMap mapMasterKeys;
@@ -116,6 +215,10 @@ public:
         strWalletFile = strWalletFileIn;
         fFileBacked = true;
     }
+    ~CWallet()
+    {
+        StopKeyPoolRefill();
+    }
     void SetNull()
     {
         nWalletVersion = FEATURE_BASE;
@@ -125,9 +228,18 @@ public:
         pwalletdbEncryption = NULL;
         nOrderPosNext = 0;
         nTimeFirstKey = 0;
+        fAbortRescan = false;
+        pthreadKeyPool = NULL;
+        fKeyPoolRefilling = false;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
+    // Unspent outputs of mapWallet that are ours, kept up to date as
+    // transactions are added and spent so balance and coin queries only
+    // visit live coins instead of the whole wallet
+    std::map<COutPoint, const CWalletTx*> mapWalletCoins;
+    // Every output of mapWallet that is ours, spent or not
+    boost::unordered_set<COutPoint, CWalletHasher> setMyOutpoints;
     int64_t nOrderPosNext;
     std::map<uint256, int> mapRequestCount;
 
@@ -145,7 +257,9 @@ public:
 
     void AvailableCoinsForStaking(std::vector<COutput>& vCoins) const;
     void AvailableCoins(std::vector<COutput>& vCoins, bool fOnlyConfirmed = true, const CCoinControl* coinControl = NULL) const;
-    bool SelectCoinsMinConf(int64_t nTargetValue, unsigned int nSpendTime, int nConfMine, int nConfTheirs, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*, unsigned int>>& setCoinsRet, int64_t& nValueRet) const;
+    // *pfChangeless is set when the inputs were matched to the target closely
+    // enough that a change output would cost more than it returns
+    bool SelectCoinsMinConf(int64_t nTargetValue, unsigned int nSpendTime, int nConfMine, int nConfTheirs, const std::vector<COutput>& vCoins, std::set<std::pair<const CWalletTx*, unsigned int>>& setCoinsRet, int64_t& nValueRet, bool* pfChangeless = NULL) const;
 
     // keystore implementation
     // Generate a new key
@@ -153,7 +267,13 @@ public:
     // Adds a key to the store, and saves it to disk.
     bool AddKeyPubKey(const CKey& key, const CPubKey& pubkey);
     // Adds a key to the store, without saving it to disk (used by LoadWallet)
-    bool LoadKey(const CKey& key, const CPubKey& pubkey) { return CCryptoKeyStore::AddKeyPubKey(key, pubkey); }
+    bool LoadKey(const CKey& key, const CPubKey& pubkey)
+    {
+        if (!CCryptoKeyStore::AddKeyPubKey(key, pubkey))
+            return false;
+        AddScriptsForKey(pubkey);
+        return true;
+    }
     // Load metadata (used by LoadWallet)
     bool LoadKeyMetadata(const CPubKey& pubkey, const CKeyMetadata& metadata);
 
@@ -171,6 +291,8 @@ public:
     bool LoadCryptedKey(const CPubKey& vchPubKey, const std::vector<unsigned char>& vchCryptedSecret);
     bool AddCScript(const CScript& redeemScript);
     bool LoadCScript(const CScript& redeemScript);
+    void AddScriptsForKey(const CPubKey& pubkey);
+    void AddScriptsForRedeemScript(const CScript& redeemScript);
 
     bool Unlock(const SecureString& strWalletPassphrase);
     bool ChangeWalletPassphrase(const SecureString& strOldWalletPassphrase, const SecureString& strNewWalletPassphrase);
@@ -187,19 +309,32 @@ public:
     typedef std::pair<CWalletTx*, CAccountingEntry*> TxPair;
     typedef std::multimap<int64_t, TxPair> TxItems;
 
-    /** Get the wallet's activity log
-        @return multimap of ordered transactions and accounting entries
-        @warning Returned pointers are *only* valid within the scope of passed acentries
-     */
-    TxItems OrderedTxItems(std::list<CAccountingEntry>& acentries, std::string strAccount = "");
+    // The wallet's activity log: every CWalletTx and accounting entry by
+    // nOrderPos, kept up to date so listtransactions can page from the end.
+    // It is not split by account: a transaction belongs to an account
+    // through the labels of its addresses, which setaccount can change at
+    // any time, so listtransactions <account> filters while it walks.
+    TxItems wtxOrdered;
+    std::list<CAccountingEntry> laccentries;
+    // (height of the confirming block, txid) for every wallet transaction;
+    // unconfirmed and disconnected ones sort last. Used by listsinceblock.
+    std::set<std::pair<int, uint256>> setTxByHeight;
+
+    void AddAccountingEntry(const CAccountingEntry& acentry);
+    void IndexTxHeight(CWalletTx& wtx, int nHeight);
+    void RebuildTxOrder();
 
     void MarkDirty();
+    void UpdateCoinIndex(const uint256& hash);
+    void RebuildCoinIndex();
     bool AddToWallet(const CWalletTx& wtxIn);
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock, bool fConnect = true);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
     void EraseFromWallet(const uint256& hash);
     void WalletUpdateSpent(const CTransaction& prevout, bool fBlock = false);
-    int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
+    int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false, CBlockIndex* pindexStop = NULL);
+    CRescanStatus GetRescanStatus() const;
+    bool AbortRescan();
     void ReacceptWalletTransactions();
     void ResendWalletTransactions(bool fForce = false);
     int64_t GetBalance() const;
@@ -212,13 +347,25 @@ public:
     bool CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey);
 
     uint64_t GetStakeWeight() const;
+    bool PlanStakeOutputs(int64_t nTarget, CStakePlan& plan) const;
+    // Plans over the given stakeable outputs, moving at most nBudget
+    bool PlanStakeOutputs(int64_t nTarget, const std::vector<COutput>& vCoins, int64_t nBudget, CStakePlan& plan) const;
+    int ExecuteStakePlan(const CStakePlan& plan);
     bool CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int64_t nSearchInterval, int64_t nFees, CTransaction& txNew, CKey& key);
 
     std::string SendMoney(CScript scriptPubKey, int64_t nValue, CWalletTx& wtxNew, bool fAskFee = false);
     std::string SendMoneyToDestination(const CTxDestination& address, int64_t nValue, CWalletTx& wtxNew, bool fAskFee = false);
 
     bool NewKeyPool();
-    bool TopUpKeyPool(unsigned int nSize = 0);
+    // Refills the pool to nSize (default -keypool) plus one. Small refills
+    // happen at once; the bulk of a large one is left to a background thread
+    // unless fWait is set.
+    bool TopUpKeyPool(unsigned int nSize = 0, bool fWait = false);
+    // Generates nKeys keys in parallel without holding cs_wallet, then adds
+    // them to the pool in one database transaction
+    bool AddKeyPoolBatch(unsigned int nKeys);
+    void ThreadTopUpKeyPool(unsigned int nTargetSize);
+    void StopKeyPoolRefill();
     int64_t AddReserveKey(const CKeyPool& keypool);
     void ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool);
     void KeepKey(int64_t nIndex);
@@ -232,9 +379,10 @@ public:
 
     bool IsMine(const CTxIn& txin) const;
     int64_t GetDebit(const CTxIn& txin) const;
+    bool IsMine(const CScript& scriptPubKey) const;
     bool IsMine(const CTxOut& txout) const
     {
-        return ::IsMine(*this, txout.scriptPubKey);
+        return IsMine(txout.scriptPubKey);
     }
     int64_t GetCredit(const CTxOut& txout) const
     {
@@ -345,6 +493,9 @@ public:
     boost::signals2::signal<void(CWallet* wallet, const uint256& hashTx, ChangeType status)> NotifyTransactionChanged;
 };
 
+/** Plan and send one round of stake consolidations and splits, run by the -stakeplanner thread */
+void RunStakePlanner(CWallet* pwallet);
+
 /** A key allocated from the key pool. */
 class CReserveKey
 {
@@ -421,6 +572,9 @@ public:
     mutable int64_t nCreditCached;
     mutable int64_t nAvailableCreditCached;
     mutable int64_t nChangeCached;
+    mutable uint256 hashBlockCached;
+    mutable CBlockIndex* pindexCached;
+    int nHeightIndexed; // key in CWallet::setTxByHeight, -1 if not indexed
 
     CWalletTx()
     {
@@ -462,6 +616,9 @@ public:
         nCreditCached = 0;
         nAvailableCreditCached = 0;
         nChangeCached = 0;
+        hashBlockCached = 0;
+        pindexCached = NULL;
+        nHeightIndexed = -1;
         nOrderPos = -1;
     }
 
@@ -652,6 +809,10 @@ public:
         return (GetDebit() > 0);
     }
 
+    // GetDepthInMainChain() that remembers the confirming block, so later
+    // calls are a pointer check instead of a mapBlockIndex lookup
+    int GetCachedDepthInMainChain() const;
+
     bool IsTrusted() const
     {
         // Quick answer in most cases
@@ -182,7 +182,7 @@ void CWalletDB::ListAccountCreditDebit(const string& strAccount, list<CAccountin
 {
     bool fAllAccounts = (strAccount == "*");
 
-    Dbc* pcursor = GetCursor();
+    CDBCursor* pcursor = GetCursor();
     if (!pcursor)
         throw runtime_error("CWalletDB::ListAccountCreditDebit() : cannot create DB cursor");
     unsigned int fFlags = DB_SET_RANGE;
@@ -519,7 +519,7 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
         }
 
         // Get cursor
-        Dbc* pcursor = GetCursor();
+        CDBCursor* pcursor = GetCursor();
         if (!pcursor) {
             LogPrintf("Error getting wallet database cursor\n");
             return DB_CORRUPT;
@@ -638,11 +638,17 @@ void ThreadFlushWalletDB(const string& strFile)
                         nLastFlushed = nWalletDBUpdated;
                         int64_t nStart = GetTimeMillis();
 
-                        // Flush wallet.dat so it's self contained
-                        bitdb.CloseDb(strFile);
-                        bitdb.CheckpointLSN(strFile);
-
-                        bitdb.mapFileUseCount.erase(mi++);
+                        if (bitdb.IsStore(strFile)) {
+                            // A LevelDB store stays open; one sync commits
+                            // the whole burst of writes since the last flush
+                            bitdb.SyncStore(strFile);
+                        } else {
+                            // Flush wallet.dat so it's self contained
+                            bitdb.CloseDb(strFile);
+                            bitdb.CheckpointLSN(strFile);
+
+                            bitdb.mapFileUseCount.erase(mi++);
+                        }
                         LogPrint("db", "Flushed wallet.dat %dms\n", GetTimeMillis() - nStart);
                     }
                 }
@@ -671,6 +677,23 @@ bool BackupWallet(const CWallet& wallet, const string& strDest)
                     pathDest /= wallet.strWalletFile;
 
                 try {
+                    if (bitdb.IsStore(wallet.strWalletFile)) {
+                        // A LevelDB wallet is a directory; copy its files
+                        pathSrc = GetWalletStorePath(wallet.strWalletFile);
+                        boost::filesystem::create_directories(pathDest);
+                        boost::filesystem::directory_iterator end;
+                        for (boost::filesystem::directory_iterator it(pathSrc); it != end; ++it) {
+                            if (it->path().filename() == "LOCK")
+                                continue;
+#if BOOST_VERSION >= 104000
+                            boost::filesystem::copy_file(it->path(), pathDest / it->path().filename(), boost::filesystem::copy_option::overwrite_if_exists);
+#else
+                            boost::filesystem::copy_file(it->path(), pathDest / it->path().filename());
+#endif
+                        }
+                        LogPrintf("copied wallet store to %s\n", pathDest.string());
+                        return true;
+                    }
 #if BOOST_VERSION >= 104000
                     boost::filesystem::copy_file(pathSrc, pathDest, boost::filesystem::copy_option::overwrite_if_exists);
 #else
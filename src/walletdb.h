@@ -68,7 +68,7 @@ public:
 class CWalletDB : public CDB
 {
 public:
-    CWalletDB(const std::string& strFilename, const char* pszMode = "r+") : CDB(strFilename, pszMode)
+    CWalletDB(const std::string& strFilename, const char* pszMode = "r+", WalletBackend backend = WALLET_BACKEND_AUTO) : CDB(strFilename, pszMode, backend)
     {
     }
 